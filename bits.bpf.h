@@ -3,10 +3,13 @@
 
 #include "types.bpf.h"
 
-// Maybe there's a way to optimize this inefficient clz
-// https://stackoverflow.com/questions/70308156/how-to-efficiently-count-leading-zeros-in-a-24-bit-unsigned-integer
-inline int bpf_clzll(u64 x) {
-  // __builtin_clzll causes a segfault in clang
+// Count leading zeros, bpf_clzll(0) is 64. __builtin_clzll causes a segfault
+// in clang when targeting BPF, which has no clz instruction, so these are built
+// from the instructions it has. The variants are kept for
+// histogram_benchmarks, bpf_clzll picks the fastest one.
+
+// One branch per halving step.
+static inline int bpf_clzll_branchy(u64 x) {
   int zeroes = 63;
   if (x >> 32) {
     zeroes -= 32;
@@ -39,6 +42,91 @@ inline int bpf_clzll(u64 x) {
   }
 }
 
+// The same binary search with the step results turned into shift amounts
+// instead of branches. BPF has no setcc, clang may still emit a jump per
+// comparison there, but no data-dependent jumps over the shifts.
+static inline int bpf_clzll_binsearch(u64 x) {
+  u64 shift, r;
+
+  r = (u64)(x > 0xFFFFFFFFull) << 5;
+  x >>= r;
+  shift = (u64)(x > 0xFFFF) << 4;
+  x >>= shift;
+  r |= shift;
+  shift = (u64)(x > 0xFF) << 3;
+  x >>= shift;
+  r |= shift;
+  shift = (u64)(x > 0xF) << 2;
+  x >>= shift;
+  r |= shift;
+  shift = (u64)(x > 0x3) << 1;
+  x >>= shift;
+  r |= shift;
+  shift = x >> 1;
+  x >>= shift;
+  r |= shift;
+  // x is now 1, or 0 if it was 0 to begin with.
+  return 64 - (int)(r + x);
+}
+
+// The bit length of the values 0..255.
+static const u8 bpf_bit_length_table[256] = {
+    0, 1, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+    8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+    8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+    8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+    8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+    8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+};
+
+// Three binary search steps down to the highest non-zero byte, then a lookup
+// in the table, which is a .rodata array map in BPF. The index is masked so
+// that the verifier can bound it.
+static inline int bpf_clzll_table(u64 x) {
+  u64 shift, r;
+
+  r = (u64)(x > 0xFFFFFFFFull) << 5;
+  x >>= r;
+  shift = (u64)(x > 0xFFFF) << 4;
+  x >>= shift;
+  r |= shift;
+  shift = (u64)(x > 0xFF) << 3;
+  x >>= shift;
+  r |= shift;
+  return 64 - (int)(r + bpf_bit_length_table[x & 0xFF]);
+}
+
+// The index of the highest set bit of 2^k - 1 values, by the de Bruijn
+// multiplication below.
+static const u8 bpf_debruijn_msb_table[64] = {
+    0,  47, 1,  56, 48, 27, 2,  60, 57, 49, 41, 37, 28, 16, 3,  61,
+    54, 58, 35, 52, 50, 42, 21, 44, 38, 32, 29, 23, 17, 11, 4,  62,
+    46, 55, 26, 59, 40, 36, 15, 53, 34, 51, 20, 43, 31, 22, 10, 45,
+    25, 39, 14, 33, 19, 30, 9,  24, 13, 18, 8,  12, 7,  6,  5,  63,
+};
+
+// Smears the highest set bit down, then a multiply by a de Bruijn sequence
+// puts a unique 6 bit pattern per bit length in the top bits.
+static inline int bpf_clzll_debruijn(u64 x) {
+  if (x == 0) {
+    return 64;
+  }
+  x |= x >> 1;
+  x |= x >> 2;
+  x |= x >> 4;
+  x |= x >> 8;
+  x |= x >> 16;
+  x |= x >> 32;
+  return 63 - bpf_debruijn_msb_table[(x * 0x03f79d71b4cb0a89ull) >> 58];
+}
+
+static inline int bpf_clzll(u64 x) { return bpf_clzll_debruijn(x); }
+
 static inline u64 bpf_log2(u32 v) {
   u32 shift, r;
 
@@ -3,6 +3,7 @@
 #include <ostream>
 #include <random>
 #include <string>
+#include <vector>
 
 #include "absl/log/log.h"
 #include "absl/time/clock.h"
@@ -48,4 +49,25 @@ TEST(Log2, BucketToValue) {
   ASSERT_EQ(bpf_log_bucket_high(3), 15);
 }
 
+TEST(Clzll, VariantsMatchBuiltin) {
+  std::mt19937_64 gen(42);
+  std::vector<u64> values = {0, 1, 2, 3, 0xFF, 0x100, ~0ull};
+  for (int bit = 0; bit < 64; ++bit) {
+    u64 v = 1ull << bit;
+    values.insert(values.end(), {v, v - 1, v + 1, v | (v >> 1)});
+  }
+  for (int i = 0; i < 10000; ++i) {
+    // Random bit lengths, not only the full width ones.
+    values.push_back(gen() >> (gen() % 64));
+  }
+  for (u64 v : values) {
+    int expected = v == 0 ? 64 : __builtin_clzll(v);
+    ASSERT_EQ(bpf_clzll_branchy(v), expected) << v;
+    ASSERT_EQ(bpf_clzll_binsearch(v), expected) << v;
+    ASSERT_EQ(bpf_clzll_table(v), expected) << v;
+    ASSERT_EQ(bpf_clzll_debruijn(v), expected) << v;
+    ASSERT_EQ(bpf_clzll(v), expected) << v;
+  }
+}
+
 }  // namespace
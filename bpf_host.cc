@@ -0,0 +1,307 @@
+#include "bpf_host.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/log/log.h"
+
+namespace nvme_bpf {
+namespace {
+
+// From include/uapi/linux/bpf.h.
+constexpr int kMapTypeHash = 1;
+constexpr int kMapTypeArray = 2;
+constexpr int kMapTypePerCpuHash = 5;
+constexpr int kMapTypePerCpuArray = 6;
+constexpr int kMapTypeLruHash = 9;
+constexpr int kMapTypeRingbuf = 27;
+
+constexpr uint64_t kBpfAny = 0;
+constexpr uint64_t kBpfNoExist = 1;
+constexpr uint64_t kBpfExist = 2;
+
+// The header the kernel puts in front of every ring buffer record.
+constexpr uint64_t kRingbufHeaderSize = 8;
+
+BpfHost* current_host = nullptr;
+
+size_t RoundUp8(size_t n) { return (n + 7) & ~size_t{7}; }
+
+}  // namespace
+
+BpfHostMap::BpfHostMap(std::string name, const Spec& spec, int num_cpus)
+    : name_(std::move(name)),
+      spec_(spec),
+      num_cpus_(num_cpus),
+      value_stride_(RoundUp8(spec.value_size)) {
+  switch (spec_.type) {
+    case kMapTypeHash:
+    case kMapTypeArray:
+    case kMapTypePerCpuHash:
+    case kMapTypePerCpuArray:
+    case kMapTypeLruHash:
+    case kMapTypeRingbuf:
+      break;
+    default:
+      LOG(FATAL) << name_ << ": map type " << spec_.type
+                 << " is not supported by the host build";
+  }
+  if (IsArray()) {
+    size_t bytes =
+        size_t{spec_.max_entries} * value_stride_ * (IsPerCpu() ? num_cpus : 1);
+    array_ = std::make_unique<char[]>(bytes);
+  }
+}
+
+bool BpfHostMap::IsPerCpu() const {
+  return spec_.type == kMapTypePerCpuHash || spec_.type == kMapTypePerCpuArray;
+}
+
+bool BpfHostMap::IsArray() const {
+  return spec_.type == kMapTypeArray || spec_.type == kMapTypePerCpuArray;
+}
+
+void BpfHostMap::CheckSize(std::string_view what, size_t size,
+                           size_t user_size) const {
+  if (size != user_size) {
+    LOG(FATAL) << name_ << ": " << what << " of " << user_size
+               << " bytes, the map has " << size;
+  }
+}
+
+void* BpfHostMap::Lookup(const void* key, int cpu) const {
+  size_t cpu_offset = IsPerCpu() ? cpu * value_stride_ : 0;
+  if (IsArray()) {
+    uint32_t index;
+    std::memcpy(&index, key, sizeof(index));
+    if (index >= spec_.max_entries) {
+      return nullptr;
+    }
+    size_t cpus = IsPerCpu() ? num_cpus_ : 1;
+    return array_.get() + index * cpus * value_stride_ + cpu_offset;
+  }
+  auto it = entries_.find(
+      std::string(static_cast<const char*>(key), spec_.key_size));
+  if (it == entries_.end()) {
+    return nullptr;
+  }
+  return it->second.get() + cpu_offset;
+}
+
+long BpfHostMap::Update(const void* key, const void* value, uint64_t flags,
+                        int cpu) {
+  if (flags > kBpfExist) {
+    return -EINVAL;
+  }
+  if (IsArray()) {
+    void* slot = Lookup(key, cpu);
+    if (slot == nullptr) {
+      return -E2BIG;
+    }
+    if (flags == kBpfNoExist) {
+      // The array elements always exist.
+      return -EEXIST;
+    }
+    std::memcpy(slot, value, spec_.value_size);
+    return 0;
+  }
+  std::string key_bytes(static_cast<const char*>(key), spec_.key_size);
+  auto it = entries_.find(key_bytes);
+  if (it != entries_.end()) {
+    if (flags == kBpfNoExist) {
+      return -EEXIST;
+    }
+    // A program update of a per-CPU element only changes its own CPU's copy.
+    std::memcpy(it->second.get() + (IsPerCpu() ? cpu * value_stride_ : 0),
+                value, spec_.value_size);
+    return 0;
+  }
+  if (flags == kBpfExist) {
+    return -ENOENT;
+  }
+  if (entries_.size() >= spec_.max_entries) {
+    if (spec_.type != kMapTypeLruHash) {
+      return -E2BIG;
+    }
+    // Any entry will do, the tests don't depend on the LRU order.
+    entries_.erase(entries_.begin());
+  }
+  size_t cpus = IsPerCpu() ? num_cpus_ : 1;
+  // Zero initialized, a new per-CPU element only has the value on `cpu`.
+  auto data = std::make_unique<char[]>(cpus * value_stride_);
+  std::memcpy(data.get() + (IsPerCpu() ? cpu * value_stride_ : 0), value,
+              spec_.value_size);
+  entries_.emplace(std::move(key_bytes), std::move(data));
+  return 0;
+}
+
+long BpfHostMap::Delete(const void* key) {
+  if (IsArray()) {
+    return -EINVAL;
+  }
+  size_t erased = entries_.erase(
+      std::string(static_cast<const char*>(key), spec_.key_size));
+  return erased != 0 ? 0 : -ENOENT;
+}
+
+void* BpfHostMap::Reserve(uint64_t size) {
+  if (spec_.type != kMapTypeRingbuf) {
+    LOG(FATAL) << name_ << ": not a ring buffer";
+  }
+  uint64_t bytes = RoundUp8(size) + kRingbufHeaderSize;
+  if (ring_used_ + bytes > spec_.max_entries) {
+    return nullptr;
+  }
+  ring_used_ += bytes;
+  Record& record = records_.emplace_back();
+  record.data = std::make_unique<char[]>(size);
+  record.size = size;
+  return record.data.get();
+}
+
+void BpfHostMap::Commit(void* data, bool discard) {
+  // The outstanding reservations are few and usually the latest.
+  for (auto it = records_.rbegin(); it != records_.rend(); ++it) {
+    if (it->data.get() == data) {
+      it->committed = true;
+      it->discarded = discard;
+      return;
+    }
+  }
+  LOG(FATAL) << name_ << ": commit of a record that wasn't reserved";
+}
+
+std::vector<std::string> BpfHostMap::Consume() {
+  std::vector<std::string> out;
+  // Like the kernel consumer, stops at the first record still reserved.
+  while (!records_.empty() && records_.front().committed) {
+    Record& record = records_.front();
+    if (!record.discarded) {
+      out.emplace_back(record.data.get(), record.size);
+    }
+    ring_used_ -= RoundUp8(record.size) + kRingbufHeaderSize;
+    records_.pop_front();
+  }
+  return out;
+}
+
+void BpfHostMap::Clear() {
+  if (IsArray()) {
+    size_t bytes = size_t{spec_.max_entries} * value_stride_ *
+                   (IsPerCpu() ? num_cpus_ : 1);
+    std::memset(array_.get(), 0, bytes);
+  }
+  entries_.clear();
+  records_.clear();
+  ring_used_ = 0;
+}
+
+BpfHost::BpfHost(int num_cpus) : num_cpus_(num_cpus) {
+  if (current_host != nullptr) {
+    LOG(FATAL) << "Only one BpfHost at a time";
+  }
+  current_host = this;
+}
+
+BpfHost::~BpfHost() { current_host = nullptr; }
+
+BpfHost* BpfHost::Current() { return current_host; }
+
+BpfHostMap& BpfHost::AddMap(const void* def, std::string name,
+                            const BpfHostMap::Spec& spec) {
+  auto map = std::make_unique<BpfHostMap>(name, spec, num_cpus_);
+  BpfHostMap* ptr = map.get();
+  if (!maps_.emplace(std::move(name), std::move(map)).second ||
+      !maps_by_def_.emplace(def, ptr).second) {
+    LOG(FATAL) << ptr->name() << ": added twice";
+  }
+  return *ptr;
+}
+
+BpfHostMap& BpfHost::MapAt(const void* def) const {
+  auto it = maps_by_def_.find(def);
+  if (it == maps_by_def_.end()) {
+    LOG(FATAL) << "A map that wasn't added with AddMap() at " << def;
+  }
+  return *it->second;
+}
+
+BpfHostMap& BpfHost::map(std::string_view name) const {
+  auto it = maps_.find(name);
+  if (it == maps_.end()) {
+    LOG(FATAL) << "No map named " << name;
+  }
+  return *it->second;
+}
+
+void* BpfHost::RingbufReserve(void* ringbuf, uint64_t size) {
+  BpfHostMap& map = MapAt(ringbuf);
+  void* data = map.Reserve(size);
+  if (data != nullptr) {
+    reserved_[data] = &map;
+  }
+  return data;
+}
+
+void BpfHost::RingbufCommit(void* data, bool discard) {
+  auto it = reserved_.find(data);
+  if (it == reserved_.end()) {
+    LOG(FATAL) << "Commit of a record that wasn't reserved";
+  }
+  it->second->Commit(data, discard);
+  reserved_.erase(it);
+}
+
+void BpfHost::set_cpu(int cpu) {
+  if (cpu < 0 || cpu >= num_cpus_) {
+    LOG(FATAL) << "CPU " << cpu << " of " << num_cpus_;
+  }
+  cpu_ = cpu;
+}
+
+}  // namespace nvme_bpf
+
+nvme_bpf::BpfHostPtr bpf_map_lookup_elem(void* map, const void* key) {
+  nvme_bpf::BpfHost* host = nvme_bpf::BpfHost::Current();
+  return nvme_bpf::BpfHostPtr(host->MapAt(map).Lookup(key, host->cpu()));
+}
+
+long bpf_map_update_elem(void* map, const void* key, const void* value,
+                         uint64_t flags) {
+  nvme_bpf::BpfHost* host = nvme_bpf::BpfHost::Current();
+  return host->MapAt(map).Update(key, value, flags, host->cpu());
+}
+
+long bpf_map_delete_elem(void* map, const void* key) {
+  return nvme_bpf::BpfHost::Current()->MapAt(map).Delete(key);
+}
+
+nvme_bpf::BpfHostPtr bpf_ringbuf_reserve(void* ringbuf, uint64_t size,
+                                         uint64_t /*flags*/) {
+  return nvme_bpf::BpfHostPtr(
+      nvme_bpf::BpfHost::Current()->RingbufReserve(ringbuf, size));
+}
+
+void bpf_ringbuf_submit(void* data, uint64_t /*flags*/) {
+  nvme_bpf::BpfHost::Current()->RingbufCommit(data, /*discard=*/false);
+}
+
+void bpf_ringbuf_discard(void* data, uint64_t /*flags*/) {
+  nvme_bpf::BpfHost::Current()->RingbufCommit(data, /*discard=*/true);
+}
+
+long bpf_get_current_comm(void* buf, uint32_t size) {
+  if (size == 0) {
+    return -EINVAL;
+  }
+  const std::string& comm = nvme_bpf::BpfHost::Current()->task().comm;
+  // NUL terminated and padded, like the kernel strscpy_pad().
+  std::memset(buf, 0, size);
+  std::memcpy(buf, comm.data(), std::min<size_t>(comm.size(), size - 1));
+  return 0;
+}
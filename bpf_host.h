@@ -0,0 +1,260 @@
+#ifndef BPF_HOST_H_
+#define BPF_HOST_H_
+
+// Runs the BPF programs as ordinary C++ on the host, for unit tests and
+// benchmarks of the probe logic without a kernel or root.
+//
+// The program sources are compiled unchanged with host_bpf/ in the include
+// path, its <bpf/bpf_helpers.h>, <bpf/bpf_core_read.h> and
+// <bpf/bpf_tracing.h> resolve to this header instead of libbpf. The helpers
+// below are backed by a BpfHost, which holds the maps and the state the
+// kernel would provide: the current CPU, the clock and the current task.
+//
+// What is not emulated: the verifier, the CO-RE relocations (the contexts and
+// the kernel structures use the layout declared in nvme_core.bpf.h) and the
+// concurrency, the programs run on the calling thread with the CPU set by
+// set_cpu().
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace nvme_bpf {
+
+// A map of the programs, with the semantics of the kernel map type for the
+// programs and a userspace view for the tests.
+class BpfHostMap {
+ public:
+  struct Spec {
+    int type = 0;
+    uint32_t key_size = 0;
+    uint32_t value_size = 0;
+    uint32_t max_entries = 0;
+  };
+
+  BpfHostMap(std::string name, const Spec& spec, int num_cpus);
+
+  // The helpers, called from the programs.
+  void* Lookup(const void* key, int cpu) const;
+  long Update(const void* key, const void* value, uint64_t flags, int cpu);
+  long Delete(const void* key);
+  void* Reserve(uint64_t size);
+  void Commit(void* data, bool discard);
+
+  const std::string& name() const { return name_; }
+  const Spec& spec() const { return spec_; }
+  // The number of entries of a hash map.
+  size_t size() const { return entries_.size(); }
+
+  // The value of `key` as seen by `cpu`, nullptr when there is none.
+  template <typename V, typename K>
+  const V* Get(const K& key, int cpu = 0) const {
+    CheckSize("key", spec_.key_size, sizeof(K));
+    CheckSize("value", spec_.value_size, sizeof(V));
+    return static_cast<const V*>(Lookup(&key, cpu));
+  }
+
+  // The keys of a hash map, in no particular order.
+  template <typename K>
+  std::vector<K> Keys() const {
+    CheckSize("key", spec_.key_size, sizeof(K));
+    std::vector<K> keys(entries_.size());
+    size_t i = 0;
+    for (const auto& [key, value] : entries_) {
+      std::memcpy(&keys[i++], key.data(), sizeof(K));
+    }
+    return keys;
+  }
+
+  // The submitted ring buffer records, oldest first. They are consumed, which
+  // frees their space for the programs.
+  template <typename T>
+  std::vector<T> ConsumeRecords() {
+    std::vector<T> records;
+    for (const std::string& data : Consume()) {
+      T record;
+      std::memcpy(&record, data.data(), std::min(sizeof(T), data.size()));
+      records.push_back(record);
+    }
+    return records;
+  }
+  std::vector<std::string> Consume();
+
+  // Removes all the entries, zeroes the arrays and drops the records.
+  void Clear();
+
+ private:
+  struct Record {
+    std::unique_ptr<char[]> data;
+    size_t size;
+    bool committed = false;
+    bool discarded = false;
+  };
+
+  bool IsPerCpu() const;
+  bool IsArray() const;
+  void CheckSize(std::string_view what, size_t size, size_t user_size) const;
+
+  std::string name_;
+  Spec spec_;
+  int num_cpus_;
+  // The per-CPU values are laid out CPU after CPU, each rounded up to 8
+  // bytes like in the kernel.
+  size_t value_stride_;
+  // Array maps, max_entries values (times the CPUs) allocated upfront.
+  std::unique_ptr<char[]> array_;
+  // Hash maps, by the key bytes. The values don't move while the entry
+  // exists, like the kernel elements.
+  std::unordered_map<std::string, std::unique_ptr<char[]>> entries_;
+  // Ring buffers, in reservation order. The bytes reserved count the 8 byte
+  // record header of the kernel ring buffer.
+  std::deque<Record> records_;
+  uint64_t ring_used_ = 0;
+};
+
+// The kernel of the host build. Only one exists at a time, the helpers use
+// the current one.
+class BpfHost {
+ public:
+  explicit BpfHost(int num_cpus = 1);
+  BpfHost(const BpfHost&) = delete;
+  BpfHost& operator=(const BpfHost&) = delete;
+  ~BpfHost();
+
+  static BpfHost* Current();
+
+  // Adds a map defined with the libbpf __uint / __type syntax, e.g.
+  // AddMap(&in_flight, "in_flight"). The type and the sizes are read from
+  // the definition like libbpf reads them from the BTF.
+  template <typename M>
+  BpfHostMap& AddMap(M* def, std::string name) {
+    BpfHostMap::Spec spec;
+    spec.type = std::extent_v<std::remove_pointer_t<decltype(def->type)>>;
+    spec.max_entries =
+        std::extent_v<std::remove_pointer_t<decltype(def->max_entries)>>;
+    if constexpr (requires { def->key; }) {
+      spec.key_size = sizeof(*def->key);
+    }
+    if constexpr (requires { def->value; }) {
+      spec.value_size = sizeof(*def->value);
+    }
+    return AddMap(def, std::move(name), spec);
+  }
+  BpfHostMap& AddMap(const void* def, std::string name,
+                     const BpfHostMap::Spec& spec);
+
+  // The map defined at `def`, for the helpers.
+  BpfHostMap& MapAt(const void* def) const;
+  BpfHostMap& map(std::string_view name) const;
+
+  // bpf_ringbuf_reserve() / submit() / discard().
+  void* RingbufReserve(void* ringbuf, uint64_t size);
+  void RingbufCommit(void* data, bool discard);
+
+  int num_cpus() const { return num_cpus_; }
+  int cpu() const { return cpu_; }
+  void set_cpu(int cpu);
+
+  // bpf_ktime_get_ns(), only moves when set.
+  uint64_t ktime_ns() const { return ktime_ns_; }
+  void set_ktime_ns(uint64_t ns) { ktime_ns_ = ns; }
+  void advance_ktime_ns(uint64_t ns) { ktime_ns_ += ns; }
+
+  // The task seen by bpf_get_current_*().
+  struct Task {
+    uint32_t tgid = 0;
+    uint32_t pid = 0;
+    uint64_t cgroup_id = 0;
+    std::string comm;
+  };
+  const Task& task() const { return task_; }
+  void set_task(Task task) { task_ = std::move(task); }
+
+ private:
+  int num_cpus_;
+  int cpu_ = 0;
+  uint64_t ktime_ns_ = 0;
+  Task task_;
+  std::map<std::string, std::unique_ptr<BpfHostMap>, std::less<>> maps_;
+  std::unordered_map<const void*, BpfHostMap*> maps_by_def_;
+  // The ring buffer of every reserved record until it is committed.
+  std::unordered_map<const void*, BpfHostMap*> reserved_;
+};
+
+// The void* returned by the helpers. Converts implicitly to any object
+// pointer, like void* does in the C programs.
+class BpfHostPtr {
+ public:
+  explicit BpfHostPtr(void* p) : p_(p) {}
+  template <typename T>
+  operator T*() const {
+    return static_cast<T*>(p_);
+  }
+
+ private:
+  void* p_;
+};
+
+}  // namespace nvme_bpf
+
+// The libbpf definitions used by the programs.
+
+#define SEC(name)
+#define __uint(name, val) int(*name)[val]
+#define __type(name, val) __typeof__(val)* name
+#ifndef __always_inline
+#define __always_inline inline __attribute__((always_inline))
+#endif
+#define bpf_printk(fmt, ...) ((void)0)
+#define BPF_CORE_READ_BITFIELD_PROBED(s, field) ((s)->field)
+#define bpf_core_type_size(type) sizeof(type)
+// The fentry / tp_btf programs become functions of their typed arguments.
+#define BPF_PROG(name, ...) name(__VA_ARGS__)
+// BPF_CORE_READ(s, a, b) is s->a->b, up to three levels.
+#define BPF_HOST_CORE_READ1(s, a) ((s)->a)
+#define BPF_HOST_CORE_READ2(s, a, b) ((s)->a->b)
+#define BPF_HOST_CORE_READ3(s, a, b, c) ((s)->a->b->c)
+#define BPF_HOST_CORE_READ_N(_1, _2, _3, N, ...) N
+#define BPF_CORE_READ(s, ...)                                         \
+  BPF_HOST_CORE_READ_N(__VA_ARGS__, BPF_HOST_CORE_READ3,              \
+                       BPF_HOST_CORE_READ2, BPF_HOST_CORE_READ1)(s, \
+                                                                 __VA_ARGS__)
+
+nvme_bpf::BpfHostPtr bpf_map_lookup_elem(void* map, const void* key);
+long bpf_map_update_elem(void* map, const void* key, const void* value,
+                         uint64_t flags);
+long bpf_map_delete_elem(void* map, const void* key);
+nvme_bpf::BpfHostPtr bpf_ringbuf_reserve(void* ringbuf, uint64_t size,
+                                         uint64_t flags);
+void bpf_ringbuf_submit(void* data, uint64_t flags);
+void bpf_ringbuf_discard(void* data, uint64_t flags);
+
+inline uint64_t bpf_ktime_get_ns() {
+  return nvme_bpf::BpfHost::Current()->ktime_ns();
+}
+
+inline uint32_t bpf_get_smp_processor_id() {
+  return nvme_bpf::BpfHost::Current()->cpu();
+}
+
+inline uint64_t bpf_get_current_pid_tgid() {
+  const auto& task = nvme_bpf::BpfHost::Current()->task();
+  return uint64_t{task.tgid} << 32 | task.pid;
+}
+
+inline uint64_t bpf_get_current_cgroup_id() {
+  return nvme_bpf::BpfHost::Current()->task().cgroup_id;
+}
+
+long bpf_get_current_comm(void* buf, uint32_t size);
+
+#endif  // BPF_HOST_H_
@@ -0,0 +1,300 @@
+#include "bpf_utils.h"
+
+#include <bpf/bpf.h>
+#include <bpf/btf.h>
+#include <bpf/libbpf.h>
+#include <errno.h>
+#include <linux/btf.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <set>
+#include <system_error>
+#include <utility>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/log/log.h"
+#include "absl/strings/str_cat.h"
+
+namespace nvme_bpf {
+
+bool KernelBtfHasFunc(const char* module_name, const char* func_name) {
+  struct btf* vmlinux_btf = btf__load_vmlinux_btf();
+  if (libbpf_get_error(vmlinux_btf)) {
+    return false;
+  }
+  auto vmlinux_cleanup = absl::MakeCleanup([&]() { btf__free(vmlinux_btf); });
+  if (btf__find_by_name_kind(vmlinux_btf, func_name, BTF_KIND_FUNC) > 0) {
+    return true;
+  }
+
+  // The module BTF is split BTF on top of vmlinux, it's absent when the
+  // module is built-in or not loaded.
+  struct btf* module_btf = btf__load_module_btf(module_name, vmlinux_btf);
+  if (libbpf_get_error(module_btf)) {
+    return false;
+  }
+  auto module_cleanup = absl::MakeCleanup([&]() { btf__free(module_btf); });
+  return btf__find_by_name_kind(module_btf, func_name, BTF_KIND_FUNC) > 0;
+}
+
+absl::StatusOr<int> EnableRunTimeStats() {
+  int fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+  if (fd < 0) {
+    return absl::InternalError(
+        absl::StrCat("Failed to enable BPF run-time stats, err=", fd));
+  }
+  return fd;
+}
+
+absl::StatusOr<std::vector<ProgRunStats>> ReadProgRunStats(
+    const struct bpf_object* obj) {
+  std::vector<ProgRunStats> result;
+  struct bpf_program* prog;
+  bpf_object__for_each_program(prog, obj) {
+    int fd = bpf_program__fd(prog);
+    if (fd < 0) {
+      // Not loaded, e.g. autoload was disabled.
+      continue;
+    }
+    struct bpf_prog_info info;
+    memset(&info, 0, sizeof(info));
+    uint32_t info_len = sizeof(info);
+    int err = bpf_prog_get_info_by_fd(fd, &info, &info_len);
+    if (err) {
+      return absl::InternalError(absl::StrCat(
+          "Failed to get BPF program info for ", bpf_program__name(prog),
+          ", err=", err));
+    }
+    ProgRunStats stats;
+    stats.name = bpf_program__name(prog);
+    stats.run_cnt = info.run_cnt;
+    stats.run_time_ns = info.run_time_ns;
+    result.push_back(std::move(stats));
+  }
+  return result;
+}
+
+namespace {
+
+constexpr char kLinkPinPrefix[] = "link_";
+
+std::string PinFile(const std::string& pin_path, const char* name) {
+  return absl::StrCat(pin_path, "/", name);
+}
+
+// Returns true if the pinned map `info` can stand in for `map`.
+bool PinnedMapCompatible(const struct bpf_map_info& info,
+                         const struct bpf_map* map) {
+  return info.type == bpf_map__type(map) &&
+         info.key_size == bpf_map__key_size(map) &&
+         info.value_size == bpf_map__value_size(map) &&
+         info.max_entries == bpf_map__max_entries(map) &&
+         info.map_flags == bpf_map__map_flags(map);
+}
+
+const char* MapTypeName(uint32_t type) {
+  const char* name = libbpf_bpf_map_type_str(static_cast<bpf_map_type>(type));
+  return name != nullptr ? name : "unknown";
+}
+
+// Unpins the links under `pin_path` except `keep`, the kernel detaches a
+// program when its last link pin is gone. Returns the number of links unpinned.
+int UnpinLinks(const std::string& pin_path, const std::set<std::string>& keep) {
+  int unpinned = 0;
+  std::error_code ec;
+  for (const auto& entry :
+       std::filesystem::directory_iterator(pin_path, ec)) {
+    std::string file = entry.path().filename().string();
+    if (file.rfind(kLinkPinPrefix, 0) == 0 && !keep.contains(file) &&
+        unlink(entry.path().c_str()) == 0) {
+      ++unpinned;
+    }
+  }
+  return unpinned;
+}
+
+}  // namespace
+
+absl::Status ReusePinnedMaps(struct bpf_object* obj,
+                             const std::string& pin_path) {
+  struct bpf_map* map;
+  bpf_object__for_each_map(map, obj) {
+    if (bpf_map__is_internal(map)) {
+      continue;
+    }
+    std::string path = PinFile(pin_path, bpf_map__name(map));
+    int fd = bpf_obj_get(path.c_str());
+    if (fd < 0) {
+      // Nothing pinned yet.
+      continue;
+    }
+    auto fd_cleanup = absl::MakeCleanup([fd]() { close(fd); });
+    struct bpf_map_info info;
+    memset(&info, 0, sizeof(info));
+    uint32_t info_len = sizeof(info);
+    if (bpf_map_get_info_by_fd(fd, &info, &info_len) != 0) {
+      return absl::InternalError(absl::StrCat(
+          "Failed to get the info of the pinned map ", path, ", errno=",
+          errno));
+    }
+    // The counts of a map of another type, e.g. a shared hash pinned by an
+    // older version before the per-CPU one, can't be carried over. Recreating
+    // it would silently drop them.
+    if (info.type != bpf_map__type(map)) {
+      return absl::FailedPreconditionError(absl::StrCat(
+          "The pinned map ", path, " is a ", MapTypeName(info.type),
+          " map, this version uses a ", MapTypeName(bpf_map__type(map)),
+          " map. It was pinned by another version of the program, remove ",
+          pin_path, " to start over"));
+    }
+    if (!PinnedMapCompatible(info, map)) {
+      LOG(WARNING) << "Pinned map " << path
+                   << " doesn't match the program, recreating it.";
+      if (unlink(path.c_str()) != 0) {
+        return absl::InternalError(absl::StrCat(
+            "Failed to unpin ", path, ", errno=", errno));
+      }
+      continue;
+    }
+    // reuse_fd dups the fd, the cleanup closes ours.
+    int err = bpf_map__reuse_fd(map, fd);
+    if (err) {
+      return absl::InternalError(
+          absl::StrCat("Failed to reuse the pinned map ", path, ", err=", err));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::Status PinMaps(struct bpf_object* obj, const std::string& pin_path) {
+  std::error_code ec;
+  std::filesystem::create_directories(pin_path, ec);
+  if (ec) {
+    return absl::InternalError(absl::StrCat("Failed to create ", pin_path,
+                                            ": ", ec.message()));
+  }
+  struct bpf_map* map;
+  bpf_object__for_each_map(map, obj) {
+    if (bpf_map__is_internal(map)) {
+      continue;
+    }
+    std::string path = PinFile(pin_path, bpf_map__name(map));
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+      // Reused from the previous run.
+      continue;
+    }
+    int err = bpf_map__pin(map, path.c_str());
+    if (err) {
+      return absl::InternalError(
+          absl::StrCat("Failed to pin the map ", path, ", err=", err));
+    }
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<std::vector<struct bpf_link*>> AttachPinnedLinks(
+    struct bpf_object* obj, const std::string& pin_path) {
+  std::vector<struct bpf_link*> links;
+  auto links_cleanup = absl::MakeCleanup([&links]() {
+    for (auto* link : links) {
+      bpf_link__destroy(link);
+    }
+  });
+
+  std::set<std::string> pinned_files;
+  struct bpf_program* prog;
+  bpf_object__for_each_program(prog, obj) {
+    if (bpf_program__fd(prog) < 0) {
+      // Not loaded, e.g. autoload was disabled.
+      continue;
+    }
+    struct bpf_link* link = bpf_program__attach(prog);
+    if (libbpf_get_error(link)) {
+      return absl::InternalError(absl::StrCat(
+          "Failed to attach ", bpf_program__name(prog),
+          ", err=", libbpf_get_error(link)));
+    }
+    links.push_back(link);
+
+    std::string file = absl::StrCat(kLinkPinPrefix, bpf_program__name(prog));
+    std::string path = PinFile(pin_path, file.c_str());
+    // Dropping the old pin detaches the previous program, the new one is
+    // already attached.
+    unlink(path.c_str());
+    int err = bpf_link__pin(link, path.c_str());
+    if (err) {
+      return absl::InternalError(
+          absl::StrCat("Failed to pin the link ", path, ", err=", err));
+    }
+    pinned_files.insert(std::move(file));
+  }
+
+  // Detach the programs of the previous run that are no longer loaded, e.g.
+  // an optional probe that is now disabled.
+  UnpinLinks(pin_path, pinned_files);
+
+  std::move(links_cleanup).Cancel();
+  return links;
+}
+
+int DetachPinnedLinks(const std::string& pin_path) {
+  return UnpinLinks(pin_path, /*keep=*/{});
+}
+
+void ReleasePinnedLinks(const std::vector<struct bpf_link*>& links) {
+  for (auto* link : links) {
+    // Keep the kernel link, it is held by the pin.
+    bpf_link__disconnect(link);
+    bpf_link__destroy(link);
+  }
+}
+
+MapBatchCursor::MapBatchCursor(int map_fd, uint32_t key_size,
+                               uint32_t value_size)
+    : map_fd_(map_fd),
+      key_size_(key_size),
+      value_size_(value_size),
+      // The hash maps use a u32 bucket index, the size of a key is always
+      // enough for the other map types.
+      batch_(std::max<uint32_t>(key_size, sizeof(uint64_t))) {}
+
+absl::StatusOr<bool> MapBatchCursor::Next(uint32_t max_entries,
+                                          std::vector<char>* values) {
+  size_t offset = values->size();
+  uint32_t capacity = max_entries;
+  uint32_t count;
+  int err;
+  while (true) {
+    keys_.resize(static_cast<size_t>(capacity) * key_size_);
+    values->resize(offset + static_cast<size_t>(capacity) * value_size_);
+    count = capacity;
+    LIBBPF_OPTS(bpf_map_batch_opts, opts);
+    err = bpf_map_lookup_batch(map_fd_, in_sweep_ ? batch_.data() : nullptr,
+                               batch_.data(), keys_.data(),
+                               values->data() + offset, &count, &opts);
+    // ENOSPC: the next hash bucket has more entries than fit, nothing was
+    // copied and the position didn't move. Retry with room for the bucket.
+    if (err != -ENOSPC || capacity > UINT32_MAX / 2) {
+      break;
+    }
+    capacity *= 2;
+  }
+  // ENOENT marks the end of the map, `count` still has the last entries.
+  bool done = err == -ENOENT;
+  if (err != 0 && !done) {
+    values->resize(offset);
+    in_sweep_ = false;
+    return absl::InternalError(
+        absl::StrCat("bpf_map_lookup_batch() failed, err=", err));
+  }
+  values->resize(offset + static_cast<size_t>(count) * value_size_);
+  in_sweep_ = !done;
+  return done;
+}
+
+}  // namespace nvme_bpf
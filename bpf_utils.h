@@ -0,0 +1,96 @@
+#ifndef BPF_UTILS_H_
+#define BPF_UTILS_H_
+
+#include <bpf/libbpf.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+
+namespace nvme_bpf {
+
+// Returns true if the kernel BTF describes the function `func_name`, either in
+// vmlinux or in the `module_name` kernel module. A missing BTF is reported as
+// the function not being available.
+bool KernelBtfHasFunc(const char* module_name, const char* func_name);
+
+// Run-time statistics of a loaded BPF program. The kernel only accumulates
+// them while the BPF_STATS_RUN_TIME statistics are enabled.
+struct ProgRunStats {
+  std::string name;
+  uint64_t run_cnt = 0;
+  uint64_t run_time_ns = 0;
+
+  double avg_ns() const {
+    return run_cnt == 0 ? 0.0 : static_cast<double>(run_time_ns) / run_cnt;
+  }
+};
+
+// Enables the kernel run-time statistics for all the BPF programs for as long
+// as the returned fd stays open.
+absl::StatusOr<int> EnableRunTimeStats();
+
+// Reads the run-time statistics of all the loaded programs in `obj`.
+absl::StatusOr<std::vector<ProgRunStats>> ReadProgRunStats(
+    const struct bpf_object* obj);
+
+// Reuses the maps of `obj` pinned under `pin_path` by a previous run, so that
+// the histograms and the in-flight requests survive a restart. Must be called
+// between the object open and load. A pinned map whose definition no longer
+// matches, e.g. after an upgrade changed a struct, is unpinned and recreated.
+// A pinned map of another type is an error, the directory was written by an
+// incompatible version.
+// The libbpf internal maps (.rodata, .bss) are never reused.
+absl::Status ReusePinnedMaps(struct bpf_object* obj,
+                             const std::string& pin_path);
+
+// Pins the maps of the loaded `obj` under `pin_path`, creating the directory
+// if needed. The maps reused by ReusePinnedMaps are already pinned.
+absl::Status PinMaps(struct bpf_object* obj, const std::string& pin_path);
+
+// Attaches the loaded programs of `obj` and pins their links under `pin_path`
+// so that the probes stay attached after the process exits. The links pinned
+// by a previous run are replaced only after the new programs are attached,
+// there is no window without probes. The returned links must be released
+// with ReleasePinnedLinks, not bpf_link__destroy.
+absl::StatusOr<std::vector<struct bpf_link*>> AttachPinnedLinks(
+    struct bpf_object* obj, const std::string& pin_path);
+
+// Detaches the programs pinned under `pin_path` by a previous run with
+// AttachPinnedLinks. Called once the programs of a run without pinned links
+// are attached, the old probes would otherwise count every IO a second time.
+// Returns the number of links detached.
+int DetachPinnedLinks(const std::string& pin_path);
+
+// Frees the userspace side of the links, the pinned kernel links stay.
+void ReleasePinnedLinks(const std::vector<struct bpf_link*>& links);
+
+// Reads a hash map in bounded batches with BPF_MAP_LOOKUP_BATCH, each call
+// resumes where the previous one stopped. A large map is swept a few thousand
+// entries at a time instead of one syscall per key. Entries inserted or
+// deleted during a sweep may or may not be seen.
+class MapBatchCursor {
+ public:
+  MapBatchCursor(int map_fd, uint32_t key_size, uint32_t value_size);
+
+  // Appends up to `max_entries` values to `values`, `value_size` bytes each,
+  // more when a single hash bucket holds more entries. Returns true when the
+  // sweep reached the end of the map, the next call starts a new sweep.
+  absl::StatusOr<bool> Next(uint32_t max_entries, std::vector<char>* values);
+
+ private:
+  int map_fd_;
+  uint32_t key_size_;
+  uint32_t value_size_;
+  // The opaque position in the map, only valid within a sweep.
+  std::vector<char> batch_;
+  bool in_sweep_ = false;
+  std::vector<char> keys_;
+};
+
+}  // namespace nvme_bpf
+
+#endif  // BPF_UTILS_H_
@@ -0,0 +1,68 @@
+#ifndef BUCKET_LAYOUT_H_
+#define BUCKET_LAYOUT_H_
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+
+namespace nvme_bpf {
+
+// The bucket boundaries of a histogram as tables, generated by constexpr code
+// from the same definition as bpf_bucket_low/high in histogram.bpf.h: slot 0
+// is [min, min + 2^shift), slot s is [min + 2^(s - 1 + shift),
+// min + 2^(s + shift)) and slot kMaxSlots holds the values below min. For a
+// layout known at compile time the tables are compile-time constants,
+// otherwise they are computed once when the layout is configured. Layouts
+// with a different number of slots are different types.
+template <int kMaxSlots>
+struct BucketLayout {
+  static_assert(kMaxSlots > 0 && kMaxSlots < 64);
+  // Including the "< min" slot.
+  static constexpr int kSlots = kMaxSlots + 1;
+
+  uint64_t lat_min_us = 0;
+  int lat_shift = 0;
+  // Indexed by slot.
+  std::array<uint64_t, kSlots> low = {};
+  std::array<uint64_t, kSlots> high = {};
+
+  // The last bucket ends at min + 2^(kMaxSlots - 1 + lat_shift), which must
+  // fit the u64, the callers validate lat_shift.
+  static constexpr BucketLayout Make(uint64_t lat_min_us, int lat_shift) {
+    assert(lat_shift >= 0 && kMaxSlots - 1 + lat_shift < 64);
+    BucketLayout layout;
+    layout.lat_min_us = lat_min_us;
+    layout.lat_shift = lat_shift;
+    layout.low[0] = lat_min_us;
+    layout.high[0] = lat_min_us + (uint64_t{1} << lat_shift);
+    for (int slot = 1; slot < kMaxSlots; ++slot) {
+      layout.low[slot] = layout.high[slot - 1];
+      layout.high[slot] = lat_min_us + (uint64_t{1} << (slot + lat_shift));
+    }
+    layout.low[kMaxSlots] = 0;
+    layout.high[kMaxSlots] = lat_min_us;
+    return layout;
+  }
+
+  // Same as bpf_get_bucket(): kMaxSlots below the minimum and -1 above the
+  // last bucket. On the CPU the bit length is one lzcnt, which is cheaper
+  // than a search of the `high` table.
+  static constexpr int SlotOf(uint64_t value_us, uint64_t lat_min_us,
+                              int lat_shift) {
+    if (value_us < lat_min_us) {
+      return kMaxSlots;
+    }
+    int slot = std::bit_width((value_us - lat_min_us) >> lat_shift);
+    return slot < kMaxSlots ? slot : -1;
+  }
+  constexpr int Slot(uint64_t value_us) const {
+    return SlotOf(value_us, lat_min_us, lat_shift);
+  }
+
+  bool operator==(const BucketLayout&) const = default;
+};
+
+}  // namespace nvme_bpf
+
+#endif /* BUCKET_LAYOUT_H_ */
@@ -0,0 +1,151 @@
+#include "cgroup_top.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <system_error>
+#include <tuple>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "histogram_kernels.h"
+
+namespace nvme_bpf {
+
+CgroupPathResolver::CgroupPathResolver(std::string root)
+    : root_(std::move(root)) {}
+
+void CgroupPathResolver::Rescan() {
+  last_scan_ = absl::Now();
+  paths_.clear();
+
+  struct stat st;
+  if (stat(root_.c_str(), &st) != 0) {
+    return;
+  }
+  paths_[st.st_ino] = "/";
+
+  std::error_code ec;
+  auto it = std::filesystem::recursive_directory_iterator(
+      root_, std::filesystem::directory_options::skip_permission_denied, ec);
+  for (; !ec && it != std::filesystem::recursive_directory_iterator();
+       it.increment(ec)) {
+    // Skip the cgroup interface files, only the directories are cgroups.
+    if (!it->is_directory(ec) || it->is_symlink(ec)) {
+      continue;
+    }
+    if (stat(it->path().c_str(), &st) != 0) {
+      continue;
+    }
+    paths_[st.st_ino] =
+        absl::StrCat("/", it->path().lexically_relative(root_).string());
+  }
+}
+
+std::string CgroupPathResolver::Resolve(uint64_t cgroup_id) {
+  auto it = paths_.find(cgroup_id);
+  if (it == paths_.end() && absl::Now() - last_scan_ > absl::Seconds(1)) {
+    Rescan();
+    it = paths_.find(cgroup_id);
+  }
+  if (it == paths_.end()) {
+    return absl::StrCat("cgroup:", cgroup_id);
+  }
+  return it->second;
+}
+
+cgroup_io CgroupIoDelta(const cgroup_io& prev, const cgroup_io& current) {
+  const latency_hist& p = prev.hist;
+  const latency_hist& c = current.hist;
+  bool went_back = prev.ios > current.ios || prev.bytes > current.bytes ||
+                   p.total_count > c.total_count ||
+                   p.total_sum > c.total_sum ||
+                   p.total_sum_sq > c.total_sum_sq ||
+                   p.overflow_count > c.overflow_count;
+  for (int slot = 0; slot <= LATENCY_MAX_SLOTS; ++slot) {
+    went_back |= p.slots[slot] > c.slots[slot];
+  }
+  cgroup_io delta = current;
+  if (went_back) {
+    return delta;
+  }
+  delta.ios -= prev.ios;
+  delta.bytes -= prev.bytes;
+  delta.hist.total_count -= p.total_count;
+  delta.hist.total_sum -= p.total_sum;
+  delta.hist.total_sum_sq -= p.total_sum_sq;
+  delta.hist.overflow_count -= p.overflow_count;
+  SubtractSlots(delta.hist.slots, p.slots, LATENCY_MAX_SLOTS + 1);
+  // The extremes can't be subtracted, they stay those of `current`.
+  return delta;
+}
+
+absl::StatusOr<TopSortKey> ParseTopSortKey(std::string_view key) {
+  if (key == "iops") {
+    return TopSortKey::kIops;
+  }
+  if (key == "bytes") {
+    return TopSortKey::kBytes;
+  }
+  if (key == "avg_lat") {
+    return TopSortKey::kAvgLatency;
+  }
+  if (key == "p99") {
+    return TopSortKey::kP99Latency;
+  }
+  return absl::InvalidArgumentError(
+      absl::StrCat("Unknown top sort key '", key,
+                   "', expected one of iops, bytes, avg_lat, p99"));
+}
+
+void SortCgroupUsage(TopSortKey key, std::vector<CgroupUsage>* usage) {
+  auto sort_value = [key](const CgroupUsage& u) -> double {
+    switch (key) {
+      case TopSortKey::kIops:
+        return u.ios;
+      case TopSortKey::kBytes:
+        return u.bytes;
+      case TopSortKey::kAvgLatency:
+        return u.avg_latency_us();
+      case TopSortKey::kP99Latency:
+        return u.p99_us;
+    }
+    return 0;
+  };
+  std::sort(usage->begin(), usage->end(),
+            [&](const CgroupUsage& a, const CgroupUsage& b) {
+              return std::make_tuple(-sort_value(a), a.cgroup_id) <
+                     std::make_tuple(-sort_value(b), b.cgroup_id);
+            });
+}
+
+void PrintCgroupUsage(const std::vector<CgroupUsage>& usage, int top_n,
+                      absl::Duration interval) {
+  double seconds = absl::ToDoubleSeconds(interval);
+  if (seconds <= 0) {
+    seconds = 1;
+  }
+  std::cout << std::left << std::setw(10) << "IOPS" << std::setw(12)
+            << "MiB/s" << std::setw(12) << "avg us" << std::setw(10)
+            << "p99 us" << std::setw(9) << "PID" << std::setw(17) << "COMM"
+            << "CGROUP" << std::endl;
+  int printed = 0;
+  for (const auto& u : usage) {
+    if (printed++ == top_n) {
+      break;
+    }
+    std::cout << std::left << std::setw(10)
+              << static_cast<uint64_t>(u.ios / seconds) << std::setw(12)
+              << std::fixed << std::setprecision(2)
+              << u.bytes / seconds / (1024 * 1024) << std::setw(12)
+              << std::setprecision(1) << u.avg_latency_us() << std::setw(10)
+              << u.p99_us << std::setw(9) << u.tgid << std::setw(17) << u.comm
+              << u.path << std::endl;
+    std::cout.unsetf(std::ios_base::floatfield);
+  }
+}
+
+}  // namespace nvme_bpf
@@ -0,0 +1,78 @@
+#ifndef CGROUP_TOP_H_
+#define CGROUP_TOP_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+#include "nvme_latency.h"
+
+namespace nvme_bpf {
+
+// Maps the cgroup v2 ids, as returned by bpf_get_current_cgroup_id(), to
+// their path relative to the cgroup2 mount. The id of a cgroup is the inode
+// number of its directory.
+class CgroupPathResolver {
+ public:
+  explicit CgroupPathResolver(std::string root = "/sys/fs/cgroup");
+
+  // Returns the cgroup path, e.g. "/system.slice/foo.service", or
+  // "cgroup:<id>" when the cgroup can't be found (e.g. it was removed).
+  std::string Resolve(uint64_t cgroup_id);
+
+ private:
+  void Rescan();
+
+  std::string root_;
+  std::unordered_map<uint64_t, std::string> paths_;
+  // The cgroup tree is rescanned on a miss, at most once per second.
+  absl::Time last_scan_ = absl::InfinitePast();
+};
+
+// The IO issued from one cgroup during a reporting interval.
+struct CgroupUsage {
+  uint64_t cgroup_id = 0;
+  std::string path;
+  uint32_t tgid = 0;
+  std::string comm;
+  uint64_t ios = 0;
+  uint64_t bytes = 0;
+  uint64_t latency_sum_us = 0;
+  uint64_t p99_us = 0;
+
+  double avg_latency_us() const {
+    return ios == 0 ? 0.0 : static_cast<double>(latency_sum_us) / ios;
+  }
+};
+
+// Returns the IOs of a `cgroup_ios` entry since its previous read `prev`. The
+// entries evicted from the LRU map and added again start over: when any
+// counter of `current` went back it is returned whole.
+cgroup_io CgroupIoDelta(const cgroup_io& prev, const cgroup_io& current);
+
+enum class TopSortKey {
+  kIops,
+  kBytes,
+  kAvgLatency,
+  kP99Latency,
+};
+
+// Parses "iops", "bytes", "avg_lat" or "p99".
+absl::StatusOr<TopSortKey> ParseTopSortKey(std::string_view key);
+
+// Sorts the heaviest or slowest cgroups first, ties are broken by cgroup id
+// so that the order is stable between intervals.
+void SortCgroupUsage(TopSortKey key, std::vector<CgroupUsage>* usage);
+
+// Prints the first `top_n` entries as a table, the rates are computed over
+// `interval`.
+void PrintCgroupUsage(const std::vector<CgroupUsage>& usage, int top_n,
+                      absl::Duration interval);
+
+}  // namespace nvme_bpf
+
+#endif /* CGROUP_TOP_H_ */
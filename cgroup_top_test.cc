@@ -0,0 +1,137 @@
+#include "cgroup_top.h"
+
+#include <sys/stat.h>
+
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+#include "histogram.h"
+#include "nvme_latency.h"
+
+/*
+bazel test --test_output=streamed :cgroup_top_test
+ */
+
+namespace {
+
+uint64_t Inode(const std::filesystem::path& path) {
+  struct stat st;
+  EXPECT_EQ(stat(path.c_str(), &st), 0) << path;
+  return st.st_ino;
+}
+
+TEST(CgroupPathResolver, ResolvesDirectories) {
+  std::filesystem::path root =
+      std::filesystem::path(::testing::TempDir()) / "cgroup_root";
+  std::filesystem::remove_all(root);
+  std::filesystem::create_directories(root / "system.slice" / "foo.service");
+  std::filesystem::create_directories(root / "user.slice");
+
+  nvme_bpf::CgroupPathResolver resolver(root.string());
+  EXPECT_EQ(resolver.Resolve(Inode(root)), "/");
+  EXPECT_EQ(resolver.Resolve(Inode(root / "system.slice" / "foo.service")),
+            "/system.slice/foo.service");
+  EXPECT_EQ(resolver.Resolve(Inode(root / "user.slice")), "/user.slice");
+
+  uint64_t unknown = Inode(root / "user.slice") + 1000000;
+  EXPECT_EQ(resolver.Resolve(unknown), absl::StrCat("cgroup:", unknown));
+  std::filesystem::remove_all(root);
+}
+
+TEST(CgroupTop, ParseTopSortKey) {
+  EXPECT_EQ(*nvme_bpf::ParseTopSortKey("iops"), nvme_bpf::TopSortKey::kIops);
+  EXPECT_EQ(*nvme_bpf::ParseTopSortKey("bytes"), nvme_bpf::TopSortKey::kBytes);
+  EXPECT_EQ(*nvme_bpf::ParseTopSortKey("avg_lat"),
+            nvme_bpf::TopSortKey::kAvgLatency);
+  EXPECT_EQ(*nvme_bpf::ParseTopSortKey("p99"),
+            nvme_bpf::TopSortKey::kP99Latency);
+  EXPECT_FALSE(nvme_bpf::ParseTopSortKey("latency").ok());
+}
+
+TEST(CgroupTop, SortCgroupUsage) {
+  std::vector<nvme_bpf::CgroupUsage> usage(3);
+  usage[0].cgroup_id = 1;
+  usage[0].ios = 100;
+  usage[0].bytes = 100 * 4096;
+  usage[0].latency_sum_us = 100 * 50;
+  usage[0].p99_us = 64;
+  usage[1].cgroup_id = 2;
+  usage[1].ios = 10;
+  usage[1].bytes = 10 * 1024 * 1024;
+  usage[1].latency_sum_us = 10 * 900;
+  usage[1].p99_us = 1024;
+  usage[2].cgroup_id = 3;
+  usage[2].ios = 100;
+  usage[2].bytes = 100 * 512;
+  usage[2].latency_sum_us = 100 * 1000;
+  usage[2].p99_us = 2048;
+
+  auto ids = [&usage]() {
+    std::vector<uint64_t> ids;
+    for (const auto& u : usage) ids.push_back(u.cgroup_id);
+    return ids;
+  };
+  nvme_bpf::SortCgroupUsage(nvme_bpf::TopSortKey::kIops, &usage);
+  EXPECT_EQ(ids(), (std::vector<uint64_t>{1, 3, 2}));
+  nvme_bpf::SortCgroupUsage(nvme_bpf::TopSortKey::kBytes, &usage);
+  EXPECT_EQ(ids(), (std::vector<uint64_t>{2, 1, 3}));
+  nvme_bpf::SortCgroupUsage(nvme_bpf::TopSortKey::kAvgLatency, &usage);
+  EXPECT_EQ(ids(), (std::vector<uint64_t>{3, 2, 1}));
+  nvme_bpf::SortCgroupUsage(nvme_bpf::TopSortKey::kP99Latency, &usage);
+  EXPECT_EQ(ids(), (std::vector<uint64_t>{3, 2, 1}));
+}
+
+cgroup_io MakeCgroupIo(uint64_t fast, uint64_t overflow) {
+  cgroup_io cg = {};
+  cg.ios = fast + overflow;
+  cg.bytes = cg.ios * 4096;
+  cg.hist.slots[3] = fast;
+  cg.hist.overflow_count = overflow;
+  cg.hist.total_count = cg.ios;
+  cg.hist.total_sum = fast * 30 + overflow * 200'000'000;
+  cg.hist.total_sum_sq = fast * 900;
+  cg.hist.max = 200'000'000;
+  return cg;
+}
+
+TEST(CgroupIoDelta, SubtractsEveryCounter) {
+  cgroup_io prev = MakeCgroupIo(/*fast=*/100, /*overflow=*/0);
+  cgroup_io current = MakeCgroupIo(/*fast=*/150, /*overflow=*/2);
+  cgroup_io delta = nvme_bpf::CgroupIoDelta(prev, current);
+  EXPECT_EQ(delta.ios, 52);
+  EXPECT_EQ(delta.bytes, 52 * 4096);
+  EXPECT_EQ(delta.hist.slots[3], 50);
+  EXPECT_EQ(delta.hist.total_count, 52);
+  EXPECT_EQ(delta.hist.total_sum, 50 * 30 + 2 * 200'000'000);
+  EXPECT_EQ(delta.hist.total_sum_sq, 50 * 900);
+  EXPECT_EQ(delta.hist.overflow_count, 2);
+
+  // The IOs above the last bucket are the slowest ones.
+  nvme_bpf::Histogram hist;
+  hist.lat_min_us = LATENCY_DEFAULT_MIN_US;
+  hist.lat_shift = LATENCY_DEFAULT_SHIFT;
+  hist.max_slots = LATENCY_MAX_SLOTS;
+  hist.slots = delta.hist.slots;
+  hist.total_count = delta.hist.total_count;
+  hist.overflow_count = delta.hist.overflow_count;
+  hist.max = delta.hist.max;
+  EXPECT_EQ(hist.percentile(0.99), 200'000'000);
+}
+
+TEST(CgroupIoDelta, EvictedEntryStartsOver) {
+  cgroup_io prev = MakeCgroupIo(100, 0);
+  // Evicted and added again, more IOs overall but fewer in slot 3.
+  cgroup_io current = MakeCgroupIo(0, 0);
+  current.hist.slots[5] = 300;
+  current.hist.total_count = 300;
+  current.ios = 300;
+  cgroup_io delta = nvme_bpf::CgroupIoDelta(prev, current);
+  EXPECT_EQ(delta.ios, 300);
+  EXPECT_EQ(delta.hist.slots[3], 0);
+  EXPECT_EQ(delta.hist.slots[5], 300);
+}
+
+}  // namespace
@@ -0,0 +1,203 @@
+#include "device_health.h"
+
+#include <fcntl.h>
+#include <linux/nvme_ioctl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <set>
+#include <string>
+
+#include "absl/log/log.h"
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "nvme_abi.h"
+#include "nvme_log_pages.h"
+#include "nvme_strings.h"
+
+namespace nvme_bpf {
+namespace {
+
+using nvme_abi::LogPageId;
+using nvme_abi::NvmeOpcode;
+
+// The Error Information log entries read when Identify fails, the minimum
+// ELPE allows.
+constexpr size_t kDefaultErrorLogEntries = 1;
+
+absl::Status AdminCommand(int fd, nvme_admin_cmd* cmd) {
+  int ret = ioctl(fd, NVME_IOCTL_ADMIN_CMD, cmd);
+  if (ret < 0) {
+    return absl::InternalError(absl::StrCat(
+        nvme_abi::NvmeAdminOpcodeToString(static_cast<NvmeOpcode>(
+            cmd->opcode)),
+        " ioctl failed, errno=", errno));
+  }
+  if (ret > 0) {
+    // The NVMe status field without the phase tag.
+    return absl::InternalError(absl::StrCat(
+        nvme_abi::NvmeAdminOpcodeToString(static_cast<NvmeOpcode>(
+            cmd->opcode)),
+        " failed, status=0x", absl::Hex(ret)));
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace
+
+absl::StatusOr<std::string> ReadLogPage(int fd, LogPageId id, uint32_t nsid,
+                                        size_t bytes) {
+  if (bytes == 0 || bytes % sizeof(uint32_t) != 0) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Log page reads are whole dwords, got ", bytes));
+  }
+  std::string page(bytes, '\0');
+  // NUMD is zero based and split between cdw10 and cdw11.
+  uint32_t numd = bytes / sizeof(uint32_t) - 1;
+  nvme_abi::GetLogPageSqeCdw10 cdw10 = {};
+  cdw10.log_page_id = id;
+  cdw10.num_dwords_lower = numd & 0xFFFF;
+  nvme_abi::GetLogPageSqeCdw11 cdw11 = {};
+  cdw11.num_dwords_upper = numd >> 16;
+
+  nvme_admin_cmd cmd = {};
+  cmd.opcode = static_cast<uint8_t>(NvmeOpcode::kGetLogPage);
+  cmd.nsid = nsid;
+  cmd.addr = reinterpret_cast<uintptr_t>(page.data());
+  cmd.data_len = bytes;
+  std::memcpy(&cmd.cdw10, &cdw10, sizeof(cmd.cdw10));
+  std::memcpy(&cmd.cdw11, &cdw11, sizeof(cmd.cdw11));
+  absl::Status status = AdminCommand(fd, &cmd);
+  if (!status.ok()) {
+    return absl::Status(status.code(),
+                        absl::StrCat(nvme_abi::LogPageIdToString(id), ": ",
+                                     status.message()));
+  }
+  return page;
+}
+
+DeviceHealthPoller::~DeviceHealthPoller() {
+  for (auto& [ctrl_id, ctrl] : ctrls_) {
+    if (ctrl.fd >= 0) {
+      close(ctrl.fd);
+    }
+  }
+}
+
+absl::Status DeviceHealthPoller::Open(int ctrl_id, Controller* ctrl) {
+  std::string path = absl::StrCat("/dev/nvme", ctrl_id);
+  ctrl->fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (ctrl->fd < 0) {
+    return absl::InternalError(
+        absl::StrCat("open(", path, ") failed, errno=", errno));
+  }
+  // ELPE, the number of Error Information log entries, from Identify.
+  nvme_abi::IdentifyController identify;
+  nvme_abi::IdentifyDw10 cdw10 = {};
+  cdw10.c_or_n_structure = nvme_abi::IdentifyType::kController;
+  nvme_admin_cmd cmd = {};
+  cmd.opcode = static_cast<uint8_t>(NvmeOpcode::kIdentify);
+  cmd.addr = reinterpret_cast<uintptr_t>(&identify);
+  cmd.data_len = sizeof(identify);
+  std::memcpy(&cmd.cdw10, &cdw10, sizeof(cmd.cdw10));
+  absl::Status status = AdminCommand(ctrl->fd, &cmd);
+  if (status.ok()) {
+    ctrl->error_log_entries = identify.error_log_page_entries + 1;
+  } else {
+    LOG(WARNING) << path << ": " << status;
+    ctrl->error_log_entries = kDefaultErrorLogEntries;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status DeviceHealthPoller::PollController(Controller* ctrl) {
+  auto smart = ReadLogPage(ctrl->fd, LogPageId::kSmartHealthInfo,
+                           nvme_abi::kBroadcastNsId,
+                           nvme_abi::kSmartHealthLogPageSize);
+  if (!smart.ok()) {
+    return smart.status();
+  }
+  auto health = ParseSmartHealthLog(*smart);
+  if (!health.ok()) {
+    return health.status();
+  }
+  ctrl->prev = ctrl->now;
+  ctrl->now = *health;
+  // The error log is only read when the SMART count says it grew.
+  if (ctrl->prev.has_value() &&
+      health->error_log_entries == ctrl->prev->error_log_entries) {
+    return absl::OkStatus();
+  }
+  auto page = ReadLogPage(
+      ctrl->fd, LogPageId::kErrorInfo, /*nsid=*/0,
+      ctrl->error_log_entries * sizeof(nvme_abi::ErrorInformationLogEntry));
+  if (!page.ok()) {
+    return page.status();
+  }
+  auto entries = ParseErrorLog(*page);
+  if (!entries.ok()) {
+    return entries.status();
+  }
+  // The first read only sets the baseline, the entries are old news.
+  bool first = !ctrl->prev.has_value();
+  for (const auto& entry : *entries) {
+    if (entry.error_count <= ctrl->last_error_count) {
+      break;
+    }
+    if (!first) {
+      ctrl->new_errors.push_back(entry);
+    }
+  }
+  if (!entries->empty()) {
+    ctrl->last_error_count =
+        std::max(ctrl->last_error_count, entries->front().error_count);
+  }
+  return absl::OkStatus();
+}
+
+void DeviceHealthPoller::Poll(const std::set<int>& ctrl_ids) {
+  for (int ctrl_id : ctrl_ids) {
+    auto [it, inserted] = ctrls_.try_emplace(ctrl_id);
+    Controller& ctrl = it->second;
+    absl::Status status;
+    if (ctrl.fd < 0) {
+      if (!inserted) {
+        // Failed to open before, don't retry every poll.
+        continue;
+      }
+      status = Open(ctrl_id, &ctrl);
+    }
+    if (status.ok()) {
+      status = PollController(&ctrl);
+    }
+    if (!status.ok() && !ctrl.logged_error) {
+      LOG(ERROR) << "nvme" << ctrl_id << " health: " << status;
+      ctrl.logged_error = true;
+    }
+  }
+}
+
+void DeviceHealthPoller::Print(std::ostream& os) {
+  for (auto& [ctrl_id, ctrl] : ctrls_) {
+    if (!ctrl.now.has_value()) {
+      continue;
+    }
+    os << FormatSmartHealth(ctrl_id, *ctrl.now,
+                            ctrl.prev.has_value() ? &*ctrl.prev : nullptr)
+       << std::endl;
+    // Oldest first.
+    for (auto it = ctrl.new_errors.rbegin(); it != ctrl.new_errors.rend();
+         ++it) {
+      os << "nvme" << ctrl_id << " error log: " << ErrorLogEntryToString(*it)
+         << std::endl;
+    }
+    ctrl.new_errors.clear();
+  }
+}
+
+}  // namespace nvme_bpf
@@ -0,0 +1,63 @@
+#ifndef DEVICE_HEALTH_H_
+#define DEVICE_HEALTH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "nvme_abi.h"
+#include "nvme_log_pages.h"
+
+namespace nvme_bpf {
+
+// Reads `bytes` of a log page through the admin passthrough ioctl of an open
+// controller character device, /dev/nvme<N>.
+absl::StatusOr<std::string> ReadLogPage(int fd, nvme_abi::LogPageId id,
+                                        uint32_t nsid, size_t bytes);
+
+// Polls the SMART / Health and the Error Information logs of the controllers
+// for the latency report. Meant for a low rate, every read is an admin command
+// that the devices may serialize with the IO.
+class DeviceHealthPoller {
+ public:
+  DeviceHealthPoller() = default;
+  DeviceHealthPoller(const DeviceHealthPoller&) = delete;
+  DeviceHealthPoller& operator=(const DeviceHealthPoller&) = delete;
+  ~DeviceHealthPoller();
+
+  // Reads the logs of `ctrl_ids`, opening the controllers on first use. A
+  // controller that fails keeps its previous reading, the error is logged
+  // once per controller.
+  void Poll(const std::set<int>& ctrl_ids);
+
+  // Prints a line per polled controller with the change since the previous
+  // poll, then the error log entries that are new since the last Print().
+  void Print(std::ostream& os);
+
+ private:
+  struct Controller {
+    int fd = -1;
+    bool logged_error = false;
+    // The Error Information log entries the controller keeps, ELPE + 1.
+    size_t error_log_entries = 0;
+    std::optional<SmartHealth> now;
+    std::optional<SmartHealth> prev;
+    uint64_t last_error_count = 0;
+    std::vector<nvme_abi::ErrorInformationLogEntry> new_errors;
+  };
+
+  absl::Status Open(int ctrl_id, Controller* ctrl);
+  absl::Status PollController(Controller* ctrl);
+
+  std::map<int, Controller> ctrls_;
+};
+
+}  // namespace nvme_bpf
+
+#endif  // DEVICE_HEALTH_H_
@@ -0,0 +1,181 @@
+#include "event_loop.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+
+namespace nvme_bpf {
+namespace {
+
+constexpr int kMaxEvents = 32;
+
+}  // namespace
+
+absl::StatusOr<std::unique_ptr<EventLoop>> EventLoop::Create() {
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) {
+    return absl::InternalError(absl::StrCat("epoll_create1() errno=", errno));
+  }
+  return std::unique_ptr<EventLoop>(new EventLoop(epoll_fd));
+}
+
+EventLoop::~EventLoop() {
+  for (const auto& [fd, handler] : handlers_) {
+    if (handler.owned) {
+      close(fd);
+    }
+  }
+  close(epoll_fd_);
+  if (signals_blocked_) {
+    sigprocmask(SIG_SETMASK, &saved_mask_, nullptr);
+  }
+}
+
+absl::Status EventLoop::Add(int fd, Handler handler) {
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+    return absl::InternalError(
+        absl::StrCat("epoll_ctl(ADD, ", fd, ") errno=", errno));
+  }
+  handlers_[fd] = std::move(handler);
+  return absl::OkStatus();
+}
+
+absl::Status EventLoop::AddFd(int fd, Callback fn) {
+  return Add(fd, Handler{std::move(fn), /*owned=*/false});
+}
+
+absl::Status EventLoop::RemoveFd(int fd) {
+  auto it = handlers_.find(fd);
+  if (it == handlers_.end()) {
+    return absl::NotFoundError(absl::StrCat("fd ", fd, " is not in the loop"));
+  }
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  if (it->second.owned) {
+    close(fd);
+  }
+  handlers_.erase(it);
+  return absl::OkStatus();
+}
+
+absl::StatusOr<int> EventLoop::AddTimer(absl::Duration interval, Callback fn) {
+  if (interval <= absl::ZeroDuration()) {
+    return absl::InvalidArgumentError("The timer interval must be positive");
+  }
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fd < 0) {
+    return absl::InternalError(absl::StrCat("timerfd_create() errno=", errno));
+  }
+  struct itimerspec spec = {};
+  spec.it_interval = absl::ToTimespec(interval);
+  spec.it_value = spec.it_interval;
+  if (timerfd_settime(fd, 0, &spec, nullptr) != 0) {
+    int err = errno;
+    close(fd);
+    return absl::InternalError(absl::StrCat("timerfd_settime() errno=", err));
+  }
+  auto on_tick = [fd, fn = std::move(fn)]() -> absl::Status {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+      // EAGAIN, the tick was already consumed.
+      return absl::OkStatus();
+    }
+    return fn();
+  };
+  absl::Status status = Add(fd, Handler{std::move(on_tick), /*owned=*/true});
+  if (!status.ok()) {
+    close(fd);
+    return status;
+  }
+  return fd;
+}
+
+absl::Status EventLoop::RemoveTimer(int timer_id) { return RemoveFd(timer_id); }
+
+absl::Status EventLoop::AddSignals(const std::vector<int>& signals,
+                                   std::function<absl::Status(int signo)> fn) {
+  sigset_t mask;
+  sigemptyset(&mask);
+  for (int signo : signals) {
+    sigaddset(&mask, signo);
+  }
+  // The signals must be blocked, otherwise they are still delivered to the
+  // default disposition instead of the signalfd.
+  sigset_t old_mask;
+  if (sigprocmask(SIG_BLOCK, &mask, &old_mask) != 0) {
+    return absl::InternalError(absl::StrCat("sigprocmask() errno=", errno));
+  }
+  if (!signals_blocked_) {
+    saved_mask_ = old_mask;
+    signals_blocked_ = true;
+  }
+  int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd < 0) {
+    return absl::InternalError(absl::StrCat("signalfd() errno=", errno));
+  }
+  auto on_signal = [fd, fn = std::move(fn)]() -> absl::Status {
+    struct signalfd_siginfo info;
+    while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+      absl::Status status = fn(info.ssi_signo);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    return absl::OkStatus();
+  };
+  absl::Status status = Add(fd, Handler{std::move(on_signal), /*owned=*/true});
+  if (!status.ok()) {
+    close(fd);
+  }
+  return status;
+}
+
+absl::Status EventLoop::RunUntil(absl::Time deadline) {
+  struct epoll_event events[kMaxEvents];
+  while (!stopped_) {
+    int timeout_ms = -1;
+    if (deadline != absl::InfiniteFuture()) {
+      absl::Duration left = deadline - absl::Now();
+      if (left <= absl::ZeroDuration()) {
+        break;
+      }
+      timeout_ms = std::ceil(
+          std::min(absl::ToDoubleMilliseconds(left), double{INT32_MAX}));
+    }
+    int n = epoll_wait(epoll_fd_, events, kMaxEvents, timeout_ms);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return absl::InternalError(absl::StrCat("epoll_wait() errno=", errno));
+    }
+    for (int i = 0; i < n && !stopped_; ++i) {
+      // An earlier callback of the batch may have removed the fd.
+      auto it = handlers_.find(events[i].data.fd);
+      if (it == handlers_.end()) {
+        continue;
+      }
+      // The callback may remove itself, keep it alive for the call.
+      Callback fn = it->second.fn;
+      absl::Status status = fn();
+      if (!status.ok()) {
+        return status;
+      }
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace nvme_bpf
@@ -0,0 +1,82 @@
+#ifndef EVENT_LOOP_H_
+#define EVENT_LOOP_H_
+
+#include <signal.h>
+
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/time/time.h"
+
+namespace nvme_bpf {
+
+// A single threaded epoll loop for the collectors: ring buffer epoll fds,
+// sockets, reporting timers (timerfd) and signals (signalfd) are all
+// dispatched from one epoll_wait, the process only wakes up when there is
+// something to do.
+//
+// The callbacks run on the thread calling Run(). A callback that returns an
+// error stops the loop and Run() returns it. Callbacks may add and remove fds,
+// including their own.
+class EventLoop {
+ public:
+  using Callback = std::function<absl::Status()>;
+
+  static absl::StatusOr<std::unique_ptr<EventLoop>> Create();
+
+  // Closes the timer and signal fds and restores the signal mask.
+  ~EventLoop();
+
+  // Calls `fn` whenever `fd` is readable. `fd` stays owned by the caller and
+  // must be removed before it's closed. A nested epoll fd, e.g.
+  // ring_buffer__epoll_fd() or MetricsServer::fd(), can be added too.
+  absl::Status AddFd(int fd, Callback fn);
+  absl::Status RemoveFd(int fd);
+
+  // Calls `fn` every `interval` on a CLOCK_MONOTONIC timerfd, the first call
+  // is one interval from now. The ticks don't drift with the time spent in
+  // the callbacks, ticks missed while the loop was busy are coalesced.
+  // Returns an id for RemoveTimer().
+  absl::StatusOr<int> AddTimer(absl::Duration interval, Callback fn);
+  absl::Status RemoveTimer(int timer_id);
+
+  // Blocks `signals` and delivers them to `fn` through a signalfd instead of
+  // an asynchronous handler.
+  absl::Status AddSignals(const std::vector<int>& signals,
+                          std::function<absl::Status(int signo)> fn);
+
+  // Dispatches the events until Stop() is called or a callback fails.
+  absl::Status Run() { return RunUntil(absl::InfiniteFuture()); }
+  // Same as Run() but also returns at `deadline`.
+  absl::Status RunUntil(absl::Time deadline);
+
+  // Makes Run() return after the current callback. Stays stopped, the next
+  // Run() returns immediately.
+  void Stop() { stopped_ = true; }
+  bool stopped() const { return stopped_; }
+
+ private:
+  struct Handler {
+    Callback fn;
+    // The timer and signal fds are closed by the loop.
+    bool owned = false;
+  };
+
+  explicit EventLoop(int epoll_fd) : epoll_fd_(epoll_fd) {}
+
+  absl::Status Add(int fd, Handler handler);
+
+  int epoll_fd_;
+  bool stopped_ = false;
+  std::unordered_map<int, Handler> handlers_;
+  bool signals_blocked_ = false;
+  sigset_t saved_mask_;
+};
+
+}  // namespace nvme_bpf
+
+#endif /* EVENT_LOOP_H_ */
@@ -0,0 +1,106 @@
+#include "event_loop.h"
+
+#include <signal.h>
+#include <unistd.h>
+
+#include "absl/status/status.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "gtest/gtest.h"
+
+/*
+bazel test --test_output=streamed :event_loop_test
+ */
+
+namespace {
+
+using nvme_bpf::EventLoop;
+
+TEST(EventLoop, TimerTicksUntilStopped) {
+  auto loop = EventLoop::Create();
+  ASSERT_TRUE(loop.ok()) << loop.status();
+  int ticks = 0;
+  auto timer = (*loop)->AddTimer(absl::Milliseconds(5), [&]() {
+    if (++ticks == 3) {
+      (*loop)->Stop();
+    }
+    return absl::OkStatus();
+  });
+  ASSERT_TRUE(timer.ok()) << timer.status();
+  absl::Time start = absl::Now();
+  ASSERT_TRUE((*loop)->Run().ok());
+  EXPECT_EQ(ticks, 3);
+  EXPECT_GE(absl::Now() - start, absl::Milliseconds(15));
+  EXPECT_TRUE((*loop)->stopped());
+  EXPECT_TRUE((*loop)->RemoveTimer(*timer).ok());
+}
+
+TEST(EventLoop, RunUntilDeadline) {
+  auto loop = EventLoop::Create();
+  ASSERT_TRUE(loop.ok()) << loop.status();
+  absl::Time start = absl::Now();
+  ASSERT_TRUE((*loop)->RunUntil(start + absl::Milliseconds(20)).ok());
+  EXPECT_GE(absl::Now() - start, absl::Milliseconds(20));
+  EXPECT_FALSE((*loop)->stopped());
+}
+
+TEST(EventLoop, ReadableFd) {
+  auto loop = EventLoop::Create();
+  ASSERT_TRUE(loop.ok()) << loop.status();
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  char received = 0;
+  ASSERT_TRUE((*loop)
+                  ->AddFd(fds[0],
+                          [&]() {
+                            EXPECT_EQ(read(fds[0], &received, 1), 1);
+                            // Removing itself from the callback is fine.
+                            EXPECT_TRUE((*loop)->RemoveFd(fds[0]).ok());
+                            (*loop)->Stop();
+                            return absl::OkStatus();
+                          })
+                  .ok());
+  ASSERT_EQ(write(fds[1], "x", 1), 1);
+  ASSERT_TRUE((*loop)->RunUntil(absl::Now() + absl::Seconds(5)).ok());
+  EXPECT_EQ(received, 'x');
+  EXPECT_EQ((*loop)->RemoveFd(fds[0]).code(), absl::StatusCode::kNotFound);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(EventLoop, CallbackErrorStopsTheLoop) {
+  auto loop = EventLoop::Create();
+  ASSERT_TRUE(loop.ok()) << loop.status();
+  ASSERT_TRUE((*loop)
+                  ->AddTimer(absl::Milliseconds(1),
+                             []() { return absl::InternalError("boom"); })
+                  .ok());
+  EXPECT_EQ((*loop)->Run().code(), absl::StatusCode::kInternal);
+}
+
+TEST(EventLoop, Signals) {
+  sigset_t before;
+  sigprocmask(SIG_SETMASK, nullptr, &before);
+  {
+    auto loop = EventLoop::Create();
+    ASSERT_TRUE(loop.ok()) << loop.status();
+    int received = 0;
+    ASSERT_TRUE((*loop)
+                    ->AddSignals({SIGUSR1, SIGUSR2},
+                                 [&](int signo) {
+                                   received = signo;
+                                   (*loop)->Stop();
+                                   return absl::OkStatus();
+                                 })
+                    .ok());
+    // Blocked, so it's queued on the signalfd instead of killing the test.
+    raise(SIGUSR2);
+    ASSERT_TRUE((*loop)->RunUntil(absl::Now() + absl::Seconds(5)).ok());
+    EXPECT_EQ(received, SIGUSR2);
+  }
+  sigset_t after;
+  sigprocmask(SIG_SETMASK, nullptr, &after);
+  EXPECT_EQ(sigismember(&after, SIGUSR2), sigismember(&before, SIGUSR2));
+}
+
+}  // namespace
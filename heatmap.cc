@@ -0,0 +1,214 @@
+#include "heatmap.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/str_cat.h"
+
+namespace nvme_bpf {
+namespace {
+
+// Clears the screen and moves to the top left corner.
+constexpr char kClearScreen[] = "\x1b[H\x1b[2J";
+// Clears the rest of the line.
+constexpr char kClearLine[] = "\x1b[K";
+
+void AppendMoveTo(int line, int column, std::string* out) {
+  absl::StrAppend(out, "\x1b[", line, ";", column, "H");
+}
+
+// The shade of a cell holding `fraction` of the interval's IOs, any IO is
+// visible.
+const char* Shade(u64 count, u64 total) {
+  if (count == 0) {
+    return " ";
+  }
+  double fraction = static_cast<double>(count) / total;
+  if (fraction <= 0.02) {
+    return "░";
+  }
+  if (fraction <= 0.1) {
+    return "▒";
+  }
+  if (fraction <= 0.4) {
+    return "▓";
+  }
+  return "█";
+}
+
+}  // namespace
+
+LatencyHeatmap::LatencyHeatmap(int width) : width_(std::max(width, 2)) {}
+
+LatencyHeatmap::Panel* LatencyHeatmap::FindPanel(const std::string& name) {
+  for (Panel& panel : panels_) {
+    if (panel.name == name) {
+      return &panel;
+    }
+  }
+  return nullptr;
+}
+
+void LatencyHeatmap::Update(const std::string& name,
+                            const Histogram& cumulative) {
+  if (rows_ == 0 || !CheckSameLayout(layout_, cumulative).ok()) {
+    layout_ = Histogram();
+    layout_.lat_min_us = cumulative.lat_min_us;
+    layout_.lat_shift = cumulative.lat_shift;
+    layout_.max_slots = cumulative.max_slots;
+    rows_ = cumulative.max_slots + 2;
+    panels_.clear();
+    needs_frame_ = true;
+  }
+  Panel* panel = FindPanel(name);
+  if (panel == nullptr) {
+    panel = &panels_.emplace_back();
+    panel->name = name;
+    panel->prev.resize(rows_);
+    panel->cells.resize(width_ * rows_);
+    panel->lo = rows_;
+    panel->hi = -1;
+    needs_frame_ = true;
+  }
+
+  std::vector<u64> current(rows_);
+  current[0] = cumulative.slots[cumulative.max_slots];
+  std::copy(cumulative.slots, cumulative.slots + cumulative.max_slots,
+            current.begin() + 1);
+  current[rows_ - 1] = cumulative.overflow_count;
+  // The counters went back when the maps were recreated, the new counts are
+  // all from this interval.
+  bool reset = false;
+  for (int i = 0; i < rows_; ++i) {
+    reset |= current[i] < panel->prev[i];
+  }
+  u64* column = &panel->cells[ticks_ % width_ * rows_];
+  for (int i = 0; i < rows_; ++i) {
+    column[i] = reset ? current[i] : current[i] - panel->prev[i];
+    if (column[i] != 0 && (i < panel->lo || i > panel->hi)) {
+      panel->lo = std::min(panel->lo, i);
+      panel->hi = std::max(panel->hi, i);
+      needs_frame_ = true;
+    }
+  }
+  panel->prev = std::move(current);
+  panel->updated = true;
+}
+
+std::string LatencyHeatmap::RowLabel(int value_index) const {
+  if (value_index == 0) {
+    return absl::StrCat("<", layout_.lat_min_us, "us");
+  }
+  if (value_index == rows_ - 1) {
+    return absl::StrCat(">=", layout_.bucket_high(layout_.max_slots - 1),
+                        "us");
+  }
+  return absl::StrCat("<", layout_.bucket_high(value_index - 1), "us");
+}
+
+// The columns of a panel, `first_line` is the line of its title.
+void LatencyHeatmap::AppendColumn(const Panel& panel, int first_line, int pos,
+                                  std::string* out) const {
+  const u64* column = &panel.cells[pos * rows_];
+  u64 total = 0;
+  for (int i = 0; i < rows_; ++i) {
+    total += column[i];
+  }
+  const int label_width = RowLabel(rows_ - 1).size();
+  const int x = label_width + 3 + pos;
+  int next = (pos + 1) % width_;
+  // The newest column and the marker of the next one, top to bottom.
+  for (int i = panel.hi, line = first_line + 1; i >= panel.lo; --i, ++line) {
+    AppendMoveTo(line, x, out);
+    out->append(Shade(column[i], total));
+    if (next == 0) {
+      AppendMoveTo(line, label_width + 3, out);
+    }
+    out->push_back('|');
+  }
+  AppendMoveTo(first_line, 1, out);
+  absl::StrAppend(out, panel.name, " ios=", total, kClearLine);
+}
+
+void LatencyHeatmap::AppendFrame(std::string* out) const {
+  out->append(kClearScreen);
+  absl::StrAppend(out, "Latency heatmap, 1 column per interval, the newest "
+                       "left of |, shaded by the share of the IOs\n");
+  const int label_width = RowLabel(rows_ - 1).size();
+  const int current = ticks_ % width_;
+  // The columns after the first ticks are blank until the ring wraps.
+  const uint64_t filled = std::min<uint64_t>(ticks_ + 1, width_);
+  for (const Panel& panel : panels_) {
+    std::vector<u64> totals(width_);
+    for (int pos = 0; pos < width_; ++pos) {
+      for (int i = 0; i < rows_; ++i) {
+        totals[pos] += panel.cells[pos * rows_ + i];
+      }
+    }
+    absl::StrAppend(out, panel.name, " ios=", totals[current], "\n");
+    for (int i = panel.hi; i >= panel.lo; --i) {
+      std::string label = RowLabel(i);
+      out->append(label_width - label.size(), ' ');
+      absl::StrAppend(out, label, " |");
+      for (int pos = 0; pos < width_; ++pos) {
+        if (pos == (current + 1) % width_) {
+          out->push_back('|');
+        } else if (static_cast<uint64_t>(pos) >= filled) {
+          out->push_back(' ');
+        } else {
+          out->append(Shade(panel.cells[pos * rows_ + i], totals[pos]));
+        }
+      }
+      out->push_back('\n');
+    }
+  }
+}
+
+std::string LatencyHeatmap::Render() {
+  const int pos = ticks_ % width_;
+  for (Panel& panel : panels_) {
+    if (!panel.updated) {
+      std::fill_n(panel.cells.begin() + pos * rows_, rows_, 0);
+    }
+    panel.updated = false;
+  }
+  std::string out;
+  if (needs_frame_) {
+    AppendFrame(&out);
+  }
+  // Below the header line.
+  int line = 2;
+  for (const Panel& panel : panels_) {
+    if (!needs_frame_) {
+      AppendColumn(panel, line, pos, &out);
+    }
+    // The title and the rows.
+    line += 1 + std::max(panel.hi - panel.lo + 1, 0);
+  }
+  // Leaves the cursor below the heatmap.
+  AppendMoveTo(line, 1, &out);
+  needs_frame_ = false;
+  ++ticks_;
+  return out;
+}
+
+std::vector<u64> LatencyHeatmap::Column(const std::string& name,
+                                        int ticks_ago) const {
+  if (ticks_ago < 0 || ticks_ago >= width_ ||
+      static_cast<uint64_t>(ticks_ago) >= ticks_) {
+    return {};
+  }
+  for (const Panel& panel : panels_) {
+    if (panel.name == name) {
+      int pos = (ticks_ - 1 - ticks_ago) % width_;
+      return std::vector<u64>(panel.cells.begin() + pos * rows_,
+                              panel.cells.begin() + (pos + 1) * rows_);
+    }
+  }
+  return {};
+}
+
+}  // namespace nvme_bpf
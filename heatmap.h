@@ -0,0 +1,73 @@
+#ifndef HEATMAP_H_
+#define HEATMAP_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "histogram.h"
+#include "types.bpf.h"
+
+namespace nvme_bpf {
+
+// Latency over time as a terminal heatmap: one panel per histogram key with
+// the latency buckets on the y axis, the newest at the top, and one column per
+// interval on the x axis. A cell is shaded by the share of the interval's IOs
+// in the bucket. The columns are the deltas of the cumulative histograms
+// between the ticks, kept in a ring of `width` columns per panel.
+//
+// The output uses ANSI cursor control and assumes the terminal belongs to the
+// heatmap. The whole frame is drawn on the first tick and after a panel or a
+// bucket row was added, otherwise a tick only draws the new column. The
+// columns sweep from left to right and wrap around, a '|' column marks where
+// the next one goes.
+class LatencyHeatmap {
+ public:
+  explicit LatencyHeatmap(int width);
+
+  // Sets the cumulative histogram of panel `name` for the current tick. All
+  // the histograms must have the same layout, a different layout starts over.
+  // A panel that isn't updated during a tick gets an empty column.
+  void Update(const std::string& name, const Histogram& cumulative);
+
+  // Ends the tick and returns the terminal output for it.
+  std::string Render();
+
+  // The counts of a panel `ticks_ago` ticks before the last Render(), in
+  // value order: the "< min" slot, the regular slots, then the overflow.
+  // Empty if the panel or the column doesn't exist.
+  std::vector<u64> Column(const std::string& name, int ticks_ago) const;
+
+ private:
+  struct Panel {
+    std::string name;
+    // The cumulative counts of the previous update, in value order.
+    std::vector<u64> prev;
+    // The ring of columns, `width_` * `rows_` counts.
+    std::vector<u64> cells;
+    // The range of the drawn value indexes, inclusive. Grows to fit the data,
+    // lo > hi while there is none.
+    int lo;
+    int hi;
+    bool updated = false;
+  };
+
+  Panel* FindPanel(const std::string& name);
+  std::string RowLabel(int value_index) const;
+  void AppendFrame(std::string* out) const;
+  void AppendColumn(const Panel& panel, int first_line, int pos,
+                    std::string* out) const;
+
+  const int width_;
+  Histogram layout_;
+  // Value indexes per column: max_slots + 2.
+  int rows_ = 0;
+  // The number of finished ticks, the current column is at ticks_ % width_.
+  uint64_t ticks_ = 0;
+  std::vector<Panel> panels_;
+  bool needs_frame_ = true;
+};
+
+}  // namespace nvme_bpf
+
+#endif /* HEATMAP_H_ */
@@ -0,0 +1,100 @@
+#include "heatmap.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "histogram.h"
+
+namespace {
+
+using Hist = nvme_bpf::OwnedHistogram<8>;
+using nvme_bpf::LatencyHeatmap;
+
+// Counts the non-overlapping occurrences of `needle`.
+int Count(const std::string& haystack, const std::string& needle) {
+  int count = 0;
+  for (size_t pos = haystack.find(needle); pos != std::string::npos;
+       pos = haystack.find(needle, pos + needle.size())) {
+    ++count;
+  }
+  return count;
+}
+
+TEST(LatencyHeatmap, ColumnsAreIntervalDeltas) {
+  LatencyHeatmap heatmap(/*width=*/4);
+  Hist hist(/*lat_min_us=*/10, /*lat_shift=*/0);
+  hist.Record(5, 3);   // < min
+  hist.Record(12, 2);  // [12, 14)
+  heatmap.Update("a", hist.view());
+  heatmap.Render();
+  EXPECT_EQ(heatmap.Column("a", 0), std::vector<u64>({3, 0, 0, 2, 0, 0, 0,
+                                                      0, 0, 0}));
+
+  hist.Record(12, 5);
+  hist.Record(1 << 20);  // overflow
+  heatmap.Update("a", hist.view());
+  heatmap.Render();
+  EXPECT_EQ(heatmap.Column("a", 0), std::vector<u64>({0, 0, 0, 5, 0, 0, 0,
+                                                      0, 0, 1}));
+  EXPECT_EQ(heatmap.Column("a", 1)[0], 3);
+
+  // Not updated, an empty column.
+  heatmap.Render();
+  EXPECT_EQ(heatmap.Column("a", 0), std::vector<u64>(10));
+
+  // The counters went back.
+  Hist restarted(10, 0);
+  restarted.Record(12);
+  heatmap.Update("a", restarted.view());
+  heatmap.Render();
+  EXPECT_EQ(heatmap.Column("a", 0)[3], 1);
+
+  // The ring holds `width` columns.
+  EXPECT_EQ(heatmap.Column("a", 3)[0], 3);
+  heatmap.Render();
+  EXPECT_TRUE(heatmap.Column("a", 4).empty());
+  EXPECT_TRUE(heatmap.Column("b", 0).empty());
+}
+
+TEST(LatencyHeatmap, DrawsOnlyTheNewColumn) {
+  LatencyHeatmap heatmap(/*width=*/60);
+  Hist a(10, 0);
+  Hist b(10, 0);
+  a.Record(12, 100);
+  a.Record(100, 1);
+  b.Record(20, 10);
+  heatmap.Update("ctrl_id=0 Read", a.view());
+  heatmap.Update("ctrl_id=0 Write", b.view());
+  std::string frame = heatmap.Render();
+  EXPECT_EQ(frame.find("\x1b[H\x1b[2J"), 0);
+  EXPECT_NE(frame.find("ctrl_id=0 Read ios=101"), std::string::npos);
+  EXPECT_NE(frame.find("ctrl_id=0 Write ios=10"), std::string::npos);
+  // [12, 14) to [74, 138), the rows of the Read panel, and [18, 26).
+  EXPECT_NE(frame.find("  <14us |█"), std::string::npos);
+  EXPECT_NE(frame.find(" <138us |░"), std::string::npos);
+  EXPECT_EQ(Count(frame, "\n"), 1 + 1 + 6 + 1 + 1);
+
+  // The same buckets, only the new cells, the markers and the titles.
+  a.Record(12, 100);
+  b.Record(20, 10);
+  heatmap.Update("ctrl_id=0 Read", a.view());
+  heatmap.Update("ctrl_id=0 Write", b.view());
+  std::string tick = heatmap.Render();
+  EXPECT_EQ(tick.find("\x1b[2J"), std::string::npos);
+  EXPECT_EQ(Count(tick, "|"), 6 + 1);
+  // The <14us row of the first panel, the second column.
+  EXPECT_NE(tick.find("\x1b[8;11H█|"), std::string::npos);
+  EXPECT_NE(tick.find("ctrl_id=0 Read ios=100"), std::string::npos);
+  EXPECT_LT(tick.size(), 300);
+
+  // The overflow adds a row, the whole frame is redrawn.
+  a.Record(5000);
+  heatmap.Update("ctrl_id=0 Read", a.view());
+  frame = heatmap.Render();
+  EXPECT_EQ(frame.find("\x1b[H\x1b[2J"), 0);
+  EXPECT_EQ(Count(frame, "\n"), 1 + 1 + 7 + 1 + 1);
+  EXPECT_NE(frame.find(">=138us |"), std::string::npos);
+}
+
+}  // namespace
@@ -1,16 +1,188 @@
 #include "histogram.h"
 
+#include <bit>
+#include <cmath>
+
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
+#include "varint.h"
 
 namespace nvme_bpf {
 
+uint64_t Histogram::percentile(double q) const {
+  // The "< min" slot is stored after the regular slots but holds the lowest
+  // values.
+  uint64_t count = slots[max_slots] + overflow_count;
+  for (int slot = 0; slot < max_slots; ++slot) {
+    count += slots[slot];
+  }
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(std::ceil(q * count));
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t accumulated = slots[max_slots];
+  if (accumulated >= rank) {
+    return bucket_high(max_slots);
+  }
+  for (int slot = 0; slot < max_slots; ++slot) {
+    accumulated += slots[slot];
+    if (accumulated >= rank) {
+      return bucket_high(slot);
+    }
+  }
+  return std::max<uint64_t>(bucket_high(max_slots - 1), max);
+}
+
+double Histogram::mean() const {
+  return total_count == 0 ? 0 : static_cast<double>(total_sum) / total_count;
+}
+
+double Histogram::stddev() const {
+  if (total_count == 0 || total_sum_sq == 0) {
+    return 0;
+  }
+  double m = mean();
+  double variance = static_cast<double>(total_sum_sq) / total_count - m * m;
+  return variance > 0 ? std::sqrt(variance) : 0;
+}
+
+namespace {
+
+constexpr uint8_t kSerializedVersion = 2;
+
+}  // namespace
+
+absl::Status CheckSameLayout(const Histogram& a, const Histogram& b) {
+  if (a.lat_min_us != b.lat_min_us || a.lat_shift != b.lat_shift ||
+      a.max_slots != b.max_slots) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "Histogram layout mismatch: lat_min_us=", a.lat_min_us, "/",
+        b.lat_min_us, " lat_shift=", a.lat_shift, "/", b.lat_shift,
+        " max_slots=", a.max_slots, "/", b.max_slots));
+  }
+  return absl::OkStatus();
+}
+
+void SerializeHistogram(const Histogram& hist, std::string* out) {
+  out->push_back(static_cast<char>(kSerializedVersion));
+  PutVarint(hist.lat_min_us, out);
+  PutVarint(hist.lat_shift, out);
+  PutVarint(hist.max_slots, out);
+  PutVarint(hist.total_count, out);
+  PutVarint(hist.total_sum, out);
+  PutVarint(hist.total_sum_sq, out);
+  PutVarint(hist.overflow_count, out);
+  PutVarint(hist.min, out);
+  PutVarint(hist.max, out);
+  int nonzero = 0;
+  for (int slot = 0; slot <= hist.max_slots; ++slot) {
+    nonzero += hist.slots[slot] != 0;
+  }
+  PutVarint(nonzero, out);
+  // The slot index is stored as the gap from the previous non-zero slot.
+  int next = 0;
+  for (int slot = 0; slot <= hist.max_slots; ++slot) {
+    if (hist.slots[slot] != 0) {
+      PutVarint(slot - next, out);
+      PutVarint(hist.slots[slot], out);
+      next = slot + 1;
+    }
+  }
+}
+
+absl::Status ParseHistogram(std::string_view in, Histogram* hist, u64* slots,
+                            int slot_capacity) {
+  if (in.empty() || static_cast<uint8_t>(in[0]) != kSerializedVersion) {
+    return absl::InvalidArgumentError("Unknown histogram encoding");
+  }
+  in.remove_prefix(1);
+  uint64_t lat_min_us, lat_shift, max_slots, nonzero;
+  if (!GetVarint(&in, &lat_min_us) || !GetVarint(&in, &lat_shift) ||
+      !GetVarint(&in, &max_slots) || !GetVarint(&in, &hist->total_count) ||
+      !GetVarint(&in, &hist->total_sum) ||
+      !GetVarint(&in, &hist->total_sum_sq) ||
+      !GetVarint(&in, &hist->overflow_count) || !GetVarint(&in, &hist->min) ||
+      !GetVarint(&in, &hist->max) || !GetVarint(&in, &nonzero)) {
+    return absl::InvalidArgumentError("Truncated histogram header");
+  }
+  if (max_slots + 1 > static_cast<uint64_t>(slot_capacity) ||
+      lat_min_us > INT32_MAX || lat_shift >= 64) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Bad histogram layout: lat_min_us=", lat_min_us,
+                     " lat_shift=", lat_shift, " max_slots=", max_slots));
+  }
+  hist->lat_min_us = lat_min_us;
+  hist->lat_shift = lat_shift;
+  hist->max_slots = max_slots;
+  std::fill(slots, slots + max_slots + 1, 0);
+  uint64_t next = 0;
+  for (uint64_t i = 0; i < nonzero; ++i) {
+    uint64_t gap, count;
+    if (!GetVarint(&in, &gap) || !GetVarint(&in, &count)) {
+      return absl::InvalidArgumentError("Truncated histogram slots");
+    }
+    if (gap > max_slots || next + gap > max_slots) {
+      return absl::InvalidArgumentError("Histogram slot out of range");
+    }
+    next += gap;
+    slots[next++] = count;
+  }
+  if (!in.empty()) {
+    return absl::InvalidArgumentError("Trailing bytes after the histogram");
+  }
+  hist->slots = slots;
+  return absl::OkStatus();
+}
+
+absl::StatusOr<LatencyRange> TuneLatencyRange(const Histogram& calibration,
+                                              int max_slots, double low_q,
+                                              double high_q) {
+  if (max_slots <= 0 || max_slots >= 64 || low_q < 0 || high_q > 1 ||
+      low_q >= high_q) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Bad tuning parameters: max_slots=", max_slots,
+                     " low_q=", low_q, " high_q=", high_q));
+  }
+  uint64_t count = calibration.overflow_count;
+  for (int slot = 0; slot <= calibration.max_slots; ++slot) {
+    count += calibration.slots[slot];
+  }
+  if (count == 0) {
+    return absl::FailedPreconditionError("The calibration histogram is empty");
+  }
+
+  // Same walk as percentile() but keeps the lower bound of the bucket.
+  uint64_t rank = std::max<uint64_t>(1, std::ceil(low_q * count));
+  uint64_t accumulated = calibration.slots[calibration.max_slots];
+  uint64_t low = 0;
+  int slot = 0;
+  for (; slot < calibration.max_slots && accumulated < rank; ++slot) {
+    accumulated += calibration.slots[slot];
+    low = calibration.bucket_low(slot);
+  }
+  if (accumulated < rank) {
+    low = calibration.bucket_high(calibration.max_slots - 1);
+  }
+  uint64_t high = std::max(calibration.percentile(high_q), low + 1);
+
+  LatencyRange range;
+  range.lat_min_us = std::min<uint64_t>(low, INT32_MAX);
+  // The last bucket ends at lat_min_us + 2^(max_slots - 1 + lat_shift).
+  int range_bits = std::bit_width(high - range.lat_min_us - 1);
+  range.lat_shift = std::clamp(range_bits - (max_slots - 1), 0, 63 - max_slots);
+  return range;
+}
+
 absl::Status PrintHistogram(const Histogram& hist) {
   int first_nonzero_slot = 0;
   while (first_nonzero_slot < hist.max_slots &&
          hist.slots[first_nonzero_slot] == 0) {
     ++first_nonzero_slot;
   }
-  if (first_nonzero_slot == hist.max_slots) {
+  if (first_nonzero_slot == hist.max_slots && hist.overflow_count == 0) {
     std::cout << "  (all zero slots)" << std::endl;
     return absl::OkStatus();
   }
@@ -20,7 +192,8 @@ absl::Status PrintHistogram(const Histogram& hist) {
     --last_nonzero_slot;
   }
 
-  uint64_t computed_total_count = hist.slots[hist.max_slots];
+  uint64_t computed_total_count = hist.slots[hist.max_slots] +
+                                  hist.overflow_count;
 
   for (int slot = first_nonzero_slot; slot <= last_nonzero_slot; ++slot) {
     computed_total_count += hist.slots[slot];
@@ -54,6 +227,16 @@ absl::Status PrintHistogram(const Histogram& hist) {
          absl::StrCat(100.0 * accumulated_total_count / computed_total_count)});
   }
 
+  if (hist.overflow_count != 0) {
+    accumulated_total_count += hist.overflow_count;
+    rows.push_back(
+        {absl::StrCat("  [", hist.bucket_high(hist.max_slots - 1), "us - ",
+                      hist.max != 0 ? absl::StrCat(hist.max, "us]:")
+                                    : std::string("inf):")),
+         absl::StrCat(hist.overflow_count),
+         absl::StrCat(100.0 * accumulated_total_count / computed_total_count)});
+  }
+
   using TColWidth = decltype(rows[0][0].size());
   std::vector<TColWidth> max_col_width;
   for (const auto& row : rows) {
@@ -72,9 +255,17 @@ absl::Status PrintHistogram(const Histogram& hist) {
     }
     std::cout << std::endl;
   }
-  std::cout << "  Total count: " << hist.total_count
-            << " avg=" << static_cast<double>(hist.total_sum) / hist.total_count
-            << std::endl;
+  std::cout << "  Total count: " << hist.total_count << " avg=" << hist.mean();
+  if (hist.total_sum_sq != 0) {
+    std::cout << " stddev=" << hist.stddev();
+  }
+  if (hist.max != 0) {
+    std::cout << " min=" << hist.min << " max=" << hist.max;
+  }
+  if (hist.overflow_count != 0) {
+    std::cout << " overflow=" << hist.overflow_count;
+  }
+  std::cout << std::endl;
   return absl::OkStatus();
 }
 
@@ -1,10 +1,18 @@
 #ifndef HISTOGRAM_H_
 #define HISTOGRAM_H_
 
+#include <algorithm>
+#include <cmath>
 #include <cstdint>
+#include <string>
+#include <string_view>
 
 #include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/str_cat.h"
+#include "bucket_layout.h"
 #include "histogram.bpf.h"
+#include "histogram_kernels.h"
 #include "types.bpf.h"
 
 namespace nvme_bpf {
@@ -17,17 +25,269 @@ struct Histogram {
   const u64* slots = nullptr;
   uint64_t total_count = 0;
   uint64_t total_sum = 0;
+  uint64_t total_sum_sq = 0;
+  // The values above the last bucket, also in total_count.
+  uint64_t overflow_count = 0;
+  // The exact extremes, zero when they are not tracked.
+  uint64_t min = 0;
+  uint64_t max = 0;
 
-  auto bucket_low(int slot) const {
-    return bpf_bucket_low(slot, lat_min_us, lat_shift, max_slots);
+  // The bound tables of the BucketLayout set with SetLayout(), indexed by
+  // slot. Without them the bounds are computed like in the BPF programs.
+  const uint64_t* lows = nullptr;
+  const uint64_t* highs = nullptr;
+
+  // Takes the layout and the bound tables of `layout`, which must outlive
+  // this histogram and its copies.
+  template <int kMaxSlots>
+  void SetLayout(const BucketLayout<kMaxSlots>& layout) {
+    lat_min_us = layout.lat_min_us;
+    lat_shift = layout.lat_shift;
+    max_slots = kMaxSlots;
+    lows = layout.low.data();
+    highs = layout.high.data();
+  }
+
+  uint64_t bucket_low(int slot) const {
+    return lows != nullptr
+               ? lows[slot]
+               : bpf_bucket_low(slot, lat_min_us, lat_shift, max_slots);
   }
-  auto bucket_high(int slot) const {
-    return bpf_bucket_high(slot, lat_min_us, lat_shift, max_slots);
+  uint64_t bucket_high(int slot) const {
+    return highs != nullptr
+               ? highs[slot]
+               : bpf_bucket_high(slot, lat_min_us, lat_shift, max_slots);
   }
+
+  // Returns the upper bound of the bucket that holds the q quantile, q in
+  // [0, 1]. Returns 0 for an empty histogram. A quantile in the overflow is
+  // the max when it is tracked.
+  uint64_t percentile(double q) const;
+
+  double mean() const;
+  // Zero unless total_sum_sq is tracked.
+  double stddev() const;
 };
 
 absl::Status PrintHistogram(const Histogram& hist);
 
+// Returns an error unless `a` and `b` have the same bucket layout.
+absl::Status CheckSameLayout(const Histogram& a, const Histogram& b);
+
+// Appends the compact encoding of `hist`: the layout, the totals and the
+// extremes followed by the non-zero slots, all as varints.
+void SerializeHistogram(const Histogram& hist, std::string* out);
+
+// Decodes a SerializeHistogram() encoding into `hist`, with the slots written
+// to `slots`, which has room for `slot_capacity` entries.
+absl::Status ParseHistogram(std::string_view in, Histogram* hist, u64* slots,
+                            int slot_capacity);
+
+struct LatencyRange {
+  int lat_min_us = 0;
+  int lat_shift = 0;
+};
+
+// Picks the layout of a histogram with `max_slots` slots that spreads the
+// [low_q, high_q] quantiles of `calibration` over the most buckets: the
+// minimum is the lower bound of the bucket of the low_q quantile and the
+// shift is the smallest one that still ends the last bucket above the high_q
+// quantile. The bucket width of `calibration` bounds the accuracy, so it
+// should have a wide layout with fine low buckets, e.g. lat_min_us=0 and
+// lat_shift=0. Fails if it holds no values.
+absl::StatusOr<LatencyRange> TuneLatencyRange(const Histogram& calibration,
+                                              int max_slots,
+                                              double low_q = 0.01,
+                                              double high_q = 0.9999);
+
+// A histogram that owns its slots. The kMaxSlots regular slots and the "< min"
+// slot are stored inline, so copies and moves don't allocate. Combining
+// histograms with a different number of slots doesn't compile, lat_min_us and
+// lat_shift only known at run time are checked by Merge() and Subtract().
+template <int kMaxSlots>
+class OwnedHistogram {
+ public:
+  static_assert(kMaxSlots > 0 && kMaxSlots < 64);
+
+  OwnedHistogram() = default;
+  OwnedHistogram(int lat_min_us, int lat_shift)
+      : lat_min_us_(lat_min_us), lat_shift_(lat_shift) {}
+
+  // Copies a view, which must have kMaxSlots slots.
+  static absl::StatusOr<OwnedHistogram> FromView(const Histogram& view) {
+    if (view.max_slots != kMaxSlots) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Expected ", kMaxSlots, " slots, got ", view.max_slots));
+    }
+    OwnedHistogram hist(view.lat_min_us, view.lat_shift);
+    std::copy(view.slots, view.slots + kMaxSlots + 1, hist.slots_);
+    hist.CopyTotals(view);
+    return hist;
+  }
+
+  static absl::StatusOr<OwnedHistogram> Parse(std::string_view in) {
+    OwnedHistogram hist;
+    Histogram parsed;
+    absl::Status status =
+        ParseHistogram(in, &parsed, hist.slots_, kMaxSlots + 1);
+    if (!status.ok()) {
+      return status;
+    }
+    if (parsed.max_slots != kMaxSlots) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Expected ", kMaxSlots, " slots, got ", parsed.max_slots));
+    }
+    hist.lat_min_us_ = parsed.lat_min_us;
+    hist.lat_shift_ = parsed.lat_shift;
+    hist.CopyTotals(parsed);
+    return hist;
+  }
+
+  // The returned view points into this histogram.
+  Histogram view() const {
+    Histogram hist;
+    hist.lat_min_us = lat_min_us_;
+    hist.lat_shift = lat_shift_;
+    hist.max_slots = kMaxSlots;
+    hist.slots = slots_;
+    hist.total_count = total_count_;
+    hist.total_sum = total_sum_;
+    hist.total_sum_sq = total_sum_sq_;
+    hist.overflow_count = overflow_count_;
+    hist.min = min_;
+    hist.max = max_;
+    return hist;
+  }
+
+  // Records `count` values of `value_us`, same as the BPF programs.
+  void Record(uint64_t value_us, uint64_t count = 1) {
+    int slot =
+        BucketLayout<kMaxSlots>::SlotOf(value_us, lat_min_us_, lat_shift_);
+    if (slot >= 0) {
+      slots_[slot] += count;
+    } else {
+      overflow_count_ += count;
+    }
+    if (total_count_ == 0 || value_us < min_) {
+      min_ = value_us;
+    }
+    max_ = std::max(max_, value_us);
+    total_count_ += count;
+    total_sum_ += value_us * count;
+    total_sum_sq_ += value_us * value_us * count;
+  }
+
+  absl::Status Merge(const OwnedHistogram& other) {
+    absl::Status status = CheckSameLayout(view(), other.view());
+    if (!status.ok()) {
+      return status;
+    }
+    AddSlots(slots_, other.slots_, kMaxSlots + 1);
+    if (other.total_count_ != 0) {
+      min_ = total_count_ == 0 ? other.min_ : std::min(min_, other.min_);
+      max_ = std::max(max_, other.max_);
+    }
+    total_count_ += other.total_count_;
+    total_sum_ += other.total_sum_;
+    total_sum_sq_ += other.total_sum_sq_;
+    overflow_count_ += other.overflow_count_;
+    return absl::OkStatus();
+  }
+
+  // Removes the values of an earlier snapshot of the same counters, which
+  // leaves the values recorded since. Fails without changing this histogram
+  // if any counter of `earlier` is larger, e.g. after the counters were reset.
+  // The extremes can't be subtracted, min and max stay those of this one.
+  absl::Status Subtract(const OwnedHistogram& earlier) {
+    absl::Status status = CheckSameLayout(view(), earlier.view());
+    if (!status.ok()) {
+      return status;
+    }
+    bool went_back = earlier.total_count_ > total_count_ ||
+                     earlier.total_sum_ > total_sum_ ||
+                     earlier.total_sum_sq_ > total_sum_sq_ ||
+                     earlier.overflow_count_ > overflow_count_;
+    for (int slot = 0; slot <= kMaxSlots; ++slot) {
+      went_back |= earlier.slots_[slot] > slots_[slot];
+    }
+    if (went_back) {
+      return absl::FailedPreconditionError(
+          "The subtracted histogram has larger counts");
+    }
+    SubtractSlots(slots_, earlier.slots_, kMaxSlots + 1);
+    total_count_ -= earlier.total_count_;
+    total_sum_ -= earlier.total_sum_;
+    total_sum_sq_ -= earlier.total_sum_sq_;
+    overflow_count_ -= earlier.overflow_count_;
+    return absl::OkStatus();
+  }
+
+  // Multiplies the counts, e.g. to compensate for sampling. The total count
+  // is the sum of the rounded slots, so it stays consistent with them.
+  void Scale(double factor) {
+    uint64_t slot_count = 0;
+    uint64_t scaled_count = 0;
+    for (u64& slot : slots_) {
+      slot_count += slot;
+      slot = static_cast<u64>(std::llround(slot * factor));
+      scaled_count += slot;
+    }
+    // The values above the last bucket.
+    scaled_count += static_cast<uint64_t>(
+        std::llround((total_count_ - slot_count) * factor));
+    total_count_ = scaled_count;
+    total_sum_ = static_cast<uint64_t>(std::llround(total_sum_ * factor));
+    total_sum_sq_ =
+        static_cast<uint64_t>(std::llround(total_sum_sq_ * factor));
+    overflow_count_ =
+        static_cast<uint64_t>(std::llround(overflow_count_ * factor));
+  }
+
+  void Clear() { *this = OwnedHistogram(lat_min_us_, lat_shift_); }
+
+  uint64_t percentile(double q) const { return view().percentile(q); }
+
+  std::string Serialize() const {
+    std::string out;
+    SerializeHistogram(view(), &out);
+    return out;
+  }
+
+  bool operator==(const OwnedHistogram&) const = default;
+
+  int lat_min_us() const { return lat_min_us_; }
+  int lat_shift() const { return lat_shift_; }
+  static constexpr int max_slots() { return kMaxSlots; }
+  // Slot kMaxSlots holds the values below lat_min_us.
+  u64 slot(int slot) const { return slots_[slot]; }
+  uint64_t total_count() const { return total_count_; }
+  uint64_t total_sum() const { return total_sum_; }
+  uint64_t total_sum_sq() const { return total_sum_sq_; }
+  uint64_t overflow_count() const { return overflow_count_; }
+  uint64_t min() const { return min_; }
+  uint64_t max() const { return max_; }
+
+ private:
+  void CopyTotals(const Histogram& view) {
+    total_count_ = view.total_count;
+    total_sum_ = view.total_sum;
+    total_sum_sq_ = view.total_sum_sq;
+    overflow_count_ = view.overflow_count;
+    min_ = view.min;
+    max_ = view.max;
+  }
+
+  int lat_min_us_ = 0;
+  int lat_shift_ = 0;
+  u64 slots_[kMaxSlots + 1] = {};
+  uint64_t total_count_ = 0;
+  uint64_t total_sum_ = 0;
+  uint64_t total_sum_sq_ = 0;
+  uint64_t overflow_count_ = 0;
+  uint64_t min_ = 0;
+  uint64_t max_ = 0;
+};
+
 }  // namespace nvme_bpf
 
 #endif /* HISTOGRAM_H_ */
\ No newline at end of file
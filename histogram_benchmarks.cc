@@ -1,12 +1,25 @@
 #include <bitset>
+#include <cmath>
+#include <algorithm>
 #include <cstdint>
 #include <ostream>
 #include <random>
+#include <string_view>
+#include <vector>
 
 #include "absl/log/log.h"
 #include "absl/random/random.h"
 #include "benchmark/benchmark.h"
 #include "histogram.bpf.h"
+#include "histogram.h"
+#include "histogram_compare.h"
+#include "histogram_kernels.h"
+#include "latency_snapshot.h"
+#include "metrics_exporter.h"
+#include "nvme_abi.h"
+#include "nvme_latency_bpf_host.h"
+#include "nvme_strings.h"
+#include "nvme_view.h"
 #include "gtest/gtest.h"
 
 /*
@@ -98,4 +111,424 @@ void BM_HistogramBuiltinClzll(benchmark::State& state) {
 }
 BENCHMARK(BM_HistogramBuiltinClzll);
 
+// The clz variants of bits.bpf.h, the bucket mapping and the bucket bounds
+// over pre-generated values, so that the generator is not timed. The uniform
+// u64 values almost always have the top bit set, which flatters the branchy
+// variant, the latency values are what the probes see.
+//
+// BM_Clzll<bpf_clzll_branchy>/1           16.1 ns         15.9 ns
+// BM_Clzll<bpf_clzll_binsearch>/1         9.02 ns         8.87 ns
+// BM_Clzll<bpf_clzll_table>/1             5.57 ns         5.44 ns
+// BM_Clzll<bpf_clzll_debruijn>/1          4.10 ns         4.06 ns
+// BM_Clzll<BuiltinClzll>/1                1.81 ns         1.77 ns
+// BM_GetBucket<bpf_clzll_branchy>         16.2 ns         15.9 ns
+// BM_GetBucket<bpf_clzll_debruijn>        5.04 ns         4.97 ns
+// BM_BpfBucketLowHigh                     3.30 ns         3.17 ns
+enum Distribution {
+  kUniformU64 = 0,
+  // Microseconds: mostly ~80us reads, a slower mode around 1ms and a 1% tail
+  // up to 100ms.
+  kLatencyUs = 1,
+};
+
+const std::vector<uint64_t>& BenchValues(int distribution) {
+  static const auto* const values = [] {
+    constexpr int kCount = 1 << 16;
+    auto* values = new std::vector<uint64_t>[2];
+    std::mt19937_64 gen(42);
+    std::uniform_int_distribution<uint64_t> uniform;
+    std::lognormal_distribution<double> fast(std::log(80.0), 0.6);
+    std::lognormal_distribution<double> slow(std::log(1000.0), 0.8);
+    std::uniform_real_distribution<double> tail(0, 100000);
+    std::uniform_int_distribution<int> pick(0, 99);
+    for (int i = 0; i < kCount; ++i) {
+      values[kUniformU64].push_back(uniform(gen));
+      int p = pick(gen);
+      double us = p < 90 ? fast(gen) : p < 99 ? slow(gen) : tail(gen);
+      values[kLatencyUs].push_back(static_cast<uint64_t>(us));
+    }
+    return values;
+  }();
+  return values[distribution];
+}
+
+template <int (*Clz)(u64)>
+void BM_Clzll(benchmark::State& state) {
+  const std::vector<uint64_t>& values = BenchValues(state.range(0));
+  size_t i = 0;
+  uint64_t sum = 0;
+  for (auto s : state) {
+    sum += Clz(values[i++ & (values.size() - 1)]);
+  }
+  benchmark::DoNotOptimize(sum);
+}
+BENCHMARK(BM_Clzll<bpf_clzll_branchy>)->Arg(kUniformU64)->Arg(kLatencyUs);
+BENCHMARK(BM_Clzll<bpf_clzll_binsearch>)->Arg(kUniformU64)->Arg(kLatencyUs);
+BENCHMARK(BM_Clzll<bpf_clzll_table>)->Arg(kUniformU64)->Arg(kLatencyUs);
+BENCHMARK(BM_Clzll<bpf_clzll_debruijn>)->Arg(kUniformU64)->Arg(kLatencyUs);
+
+int BuiltinClzll(u64 x) { return x == 0 ? 64 : __builtin_clzll(x); }
+BENCHMARK(BM_Clzll<BuiltinClzll>)->Arg(kUniformU64)->Arg(kLatencyUs);
+
+// bpf_get_bucket with the clz variant under test.
+template <int (*Clz)(u64)>
+int GetBucket(u64 v, u64 min, int shift, int max_slots) {
+  if (v < min) {
+    return max_slots;
+  }
+  v -= min;
+  v >>= shift;
+  if (v == 0) {
+    return 0;
+  }
+  int s = 64 - Clz(v);
+  if (s >= max_slots) {
+    return -1;
+  }
+  return s;
+}
+
+// The whole per-IO bucket mapping with the default 20us minimum.
+template <int (*Clz)(u64)>
+void BM_GetBucket(benchmark::State& state) {
+  const std::vector<uint64_t>& values = BenchValues(kLatencyUs);
+  size_t i = 0;
+  int64_t sum = 0;
+  for (auto s : state) {
+    sum += GetBucket<Clz>(values[i++ & (values.size() - 1)], 20, 0,
+                          LATENCY_MAX_SLOTS);
+  }
+  benchmark::DoNotOptimize(sum);
+}
+BENCHMARK(BM_GetBucket<bpf_clzll_branchy>);
+BENCHMARK(BM_GetBucket<bpf_clzll_binsearch>);
+BENCHMARK(BM_GetBucket<bpf_clzll_table>);
+BENCHMARK(BM_GetBucket<bpf_clzll_debruijn>);
+BENCHMARK(BM_GetBucket<BuiltinClzll>);
+
+// The real bpf_get_bucket, with the variant bpf_clzll picked.
+void BM_BpfGetBucket(benchmark::State& state) {
+  const std::vector<uint64_t>& values = BenchValues(kLatencyUs);
+  size_t i = 0;
+  int64_t sum = 0;
+  for (auto s : state) {
+    sum += bpf_get_bucket(values[i++ & (values.size() - 1)], 20, 0,
+                          LATENCY_MAX_SLOTS);
+  }
+  benchmark::DoNotOptimize(sum);
+}
+BENCHMARK(BM_BpfGetBucket);
+
+// The bucket bounds of the slots of the latency values, as the reporting side
+// computes them.
+void BM_BpfBucketLowHigh(benchmark::State& state) {
+  const std::vector<uint64_t>& values = BenchValues(kLatencyUs);
+  std::vector<int> slots;
+  for (uint64_t v : values) {
+    int slot = bpf_get_bucket(v, 20, 0, LATENCY_MAX_SLOTS);
+    slots.push_back(slot < 0 ? LATENCY_MAX_SLOTS - 1 : slot);
+  }
+  size_t i = 0;
+  uint64_t sum = 0;
+  for (auto s : state) {
+    int slot = slots[i++ & (slots.size() - 1)];
+    sum += bpf_bucket_low(slot, 20, 0, LATENCY_MAX_SLOTS);
+    sum += bpf_bucket_high(slot, 20, 0, LATENCY_MAX_SLOTS);
+  }
+  benchmark::DoNotOptimize(sum);
+}
+BENCHMARK(BM_BpfBucketLowHigh);
+
+// The constexpr generated tables of bucket_layout.h, the slot with lzcnt and
+// the bounds with a table lookup.
+//
+// BM_BpfGetBucket                         4.09 ns         4.06 ns
+// BM_BpfBucketLowHigh                     2.77 ns         2.74 ns
+// BM_BucketLayoutSlot                     2.18 ns         2.17 ns
+// BM_BucketLayoutLowHigh                 0.946 ns        0.934 ns
+void BM_BucketLayoutSlot(benchmark::State& state) {
+  const std::vector<uint64_t>& values = BenchValues(kLatencyUs);
+  const auto layout = nvme_bpf::LatencyBucketLayout::Make(20, 0);
+  size_t i = 0;
+  int64_t sum = 0;
+  for (auto s : state) {
+    sum += layout.Slot(values[i++ & (values.size() - 1)]);
+  }
+  benchmark::DoNotOptimize(sum);
+}
+BENCHMARK(BM_BucketLayoutSlot);
+
+void BM_BucketLayoutLowHigh(benchmark::State& state) {
+  const std::vector<uint64_t>& values = BenchValues(kLatencyUs);
+  const auto layout = nvme_bpf::LatencyBucketLayout::Make(20, 0);
+  std::vector<int> slots;
+  for (uint64_t v : values) {
+    int slot = layout.Slot(v);
+    slots.push_back(slot < 0 ? LATENCY_MAX_SLOTS - 1 : slot);
+  }
+  size_t i = 0;
+  uint64_t sum = 0;
+  for (auto s : state) {
+    int slot = slots[i++ & (slots.size() - 1)];
+    sum += layout.low[slot];
+    sum += layout.high[slot];
+  }
+  benchmark::DoNotOptimize(sum);
+}
+BENCHMARK(BM_BucketLayoutLowHigh);
+
+// Renders state.range(0) histograms in the Prometheus format into a reused
+// buffer, the per-interval cost of the exporter.
+void BM_AppendPrometheusHistograms(benchmark::State& state) {
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<uint64_t> d(0, 1000000);
+
+  nvme_bpf::Snapshot snapshot;
+  snapshot.lat_min_us = 20;
+  snapshot.lat_shift = 0;
+  snapshot.max_slots = LATENCY_MAX_SLOTS;
+  for (int i = 0; i < state.range(0); ++i) {
+    nvme_bpf::SnapshotHist hist = {};
+    hist.ctrl_id = i / 16;
+    hist.opcode = 1 + i % 2;
+    hist.size_class = (i / 2) % 3;
+    for (auto& slot : hist.slots) {
+      slot = d(gen);
+      hist.total_count += slot;
+    }
+    hist.total_sum = hist.total_count * 100;
+    snapshot.hists.push_back(hist);
+  }
+
+  std::string out;
+  for (auto s : state) {
+    out.clear();
+    nvme_bpf::AppendPrometheusHistograms(snapshot, &out);
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetBytesProcessed(state.iterations() * out.size());
+}
+BENCHMARK(BM_AppendPrometheusHistograms)->Arg(100)->Arg(500);
+
+// Sums the per-CPU copies of 100 `latency_hist` values, the slots and the
+// totals, with the kernels of state.range(0) in SupportedSlotKernels(), with
+// state.range(1) CPUs. This is the per-interval aggregation cost once the
+// histograms are per-CPU. The 256 CPU case doesn't fit in L2 and is memory
+// bound, so AVX2 and AVX-512 end up close:
+//
+// BM_SumPerCpuHists/0/256        945 us          932 us   scalar
+// BM_SumPerCpuHists/1/256        377 us          374 us   avx2
+// BM_SumPerCpuHists/2/256        387 us          384 us   avx512
+void BM_SumPerCpuHists(benchmark::State& state) {
+  auto kernels = nvme_bpf::SupportedSlotKernels();
+  if (state.range(0) >= static_cast<int64_t>(kernels.size())) {
+    state.SkipWithError("Not supported by the CPU");
+    return;
+  }
+  const nvme_bpf::SlotKernels& k = *kernels[state.range(0)];
+  state.SetLabel(k.name);
+
+  constexpr int kKeys = 100;
+  constexpr size_t kValueSlots = LATENCY_MAX_SLOTS + 3;
+  const int cpus = state.range(1);
+  std::mt19937_64 gen(42);
+  std::vector<u64> per_cpu(kKeys * cpus * kValueSlots);
+  for (u64& v : per_cpu) {
+    v = gen() % 1000;
+  }
+  std::vector<u64> sums(kKeys * kValueSlots);
+
+  for (auto s : state) {
+    std::fill(sums.begin(), sums.end(), 0);
+    for (int key = 0; key < kKeys; ++key) {
+      u64* sum = &sums[key * kValueSlots];
+      const u64* values = &per_cpu[key * cpus * kValueSlots];
+      for (int cpu = 0; cpu < cpus; ++cpu) {
+        k.add(sum, values + cpu * kValueSlots, kValueSlots);
+      }
+    }
+    benchmark::DoNotOptimize(sums.data());
+  }
+  state.SetBytesProcessed(state.iterations() * per_cpu.size() * sizeof(u64));
+}
+BENCHMARK(BM_SumPerCpuHists)
+    ->ArgsProduct({{0, 1, 2}, {128, 256}})
+    ->Unit(benchmark::kMicrosecond);
+
+// The cumulative bucket counts of one histogram. The vector scans lose here:
+//
+// BM_PrefixSumSlots/0           20.1 ns         19.6 ns   scalar
+// BM_PrefixSumSlots/1           29.1 ns         28.7 ns   avx2
+// BM_PrefixSumSlots/2           26.3 ns         25.8 ns   avx512
+void BM_PrefixSumSlots(benchmark::State& state) {
+  auto kernels = nvme_bpf::SupportedSlotKernels();
+  if (state.range(0) >= static_cast<int64_t>(kernels.size())) {
+    state.SkipWithError("Not supported by the CPU");
+    return;
+  }
+  const nvme_bpf::SlotKernels& k = *kernels[state.range(0)];
+  state.SetLabel(k.name);
+
+  std::mt19937_64 gen(42);
+  u64 slots[LATENCY_MAX_SLOTS + 1];
+  for (u64& slot : slots) {
+    slot = gen() % 1000;
+  }
+  for (auto s : state) {
+    u64 cumulative[LATENCY_MAX_SLOTS + 1];
+    std::copy(std::begin(slots), std::end(slots), cumulative);
+    k.prefix_sum(cumulative, LATENCY_MAX_SLOTS + 1);
+    benchmark::DoNotOptimize(cumulative);
+  }
+}
+BENCHMARK(BM_PrefixSumSlots)->DenseRange(0, 2);
+
+// Compares 2000 before/after pairs of the default layout, the latency_compare
+// cost of a fleet sized history range once it is merged:
+//
+// BM_CompareHistograms       1602349 ns      1582047 ns
+void BM_CompareHistograms(benchmark::State& state) {
+  constexpr int kPairs = 2000;
+  std::mt19937_64 gen(42);
+  std::vector<nvme_bpf::OwnedHistogram<LATENCY_MAX_SLOTS>> hists;
+  for (int i = 0; i < 2 * kPairs; ++i) {
+    auto& hist = hists.emplace_back(LATENCY_DEFAULT_MIN_US,
+                                    LATENCY_DEFAULT_SHIFT);
+    for (int j = 0; j < 1000; ++j) {
+      hist.Record(50 + gen() % 1000 * (i % 2 + 1));
+    }
+  }
+  nvme_bpf::CompareOptions options;
+  for (auto s : state) {
+    int regressed = 0;
+    for (int i = 0; i < 2 * kPairs; i += 2) {
+      auto result = nvme_bpf::CompareHistograms(hists[i].view(),
+                                                hists[i + 1].view(), options);
+      regressed += result->regressed;
+    }
+    benchmark::DoNotOptimize(regressed);
+  }
+}
+BENCHMARK(BM_CompareHistograms);
+
+// The opcode names of a trace-like stream, mostly reads and writes with a
+// sprinkle of the rest and of unknown opcodes. The switch the name table
+// replaced took 9.73 ns per opcode, mispredicting on the rare ones.
+//
+// BM_NvmeOpcodeToString           2.56 ns         2.52 ns
+// BM_NvmeOpcodeFromString         61.9 ns         61.3 ns
+std::vector<nvme_abi::NvmeOpcode> BenchOpcodes() {
+  std::mt19937_64 gen(42);
+  std::vector<nvme_abi::NvmeOpcode> opcodes(1 << 12);
+  for (auto& opcode : opcodes) {
+    uint64_t r = gen() % 100;
+    opcode = static_cast<nvme_abi::NvmeOpcode>(r < 90 ? 1 + r % 2 : r);
+  }
+  return opcodes;
+}
+
+void BM_NvmeOpcodeToString(benchmark::State& state) {
+  const std::vector<nvme_abi::NvmeOpcode> opcodes = BenchOpcodes();
+  size_t i = 0;
+  size_t sum = 0;
+  for (auto s : state) {
+    sum += nvme_abi::NvmeIoOpcodeToString(opcodes[i++ & (opcodes.size() - 1)])
+               .size();
+  }
+  benchmark::DoNotOptimize(sum);
+}
+BENCHMARK(BM_NvmeOpcodeToString);
+
+void BM_NvmeOpcodeFromString(benchmark::State& state) {
+  std::vector<std::string_view> names;
+  for (nvme_abi::NvmeOpcode opcode : BenchOpcodes()) {
+    names.push_back(nvme_abi::NvmeIoOpcodeToString(opcode));
+  }
+  size_t i = 0;
+  int found = 0;
+  for (auto s : state) {
+    found += nvme_abi::NvmeIoOpcodeFromString(names[i++ & (names.size() - 1)])
+                 .has_value();
+  }
+  benchmark::DoNotOptimize(found);
+}
+BENCHMARK(BM_NvmeOpcodeFromString);
+
+// Decodes a capture of 4096 submission queue entries with the opcode mix of
+// BenchOpcodes(), about 7 ns per entry:
+//
+// BM_VisitSqes      30815 ns        30118 ns   items_per_second=136M/s
+class BlockCounter : public nvme_abi::CommandVisitor {
+ public:
+  void Read(const nvme_abi::CommandView& command,
+            const nvme_abi::ReadWriteCommand& rw) override {
+    blocks += rw.number_of_blocks;
+  }
+  void Write(const nvme_abi::CommandView& command,
+             const nvme_abi::ReadWriteCommand& rw) override {
+    blocks += rw.number_of_blocks;
+  }
+
+  uint64_t blocks = 0;
+};
+
+void BM_VisitSqes(benchmark::State& state) {
+  std::mt19937_64 gen(42);
+  std::vector<nvme_abi::SubmissionQueueEntry> sqes;
+  for (nvme_abi::NvmeOpcode opcode : BenchOpcodes()) {
+    nvme_abi::SubmissionQueueEntry& sqe = sqes.emplace_back();
+    sqe.cdw0.opcode = opcode;
+    sqe.cdw10 = gen();
+    sqe.cdw12 = gen() % 256;
+  }
+  BlockCounter counter;
+  for (auto s : state) {
+    nvme_abi::VisitSqes(/*admin=*/false, sqes.data(), sqes.size(), &counter);
+  }
+  benchmark::DoNotOptimize(counter.blocks);
+  state.SetItemsProcessed(state.iterations() * sqes.size());
+}
+BENCHMARK(BM_VisitSqes);
+
+// The nvme_latency.bpf.c tracepoint handlers built for the host, see
+// bpf_host.h. An item is a setup and a completion, 64 commands in flight.
+// Arg 1 also tracks the cgroups, the stuck IOs and the load. The map helpers
+// of the host build cost more than the kernel ones, use for the comparisons
+// of the probe logic, not as the absolute per IO overhead:
+//
+// BM_NvmeLatencyBpfIo/0    24127 ns     22460 ns   items_per_second=2.85M/s
+// BM_NvmeLatencyBpfIo/1    34502 ns     34103 ns   items_per_second=1.88M/s
+void BM_NvmeLatencyBpfIo(benchmark::State& state) {
+  constexpr int kInFlight = 64;
+  nvme_bpf::BpfHost host;
+  nvme_latency_bpf::Load(&host);
+  if (state.range(0) == 1) {
+    nvme_latency_bpf::track_cgroups = 1;
+    nvme_latency_bpf::track_stuck_ios = 1;
+    nvme_latency_bpf::shed_in_flight_cmds = 1 << 20;
+  }
+  host.set_task({.tgid = 1, .pid = 1, .cgroup_id = 1, .comm = "bench"});
+  std::mt19937_64 gen(42);
+  std::vector<trace_event_raw_nvme_setup_cmd> setups(kInFlight);
+  std::vector<trace_event_raw_nvme_complete_rq> completes(kInFlight);
+  for (int i = 0; i < kInFlight; ++i) {
+    setups[i].ctrl_id = completes[i].ctrl_id = i % 2;
+    setups[i].qid = completes[i].qid = 1 + i % 8;
+    setups[i].cid = completes[i].cid = i;
+    setups[i].opcode = i % 4 == 0 ? 0x01 : 0x02;
+    setups[i].cdw10[8] = gen() % 256;
+  }
+  for (auto s : state) {
+    for (auto& setup : setups) {
+      nvme_latency_bpf::handle_nvme_setup_cmd(&setup);
+    }
+    for (auto& complete : completes) {
+      host.advance_ktime_ns(gen() % 1'000'000);
+      nvme_latency_bpf::handle_nvme_complete_rq(&complete);
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * kInFlight);
+}
+BENCHMARK(BM_NvmeLatencyBpfIo)->Arg(0)->Arg(1);
+
 }  // namespace mogo
@@ -0,0 +1,108 @@
+#include "histogram_compare.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "histogram_kernels.h"
+
+namespace nvme_bpf {
+namespace {
+
+// The counts of `hist` in value order: the "< min" slot, the regular slots
+// and the overflow, as a running total.
+std::vector<u64> Cumulative(const Histogram& hist) {
+  std::vector<u64> cdf(hist.max_slots + 2);
+  cdf[0] = hist.slots[hist.max_slots];
+  std::copy(hist.slots, hist.slots + hist.max_slots, cdf.begin() + 1);
+  cdf[hist.max_slots + 1] = hist.overflow_count;
+  PrefixSumSlots(cdf.data(), cdf.size());
+  return cdf;
+}
+
+// Same as Histogram::percentile() on the running total.
+uint64_t Quantile(const Histogram& hist, const std::vector<u64>& cdf,
+                  double q) {
+  uint64_t count = cdf.back();
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = std::max<uint64_t>(1, std::ceil(q * count));
+  int i = std::lower_bound(cdf.begin(), cdf.end(), rank) - cdf.begin();
+  if (i == 0) {
+    return hist.bucket_high(hist.max_slots);
+  }
+  if (i <= hist.max_slots) {
+    return hist.bucket_high(i - 1);
+  }
+  return std::max<uint64_t>(hist.bucket_high(hist.max_slots - 1), hist.max);
+}
+
+}  // namespace
+
+absl::StatusOr<HistogramComparison> CompareHistograms(
+    const Histogram& before, const Histogram& after,
+    const CompareOptions& options) {
+  absl::Status status = CheckSameLayout(before, after);
+  if (!status.ok()) {
+    return status;
+  }
+  std::vector<u64> before_cdf = Cumulative(before);
+  std::vector<u64> after_cdf = Cumulative(after);
+  HistogramComparison result;
+  result.before_count = before_cdf.back();
+  result.after_count = after_cdf.back();
+  if (result.before_count == 0 || result.after_count == 0) {
+    return result;
+  }
+  bool enough = result.before_count >= options.min_count &&
+                result.after_count >= options.min_count;
+
+  for (double q : options.quantiles) {
+    QuantileDelta& delta = result.quantiles.emplace_back();
+    delta.q = q;
+    delta.before_us = Quantile(before, before_cdf, q);
+    delta.after_us = Quantile(after, after_cdf, q);
+    delta.regressed =
+        enough &&
+        delta.after_us > delta.before_us * (1 + options.max_quantile_increase);
+    result.regressed |= delta.regressed;
+  }
+
+  const double before_scale = 1.0 / result.before_count;
+  const double after_scale = 1.0 / result.after_count;
+  u64 before_prev = 0;
+  u64 after_prev = 0;
+  for (size_t i = 0; i < before_cdf.size(); ++i) {
+    double slower = before_cdf[i] * before_scale - after_cdf[i] * after_scale;
+    result.ks_distance = std::max(result.ks_distance, std::abs(slower));
+    result.slower_fraction = std::max(result.slower_fraction, slower);
+
+    double before_fraction = (before_cdf[i] - before_prev) * before_scale;
+    double after_fraction = (after_cdf[i] - after_prev) * after_scale;
+    before_prev = before_cdf[i];
+    after_prev = after_cdf[i];
+    if (std::abs(after_fraction - before_fraction) <=
+        options.min_bucket_shift) {
+      continue;
+    }
+    BucketShift& shift = result.moved_buckets.emplace_back();
+    // Index 0 is the "< min" slot and the last one the overflow.
+    int slot = i == 0 ? before.max_slots : i - 1;
+    shift.low_us = i <= static_cast<size_t>(before.max_slots)
+                       ? before.bucket_low(slot)
+                       : before.bucket_high(before.max_slots - 1);
+    shift.high_us = i <= static_cast<size_t>(before.max_slots)
+                        ? before.bucket_high(slot)
+                        : UINT64_MAX;
+    shift.before_fraction = before_fraction;
+    shift.after_fraction = after_fraction;
+  }
+  result.regressed |=
+      enough && result.slower_fraction > options.max_slower_fraction;
+  return result;
+}
+
+}  // namespace nvme_bpf
@@ -0,0 +1,70 @@
+#ifndef HISTOGRAM_COMPARE_H_
+#define HISTOGRAM_COMPARE_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "histogram.h"
+
+namespace nvme_bpf {
+
+// Before/after comparison of two latency histograms with the same layout,
+// e.g. the same controller and opcode before and after a firmware update.
+
+struct CompareOptions {
+  // In [0, 1].
+  std::vector<double> quantiles = {0.5, 0.9, 0.99, 0.999};
+  // A quantile regressed if it grew by more than this fraction. The quantiles
+  // are bucket bounds, so any move to a higher bucket is at least ~2x.
+  double max_quantile_increase = 0.5;
+  // The histograms regressed if the after CDF is below the before CDF by more
+  // than this at any bucket bound, i.e. this fraction of the IOs got slower.
+  double max_slower_fraction = 0.05;
+  // The buckets whose share of the IOs changed by more than this are
+  // reported.
+  double min_bucket_shift = 0.01;
+  // Histograms with fewer IOs on either side are reported but never regress.
+  uint64_t min_count = 100;
+};
+
+struct QuantileDelta {
+  double q = 0;
+  uint64_t before_us = 0;
+  uint64_t after_us = 0;
+  bool regressed = false;
+};
+
+struct BucketShift {
+  // The bucket bounds in us, the overflow bucket has high_us == UINT64_MAX.
+  uint64_t low_us = 0;
+  uint64_t high_us = 0;
+  // The share of the IOs in the bucket.
+  double before_fraction = 0;
+  double after_fraction = 0;
+};
+
+struct HistogramComparison {
+  uint64_t before_count = 0;
+  uint64_t after_count = 0;
+  std::vector<QuantileDelta> quantiles;
+  // The Kolmogorov-Smirnov distance over the bucket bounds: the largest
+  // difference of the two CDFs, in [0, 1].
+  double ks_distance = 0;
+  // The one-sided version, the largest fraction of the IOs that moved above
+  // a bucket bound.
+  double slower_fraction = 0;
+  // In value order.
+  std::vector<BucketShift> moved_buckets;
+  bool regressed = false;
+};
+
+// Compares the distributions of `before` and `after`, in O(slots +
+// quantiles * log(slots)). Fails if the layouts differ.
+absl::StatusOr<HistogramComparison> CompareHistograms(
+    const Histogram& before, const Histogram& after,
+    const CompareOptions& options);
+
+}  // namespace nvme_bpf
+
+#endif /* HISTOGRAM_COMPARE_H_ */
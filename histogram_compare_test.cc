@@ -0,0 +1,102 @@
+#include "histogram_compare.h"
+
+#include <cstdint>
+#include <random>
+
+#include "gtest/gtest.h"
+#include "histogram.h"
+
+namespace {
+
+using Hist = nvme_bpf::OwnedHistogram<16>;
+using nvme_bpf::CompareHistograms;
+using nvme_bpf::CompareOptions;
+
+TEST(CompareHistograms, SameDistribution) {
+  std::mt19937_64 rng(1);
+  Hist hist(/*lat_min_us=*/10, /*lat_shift=*/0);
+  for (int i = 0; i < 10000; ++i) {
+    hist.Record(rng() % 200000);
+  }
+  CompareOptions options;
+  options.quantiles = {0, 0.1, 0.5, 0.9, 0.99, 0.9999, 1};
+  auto result = CompareHistograms(hist.view(), hist.view(), options);
+  ASSERT_TRUE(result.ok()) << result.status();
+  EXPECT_EQ(result->before_count, 10000);
+  EXPECT_EQ(result->ks_distance, 0);
+  EXPECT_TRUE(result->moved_buckets.empty());
+  EXPECT_FALSE(result->regressed);
+  ASSERT_EQ(result->quantiles.size(), options.quantiles.size());
+  for (const auto& delta : result->quantiles) {
+    EXPECT_EQ(delta.before_us, hist.percentile(delta.q)) << delta.q;
+    EXPECT_EQ(delta.after_us, delta.before_us);
+  }
+}
+
+TEST(CompareHistograms, SlowerTail) {
+  Hist before(0, 0);
+  before.Record(100, 1000);  // [64, 128)
+  Hist after(0, 0);
+  after.Record(100, 800);
+  after.Record(300, 200);  // [256, 512)
+
+  auto result = CompareHistograms(before.view(), after.view(), {});
+  ASSERT_TRUE(result.ok()) << result.status();
+  EXPECT_DOUBLE_EQ(result->ks_distance, 0.2);
+  EXPECT_DOUBLE_EQ(result->slower_fraction, 0.2);
+  EXPECT_TRUE(result->regressed);
+  ASSERT_EQ(result->moved_buckets.size(), 2);
+  EXPECT_EQ(result->moved_buckets[0].low_us, 64);
+  EXPECT_DOUBLE_EQ(result->moved_buckets[0].before_fraction, 1);
+  EXPECT_DOUBLE_EQ(result->moved_buckets[0].after_fraction, 0.8);
+  EXPECT_EQ(result->moved_buckets[1].high_us, 512);
+  // p50 stays, p90 moves.
+  EXPECT_FALSE(result->quantiles[0].regressed);
+  EXPECT_EQ(result->quantiles[1].before_us, 128);
+  EXPECT_EQ(result->quantiles[1].after_us, 512);
+  EXPECT_TRUE(result->quantiles[1].regressed);
+
+  // Faster is not a regression, but still a distance.
+  result = CompareHistograms(after.view(), before.view(), {});
+  ASSERT_TRUE(result.ok()) << result.status();
+  EXPECT_DOUBLE_EQ(result->ks_distance, 0.2);
+  EXPECT_EQ(result->slower_fraction, 0);
+  EXPECT_FALSE(result->regressed);
+}
+
+TEST(CompareHistograms, Overflow) {
+  Hist before(0, 0);
+  before.Record(100, 1000);
+  Hist after = before;
+  after.Record(1 << 20, 100);
+  auto result = CompareHistograms(before.view(), after.view(), {});
+  ASSERT_TRUE(result.ok()) << result.status();
+  ASSERT_EQ(result->moved_buckets.size(), 2);
+  EXPECT_EQ(result->moved_buckets[1].low_us, 1 << 15);
+  EXPECT_EQ(result->moved_buckets[1].high_us, UINT64_MAX);
+  EXPECT_EQ(result->quantiles.back().after_us, 1 << 20);
+  EXPECT_TRUE(result->regressed);
+}
+
+TEST(CompareHistograms, SmallCountsDontRegress) {
+  Hist before(0, 0);
+  before.Record(100, 10);
+  Hist after(0, 0);
+  after.Record(1000, 10);
+  auto result = CompareHistograms(before.view(), after.view(), {});
+  ASSERT_TRUE(result.ok()) << result.status();
+  EXPECT_DOUBLE_EQ(result->slower_fraction, 1);
+  EXPECT_FALSE(result->regressed);
+
+  result = CompareHistograms(before.view(), Hist(0, 0).view(), {});
+  ASSERT_TRUE(result.ok()) << result.status();
+  EXPECT_TRUE(result->quantiles.empty());
+  EXPECT_FALSE(result->regressed);
+}
+
+TEST(CompareHistograms, LayoutMismatch) {
+  EXPECT_FALSE(
+      CompareHistograms(Hist(0, 0).view(), Hist(20, 0).view(), {}).ok());
+}
+
+}  // namespace
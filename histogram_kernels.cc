@@ -0,0 +1,189 @@
+#include "histogram_kernels.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace nvme_bpf {
+namespace {
+
+// The baseline, the compiler may still vectorize these for the baseline ISA.
+void ScalarAdd(u64* dst, const u64* src, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] += src[i];
+  }
+}
+
+void ScalarSubtract(u64* dst, const u64* src, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    dst[i] -= src[i];
+  }
+}
+
+void ScalarPrefixSum(u64* slots, size_t n) {
+  for (size_t i = 1; i < n; ++i) {
+    slots[i] += slots[i - 1];
+  }
+}
+
+constexpr SlotKernels kScalarKernels = {"scalar", ScalarAdd, ScalarSubtract,
+                                        ScalarPrefixSum};
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) void Avx2Add(u64* dst, const u64* src,
+                                             size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+    __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_add_epi64(d, s));
+  }
+  for (; i < n; ++i) {
+    dst[i] += src[i];
+  }
+}
+
+__attribute__((target("avx2"))) void Avx2Subtract(u64* dst, const u64* src,
+                                                  size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+    __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_sub_epi64(d, s));
+  }
+  for (; i < n; ++i) {
+    dst[i] -= src[i];
+  }
+}
+
+// Log-step scan within the 4 lanes, then the running total of the previous
+// vectors is broadcast from the last lane.
+__attribute__((target("avx2"))) void Avx2PrefixSum(u64* slots, size_t n) {
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i carry = zero;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(slots + i));
+    // [a, b, c, d] + [0, a, b, c]
+    __m256i t = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(2, 1, 0, 0));
+    x = _mm256_add_epi64(x, _mm256_blend_epi32(t, zero, 0x03));
+    // + [0, 0, a, a + b]
+    x = _mm256_add_epi64(x, _mm256_permute2x128_si256(x, x, 0x08));
+    x = _mm256_add_epi64(x, carry);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(slots + i), x);
+    carry = _mm256_permute4x64_epi64(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  // Slot 0 is its own prefix sum.
+  for (i = std::max<size_t>(i, 1); i < n; ++i) {
+    slots[i] += slots[i - 1];
+  }
+}
+
+constexpr SlotKernels kAvx2Kernels = {"avx2", Avx2Add, Avx2Subtract,
+                                      Avx2PrefixSum};
+
+// The tail is handled with masked loads and stores.
+__attribute__((target("avx512f"))) void Avx512Add(u64* dst, const u64* src,
+                                                  size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i d = _mm512_loadu_si512(dst + i);
+    __m512i s = _mm512_loadu_si512(src + i);
+    _mm512_storeu_si512(dst + i, _mm512_add_epi64(d, s));
+  }
+  if (i < n) {
+    __mmask8 mask = (1u << (n - i)) - 1;
+    __m512i d = _mm512_maskz_loadu_epi64(mask, dst + i);
+    __m512i s = _mm512_maskz_loadu_epi64(mask, src + i);
+    _mm512_mask_storeu_epi64(dst + i, mask, _mm512_add_epi64(d, s));
+  }
+}
+
+__attribute__((target("avx512f"))) void Avx512Subtract(u64* dst,
+                                                       const u64* src,
+                                                       size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m512i d = _mm512_loadu_si512(dst + i);
+    __m512i s = _mm512_loadu_si512(src + i);
+    _mm512_storeu_si512(dst + i, _mm512_sub_epi64(d, s));
+  }
+  if (i < n) {
+    __mmask8 mask = (1u << (n - i)) - 1;
+    __m512i d = _mm512_maskz_loadu_epi64(mask, dst + i);
+    __m512i s = _mm512_maskz_loadu_epi64(mask, src + i);
+    _mm512_mask_storeu_epi64(dst + i, mask, _mm512_sub_epi64(d, s));
+  }
+}
+
+__attribute__((target("avx512f"))) void Avx512PrefixSum(u64* slots,
+                                                        size_t n) {
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i last_lane = _mm512_set1_epi64(7);
+  __m512i carry = zero;
+  for (size_t i = 0; i < n; i += 8) {
+    __mmask8 mask = n - i >= 8 ? 0xff : (1u << (n - i)) - 1;
+    __m512i x = _mm512_maskz_loadu_epi64(mask, slots + i);
+    // alignr(x, zero, 8 - k) shifts x up by k lanes, filling with zeros. The
+    // maskz forms avoid a GCC 12 -Wmaybe-uninitialized in the plain ones.
+    x = _mm512_add_epi64(x, _mm512_maskz_alignr_epi64(0xff, x, zero, 7));
+    x = _mm512_add_epi64(x, _mm512_maskz_alignr_epi64(0xff, x, zero, 6));
+    x = _mm512_add_epi64(x, _mm512_maskz_alignr_epi64(0xff, x, zero, 4));
+    x = _mm512_add_epi64(x, carry);
+    _mm512_mask_storeu_epi64(slots + i, mask, x);
+    carry = _mm512_maskz_permutexvar_epi64(0xff, last_lane, x);
+  }
+}
+
+constexpr SlotKernels kAvx512Kernels = {"avx512", Avx512Add, Avx512Subtract,
+                                        Avx512PrefixSum};
+
+#endif  // defined(__x86_64__)
+
+const SlotKernels* PickSlotKernels() {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return &kAvx512Kernels;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return &kAvx2Kernels;
+  }
+#endif
+  return &kScalarKernels;
+}
+
+}  // namespace
+
+const SlotKernels& BestSlotKernels() {
+  static const SlotKernels kernels = [] {
+    SlotKernels k = *PickSlotKernels();
+    // The scan is a dependency chain either way, at histogram sizes the
+    // shuffles of the vector versions make them slower than the scalar loop,
+    // see BM_PrefixSumSlots.
+    k.prefix_sum = ScalarPrefixSum;
+    return k;
+  }();
+  return kernels;
+}
+
+std::vector<const SlotKernels*> SupportedSlotKernels() {
+  std::vector<const SlotKernels*> kernels = {&kScalarKernels};
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back(&kAvx2Kernels);
+  }
+  if (__builtin_cpu_supports("avx512f")) {
+    kernels.push_back(&kAvx512Kernels);
+  }
+#endif
+  return kernels;
+}
+
+}  // namespace nvme_bpf
@@ -0,0 +1,45 @@
+#ifndef HISTOGRAM_KERNELS_H_
+#define HISTOGRAM_KERNELS_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "types.bpf.h"
+
+namespace nvme_bpf {
+
+// Element-wise kernels over u64 counter arrays, e.g. the slots of a
+// `latency_hist` summed across the CPUs and the keys every interval. The
+// implementation is picked at run time from the instruction sets supported by
+// the CPU.
+struct SlotKernels {
+  const char* name;
+  // dst[i] += src[i]
+  void (*add)(u64* dst, const u64* src, size_t n);
+  // dst[i] -= src[i]
+  void (*subtract)(u64* dst, const u64* src, size_t n);
+  // slots[i] += slots[i - 1], in place.
+  void (*prefix_sum)(u64* slots, size_t n);
+};
+
+// The kernels of the best instruction set supported by the CPU.
+const SlotKernels& BestSlotKernels();
+
+// All the kernels the CPU supports, the scalar ones first.
+std::vector<const SlotKernels*> SupportedSlotKernels();
+
+inline void AddSlots(u64* dst, const u64* src, size_t n) {
+  BestSlotKernels().add(dst, src, n);
+}
+
+inline void SubtractSlots(u64* dst, const u64* src, size_t n) {
+  BestSlotKernels().subtract(dst, src, n);
+}
+
+inline void PrefixSumSlots(u64* slots, size_t n) {
+  BestSlotKernels().prefix_sum(slots, n);
+}
+
+}  // namespace nvme_bpf
+
+#endif /* HISTOGRAM_KERNELS_H_ */
@@ -0,0 +1,75 @@
+#include "histogram_kernels.h"
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+/*
+bazel test --test_output=streamed :histogram_kernels_test
+ */
+
+namespace {
+
+using nvme_bpf::SlotKernels;
+
+std::vector<u64> RandomSlots(std::mt19937_64& gen, size_t n) {
+  std::vector<u64> v(n);
+  for (u64& x : v) {
+    x = gen();
+  }
+  return v;
+}
+
+TEST(SlotKernels, MatchScalar) {
+  std::mt19937_64 gen(42);
+  auto kernels = nvme_bpf::SupportedSlotKernels();
+  ASSERT_FALSE(kernels.empty());
+  const SlotKernels& scalar = *kernels[0];
+  EXPECT_STREQ(scalar.name, "scalar");
+  for (const SlotKernels* k : kernels) {
+    // Covers the empty arrays and the partial vector tails.
+    for (size_t n = 0; n <= 40; ++n) {
+      std::vector<u64> a = RandomSlots(gen, n);
+      std::vector<u64> b = RandomSlots(gen, n);
+
+      std::vector<u64> expected = a;
+      std::vector<u64> actual = a;
+      scalar.add(expected.data(), b.data(), n);
+      k->add(actual.data(), b.data(), n);
+      EXPECT_EQ(actual, expected) << k->name << " add n=" << n;
+
+      expected = a;
+      actual = a;
+      scalar.subtract(expected.data(), b.data(), n);
+      k->subtract(actual.data(), b.data(), n);
+      EXPECT_EQ(actual, expected) << k->name << " subtract n=" << n;
+
+      expected = a;
+      actual = a;
+      scalar.prefix_sum(expected.data(), n);
+      k->prefix_sum(actual.data(), n);
+      EXPECT_EQ(actual, expected) << k->name << " prefix_sum n=" << n;
+    }
+  }
+}
+
+TEST(SlotKernels, DoNotTouchPastTheEnd) {
+  for (const SlotKernels* k : nvme_bpf::SupportedSlotKernels()) {
+    std::vector<u64> dst(32, 1);
+    std::vector<u64> src(32, 1);
+    k->add(dst.data(), src.data(), 27);
+    k->prefix_sum(dst.data(), 27);
+    EXPECT_EQ(dst[26], 2 * 27) << k->name;
+    EXPECT_EQ(dst[27], 1) << k->name;
+  }
+}
+
+TEST(SlotKernels, PrefixSum) {
+  std::vector<u64> slots = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+  nvme_bpf::PrefixSumSlots(slots.data(), slots.size());
+  EXPECT_EQ(slots, (std::vector<u64>{1, 3, 6, 10, 15, 21, 28, 36, 45}));
+}
+
+}  // namespace
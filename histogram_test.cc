@@ -9,6 +9,8 @@
 #include "absl/time/time.h"
 #include "gtest/gtest.h"
 #include "histogram.bpf.h"
+#include "histogram.h"
+#include "latency_snapshot.h"
 
 /*
 bazel test --test_output=streamed :histogram_test
@@ -164,4 +166,238 @@ TEST(Log2, HistogramHelperTest) {
   } while (absl::Now() < end || --count > 0);
 }
 
+TEST(Histogram, Percentile) {
+  u64 slots[14] = {};
+  nvme_bpf::Histogram hist;
+  hist.lat_min_us = 10;
+  hist.lat_shift = 0;
+  hist.max_slots = 13;
+  hist.slots = slots;
+  ASSERT_EQ(hist.percentile(0.5), 0);
+
+  slots[13] = 10;  // [0, 10)
+  slots[0] = 80;   // [10, 11)
+  slots[3] = 9;    // [14, 18)
+  slots[5] = 1;    // [26, 42)
+  EXPECT_EQ(hist.percentile(0.0), 10);
+  EXPECT_EQ(hist.percentile(0.1), 10);
+  EXPECT_EQ(hist.percentile(0.5), 11);
+  EXPECT_EQ(hist.percentile(0.9), 11);
+  EXPECT_EQ(hist.percentile(0.95), 18);
+  EXPECT_EQ(hist.percentile(0.99), 18);
+  EXPECT_EQ(hist.percentile(1.0), 42);
+}
+
+TEST(BucketLayout, MatchesBpfHelpers) {
+  std::mt19937_64 gen(42);
+  for (uint64_t min : {0, 1, 20, 65, 1000}) {
+    for (int shift = 0; shift <= 8; ++shift) {
+      auto layout = nvme_bpf::BucketLayout<13>::Make(min, shift);
+      for (int slot = 0; slot <= 13; ++slot) {
+        ASSERT_EQ(layout.low[slot], bpf_bucket_low(slot, min, shift, 13))
+            << min << " " << shift << " " << slot;
+        ASSERT_EQ(layout.high[slot], bpf_bucket_high(slot, min, shift, 13))
+            << min << " " << shift << " " << slot;
+      }
+      for (int i = 0; i < 1000; ++i) {
+        uint64_t v = gen() >> (gen() % 64);
+        ASSERT_EQ(layout.Slot(v), bpf_get_bucket(v, min, shift, 13)) << v;
+      }
+      for (int slot = 0; slot < 13; ++slot) {
+        ASSERT_EQ(layout.Slot(layout.low[slot]), slot);
+        ASSERT_EQ(layout.Slot(layout.high[slot] - 1), slot);
+      }
+    }
+  }
+}
+
+TEST(BucketLayout, DefaultLatencyLayout) {
+  const auto& layout = nvme_bpf::kDefaultLatencyLayout;
+  EXPECT_EQ(layout, nvme_bpf::LatencyBucketLayout::Make(20, 0));
+  EXPECT_EQ(layout.low[LATENCY_MAX_SLOTS], 0);
+  EXPECT_EQ(layout.high[LATENCY_MAX_SLOTS], 20);
+  EXPECT_EQ(layout.Slot(20 + (1 << LATENCY_MAX_SLOTS)), -1);
+}
+
+// The widest layout TuneLatencyRange picks and --lat_shift accepts.
+TEST(BucketLayout, WidestShiftFitsU64) {
+  constexpr int kShift = 63 - LATENCY_MAX_SLOTS;
+  const auto layout = nvme_bpf::LatencyBucketLayout::Make(20, kShift);
+  EXPECT_EQ(layout.high[LATENCY_MAX_SLOTS - 1],
+            20 + (uint64_t{1} << (LATENCY_MAX_SLOTS - 1 + kShift)));
+  EXPECT_EQ(layout.Slot(UINT64_MAX), -1);
+}
+
+TEST(BucketLayout, HistogramUsesTheTables) {
+  nvme_bpf::OwnedHistogram<13> owned(10, 2);
+  for (uint64_t v = 5; v < 50000; v = v * 3 / 2) {
+    owned.Record(v);
+  }
+  nvme_bpf::Histogram computed = owned.view();
+  const auto layout = nvme_bpf::BucketLayout<13>::Make(10, 2);
+  nvme_bpf::Histogram tabled = computed;
+  tabled.SetLayout(layout);
+  ASSERT_EQ(tabled.highs, layout.high.data());
+  EXPECT_TRUE(nvme_bpf::CheckSameLayout(computed, tabled).ok());
+  for (int slot = 0; slot <= 13; ++slot) {
+    EXPECT_EQ(tabled.bucket_low(slot), computed.bucket_low(slot));
+    EXPECT_EQ(tabled.bucket_high(slot), computed.bucket_high(slot));
+  }
+  for (double q : {0.0, 0.1, 0.5, 0.9, 0.99, 1.0}) {
+    EXPECT_EQ(tabled.percentile(q), computed.percentile(q)) << q;
+  }
+}
+
+TEST(TuneLatencyRange, SpreadsTheBulkOverTheBuckets) {
+  nvme_bpf::OwnedHistogram<LATENCY_MAX_SLOTS> calibration(0, 0);
+  EXPECT_EQ(nvme_bpf::TuneLatencyRange(calibration.view(), 13).status().code(),
+            absl::StatusCode::kFailedPrecondition);
+  calibration.Record(3, 5);
+  for (uint64_t v = 100; v < 400; ++v) {
+    calibration.Record(v, 33);
+  }
+  calibration.Record(30000, 5);
+
+  // p1 is in [64, 128), p99.99 in [16384, 32768).
+  auto range = nvme_bpf::TuneLatencyRange(calibration.view(), 8);
+  ASSERT_TRUE(range.ok()) << range.status();
+  EXPECT_EQ(range->lat_min_us, 64);
+  EXPECT_EQ(range->lat_shift, 8);
+  auto layout = nvme_bpf::BucketLayout<8>::Make(range->lat_min_us,
+                                                range->lat_shift);
+  EXPECT_GE(layout.high[7], 32768);
+  EXPECT_LT(layout.high[7] - 64, 2 * (32768 - 64));
+
+  // The wide default leaves the shift at 0.
+  range = nvme_bpf::TuneLatencyRange(calibration.view(), LATENCY_MAX_SLOTS);
+  ASSERT_TRUE(range.ok()) << range.status();
+  EXPECT_EQ(range->lat_min_us, 64);
+  EXPECT_EQ(range->lat_shift, 0);
+
+  // Only the overflow.
+  nvme_bpf::OwnedHistogram<4> tiny(0, 0);
+  tiny.Record(1000);
+  range = nvme_bpf::TuneLatencyRange(tiny.view(), 4);
+  ASSERT_TRUE(range.ok()) << range.status();
+  EXPECT_EQ(range->lat_min_us, 8);
+
+  EXPECT_FALSE(
+      nvme_bpf::TuneLatencyRange(calibration.view(), 8, 0.5, 0.1).ok());
+}
+
+using Hist13 = nvme_bpf::OwnedHistogram<13>;
+
+TEST(OwnedHistogram, RecordMergeSubtract) {
+  Hist13 a(/*lat_min_us=*/10, /*lat_shift=*/0);
+  a.Record(5);           // < min
+  a.Record(11, 2);       // [11, 12)
+  a.Record(1 << 20);     // above the last bucket
+  EXPECT_EQ(a.slot(13), 1);
+  EXPECT_EQ(a.slot(1), 2);
+  EXPECT_EQ(a.total_count(), 4);
+  EXPECT_EQ(a.total_sum(), 5 + 22 + (1 << 20));
+
+  Hist13 b = a;
+  ASSERT_TRUE(b.Merge(a).ok());
+  EXPECT_EQ(b.slot(1), 4);
+  EXPECT_EQ(b.total_count(), 8);
+
+  ASSERT_TRUE(b.Subtract(a).ok());
+  EXPECT_EQ(b, a);
+  // The counters went back, nothing changes.
+  Hist13 empty(10, 0);
+  EXPECT_EQ(empty.Subtract(a).code(), absl::StatusCode::kFailedPrecondition);
+  EXPECT_EQ(empty, Hist13(10, 0));
+
+  Hist13 other_layout(/*lat_min_us=*/20, /*lat_shift=*/0);
+  EXPECT_EQ(other_layout.Merge(a).code(), absl::StatusCode::kInvalidArgument);
+  // OwnedHistogram<12>().Merge(a) doesn't compile.
+}
+
+TEST(OwnedHistogram, MinMaxStddevOverflow) {
+  Hist13 a(/*lat_min_us=*/10, /*lat_shift=*/0);
+  EXPECT_EQ(a.view().stddev(), 0);
+  a.Record(100, 2);
+  a.Record(300, 2);
+  EXPECT_EQ(a.min(), 100);
+  EXPECT_EQ(a.max(), 300);
+  EXPECT_DOUBLE_EQ(a.view().mean(), 200);
+  EXPECT_DOUBLE_EQ(a.view().stddev(), 100);
+  EXPECT_EQ(a.overflow_count(), 0);
+
+  Hist13 b(10, 0);
+  b.Record(50);
+  b.Record(1 << 20);
+  EXPECT_EQ(b.overflow_count(), 1);
+  ASSERT_TRUE(a.Merge(b).ok());
+  EXPECT_EQ(a.min(), 50);
+  EXPECT_EQ(a.max(), 1 << 20);
+  EXPECT_EQ(a.overflow_count(), 1);
+  EXPECT_EQ(a.total_count(), 6);
+  // The overflow is above every bucket, the top percentile is the real max
+  // instead of the last bucket bound.
+  EXPECT_EQ(a.percentile(1.0), 1 << 20);
+  EXPECT_LE(a.percentile(0.5), 512);
+
+  // Merging an empty histogram keeps the extremes.
+  ASSERT_TRUE(a.Merge(Hist13(10, 0)).ok());
+  EXPECT_EQ(a.min(), 50);
+  ASSERT_TRUE(a.Subtract(b).ok());
+  EXPECT_EQ(a.overflow_count(), 0);
+  EXPECT_EQ(a.total_count(), 4);
+}
+
+TEST(OwnedHistogram, Scale) {
+  Hist13 hist(10, 2);
+  hist.Record(10, 3);
+  hist.Record(30, 1);
+  hist.Record(1 << 20, 1);
+  hist.Scale(2.5);
+  EXPECT_EQ(hist.slot(0), 8);
+  EXPECT_EQ(hist.slot(3), 3);
+  EXPECT_EQ(hist.total_count(), 8 + 3 + 3);
+  EXPECT_EQ(hist.overflow_count(), 3);
+  EXPECT_EQ(hist.total_sum(), std::llround((30 + 30 + (1 << 20)) * 2.5));
+}
+
+TEST(OwnedHistogram, SerializeRoundTrip) {
+  Hist13 hist(10, 2);
+  EXPECT_EQ(Hist13::Parse(hist.Serialize()).value(), hist);
+  hist.Record(5);
+  hist.Record(10, 300);
+  hist.Record(5000);
+  std::string encoded = hist.Serialize();
+  // Version, 3 layout bytes, the count, sum, sum_sq, overflow, min and max,
+  // the slot count and 3 slots.
+  EXPECT_EQ(encoded.size(), 1 + 3 + 2 + 2 + 4 + 1 + 1 + 2 + 1 + 3 + 2 + 2);
+  auto parsed = Hist13::Parse(encoded);
+  ASSERT_TRUE(parsed.ok()) << parsed.status();
+  EXPECT_EQ(*parsed, hist);
+  EXPECT_EQ(parsed->percentile(1.0), hist.percentile(1.0));
+
+  for (size_t size = 0; size < encoded.size(); ++size) {
+    EXPECT_FALSE(Hist13::Parse(encoded.substr(0, size)).ok()) << size;
+  }
+  EXPECT_FALSE(Hist13::Parse(encoded + "x").ok());
+  EXPECT_EQ(nvme_bpf::OwnedHistogram<12>::Parse(encoded).status().code(),
+            absl::StatusCode::kInvalidArgument);
+  // The number of slots must match exactly.
+  EXPECT_FALSE(nvme_bpf::OwnedHistogram<20>::Parse(encoded).ok());
+}
+
+TEST(OwnedHistogram, FromView) {
+  u64 slots[14] = {1, 2, 3};
+  nvme_bpf::Histogram view;
+  view.lat_min_us = 10;
+  view.max_slots = 13;
+  view.slots = slots;
+  view.total_count = 6;
+  auto hist = Hist13::FromView(view);
+  ASSERT_TRUE(hist.ok()) << hist.status();
+  EXPECT_EQ(hist->slot(2), 3);
+  EXPECT_EQ(hist->view().percentile(1.0), view.percentile(1.0));
+  view.max_slots = 12;
+  EXPECT_FALSE(Hist13::FromView(view).ok());
+}
+
 }  // namespace
@@ -0,0 +1,7 @@
+#ifndef HOST_BPF_BPF_BPF_TRACING_H_
+#define HOST_BPF_BPF_BPF_TRACING_H_
+
+// Host build stand-in for libbpf's <bpf/bpf_tracing.h>, see bpf_host.h.
+#include "bpf_host.h"
+
+#endif  // HOST_BPF_BPF_BPF_TRACING_H_
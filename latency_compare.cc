@@ -0,0 +1,353 @@
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/log/initialize.h"
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/time.h"
+#include "histogram.h"
+#include "histogram_compare.h"
+#include "latency_history.h"
+#include "nvme_abi.h"
+#include "nvme_strings.h"
+
+/*
+Compares the latency distributions of two captures, e.g. before and after a
+firmware or kernel update, and exits with status 2 if any histogram regressed.
+
+The captures are either two time ranges recorded by nvme_latency
+--history_dir, compared key by key (controller, opcode, size class):
+
+bazel build :latency_compare && \
+  bazel-bin/latency_compare --history_dir=/var/lib/nvme_latency \
+    --before_start=2026-01-02T03:00:00Z --before_end=2026-01-02T04:00:00Z \
+    --after_start=2026-01-03T03:00:00Z --after_end=2026-01-03T04:00:00Z
+
+or two histograms in the nvme_bpf::SerializeHistogram() encoding:
+
+bazel-bin/latency_compare --before_file=a.hist --after_file=b.hist
+*/
+
+ABSL_FLAG(std::string, history_dir, "",
+          "The directory written by nvme_latency --history_dir.");
+ABSL_FLAG(std::string, after_history_dir, "",
+          "If set the after range is read from this directory instead of "
+          "--history_dir, e.g. from another host.");
+ABSL_FLAG(absl::Time, before_start, absl::InfinitePast(),
+          "The start of the before range, RFC3339.");
+ABSL_FLAG(absl::Time, before_end, absl::InfiniteFuture(),
+          "The end of the before range, RFC3339.");
+ABSL_FLAG(absl::Time, after_start, absl::InfinitePast(),
+          "The start of the after range, RFC3339.");
+ABSL_FLAG(absl::Time, after_end, absl::InfiniteFuture(),
+          "The end of the after range, RFC3339.");
+ABSL_FLAG(std::string, before_file, "",
+          "A serialized histogram to compare instead of the history.");
+ABSL_FLAG(std::string, after_file, "",
+          "The serialized histogram compared to --before_file.");
+ABSL_FLAG(int, ctrl_id, -1, "Only the histograms of this controller.");
+ABSL_FLAG(std::string, opcode, "",
+          "Only the histograms of this opcode, a number or a name such as "
+          "Read or Identify.");
+ABSL_FLAG(bool, admin, false,
+          "Compares the admin command histograms instead of the IO ones.");
+ABSL_FLAG(std::vector<std::string>, percentiles,
+          std::vector<std::string>({"50", "90", "99", "99.9"}),
+          "The percentiles compared.");
+ABSL_FLAG(double, max_percentile_increase, 0.5,
+          "A percentile regressed if it grew by more than this fraction.");
+ABSL_FLAG(double, max_slower_fraction, 0.05,
+          "A histogram regressed if more than this fraction of the IOs moved "
+          "above a bucket bound (the one-sided KS distance).");
+ABSL_FLAG(double, min_bucket_shift, 0.01,
+          "The buckets whose share of the IOs changed by more than this are "
+          "printed.");
+ABSL_FLAG(uint64_t, min_count, 100,
+          "Histograms with fewer IOs on either side are never a regression.");
+ABSL_FLAG(bool, verbose, false,
+          "Prints the moved buckets of every histogram, not only of the "
+          "regressed ones.");
+
+namespace {
+
+using nvme_bpf::HistoryKey;
+using nvme_bpf::Snapshot;
+using nvme_bpf::SnapshotHist;
+
+constexpr int kRegressedExitCode = 2;
+
+uint64_t RangeNanos(absl::Time t) {
+  if (t <= absl::UnixEpoch()) {
+    return 0;
+  }
+  if (t == absl::InfiniteFuture()) {
+    return UINT64_MAX;
+  }
+  return absl::ToUnixNanos(t);
+}
+
+std::string KeyToString(const HistoryKey& key) {
+  auto opcode = static_cast<nvme_abi::NvmeOpcode>(key.opcode);
+  if (key.kind == nvme_bpf::kSnapshotHistAdmin) {
+    return absl::StrCat("ctrl_id=", key.ctrl_id,
+                        " opcode=", nvme_abi::NvmeAdminOpcodeToString(opcode));
+  }
+  return absl::StrCat("ctrl_id=", key.ctrl_id,
+                      " opcode=", nvme_abi::NvmeIoOpcodeToString(opcode),
+                      " size_class=", key.size_class,
+                      key.saturated ? " saturated" : "");
+}
+
+// The matching histograms of a time range, merged per key.
+struct Capture {
+  nvme_bpf::Histogram layout;
+  std::map<HistoryKey, SnapshotHist> hists;
+
+  nvme_bpf::Histogram View(const SnapshotHist& hist) const {
+    nvme_bpf::Histogram h = layout;
+    h.slots = hist.slots;
+    h.total_count = hist.total_count;
+    h.total_sum = hist.total_sum;
+    h.total_sum_sq = hist.total_sum_sq;
+    h.overflow_count = hist.overflow_count;
+    h.min = hist.min;
+    h.max = hist.max;
+    return h;
+  }
+};
+
+// The history records hold the IOs of one interval each, see SnapshotDelta,
+// the capture of a range is their sum.
+absl::StatusOr<Capture> ReadCapture(const std::string& dir, absl::Time start,
+                                    absl::Time end) {
+  auto reader = nvme_bpf::HistoryReader::Open(dir);
+  if (!reader.ok()) {
+    return reader.status();
+  }
+  const bool admin = absl::GetFlag(FLAGS_admin);
+  const uint8_t kind =
+      admin ? nvme_bpf::kSnapshotHistAdmin : nvme_bpf::kSnapshotHistIo;
+  const int64_t ctrl_id = absl::GetFlag(FLAGS_ctrl_id);
+  // -1 matches all the opcodes.
+  int opcode = -1;
+  if (std::string text = absl::GetFlag(FLAGS_opcode); !text.empty()) {
+    auto parsed = nvme_abi::ParseNvmeOpcode(text, admin);
+    if (!parsed.has_value()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid opcode '", text, "'"));
+    }
+    opcode = static_cast<int>(*parsed);
+  }
+  Capture capture;
+  int records = 0;
+  auto status = reader->Scan(
+      RangeNanos(start), RangeNanos(end),
+      [&](const Snapshot& snapshot) -> absl::Status {
+        ++records;
+        nvme_bpf::Histogram& layout = capture.layout;
+        if (layout.max_slots == 0) {
+          layout.lat_min_us = snapshot.lat_min_us;
+          layout.lat_shift = snapshot.lat_shift;
+          layout.max_slots = snapshot.max_slots;
+        } else if (snapshot.lat_min_us != layout.lat_min_us ||
+                   snapshot.lat_shift != layout.lat_shift ||
+                   snapshot.max_slots != layout.max_slots) {
+          return absl::FailedPreconditionError(absl::StrCat(
+              "The histogram layout changed at ",
+              absl::FormatTime(absl::FromUnixNanos(snapshot.timestamp_ns)),
+              ", narrow the range"));
+        }
+        for (const SnapshotHist& hist : snapshot.hists) {
+          if (hist.kind != kind || (ctrl_id >= 0 && hist.ctrl_id != ctrl_id) ||
+              (opcode >= 0 && hist.opcode != opcode)) {
+            continue;
+          }
+          auto [it, inserted] =
+              capture.hists.try_emplace(HistoryKey::Of(hist));
+          nvme_bpf::MergeSnapshotHist(hist, &it->second);
+        }
+        return absl::OkStatus();
+      });
+  if (!status.ok()) {
+    return status;
+  }
+  // An empty capture would compare as no regression.
+  if (records == 0) {
+    return absl::NotFoundError(absl::StrCat(
+        "No history in ", dir, " between ", absl::FormatTime(start), " and ",
+        absl::FormatTime(end),
+        ", the files of nvme_latency versions that recorded the cumulative "
+        "histograms are not read"));
+  }
+  return capture;
+}
+
+// Prints the comparison of one key and returns whether it regressed.
+bool PrintComparison(const std::string& name,
+                     const nvme_bpf::HistogramComparison& result) {
+  std::cout << name << " count=" << result.before_count << "->"
+            << result.after_count << " ks=" << result.ks_distance
+            << " slower=" << result.slower_fraction;
+  for (const auto& delta : result.quantiles) {
+    std::cout << " p" << delta.q * 100 << "=" << delta.before_us << "->"
+              << delta.after_us << "us";
+    if (delta.regressed) {
+      std::cout << "!";
+    }
+  }
+  if (result.regressed) {
+    std::cout << " REGRESSED";
+  }
+  std::cout << std::endl;
+  if (result.regressed || absl::GetFlag(FLAGS_verbose)) {
+    for (const auto& shift : result.moved_buckets) {
+      std::cout << "  [" << shift.low_us << "us - "
+                << (shift.high_us == UINT64_MAX
+                        ? std::string("inf)")
+                        : absl::StrCat(shift.high_us, "us)"))
+                << ": " << shift.before_fraction * 100 << "% -> "
+                << shift.after_fraction * 100 << "%" << std::endl;
+    }
+  }
+  return result.regressed;
+}
+
+absl::StatusOr<std::string> ReadFile(const std::string& path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    return absl::NotFoundError(absl::StrCat("Failed to open ", path));
+  }
+  std::stringstream contents;
+  contents << in.rdbuf();
+  return contents.str();
+}
+
+// Compares two serialized histograms.
+absl::StatusOr<bool> CompareFiles(const nvme_bpf::CompareOptions& options) {
+  // Room for any layout the encoding can describe.
+  u64 slots[2][64];
+  nvme_bpf::Histogram hists[2];
+  const std::string paths[2] = {absl::GetFlag(FLAGS_before_file),
+                                absl::GetFlag(FLAGS_after_file)};
+  for (int i = 0; i < 2; ++i) {
+    auto contents = ReadFile(paths[i]);
+    if (!contents.ok()) {
+      return contents.status();
+    }
+    auto status = nvme_bpf::ParseHistogram(*contents, &hists[i], slots[i], 64);
+    if (!status.ok()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat(paths[i], ": ", status.message()));
+    }
+  }
+  auto result = nvme_bpf::CompareHistograms(hists[0], hists[1], options);
+  if (!result.ok()) {
+    return result.status();
+  }
+  return PrintComparison(absl::StrCat(paths[0], " vs ", paths[1]), *result);
+}
+
+// Compares two time ranges of the history key by key.
+absl::StatusOr<bool> CompareHistory(const nvme_bpf::CompareOptions& options) {
+  auto before_dir = absl::GetFlag(FLAGS_history_dir);
+  auto after_dir = absl::GetFlag(FLAGS_after_history_dir);
+  if (after_dir.empty()) {
+    after_dir = before_dir;
+  }
+  auto before = ReadCapture(before_dir, absl::GetFlag(FLAGS_before_start),
+                            absl::GetFlag(FLAGS_before_end));
+  if (!before.ok()) {
+    return before.status();
+  }
+  auto after = ReadCapture(after_dir, absl::GetFlag(FLAGS_after_start),
+                           absl::GetFlag(FLAGS_after_end));
+  if (!after.ok()) {
+    return after.status();
+  }
+
+  int compared = 0;
+  int regressed = 0;
+  int only_before = 0;
+  for (const auto& [key, hist] : before->hists) {
+    auto it = after->hists.find(key);
+    if (it == after->hists.end()) {
+      std::cout << KeyToString(key) << " only before" << std::endl;
+      ++only_before;
+      continue;
+    }
+    auto result = nvme_bpf::CompareHistograms(before->View(hist),
+                                              after->View(it->second), options);
+    if (!result.ok()) {
+      return result.status();
+    }
+    ++compared;
+    regressed += PrintComparison(KeyToString(key), *result);
+  }
+  int only_after = 0;
+  for (const auto& [key, hist] : after->hists) {
+    if (!before->hists.contains(key)) {
+      std::cout << KeyToString(key) << " only after" << std::endl;
+      ++only_after;
+    }
+  }
+  std::cout << "Compared " << compared << " histograms, " << regressed
+            << " regressed, " << only_before << " only before, " << only_after
+            << " only after." << std::endl;
+  return regressed > 0;
+}
+
+absl::StatusOr<bool> Compare() {
+  nvme_bpf::CompareOptions options;
+  options.quantiles.clear();
+  for (const auto& p : absl::GetFlag(FLAGS_percentiles)) {
+    double value;
+    if (!absl::SimpleAtod(p, &value) || value < 0 || value > 100) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid percentile '", p, "'"));
+    }
+    options.quantiles.push_back(value / 100);
+  }
+  options.max_quantile_increase = absl::GetFlag(FLAGS_max_percentile_increase);
+  options.max_slower_fraction = absl::GetFlag(FLAGS_max_slower_fraction);
+  options.min_bucket_shift = absl::GetFlag(FLAGS_min_bucket_shift);
+  options.min_count = absl::GetFlag(FLAGS_min_count);
+
+  bool files = !absl::GetFlag(FLAGS_before_file).empty() ||
+               !absl::GetFlag(FLAGS_after_file).empty();
+  if (files) {
+    if (absl::GetFlag(FLAGS_before_file).empty() ||
+        absl::GetFlag(FLAGS_after_file).empty()) {
+      return absl::InvalidArgumentError(
+          "--before_file and --after_file go together");
+    }
+    return CompareFiles(options);
+  }
+  if (absl::GetFlag(FLAGS_history_dir).empty()) {
+    return absl::InvalidArgumentError(
+        "Either --history_dir or --before_file and --after_file is required");
+  }
+  return CompareHistory(options);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  absl::InitializeLog();
+
+  auto regressed = Compare();
+  if (!regressed.ok()) {
+    std::cerr << regressed.status() << std::endl;
+    return EXIT_FAILURE;
+  }
+  return *regressed ? kRegressedExitCode : EXIT_SUCCESS;
+}
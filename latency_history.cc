@@ -0,0 +1,667 @@
+#include "latency_history.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <filesystem>
+#include <string_view>
+
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/strip.h"
+#include "histogram_kernels.h"
+#include "varint.h"
+
+namespace nvme_bpf {
+namespace {
+
+constexpr uint32_t kFileMagic = 0x484c564e;   // "NVLH"
+// Version 2 recorded the cumulative histograms, version 3 had one count scale
+// per chunk.
+constexpr uint32_t kFileVersion = 4;
+constexpr uint32_t kChunkMagic = 0x434c564e;  // "NVLC"
+constexpr size_t kMaxPayloadBytes = 256 << 10;
+constexpr std::string_view kFilePrefix = "history-";
+constexpr std::string_view kFileSuffix = ".nvlh";
+constexpr std::string_view kIndexSuffix = ".idx";
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+};
+
+// The histogram layout applies to every record of the chunk. count_scale is
+// the scale of the first record, every record stores its own XORed with the
+// previous one, so an unchanged scale takes one byte.
+struct ChunkHeader {
+  uint32_t magic;
+  uint32_t payload_bytes;
+  uint32_t record_count;
+  int32_t lat_min_us;
+  int32_t lat_shift;
+  int32_t max_slots;
+  double count_scale;
+  uint64_t first_ns;
+};
+
+struct IndexEntry {
+  uint64_t first_ns;
+  uint64_t last_ns;
+  uint64_t offset;
+  uint32_t size;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(ChunkHeader) == 40, "ChunkHeader must not have padding");
+static_assert(sizeof(IndexEntry) == 32, "IndexEntry must not have padding");
+static_assert(kSnapshotSlots <= 64, "The changed slots mask is a u64");
+
+uint64_t SlotSum(const SnapshotHist& hist) {
+  uint64_t sum = 0;
+  for (uint64_t slot : hist.slots) {
+    sum += slot;
+  }
+  return sum;
+}
+
+// Appends `hist` as the delta against `prev`.
+void EncodeHist(const SnapshotHist& hist, const SnapshotHist& prev,
+                std::string* out) {
+  uint64_t changed = 0;
+  for (uint32_t slot = 0; slot < kSnapshotSlots; ++slot) {
+    if (hist.slots[slot] != prev.slots[slot]) {
+      changed |= uint64_t{1} << slot;
+    }
+  }
+  PutVarint(changed, out);
+  for (uint32_t slot = 0; slot < kSnapshotSlots; ++slot) {
+    if (changed & (uint64_t{1} << slot)) {
+      PutVarint(ZigZag(hist.slots[slot] - prev.slots[slot]), out);
+    }
+  }
+  // The total count is usually the sum of the slots and the overflow.
+  PutVarint(ZigZag(hist.total_count - SlotSum(hist) - hist.overflow_count),
+            out);
+  PutVarint(ZigZag(hist.total_sum - prev.total_sum), out);
+  PutVarint(ZigZag(hist.total_sum_sq - prev.total_sum_sq), out);
+  PutVarint(ZigZag(hist.overflow_count - prev.overflow_count), out);
+  PutVarint(ZigZag(hist.min - prev.min), out);
+  PutVarint(ZigZag(hist.max - prev.max), out);
+}
+
+bool DecodeHist(std::string_view* in, const SnapshotHist& prev,
+                SnapshotHist* hist) {
+  uint64_t changed;
+  if (!GetVarint(in, &changed) || (changed >> kSnapshotSlots) != 0) {
+    return false;
+  }
+  for (uint32_t slot = 0; slot < kSnapshotSlots; ++slot) {
+    hist->slots[slot] = prev.slots[slot];
+    uint64_t delta;
+    if (changed & (uint64_t{1} << slot)) {
+      if (!GetVarint(in, &delta)) {
+        return false;
+      }
+      hist->slots[slot] += UnZigZag(delta);
+    }
+  }
+  uint64_t count_delta, sum_delta, sum_sq_delta, overflow_delta, min_delta,
+      max_delta;
+  if (!GetVarint(in, &count_delta) || !GetVarint(in, &sum_delta) ||
+      !GetVarint(in, &sum_sq_delta) || !GetVarint(in, &overflow_delta) ||
+      !GetVarint(in, &min_delta) || !GetVarint(in, &max_delta)) {
+    return false;
+  }
+  hist->total_sum = prev.total_sum + UnZigZag(sum_delta);
+  hist->total_sum_sq = prev.total_sum_sq + UnZigZag(sum_sq_delta);
+  hist->overflow_count = prev.overflow_count + UnZigZag(overflow_delta);
+  hist->min = prev.min + UnZigZag(min_delta);
+  hist->max = prev.max + UnZigZag(max_delta);
+  hist->total_count =
+      SlotSum(*hist) + hist->overflow_count + UnZigZag(count_delta);
+  return true;
+}
+
+// Decodes the snapshots of a chunk, returns false if it is corrupt.
+bool DecodeChunk(const ChunkHeader& header, std::string_view payload,
+                 std::vector<Snapshot>* snapshots) {
+  std::vector<HistoryKey> keys;
+  std::vector<SnapshotHist> prev;
+  uint64_t ts = header.first_ns;
+  uint64_t scale_bits = std::bit_cast<uint64_t>(header.count_scale);
+  for (uint32_t record = 0; record < header.record_count; ++record) {
+    Snapshot& snapshot = snapshots->emplace_back();
+    uint64_t ts_delta, scale_xor, hist_count;
+    if (!GetVarint(&payload, &ts_delta) || !GetVarint(&payload, &scale_xor) ||
+        !GetVarint(&payload, &hist_count) || hist_count > payload.size()) {
+      return false;
+    }
+    scale_bits ^= scale_xor;
+    ts += ts_delta;
+    snapshot.timestamp_ns = ts;
+    snapshot.lat_min_us = header.lat_min_us;
+    snapshot.lat_shift = header.lat_shift;
+    snapshot.max_slots = header.max_slots;
+    snapshot.count_scale = std::bit_cast<double>(scale_bits);
+    snapshot.hists.resize(hist_count);
+    for (SnapshotHist& hist : snapshot.hists) {
+      uint64_t key_ref;
+      if (!GetVarint(&payload, &key_ref) || key_ref > keys.size()) {
+        return false;
+      }
+      if (key_ref == keys.size()) {
+        uint64_t ctrl_id;
+        if (!GetVarint(&payload, &ctrl_id) || payload.size() < 4) {
+          return false;
+        }
+        HistoryKey& key = keys.emplace_back();
+        key.ctrl_id = ctrl_id;
+        key.kind = payload[0];
+        key.opcode = payload[1];
+        key.size_class = payload[2];
+        key.saturated = payload[3];
+        payload.remove_prefix(4);
+        prev.push_back(SnapshotHist{});
+      }
+      if (!DecodeHist(&payload, prev[key_ref], &hist)) {
+        return false;
+      }
+      const HistoryKey& key = keys[key_ref];
+      hist.ctrl_id = key.ctrl_id;
+      hist.kind = key.kind;
+      hist.opcode = key.opcode;
+      hist.size_class = key.size_class;
+      hist.saturated = key.saturated;
+      prev[key_ref] = hist;
+    }
+  }
+  return payload.empty();
+}
+
+absl::Status WriteAll(int fd, const void* data, size_t size,
+                      const std::string& path) {
+  const char* p = static_cast<const char*>(data);
+  while (size > 0) {
+    ssize_t n = write(fd, p, size);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return absl::InternalError(
+          absl::StrCat("write(", path, ") failed, errno=", errno));
+    }
+    p += n;
+    size -= n;
+  }
+  return absl::OkStatus();
+}
+
+bool ReadAt(int fd, void* data, size_t size, off_t offset) {
+  char* p = static_cast<char*>(data);
+  while (size > 0) {
+    ssize_t n = pread(fd, p, size, offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    p += n;
+    size -= n;
+    offset += n;
+  }
+  return true;
+}
+
+struct HistoryFile {
+  uint64_t first_ns;
+  std::string path;
+};
+
+// Returns the data files of `dir` sorted by time.
+std::vector<HistoryFile> ListFiles(const std::string& dir) {
+  std::vector<HistoryFile> files;
+  std::error_code ec;
+  for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+    std::string name = entry.path().filename().string();
+    std::string_view ts = name;
+    uint64_t first_ns;
+    if (absl::ConsumePrefix(&ts, kFilePrefix) &&
+        absl::ConsumeSuffix(&ts, kFileSuffix) &&
+        absl::SimpleAtoi(ts, &first_ns)) {
+      files.push_back({first_ns, entry.path().string()});
+    }
+  }
+  std::sort(files.begin(), files.end(),
+            [](const HistoryFile& a, const HistoryFile& b) {
+              return a.first_ns < b.first_ns;
+            });
+  return files;
+}
+
+uint64_t FileSize(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+// Calls `fn` with the snapshots of the chunks of `path` that overlap
+// [begin_ns, end_ns). The index is binary searched for the first chunk.
+absl::Status ScanFile(const std::string& path, uint64_t begin_ns,
+                      uint64_t end_ns,
+                      const std::function<absl::Status(const Snapshot&)>& fn) {
+  // The writer may have removed the file since it was listed.
+  int data_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (data_fd < 0) {
+    return absl::OkStatus();
+  }
+  std::string index_path = absl::StrCat(path, kIndexSuffix);
+  int index_fd = open(index_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (index_fd < 0) {
+    close(data_fd);
+    return absl::OkStatus();
+  }
+  struct stat data_st, index_st;
+  FileHeader file_header;
+  if (fstat(data_fd, &data_st) != 0 || fstat(index_fd, &index_st) != 0 ||
+      !ReadAt(data_fd, &file_header, sizeof(file_header), 0) ||
+      file_header.magic != kFileMagic || file_header.version != kFileVersion) {
+    close(index_fd);
+    close(data_fd);
+    return absl::OkStatus();
+  }
+
+  auto entry_at = [index_fd](uint64_t i, IndexEntry* entry) {
+    return ReadAt(index_fd, entry, sizeof(*entry), i * sizeof(*entry));
+  };
+  // The first chunk that ends at or after begin_ns.
+  uint64_t lo = 0;
+  uint64_t hi = index_st.st_size / sizeof(IndexEntry);
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    IndexEntry entry;
+    if (entry_at(mid, &entry) && entry.last_ns < begin_ns) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  absl::Status status;
+  std::string chunk;
+  std::vector<Snapshot> snapshots;
+  IndexEntry entry;
+  for (uint64_t i = lo; status.ok() && entry_at(i, &entry); ++i) {
+    if (entry.first_ns >= end_ns) {
+      break;
+    }
+    ChunkHeader header;
+    if (entry.size < sizeof(header) ||
+        entry.offset + entry.size > static_cast<uint64_t>(data_st.st_size)) {
+      continue;
+    }
+    chunk.resize(entry.size);
+    if (!ReadAt(data_fd, chunk.data(), chunk.size(), entry.offset)) {
+      continue;
+    }
+    memcpy(&header, chunk.data(), sizeof(header));
+    if (header.magic != kChunkMagic ||
+        header.payload_bytes != entry.size - sizeof(header)) {
+      continue;
+    }
+    snapshots.clear();
+    if (!DecodeChunk(header,
+                     std::string_view(chunk).substr(sizeof(header)),
+                     &snapshots)) {
+      continue;
+    }
+    for (const Snapshot& snapshot : snapshots) {
+      if (snapshot.timestamp_ns >= begin_ns && snapshot.timestamp_ns < end_ns) {
+        status = fn(snapshot);
+        if (!status.ok()) {
+          break;
+        }
+      }
+    }
+  }
+  close(index_fd);
+  close(data_fd);
+  return status;
+}
+
+}  // namespace
+
+Snapshot SnapshotDelta::Next(const Snapshot& cumulative) {
+  if (cumulative.lat_min_us != lat_min_us_ ||
+      cumulative.lat_shift != lat_shift_ ||
+      cumulative.max_slots != max_slots_) {
+    lat_min_us_ = cumulative.lat_min_us;
+    lat_shift_ = cumulative.lat_shift;
+    max_slots_ = cumulative.max_slots;
+    prev_.clear();
+  }
+  Snapshot delta = cumulative;
+  for (SnapshotHist& hist : delta.hists) {
+    auto [it, inserted] = prev_.try_emplace(HistoryKey::Of(hist), hist);
+    if (inserted) {
+      continue;
+    }
+    const SnapshotHist& prev = it->second;
+    // The counters went back when the maps were recreated, the new counts are
+    // all from this interval.
+    bool reset = hist.total_count < prev.total_count ||
+                 hist.total_sum < prev.total_sum ||
+                 hist.total_sum_sq < prev.total_sum_sq ||
+                 hist.overflow_count < prev.overflow_count;
+    for (uint32_t slot = 0; slot < kSnapshotSlots; ++slot) {
+      reset |= hist.slots[slot] < prev.slots[slot];
+    }
+    SnapshotHist current = hist;
+    if (!reset) {
+      hist.total_count -= prev.total_count;
+      hist.total_sum -= prev.total_sum;
+      hist.total_sum_sq -= prev.total_sum_sq;
+      hist.overflow_count -= prev.overflow_count;
+      SubtractSlots(hist.slots, prev.slots, kSnapshotSlots);
+    }
+    it->second = current;
+  }
+  return delta;
+}
+
+Snapshot SnapshotSum::Add(const Snapshot& interval) {
+  if (interval.lat_min_us != lat_min_us_ ||
+      interval.lat_shift != lat_shift_ || interval.max_slots != max_slots_) {
+    lat_min_us_ = interval.lat_min_us;
+    lat_shift_ = interval.lat_shift;
+    max_slots_ = interval.max_slots;
+    sums_.clear();
+  }
+  for (const SnapshotHist& hist : interval.hists) {
+    auto [it, inserted] =
+        sums_.try_emplace({hist.kind, HistoryKey::Of(hist)}, hist);
+    if (!inserted) {
+      MergeSnapshotHist(hist, &it->second);
+    }
+  }
+  Snapshot sum = interval;
+  sum.hists.clear();
+  sum.hists.reserve(sums_.size());
+  for (const auto& [key, hist] : sums_) {
+    sum.hists.push_back(hist);
+  }
+  return sum;
+}
+
+void MergeSnapshotHist(const SnapshotHist& from, SnapshotHist* to) {
+  // The extremes of an empty histogram are not meaningful.
+  if (from.total_count != 0) {
+    to->min = to->total_count == 0 ? from.min : std::min(to->min, from.min);
+    to->max = std::max(to->max, from.max);
+  }
+  AddSlots(to->slots, from.slots, kSnapshotSlots);
+  to->total_count += from.total_count;
+  to->total_sum += from.total_sum;
+  to->total_sum_sq += from.total_sum_sq;
+  to->overflow_count += from.overflow_count;
+}
+
+absl::StatusOr<HistoryWriter> HistoryWriter::Open(HistoryOptions options) {
+  std::error_code ec;
+  std::filesystem::create_directories(options.dir, ec);
+  if (ec) {
+    return absl::InternalError(absl::StrCat(
+        "Failed to create ", options.dir, ": ", ec.message()));
+  }
+  HistoryWriter writer(std::move(options));
+  absl::Status status = writer.EnforceBudget();
+  if (!status.ok()) {
+    return status;
+  }
+  return writer;
+}
+
+HistoryWriter::HistoryWriter(HistoryWriter&& other)
+    : options_(std::move(other.options_)),
+      data_fd_(other.data_fd_),
+      index_fd_(other.index_fd_),
+      data_path_(std::move(other.data_path_)),
+      data_size_(other.data_size_),
+      payload_(std::move(other.payload_)),
+      record_count_(other.record_count_),
+      first_ns_(other.first_ns_),
+      last_ns_(other.last_ns_),
+      lat_min_us_(other.lat_min_us_),
+      lat_shift_(other.lat_shift_),
+      max_slots_(other.max_slots_),
+      count_scale_(other.count_scale_),
+      last_count_scale_(other.last_count_scale_),
+      key_index_(std::move(other.key_index_)),
+      prev_(std::move(other.prev_)) {
+  other.data_fd_ = -1;
+  other.index_fd_ = -1;
+  other.record_count_ = 0;
+}
+
+HistoryWriter::~HistoryWriter() {
+  Flush().IgnoreError();
+  CloseFile();
+}
+
+absl::Status HistoryWriter::Append(const Snapshot& snapshot) {
+  if (record_count_ > 0 && snapshot.timestamp_ns < last_ns_) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Snapshot at ", snapshot.timestamp_ns,
+                     " is older than the previous one at ", last_ns_));
+  }
+  if (record_count_ > 0 && (snapshot.lat_min_us != lat_min_us_ ||
+                            snapshot.lat_shift != lat_shift_ ||
+                            snapshot.max_slots != max_slots_)) {
+    absl::Status status = Flush();
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  if (record_count_ == 0) {
+    first_ns_ = snapshot.timestamp_ns;
+    last_ns_ = snapshot.timestamp_ns;
+    lat_min_us_ = snapshot.lat_min_us;
+    lat_shift_ = snapshot.lat_shift;
+    max_slots_ = snapshot.max_slots;
+    count_scale_ = snapshot.count_scale;
+    last_count_scale_ = snapshot.count_scale;
+  }
+
+  // The sampling rate is recomputed every interval, the scale changes without
+  // starting a chunk.
+  PutVarint(snapshot.timestamp_ns - last_ns_, &payload_);
+  last_ns_ = snapshot.timestamp_ns;
+  PutVarint(std::bit_cast<uint64_t>(snapshot.count_scale) ^
+                std::bit_cast<uint64_t>(last_count_scale_),
+            &payload_);
+  last_count_scale_ = snapshot.count_scale;
+  uint64_t hist_count = 0;
+  for (const SnapshotHist& hist : snapshot.hists) {
+    hist_count += hist.total_count != 0;
+  }
+  PutVarint(hist_count, &payload_);
+  for (const SnapshotHist& hist : snapshot.hists) {
+    if (hist.total_count == 0) {
+      continue;
+    }
+    HistoryKey key = HistoryKey::Of(hist);
+    auto [it, inserted] = key_index_.try_emplace(key, key_index_.size());
+    PutVarint(it->second, &payload_);
+    if (inserted) {
+      PutVarint(key.ctrl_id, &payload_);
+      payload_.push_back(key.kind);
+      payload_.push_back(key.opcode);
+      payload_.push_back(key.size_class);
+      payload_.push_back(key.saturated);
+      prev_.push_back(SnapshotHist{});
+    }
+    EncodeHist(hist, prev_[it->second], &payload_);
+    prev_[it->second] = hist;
+  }
+  ++record_count_;
+
+  if (record_count_ >= options_.chunk_records ||
+      payload_.size() >= kMaxPayloadBytes) {
+    return Flush();
+  }
+  return absl::OkStatus();
+}
+
+absl::Status HistoryWriter::Flush() {
+  if (record_count_ == 0) {
+    return absl::OkStatus();
+  }
+  if (data_fd_ < 0) {
+    absl::Status status = OpenFile(first_ns_);
+    if (!status.ok()) {
+      ResetChunk();
+      return status;
+    }
+  }
+  ChunkHeader header = {};
+  header.magic = kChunkMagic;
+  header.payload_bytes = payload_.size();
+  header.record_count = record_count_;
+  header.lat_min_us = lat_min_us_;
+  header.lat_shift = lat_shift_;
+  header.max_slots = max_slots_;
+  header.count_scale = count_scale_;
+  header.first_ns = first_ns_;
+  IndexEntry entry = {};
+  entry.first_ns = first_ns_;
+  entry.last_ns = last_ns_;
+  entry.offset = data_size_;
+  entry.size = sizeof(header) + payload_.size();
+
+  // The index entry is written last, the reader never follows it to a chunk
+  // that isn't complete.
+  absl::Status status = WriteAll(data_fd_, &header, sizeof(header), data_path_);
+  if (status.ok()) {
+    status = WriteAll(data_fd_, payload_.data(), payload_.size(), data_path_);
+  }
+  if (status.ok()) {
+    data_size_ += entry.size;
+    status = WriteAll(index_fd_, &entry, sizeof(entry),
+                      absl::StrCat(data_path_, kIndexSuffix));
+  }
+  ResetChunk();
+  // A failed write leaves a partial chunk, the next one starts a new file.
+  if (!status.ok() || data_size_ >= options_.file_bytes) {
+    CloseFile();
+  }
+  if (!status.ok()) {
+    return status;
+  }
+  return EnforceBudget();
+}
+
+absl::Status HistoryWriter::OpenFile(uint64_t first_ns) {
+  data_path_ = absl::StrCat(options_.dir, "/", kFilePrefix,
+                            absl::Dec(first_ns, absl::kZeroPad20), kFileSuffix);
+  std::string index_path = absl::StrCat(data_path_, kIndexSuffix);
+  data_fd_ =
+      open(data_path_.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if (data_fd_ < 0) {
+    return absl::InternalError(
+        absl::StrCat("open(", data_path_, ") failed, errno=", errno));
+  }
+  index_fd_ =
+      open(index_path.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
+  if (index_fd_ < 0) {
+    int err = errno;
+    CloseFile();
+    return absl::InternalError(
+        absl::StrCat("open(", index_path, ") failed, errno=", err));
+  }
+  FileHeader header = {kFileMagic, kFileVersion};
+  data_size_ = sizeof(header);
+  absl::Status status = WriteAll(data_fd_, &header, sizeof(header), data_path_);
+  if (!status.ok()) {
+    CloseFile();
+  }
+  return status;
+}
+
+void HistoryWriter::CloseFile() {
+  if (data_fd_ >= 0) {
+    close(data_fd_);
+    data_fd_ = -1;
+  }
+  if (index_fd_ >= 0) {
+    close(index_fd_);
+    index_fd_ = -1;
+  }
+}
+
+absl::Status HistoryWriter::EnforceBudget() {
+  std::vector<HistoryFile> files = ListFiles(options_.dir);
+  std::vector<uint64_t> sizes;
+  uint64_t total = 0;
+  for (const HistoryFile& file : files) {
+    sizes.push_back(FileSize(file.path) +
+                    FileSize(absl::StrCat(file.path, kIndexSuffix)));
+    total += sizes.back();
+  }
+  for (size_t i = 0; i < files.size() && total > options_.max_bytes; ++i) {
+    // The file being written is kept even if it's alone above the budget.
+    if (data_fd_ >= 0 && files[i].path == data_path_) {
+      break;
+    }
+    std::string index_path = absl::StrCat(files[i].path, kIndexSuffix);
+    if (unlink(files[i].path.c_str()) != 0 && errno != ENOENT) {
+      return absl::InternalError(
+          absl::StrCat("unlink(", files[i].path, ") failed, errno=", errno));
+    }
+    unlink(index_path.c_str());
+    total -= sizes[i];
+  }
+  return absl::OkStatus();
+}
+
+void HistoryWriter::ResetChunk() {
+  payload_.clear();
+  record_count_ = 0;
+  key_index_.clear();
+  prev_.clear();
+}
+
+absl::StatusOr<HistoryReader> HistoryReader::Open(std::string dir) {
+  std::error_code ec;
+  if (!std::filesystem::is_directory(dir, ec)) {
+    return absl::NotFoundError(absl::StrCat(dir, " is not a directory"));
+  }
+  return HistoryReader(std::move(dir));
+}
+
+absl::Status HistoryReader::Scan(
+    uint64_t begin_ns, uint64_t end_ns,
+    const std::function<absl::Status(const Snapshot&)>& fn) const {
+  std::vector<HistoryFile> files = ListFiles(dir_);
+  // The last file that starts at or before begin_ns may hold the first
+  // snapshots of the range.
+  auto it = std::partition_point(
+      files.begin(), files.end(),
+      [begin_ns](const HistoryFile& file) { return file.first_ns <= begin_ns; });
+  if (it != files.begin()) {
+    --it;
+  }
+  for (; it != files.end() && it->first_ns < end_ns; ++it) {
+    absl::Status status = ScanFile(it->path, begin_ns, end_ns, fn);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace nvme_bpf
@@ -0,0 +1,167 @@
+#ifndef LATENCY_HISTORY_H_
+#define LATENCY_HISTORY_H_
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "latency_snapshot.h"
+
+namespace nvme_bpf {
+
+// On-disk time series of the nvme_latency interval histograms, for looking at
+// the hours before an incident. Every record holds the IOs of one interval, a
+// time range is the sum of its records.
+//
+// The recorder writes a directory of rotating files named
+// history-<first timestamp ns>.nvlh. A file is a sequence of chunks of
+// consecutive snapshots, every chunk decodes on its own. Within a chunk the
+// histogram keys are defined once and then referenced by index, and every
+// histogram is stored as the delta against the previous record of the same
+// key: a varint bitmask of the changed slots followed by the zigzag varint
+// deltas. Empty histograms are not stored. Each data file has a .idx
+// companion with one fixed size {first_ns, last_ns, offset, size} entry per
+// chunk, the reader binary searches it to seek to a time. When the directory
+// grows above the disk budget the oldest files are removed.
+
+struct HistoryOptions {
+  std::string dir;
+  // The budget of all the files in `dir`, the oldest files are removed to stay
+  // below it.
+  uint64_t max_bytes = 256 << 20;
+  // A new file is started once the current one reaches this size.
+  uint64_t file_bytes = 16 << 20;
+  // The snapshots are buffered and written as one chunk once there are this
+  // many, or the chunk reaches 256KiB, or the histogram layout changes.
+  uint32_t chunk_records = 60;
+};
+
+// Identifies a histogram across the snapshots.
+struct HistoryKey {
+  uint32_t ctrl_id = 0;
+  uint8_t kind = 0;
+  uint8_t opcode = 0;
+  uint8_t size_class = 0;
+  uint8_t saturated = 0;
+
+  static HistoryKey Of(const SnapshotHist& hist) {
+    return {hist.ctrl_id, hist.kind, hist.opcode, hist.size_class,
+            hist.saturated};
+  }
+  auto operator<=>(const HistoryKey&) const = default;
+};
+
+// Turns the cumulative histograms read from the BPF maps into the IOs of one
+// interval, the history records what happened between two reads. The min and
+// max can't be subtracted and stay the extremes since the maps were created.
+// The counts must be the raw ones: the sampling scale changes every interval
+// and only the delta is scaled, see ScaleSnapshot.
+class SnapshotDelta {
+ public:
+  // Returns `cumulative` minus the previous call's. A histogram whose counters
+  // went back, e.g. the maps were recreated, is returned whole, and so is
+  // every histogram after a layout change.
+  Snapshot Next(const Snapshot& cumulative);
+
+ private:
+  int lat_min_us_ = 0;
+  int lat_shift_ = 0;
+  int max_slots_ = 0;
+  std::map<HistoryKey, SnapshotHist> prev_;
+};
+
+// Adds up the scaled intervals of SnapshotDelta. The sums only grow, unlike
+// the raw counts multiplied by the current sampling scale, for exporting the
+// IO counts as counters.
+class SnapshotSum {
+ public:
+  // Adds `interval` and returns the sum since the first call, or since the
+  // last layout change. The IO histograms come before the admin ones.
+  Snapshot Add(const Snapshot& interval);
+
+ private:
+  int lat_min_us_ = 0;
+  int lat_shift_ = 0;
+  int max_slots_ = 0;
+  // Keyed by the kind first, for the order of the histograms.
+  std::map<std::pair<uint8_t, HistoryKey>, SnapshotHist> sums_;
+};
+
+class HistoryWriter {
+ public:
+  // Creates `options.dir` if needed. A new file is started on every Open,
+  // existing files are kept and count against the budget.
+  static absl::StatusOr<HistoryWriter> Open(HistoryOptions options);
+
+  HistoryWriter(HistoryWriter&& other);
+  HistoryWriter& operator=(HistoryWriter&& other) = delete;
+  // Writes out the pending chunk.
+  ~HistoryWriter();
+
+  // Appends the histograms of an interval, see SnapshotDelta, with the IO
+  // counts already scaled by snapshot.count_scale. The timestamps must not go
+  // backwards.
+  absl::Status Append(const Snapshot& snapshot);
+
+  // Writes the buffered snapshots as a chunk.
+  absl::Status Flush();
+
+ private:
+  explicit HistoryWriter(HistoryOptions options)
+      : options_(std::move(options)) {}
+
+  absl::Status OpenFile(uint64_t first_ns);
+  void CloseFile();
+  absl::Status EnforceBudget();
+  void ResetChunk();
+
+  HistoryOptions options_;
+  int data_fd_ = -1;
+  int index_fd_ = -1;
+  std::string data_path_;
+  uint64_t data_size_ = 0;
+
+  // The chunk being built.
+  std::string payload_;
+  uint32_t record_count_ = 0;
+  uint64_t first_ns_ = 0;
+  uint64_t last_ns_ = 0;
+  int lat_min_us_ = 0;
+  int lat_shift_ = 0;
+  int max_slots_ = 0;
+  // The scale of the first and of the last record.
+  double count_scale_ = 1.0;
+  double last_count_scale_ = 1.0;
+  std::map<HistoryKey, uint32_t> key_index_;
+  // The previous record of every key, indexed like key_index_.
+  std::vector<SnapshotHist> prev_;
+};
+
+class HistoryReader {
+ public:
+  static absl::StatusOr<HistoryReader> Open(std::string dir);
+
+  // Calls `fn` with every recorded snapshot that has begin_ns <= timestamp_ns
+  // < end_ns, in time order. Stops at the first error returned by `fn`.
+  // Chunks that are truncated or corrupt are skipped.
+  absl::Status Scan(
+      uint64_t begin_ns, uint64_t end_ns,
+      const std::function<absl::Status(const Snapshot&)>& fn) const;
+
+ private:
+  explicit HistoryReader(std::string dir) : dir_(std::move(dir)) {}
+
+  std::string dir_;
+};
+
+// Adds the counts of `from` to `to`, the keys are not checked.
+void MergeSnapshotHist(const SnapshotHist& from, SnapshotHist* to);
+
+}  // namespace nvme_bpf
+
+#endif /* LATENCY_HISTORY_H_ */
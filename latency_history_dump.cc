@@ -0,0 +1,236 @@
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/log/initialize.h"
+#include "absl/status/status.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "histogram.h"
+#include "latency_history.h"
+#include "nvme_abi.h"
+#include "nvme_strings.h"
+
+/*
+Extracts a time range of the histograms recorded by nvme_latency
+--history_dir, either merged into one histogram per key or as a percentile
+series.
+
+bazel build :latency_history_dump && \
+  bazel-bin/latency_history_dump --history_dir=/var/lib/nvme_latency \
+    --start=2026-01-02T03:00:00Z --end=2026-01-02T04:00:00Z --ctrl_id=0
+
+bazel-bin/latency_history_dump --history_dir=/var/lib/nvme_latency \
+  --last=6h --step=1m --opcode=Read --percentiles=50,99,99.9
+*/
+
+ABSL_FLAG(std::string, history_dir, "",
+          "The directory written by nvme_latency --history_dir.");
+ABSL_FLAG(absl::Time, start, absl::InfinitePast(),
+          "The start of the range, RFC3339.");
+ABSL_FLAG(absl::Time, end, absl::InfiniteFuture(),
+          "The end of the range, RFC3339.");
+ABSL_FLAG(absl::Duration, last, absl::ZeroDuration(),
+          "If set the range is the last `last` until now, overrides --start "
+          "and --end.");
+ABSL_FLAG(int, ctrl_id, -1, "Only the histograms of this controller.");
+ABSL_FLAG(std::string, opcode, "",
+          "Only the histograms of this opcode, a number or a name such as "
+          "Read or Identify.");
+ABSL_FLAG(bool, admin, false,
+          "Extracts the admin command histograms instead of the IO ones.");
+ABSL_FLAG(absl::Duration, step, absl::ZeroDuration(),
+          "If set prints the percentiles of every step instead of one merged "
+          "histogram per key.");
+ABSL_FLAG(std::vector<std::string>, percentiles,
+          std::vector<std::string>({"50", "90", "99", "99.9"}),
+          "The percentiles printed with --step.");
+
+namespace {
+
+using nvme_bpf::HistoryKey;
+using nvme_bpf::Snapshot;
+using nvme_bpf::SnapshotHist;
+
+uint64_t RangeNanos(absl::Time t) {
+  if (t <= absl::UnixEpoch()) {
+    return 0;
+  }
+  if (t == absl::InfiniteFuture()) {
+    return UINT64_MAX;
+  }
+  return absl::ToUnixNanos(t);
+}
+
+std::string KeyToString(const HistoryKey& key) {
+  auto opcode = static_cast<nvme_abi::NvmeOpcode>(key.opcode);
+  if (key.kind == nvme_bpf::kSnapshotHistAdmin) {
+    return absl::StrCat("ctrl_id=", key.ctrl_id,
+                        " opcode=", nvme_abi::NvmeAdminOpcodeToString(opcode));
+  }
+  return absl::StrCat("ctrl_id=", key.ctrl_id,
+                      " opcode=", nvme_abi::NvmeIoOpcodeToString(opcode),
+                      " size_class=", key.size_class,
+                      key.saturated ? " saturated" : "");
+}
+
+// Merges the matching histograms of a time range.
+class Merger {
+ public:
+  // `opcode` -1 matches all the opcodes.
+  Merger(uint8_t kind, int opcode)
+      : kind_(kind), ctrl_id_(absl::GetFlag(FLAGS_ctrl_id)), opcode_(opcode) {}
+
+  absl::Status Add(const Snapshot& snapshot) {
+    if (layout_.max_slots == 0) {
+      layout_.lat_min_us = snapshot.lat_min_us;
+      layout_.lat_shift = snapshot.lat_shift;
+      layout_.max_slots = snapshot.max_slots;
+    } else if (snapshot.lat_min_us != layout_.lat_min_us ||
+               snapshot.lat_shift != layout_.lat_shift ||
+               snapshot.max_slots != layout_.max_slots) {
+      return absl::FailedPreconditionError(absl::StrCat(
+          "The histogram layout changed at ",
+          absl::FormatTime(absl::FromUnixNanos(snapshot.timestamp_ns)),
+          ", narrow the range"));
+    }
+    for (const SnapshotHist& hist : snapshot.hists) {
+      if (hist.kind != kind_ || (ctrl_id_ >= 0 && hist.ctrl_id != ctrl_id_) ||
+          (opcode_ >= 0 && hist.opcode != opcode_)) {
+        continue;
+      }
+      auto [it, inserted] = merged_.try_emplace(HistoryKey::Of(hist));
+      nvme_bpf::MergeSnapshotHist(hist, &it->second);
+    }
+    return absl::OkStatus();
+  }
+
+  nvme_bpf::Histogram ToHistogram(const SnapshotHist& hist) const {
+    nvme_bpf::Histogram h = layout_;
+    h.slots = hist.slots;
+    h.total_count = hist.total_count;
+    h.total_sum = hist.total_sum;
+    h.total_sum_sq = hist.total_sum_sq;
+    h.overflow_count = hist.overflow_count;
+    h.min = hist.min;
+    h.max = hist.max;
+    return h;
+  }
+
+  const std::map<HistoryKey, SnapshotHist>& merged() const { return merged_; }
+  void Clear() { merged_.clear(); }
+
+ private:
+  uint8_t kind_;
+  int64_t ctrl_id_;
+  int opcode_;
+  nvme_bpf::Histogram layout_;
+  std::map<HistoryKey, SnapshotHist> merged_;
+};
+
+void PrintPercentiles(absl::Time step_start, const Merger& merger,
+                      const std::vector<double>& percentiles) {
+  for (const auto& [key, hist] : merger.merged()) {
+    nvme_bpf::Histogram h = merger.ToHistogram(hist);
+    std::cout << absl::FormatTime(step_start) << " " << KeyToString(key)
+              << " count=" << hist.total_count;
+    for (double p : percentiles) {
+      std::cout << " p" << p << "=" << h.percentile(p / 100) << "us";
+    }
+    std::cout << std::endl;
+  }
+}
+
+absl::Status Dump() {
+  auto reader = nvme_bpf::HistoryReader::Open(absl::GetFlag(FLAGS_history_dir));
+  if (!reader.ok()) {
+    return reader.status();
+  }
+  absl::Time start = absl::GetFlag(FLAGS_start);
+  absl::Time end = absl::GetFlag(FLAGS_end);
+  auto last = absl::GetFlag(FLAGS_last);
+  if (last > absl::ZeroDuration()) {
+    end = absl::Now();
+    start = end - last;
+  }
+  std::vector<double> percentiles;
+  for (const auto& p : absl::GetFlag(FLAGS_percentiles)) {
+    double value;
+    if (!absl::SimpleAtod(p, &value) || value < 0 || value > 100) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid percentile '", p, "'"));
+    }
+    percentiles.push_back(value);
+  }
+
+  const bool admin = absl::GetFlag(FLAGS_admin);
+  int opcode = -1;
+  if (std::string text = absl::GetFlag(FLAGS_opcode); !text.empty()) {
+    auto parsed = nvme_abi::ParseNvmeOpcode(text, admin);
+    if (!parsed.has_value()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid opcode '", text, "'"));
+    }
+    opcode = static_cast<int>(*parsed);
+  }
+
+  Merger merger(
+      admin ? nvme_bpf::kSnapshotHistAdmin : nvme_bpf::kSnapshotHistIo,
+      opcode);
+  auto step = absl::GetFlag(FLAGS_step);
+  if (step <= absl::ZeroDuration()) {
+    auto status = reader->Scan(
+        RangeNanos(start), RangeNanos(end),
+        [&merger](const Snapshot& snapshot) { return merger.Add(snapshot); });
+    if (!status.ok()) {
+      return status;
+    }
+    for (const auto& [key, hist] : merger.merged()) {
+      std::cout << "key: " << KeyToString(key) << std::endl;
+      nvme_bpf::PrintHistogram(merger.ToHistogram(hist)).IgnoreError();
+    }
+    return absl::OkStatus();
+  }
+
+  // The steps are aligned to multiples of `step` since the epoch.
+  std::optional<absl::Time> step_start;
+  auto status = reader->Scan(
+      RangeNanos(start), RangeNanos(end),
+      [&](const Snapshot& snapshot) {
+        absl::Time t = absl::Floor(absl::FromUnixNanos(snapshot.timestamp_ns) -
+                                       absl::UnixEpoch(),
+                                   step) +
+                       absl::UnixEpoch();
+        if (step_start.has_value() && *step_start != t) {
+          PrintPercentiles(*step_start, merger, percentiles);
+          merger.Clear();
+        }
+        step_start = t;
+        return merger.Add(snapshot);
+      });
+  if (step_start.has_value()) {
+    PrintPercentiles(*step_start, merger, percentiles);
+  }
+  return status;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  absl::InitializeLog();
+
+  auto status = Dump();
+  if (!status.ok()) {
+    std::cerr << status << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,434 @@
+#include "latency_history.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "gtest/gtest.h"
+
+/*
+bazel test --test_output=streamed :latency_history_test
+ */
+
+namespace {
+
+using nvme_bpf::HistoryOptions;
+using nvme_bpf::HistoryReader;
+using nvme_bpf::HistoryWriter;
+using nvme_bpf::Snapshot;
+using nvme_bpf::SnapshotHist;
+
+constexpr uint64_t kSecond = 1000000000;
+
+std::string TestDir(const char* name) {
+  std::filesystem::path dir =
+      std::filesystem::path(::testing::TempDir()) / "latency_history" / name;
+  std::filesystem::remove_all(dir);
+  return dir.string();
+}
+
+// `key_count` histograms with a few random slots, like one second of IO.
+Snapshot MakeSnapshot(std::mt19937_64& rng, uint64_t ts, int key_count) {
+  Snapshot snapshot;
+  snapshot.timestamp_ns = ts;
+  snapshot.lat_min_us = 20;
+  snapshot.lat_shift = 1;
+  snapshot.max_slots = LATENCY_MAX_SLOTS;
+  snapshot.count_scale = 1.0;
+  for (int i = 0; i < key_count; ++i) {
+    SnapshotHist hist = {};
+    hist.ctrl_id = i / 8;
+    hist.opcode = i % 2 + 1;
+    hist.size_class = i / 2 % 4;
+    hist.saturated = i % 8 >= 6;
+    for (int slot = 5; slot < 12; ++slot) {
+      hist.slots[slot] = rng() % 1000;
+      hist.total_count += hist.slots[slot];
+      hist.total_sum += hist.slots[slot] * (50 << (slot - 5));
+      hist.total_sum_sq += hist.slots[slot] * (2500 << (2 * (slot - 5)));
+    }
+    hist.min = 40 + rng() % 10;
+    hist.max = 3200 + rng() % 100;
+    // The IOs above the last bucket are only in the total count.
+    hist.overflow_count = rng() % 2;
+    hist.total_count += hist.overflow_count;
+    snapshot.hists.push_back(hist);
+  }
+  return snapshot;
+}
+
+void ExpectSameHist(const SnapshotHist& a, const SnapshotHist& b) {
+  EXPECT_EQ(nvme_bpf::HistoryKey::Of(a), nvme_bpf::HistoryKey::Of(b));
+  EXPECT_EQ(a.total_count, b.total_count);
+  EXPECT_EQ(a.total_sum, b.total_sum);
+  EXPECT_EQ(a.total_sum_sq, b.total_sum_sq);
+  EXPECT_EQ(a.overflow_count, b.overflow_count);
+  EXPECT_EQ(a.min, b.min);
+  EXPECT_EQ(a.max, b.max);
+  for (uint32_t slot = 0; slot < nvme_bpf::kSnapshotSlots; ++slot) {
+    EXPECT_EQ(a.slots[slot], b.slots[slot]) << slot;
+  }
+}
+
+std::vector<Snapshot> ScanAll(const std::string& dir, uint64_t begin_ns,
+                              uint64_t end_ns) {
+  auto reader = HistoryReader::Open(dir);
+  EXPECT_TRUE(reader.ok()) << reader.status();
+  std::vector<Snapshot> snapshots;
+  EXPECT_TRUE(reader
+                  ->Scan(begin_ns, end_ns,
+                         [&snapshots](const Snapshot& snapshot) {
+                           snapshots.push_back(snapshot);
+                           return absl::OkStatus();
+                         })
+                  .ok());
+  return snapshots;
+}
+
+TEST(LatencyHistory, RoundTrip) {
+  HistoryOptions options;
+  options.dir = TestDir("round_trip");
+  options.chunk_records = 7;
+  std::mt19937_64 rng(1);
+  std::vector<Snapshot> written;
+  {
+    auto writer = HistoryWriter::Open(options);
+    ASSERT_TRUE(writer.ok()) << writer.status();
+    for (int i = 0; i < 50; ++i) {
+      written.push_back(MakeSnapshot(rng, (100 + i) * kSecond, 16));
+      // Idle keys are not stored.
+      written.back().hists[3] = SnapshotHist{};
+      ASSERT_TRUE(writer->Append(written.back()).ok());
+    }
+  }
+
+  std::vector<Snapshot> read = ScanAll(options.dir, 0, UINT64_MAX);
+  ASSERT_EQ(read.size(), written.size());
+  for (size_t i = 0; i < read.size(); ++i) {
+    EXPECT_EQ(read[i].timestamp_ns, written[i].timestamp_ns);
+    EXPECT_EQ(read[i].lat_min_us, 20);
+    EXPECT_EQ(read[i].max_slots, LATENCY_MAX_SLOTS);
+    ASSERT_EQ(read[i].hists.size(), 15);
+    for (size_t h = 0; h < read[i].hists.size(); ++h) {
+      ExpectSameHist(read[i].hists[h], written[i].hists[h < 3 ? h : h + 1]);
+    }
+  }
+
+  read = ScanAll(options.dir, 120 * kSecond, 125 * kSecond);
+  ASSERT_EQ(read.size(), 5);
+  EXPECT_EQ(read.front().timestamp_ns, 120 * kSecond);
+  EXPECT_EQ(read.back().timestamp_ns, 124 * kSecond);
+  EXPECT_TRUE(ScanAll(options.dir, 200 * kSecond, 300 * kSecond).empty());
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(LatencyHistory, Compact) {
+  HistoryOptions options;
+  options.dir = TestDir("compact");
+  std::mt19937_64 rng(2);
+  const int kKeys = 200;
+  const int kSeconds = 600;
+  {
+    auto writer = HistoryWriter::Open(options);
+    ASSERT_TRUE(writer.ok()) << writer.status();
+    for (int i = 0; i < kSeconds; ++i) {
+      ASSERT_TRUE(writer->Append(MakeSnapshot(rng, i * kSecond, kKeys)).ok());
+    }
+  }
+  uint64_t bytes = 0;
+  for (const auto& entry : std::filesystem::directory_iterator(options.dir)) {
+    bytes += entry.file_size();
+  }
+  // 7 random slots of up to 1000, the sums and the extremes, vs 272 bytes in
+  // memory.
+  EXPECT_LT(bytes / (kKeys * kSeconds), 32);
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(LatencyHistory, RotatesWithinBudget) {
+  HistoryOptions options;
+  options.dir = TestDir("rotate");
+  options.chunk_records = 10;
+  options.file_bytes = 16 << 10;
+  options.max_bytes = 64 << 10;
+  std::mt19937_64 rng(3);
+  {
+    auto writer = HistoryWriter::Open(options);
+    ASSERT_TRUE(writer.ok()) << writer.status();
+    for (int i = 0; i < 2000; ++i) {
+      ASSERT_TRUE(writer->Append(MakeSnapshot(rng, i * kSecond, 4)).ok());
+    }
+  }
+  uint64_t bytes = 0;
+  int files = 0;
+  for (const auto& entry : std::filesystem::directory_iterator(options.dir)) {
+    bytes += entry.file_size();
+    ++files;
+  }
+  EXPECT_LE(bytes, options.max_bytes);
+  EXPECT_GT(files, 4);
+
+  // The oldest snapshots are gone, the rest is contiguous up to the end.
+  std::vector<Snapshot> read = ScanAll(options.dir, 0, UINT64_MAX);
+  ASSERT_FALSE(read.empty());
+  EXPECT_GT(read.front().timestamp_ns, 0);
+  EXPECT_EQ(read.back().timestamp_ns, 1999 * kSecond);
+  for (size_t i = 1; i < read.size(); ++i) {
+    EXPECT_EQ(read[i].timestamp_ns, read[i - 1].timestamp_ns + kSecond);
+  }
+
+  // Seeking into the middle of the retained range.
+  uint64_t mid = read[read.size() / 2].timestamp_ns;
+  std::vector<Snapshot> tail = ScanAll(options.dir, mid, mid + 3 * kSecond);
+  ASSERT_EQ(tail.size(), 3);
+  EXPECT_EQ(tail.front().timestamp_ns, mid);
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(LatencyHistory, LayoutChangeStartsAChunk) {
+  HistoryOptions options;
+  options.dir = TestDir("layout");
+  std::mt19937_64 rng(4);
+  {
+    auto writer = HistoryWriter::Open(options);
+    ASSERT_TRUE(writer.ok()) << writer.status();
+    Snapshot snapshot = MakeSnapshot(rng, kSecond, 2);
+    ASSERT_TRUE(writer->Append(snapshot).ok());
+    snapshot = MakeSnapshot(rng, 2 * kSecond, 2);
+    snapshot.lat_shift = 2;
+    ASSERT_TRUE(writer->Append(snapshot).ok());
+    snapshot.timestamp_ns = 0;
+    EXPECT_EQ(writer->Append(snapshot).code(),
+              absl::StatusCode::kInvalidArgument);
+  }
+  std::vector<Snapshot> read = ScanAll(options.dir, 0, UINT64_MAX);
+  ASSERT_EQ(read.size(), 2);
+  EXPECT_EQ(read[0].lat_shift, 1);
+  EXPECT_EQ(read[1].lat_shift, 2);
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(LatencyHistory, SkipsTruncatedChunk) {
+  HistoryOptions options;
+  options.dir = TestDir("truncated");
+  options.chunk_records = 5;
+  std::mt19937_64 rng(5);
+  {
+    auto writer = HistoryWriter::Open(options);
+    ASSERT_TRUE(writer.ok()) << writer.status();
+    for (int i = 0; i < 10; ++i) {
+      ASSERT_TRUE(writer->Append(MakeSnapshot(rng, i * kSecond, 4)).ok());
+    }
+  }
+  for (const auto& entry : std::filesystem::directory_iterator(options.dir)) {
+    if (entry.path().extension() == ".nvlh") {
+      std::filesystem::resize_file(entry.path(), entry.file_size() - 1);
+    }
+  }
+  EXPECT_EQ(ScanAll(options.dir, 0, UINT64_MAX).size(), 5);
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(LatencyHistory, RecordsTheIntervals) {
+  HistoryOptions options;
+  options.dir = TestDir("RecordsTheIntervals");
+  // The cumulative maps: 100 IOs before the start, then 10 per interval on
+  // one key while the other stays idle.
+  Snapshot cumulative;
+  cumulative.lat_min_us = 20;
+  cumulative.lat_shift = 1;
+  cumulative.max_slots = LATENCY_MAX_SLOTS;
+  SnapshotHist busy = {};
+  busy.opcode = 2;
+  SnapshotHist idle = {};
+  idle.opcode = 1;
+  auto add = [](SnapshotHist* hist, uint32_t slot, uint64_t count) {
+    hist->slots[slot] += count;
+    hist->total_count += count;
+    hist->total_sum += count * 100;
+  };
+  add(&busy, 3, 100);
+  add(&idle, 3, 5);
+  cumulative.hists = {busy, idle};
+
+  nvme_bpf::SnapshotDelta delta;
+  delta.Next(cumulative);
+  {
+    auto writer = HistoryWriter::Open(options);
+    ASSERT_TRUE(writer.ok()) << writer.status();
+    for (uint64_t i = 1; i <= 3; ++i) {
+      cumulative.timestamp_ns = i * kSecond;
+      add(&busy, 3 + i, 10);
+      cumulative.hists = {busy, idle};
+      ASSERT_TRUE(writer->Append(delta.Next(cumulative)).ok());
+    }
+  }
+
+  std::vector<Snapshot> snapshots = ScanAll(options.dir, 0, UINT64_MAX);
+  ASSERT_EQ(snapshots.size(), 3);
+  SnapshotHist merged = {};
+  for (const Snapshot& snapshot : snapshots) {
+    // The idle key is not recorded.
+    ASSERT_EQ(snapshot.hists.size(), 1);
+    EXPECT_EQ(snapshot.hists[0].total_count, 10);
+    nvme_bpf::MergeSnapshotHist(snapshot.hists[0], &merged);
+  }
+  // The range is the last cumulative read minus the first.
+  EXPECT_EQ(merged.total_count, 30);
+  EXPECT_EQ(merged.total_sum, 3000);
+  EXPECT_EQ(merged.slots[3], 0);
+  EXPECT_EQ(merged.slots[4], 10);
+  EXPECT_EQ(merged.slots[6], 10);
+  std::filesystem::remove_all(options.dir);
+}
+
+// The sampling scale changes every interval, only the raw delta is scaled.
+TEST(LatencyHistory, ScaleChangesBetweenIntervals) {
+  HistoryOptions options;
+  options.dir = TestDir("ScaleChangesBetweenIntervals");
+  Snapshot cumulative;
+  cumulative.lat_min_us = 20;
+  cumulative.lat_shift = 1;
+  cumulative.max_slots = LATENCY_MAX_SLOTS;
+  SnapshotHist busy = {};
+  busy.opcode = 2;
+  busy.slots[3] = 100;
+  busy.total_count = 100;
+  SnapshotHist idle = busy;
+  idle.opcode = 1;
+  cumulative.hists = {busy, idle};
+
+  const double scales[] = {4.0, 2.0, 8.0, 3.0};
+  nvme_bpf::SnapshotDelta delta;
+  delta.Next(cumulative);
+  {
+    auto writer = HistoryWriter::Open(options);
+    ASSERT_TRUE(writer.ok()) << writer.status();
+    for (uint64_t i = 1; i <= 4; ++i) {
+      cumulative.timestamp_ns = i * kSecond;
+      cumulative.hists[0].slots[3] += 10;
+      cumulative.hists[0].total_count += 10;
+      Snapshot interval = delta.Next(cumulative);
+      nvme_bpf::ScaleSnapshot(scales[i - 1], &interval);
+      ASSERT_TRUE(writer->Append(interval).ok());
+    }
+  }
+
+  std::vector<Snapshot> snapshots = ScanAll(options.dir, 0, UINT64_MAX);
+  ASSERT_EQ(snapshots.size(), 4);
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(snapshots[i].count_scale, scales[i]);
+    // Neither a drop of the scale reads as a reset nor a rise gives the idle
+    // key IOs.
+    ASSERT_EQ(snapshots[i].hists.size(), 1);
+    EXPECT_EQ(snapshots[i].hists[0].total_count, 10 * scales[i]);
+    EXPECT_EQ(snapshots[i].hists[0].slots[3], 10 * scales[i]);
+  }
+  // All the records are in one chunk.
+  uint64_t index_bytes = 0;
+  for (const auto& entry : std::filesystem::directory_iterator(options.dir)) {
+    if (entry.path().extension() == ".idx") {
+      index_bytes += entry.file_size();
+    }
+  }
+  EXPECT_EQ(index_bytes, 32);
+  std::filesystem::remove_all(options.dir);
+}
+
+TEST(LatencyHistory, DeltaAfterReset) {
+  Snapshot cumulative;
+  cumulative.max_slots = LATENCY_MAX_SLOTS;
+  SnapshotHist hist = {};
+  hist.slots[2] = 50;
+  hist.total_count = 50;
+  cumulative.hists = {hist};
+  nvme_bpf::SnapshotDelta delta;
+  delta.Next(cumulative);
+
+  // The maps were recreated, the counts start over.
+  cumulative.hists[0].slots[2] = 7;
+  cumulative.hists[0].total_count = 7;
+  Snapshot next = delta.Next(cumulative);
+  ASSERT_EQ(next.hists.size(), 1);
+  EXPECT_EQ(next.hists[0].total_count, 7);
+  EXPECT_EQ(next.hists[0].slots[2], 7);
+
+  cumulative.hists[0].slots[2] = 9;
+  cumulative.hists[0].total_count = 9;
+  next = delta.Next(cumulative);
+  EXPECT_EQ(next.hists[0].total_count, 2);
+}
+
+// The raw counts times the current scale would go from 400 to 220.
+TEST(LatencyHistory, SumOfScaledIntervalsNeverGoesBack) {
+  Snapshot cumulative;
+  cumulative.max_slots = LATENCY_MAX_SLOTS;
+  SnapshotHist admin = {};
+  admin.kind = nvme_bpf::kSnapshotHistAdmin;
+  admin.slots[2] = 3;
+  admin.total_count = 3;
+  SnapshotHist io = {};
+  io.slots[2] = 100;
+  io.total_count = 100;
+  cumulative.hists = {admin, io};
+
+  nvme_bpf::SnapshotDelta delta;
+  nvme_bpf::SnapshotSum sum;
+  Snapshot interval = delta.Next(cumulative);
+  nvme_bpf::ScaleSnapshot(4.0, &interval);
+  Snapshot first = sum.Add(interval);
+  ASSERT_EQ(first.hists.size(), 2);
+  EXPECT_EQ(first.hists[0].kind, nvme_bpf::kSnapshotHistIo);
+  EXPECT_EQ(first.hists[0].total_count, 400);
+  EXPECT_EQ(first.hists[1].total_count, 3);
+
+  cumulative.hists[1].slots[2] = 110;
+  cumulative.hists[1].total_count = 110;
+  interval = delta.Next(cumulative);
+  nvme_bpf::ScaleSnapshot(2.0, &interval);
+  Snapshot second = sum.Add(interval);
+  ASSERT_EQ(second.hists.size(), 2);
+  EXPECT_EQ(second.hists[0].total_count, 420);
+  EXPECT_EQ(second.hists[0].slots[2], 420);
+  EXPECT_EQ(second.hists[1].total_count, 3);
+  EXPECT_EQ(second.count_scale, 2.0);
+
+  // The buckets restart with the layout.
+  cumulative.lat_shift = 1;
+  interval = delta.Next(cumulative);
+  EXPECT_EQ(sum.Add(interval).hists[0].total_count, 110);
+}
+
+TEST(LatencyHistory, MergeSnapshotHist) {
+  SnapshotHist a = {};
+  SnapshotHist b = {};
+  a.slots[0] = 1;
+  a.total_count = 1;
+  a.total_sum = 10;
+  a.min = a.max = 10;
+  b.slots[0] = 2;
+  b.slots[3] = 4;
+  b.total_count = 6;
+  b.total_sum = 100;
+  b.overflow_count = 1;
+  b.min = 12;
+  b.max = 40;
+  nvme_bpf::MergeSnapshotHist(b, &a);
+  EXPECT_EQ(a.slots[0], 3);
+  EXPECT_EQ(a.slots[3], 4);
+  EXPECT_EQ(a.total_count, 7);
+  EXPECT_EQ(a.total_sum, 110);
+  EXPECT_EQ(a.overflow_count, 1);
+  EXPECT_EQ(a.min, 10);
+  EXPECT_EQ(a.max, 40);
+
+  // Into an empty histogram the extremes are copied.
+  SnapshotHist empty = {};
+  nvme_bpf::MergeSnapshotHist(b, &empty);
+  EXPECT_EQ(empty.min, 12);
+}
+
+}  // namespace
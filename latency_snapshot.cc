@@ -0,0 +1,195 @@
+#include "latency_snapshot.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+
+#include "absl/strings/str_cat.h"
+
+namespace nvme_bpf {
+
+namespace {
+
+uint64_t RoundScaled(uint64_t value, double factor) {
+  return static_cast<uint64_t>(std::llround(value * factor));
+}
+
+}  // namespace
+
+void ScaleSnapshot(double count_scale, Snapshot* snapshot) {
+  snapshot->count_scale = count_scale;
+  for (SnapshotHist& hist : snapshot->hists) {
+    if (hist.kind != kSnapshotHistIo) {
+      continue;
+    }
+    uint64_t slot_count = 0;
+    uint64_t scaled_count = 0;
+    for (u64& slot : hist.slots) {
+      slot_count += slot;
+      slot = RoundScaled(slot, count_scale);
+      scaled_count += slot;
+    }
+    // The values above the last bucket.
+    hist.total_count =
+        scaled_count + RoundScaled(hist.total_count - slot_count, count_scale);
+    hist.total_sum = RoundScaled(hist.total_sum, count_scale);
+    hist.total_sum_sq = RoundScaled(hist.total_sum_sq, count_scale);
+    hist.overflow_count = RoundScaled(hist.overflow_count, count_scale);
+  }
+}
+
+absl::StatusOr<SnapshotWriter> SnapshotWriter::Create(const std::string& name) {
+  int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+  if (fd < 0) {
+    return absl::InternalError(
+        absl::StrCat("shm_open(", name, ") failed, errno=", errno));
+  }
+  // ftruncate zero fills, a reader that maps the segment before the first
+  // publication sees seq == 0.
+  if (ftruncate(fd, 0) != 0 || ftruncate(fd, sizeof(SnapshotSegment)) != 0) {
+    int err = errno;
+    close(fd);
+    return absl::InternalError(
+        absl::StrCat("ftruncate(", name, ") failed, errno=", err));
+  }
+  void* addr = mmap(nullptr, sizeof(SnapshotSegment), PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+  int err = errno;
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return absl::InternalError(
+        absl::StrCat("mmap(", name, ") failed, errno=", err));
+  }
+  auto* segment = static_cast<SnapshotSegment*>(addr);
+  segment->header.magic = kSnapshotMagic;
+  segment->header.version = kSnapshotVersion;
+  return SnapshotWriter(name, segment);
+}
+
+SnapshotWriter::SnapshotWriter(SnapshotWriter&& other)
+    : name_(std::move(other.name_)), segment_(other.segment_) {
+  other.segment_ = nullptr;
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  if (segment_ != nullptr) {
+    munmap(segment_, sizeof(SnapshotSegment));
+  }
+}
+
+absl::Status SnapshotWriter::Publish(const Snapshot& snapshot) {
+  SnapshotHeader& header = segment_->header;
+  uint32_t hist_count = std::min<size_t>(snapshot.hists.size(),
+                                         kSnapshotMaxHists);
+
+  uint64_t seq = header.seq.load(std::memory_order_relaxed);
+  header.seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  header.timestamp_ns = snapshot.timestamp_ns;
+  header.lat_min_us = snapshot.lat_min_us;
+  header.lat_shift = snapshot.lat_shift;
+  header.max_slots = snapshot.max_slots;
+  header.count_scale = snapshot.count_scale;
+  header.hist_count = hist_count;
+  std::memcpy(segment_->hists, snapshot.hists.data(),
+              hist_count * sizeof(SnapshotHist));
+
+  header.seq.store(seq + 2, std::memory_order_release);
+
+  if (hist_count < snapshot.hists.size()) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Snapshot truncated to ", kSnapshotMaxHists, " of ",
+                     snapshot.hists.size(), " histograms"));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SnapshotWriter::Unlink() {
+  if (shm_unlink(name_.c_str()) != 0) {
+    return absl::InternalError(
+        absl::StrCat("shm_unlink(", name_, ") failed, errno=", errno));
+  }
+  return absl::OkStatus();
+}
+
+absl::StatusOr<SnapshotReader> SnapshotReader::Open(const std::string& name) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return absl::NotFoundError(
+        absl::StrCat("shm_open(", name, ") failed, errno=", errno));
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(SnapshotSegment)) {
+    close(fd);
+    return absl::FailedPreconditionError(
+        absl::StrCat(name, " is not a snapshot segment of this version"));
+  }
+  void* addr =
+      mmap(nullptr, sizeof(SnapshotSegment), PROT_READ, MAP_SHARED, fd, 0);
+  int err = errno;
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return absl::InternalError(
+        absl::StrCat("mmap(", name, ") failed, errno=", err));
+  }
+  const auto* segment = static_cast<const SnapshotSegment*>(addr);
+  if (segment->header.magic != kSnapshotMagic ||
+      segment->header.version != kSnapshotVersion) {
+    munmap(addr, sizeof(SnapshotSegment));
+    return absl::FailedPreconditionError(absl::StrCat(
+        name, " has magic 0x", absl::Hex(segment->header.magic), " version ",
+        segment->header.version, ", expected version ", kSnapshotVersion));
+  }
+  return SnapshotReader(segment);
+}
+
+SnapshotReader::SnapshotReader(SnapshotReader&& other)
+    : segment_(other.segment_) {
+  other.segment_ = nullptr;
+}
+
+SnapshotReader::~SnapshotReader() {
+  if (segment_ != nullptr) {
+    munmap(const_cast<SnapshotSegment*>(segment_), sizeof(SnapshotSegment));
+  }
+}
+
+absl::StatusOr<Snapshot> SnapshotReader::Read(int max_attempts) const {
+  const SnapshotHeader& header = segment_->header;
+  Snapshot snapshot;
+  for (int attempt = 0; attempt < max_attempts; ++attempt) {
+    uint64_t seq = header.seq.load(std::memory_order_acquire);
+    if (seq == 0) {
+      return absl::UnavailableError("Nothing published yet");
+    }
+    if (seq & 1) {
+      continue;
+    }
+    snapshot.timestamp_ns = header.timestamp_ns;
+    snapshot.lat_min_us = header.lat_min_us;
+    snapshot.lat_shift = header.lat_shift;
+    snapshot.max_slots = header.max_slots;
+    snapshot.count_scale = header.count_scale;
+    uint32_t hist_count = std::min(header.hist_count, kSnapshotMaxHists);
+    snapshot.hists.resize(hist_count);
+    std::memcpy(snapshot.hists.data(), segment_->hists,
+                hist_count * sizeof(SnapshotHist));
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header.seq.load(std::memory_order_relaxed) == seq) {
+      return snapshot;
+    }
+  }
+  return absl::UnavailableError(
+      absl::StrCat("No consistent snapshot after ", max_attempts, " attempts"));
+}
+
+}  // namespace nvme_bpf
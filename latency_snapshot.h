@@ -0,0 +1,160 @@
+#ifndef LATENCY_SNAPSHOT_H_
+#define LATENCY_SNAPSHOT_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "bucket_layout.h"
+#include "nvme_latency.h"
+
+namespace nvme_bpf {
+
+// Shared memory publication of the nvme_latency histograms. The writer
+// (nvme_latency --shm_name) republishes the whole segment every interval, any
+// number of local readers map it read-only and copy a consistent snapshot out
+// without syscalls.
+//
+// The segment has a fixed binary layout: a SnapshotHeader followed by
+// kSnapshotMaxHists SnapshotHist entries, of which header.hist_count are
+// valid. header.seq is a seqlock: odd while the writer is updating the
+// segment. Readers retry when seq is odd or changed during their copy.
+// Incompatible layout changes bump kSnapshotVersion.
+
+inline constexpr uint32_t kSnapshotMagic = 0x534c564e;  // "NVLS"
+inline constexpr uint32_t kSnapshotVersion = 2;
+inline constexpr uint32_t kSnapshotMaxHists = 512;
+inline constexpr uint32_t kSnapshotSlots = LATENCY_MAX_SLOTS + 1;
+
+using LatencyBucketLayout = BucketLayout<LATENCY_MAX_SLOTS>;
+
+// The layout of the BPF histograms without --lat_min_us and --lat_shift.
+inline constexpr LatencyBucketLayout kDefaultLatencyLayout =
+    LatencyBucketLayout::Make(LATENCY_DEFAULT_MIN_US, LATENCY_DEFAULT_SHIFT);
+
+static_assert(sizeof(latency_hist::slots) / sizeof(u64) ==
+              LatencyBucketLayout::kSlots);
+static_assert(kSnapshotSlots == LatencyBucketLayout::kSlots);
+static_assert(kDefaultLatencyLayout.high[0] == 21);
+static_assert(kDefaultLatencyLayout.high[LATENCY_MAX_SLOTS - 1] ==
+              20 + (uint64_t{1} << (LATENCY_MAX_SLOTS - 1)));
+static_assert(kDefaultLatencyLayout.Slot(19) == LATENCY_MAX_SLOTS);
+static_assert(kDefaultLatencyLayout.Slot(120) == 7);
+
+enum SnapshotHistKind : uint8_t {
+  kSnapshotHistIo = 0,
+  kSnapshotHistAdmin = 1,
+};
+
+struct SnapshotHeader {
+  uint32_t magic;
+  uint32_t version;
+  std::atomic<uint64_t> seq;
+  // CLOCK_REALTIME of the publication.
+  uint64_t timestamp_ns;
+  // The histogram layout, see nvme_bpf::Histogram.
+  int32_t lat_min_us;
+  int32_t lat_shift;
+  int32_t max_slots;
+  uint32_t hist_count;
+  // The IO counts are already scaled by the sampling rate, this is the scale
+  // that was applied.
+  double count_scale;
+};
+
+struct SnapshotHist {
+  uint32_t ctrl_id;
+  uint8_t kind;
+  uint8_t opcode;
+  uint8_t size_class;
+  uint8_t saturated;
+  uint64_t total_count;
+  uint64_t total_sum;
+  // In us^2, for the standard deviation.
+  uint64_t total_sum_sq;
+  // The IOs above the last bucket, not in the slots.
+  uint64_t overflow_count;
+  // The extremes in us, 0 when not tracked, see latency_hist.
+  uint64_t min;
+  uint64_t max;
+  // Same type as latency_hist::slots, for nvme_bpf::Histogram.
+  u64 slots[kSnapshotSlots];
+};
+
+struct SnapshotSegment {
+  SnapshotHeader header;
+  SnapshotHist hists[kSnapshotMaxHists];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "The seqlock must be usable across processes");
+static_assert(sizeof(SnapshotHist) == 8 + 8 * (6 + kSnapshotSlots),
+              "SnapshotHist must not have padding");
+
+// A consistent copy of the segment.
+struct Snapshot {
+  uint64_t timestamp_ns = 0;
+  int lat_min_us = 0;
+  int lat_shift = 0;
+  int max_slots = 0;
+  double count_scale = 1.0;
+  std::vector<SnapshotHist> hists;
+};
+
+// Multiplies the IO counts by `count_scale`, like OwnedHistogram::Scale: the
+// slots are rounded and the total count is their sum, so the buckets add up.
+// The admin commands are never sampled and are left alone.
+void ScaleSnapshot(double count_scale, Snapshot* snapshot);
+
+class SnapshotWriter {
+ public:
+  // Creates or truncates the POSIX shared memory object `name`, e.g.
+  // "/nvme_latency".
+  static absl::StatusOr<SnapshotWriter> Create(const std::string& name);
+
+  SnapshotWriter(SnapshotWriter&& other);
+  SnapshotWriter& operator=(SnapshotWriter&& other) = delete;
+  ~SnapshotWriter();
+
+  // Publishes `snapshot`. Histograms beyond kSnapshotMaxHists are dropped and
+  // reported as an error after the rest was published.
+  absl::Status Publish(const Snapshot& snapshot);
+
+  // Removes the shared memory object, the mappings of the readers stay valid.
+  absl::Status Unlink();
+
+ private:
+  SnapshotWriter(std::string name, SnapshotSegment* segment)
+      : name_(std::move(name)), segment_(segment) {}
+
+  std::string name_;
+  SnapshotSegment* segment_;
+};
+
+class SnapshotReader {
+ public:
+  static absl::StatusOr<SnapshotReader> Open(const std::string& name);
+
+  SnapshotReader(SnapshotReader&& other);
+  SnapshotReader& operator=(SnapshotReader&& other) = delete;
+  ~SnapshotReader();
+
+  // Copies out a consistent snapshot. Fails with UnavailableError if the
+  // writer kept updating the segment for `max_attempts` copies in a row, or
+  // if nothing has been published yet.
+  absl::StatusOr<Snapshot> Read(int max_attempts = 1000) const;
+
+ private:
+  explicit SnapshotReader(const SnapshotSegment* segment)
+      : segment_(segment) {}
+
+  const SnapshotSegment* segment_;
+};
+
+}  // namespace nvme_bpf
+
+#endif /* LATENCY_SNAPSHOT_H_ */
@@ -0,0 +1,93 @@
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "absl/flags/flag.h"
+#include "absl/flags/parse.h"
+#include "absl/log/initialize.h"
+#include "absl/time/clock.h"
+#include "absl/time/time.h"
+#include "histogram.h"
+#include "latency_snapshot.h"
+#include "nvme_abi.h"
+#include "nvme_strings.h"
+
+/*
+Dumps the histograms published by nvme_latency --shm_name.
+
+bazel build :latency_snapshot_dump && \
+  bazel-bin/latency_snapshot_dump --shm_name=/nvme_latency
+*/
+
+ABSL_FLAG(std::string, shm_name, "/nvme_latency",
+          "The POSIX shared memory object published by nvme_latency.");
+ABSL_FLAG(absl::Duration, interval, absl::ZeroDuration(),
+          "If set dumps the segment again every interval.");
+
+namespace {
+
+void DumpSnapshot(const nvme_bpf::Snapshot& snapshot) {
+  std::cout << "timestamp="
+            << absl::FormatTime(absl::FromUnixNanos(snapshot.timestamp_ns))
+            << " lat_min_us=" << snapshot.lat_min_us
+            << " lat_shift=" << snapshot.lat_shift
+            << " count_scale=" << snapshot.count_scale
+            << " hists=" << snapshot.hists.size() << std::endl;
+  for (const auto& hist : snapshot.hists) {
+    auto opcode = static_cast<nvme_abi::NvmeOpcode>(hist.opcode);
+    if (hist.kind == nvme_bpf::kSnapshotHistAdmin) {
+      std::cout << "admin key: ctrl_id=" << hist.ctrl_id
+                << ", opcode=" << static_cast<int>(hist.opcode) << " "
+                << nvme_abi::NvmeAdminOpcodeToString(opcode);
+    } else {
+      std::cout << "key: ctrl_id=" << hist.ctrl_id
+                << ", opcode=" << static_cast<int>(hist.opcode) << " "
+                << nvme_abi::NvmeIoOpcodeToString(opcode)
+                << ", size_class=" << static_cast<int>(hist.size_class);
+      if (hist.saturated) {
+        std::cout << ", saturated";
+      }
+    }
+    std::cout << std::endl;
+
+    nvme_bpf::Histogram h;
+    h.lat_min_us = snapshot.lat_min_us;
+    h.lat_shift = snapshot.lat_shift;
+    h.max_slots = snapshot.max_slots;
+    h.slots = hist.slots;
+    h.total_count = hist.total_count;
+    h.total_sum = hist.total_sum;
+    h.total_sum_sq = hist.total_sum_sq;
+    h.overflow_count = hist.overflow_count;
+    h.min = hist.min;
+    h.max = hist.max;
+    nvme_bpf::PrintHistogram(h).IgnoreError();
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  absl::ParseCommandLine(argc, argv);
+  absl::InitializeLog();
+
+  auto reader = nvme_bpf::SnapshotReader::Open(absl::GetFlag(FLAGS_shm_name));
+  if (!reader.ok()) {
+    std::cerr << reader.status() << std::endl;
+    return EXIT_FAILURE;
+  }
+  auto interval = absl::GetFlag(FLAGS_interval);
+  while (true) {
+    auto snapshot = reader->Read();
+    if (!snapshot.ok()) {
+      std::cerr << snapshot.status() << std::endl;
+      return EXIT_FAILURE;
+    }
+    DumpSnapshot(*snapshot);
+    if (interval <= absl::ZeroDuration()) {
+      break;
+    }
+    absl::SleepFor(interval);
+  }
+  return EXIT_SUCCESS;
+}
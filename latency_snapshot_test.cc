@@ -0,0 +1,156 @@
+#include "latency_snapshot.h"
+
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+/*
+bazel test --test_output=streamed :latency_snapshot_test
+ */
+
+namespace {
+
+using nvme_bpf::Snapshot;
+using nvme_bpf::SnapshotHist;
+using nvme_bpf::SnapshotReader;
+using nvme_bpf::SnapshotWriter;
+
+std::string SegmentName(const char* test) {
+  return absl::StrCat("/nvme_latency_snapshot_test_", test, "_", getpid());
+}
+
+Snapshot MakeSnapshot(int hist_count, uint64_t value) {
+  Snapshot snapshot;
+  snapshot.timestamp_ns = value;
+  snapshot.lat_min_us = 20;
+  snapshot.lat_shift = 1;
+  snapshot.max_slots = LATENCY_MAX_SLOTS;
+  snapshot.count_scale = 4.0;
+  for (int i = 0; i < hist_count; ++i) {
+    SnapshotHist hist = {};
+    hist.ctrl_id = i;
+    hist.opcode = 2;
+    hist.total_count = value;
+    hist.total_sum = value;
+    for (auto& slot : hist.slots) {
+      slot = value;
+    }
+    snapshot.hists.push_back(hist);
+  }
+  return snapshot;
+}
+
+TEST(LatencySnapshot, PublishAndRead) {
+  std::string name = SegmentName("publish");
+  auto writer = SnapshotWriter::Create(name);
+  ASSERT_TRUE(writer.ok()) << writer.status();
+  auto reader = SnapshotReader::Open(name);
+  ASSERT_TRUE(reader.ok()) << reader.status();
+
+  EXPECT_EQ(reader->Read().status().code(), absl::StatusCode::kUnavailable);
+
+  ASSERT_TRUE(writer->Publish(MakeSnapshot(3, 7)).ok());
+  auto snapshot = reader->Read();
+  ASSERT_TRUE(snapshot.ok()) << snapshot.status();
+  EXPECT_EQ(snapshot->timestamp_ns, 7);
+  EXPECT_EQ(snapshot->lat_min_us, 20);
+  EXPECT_EQ(snapshot->lat_shift, 1);
+  EXPECT_EQ(snapshot->max_slots, LATENCY_MAX_SLOTS);
+  EXPECT_EQ(snapshot->count_scale, 4.0);
+  ASSERT_EQ(snapshot->hists.size(), 3);
+  EXPECT_EQ(snapshot->hists[2].ctrl_id, 2);
+  EXPECT_EQ(snapshot->hists[2].slots[LATENCY_MAX_SLOTS], 7);
+
+  ASSERT_TRUE(writer->Publish(MakeSnapshot(1, 8)).ok());
+  snapshot = reader->Read();
+  ASSERT_TRUE(snapshot.ok()) << snapshot.status();
+  EXPECT_EQ(snapshot->hists.size(), 1);
+
+  EXPECT_EQ(
+      writer->Publish(MakeSnapshot(nvme_bpf::kSnapshotMaxHists + 1, 9)).code(),
+      absl::StatusCode::kResourceExhausted);
+  snapshot = reader->Read();
+  ASSERT_TRUE(snapshot.ok()) << snapshot.status();
+  EXPECT_EQ(snapshot->hists.size(), nvme_bpf::kSnapshotMaxHists);
+
+  ASSERT_TRUE(writer->Unlink().ok());
+  EXPECT_FALSE(SnapshotReader::Open(name).ok());
+}
+
+TEST(LatencySnapshot, ScaleKeepsTheBucketsAddingUp) {
+  Snapshot snapshot;
+  SnapshotHist io = {};
+  io.kind = nvme_bpf::kSnapshotHistIo;
+  io.overflow_count = 1;
+  io.total_count = 1;
+  io.total_sum = 7;
+  for (auto& slot : io.slots) {
+    slot = 1;
+    ++io.total_count;
+  }
+  snapshot.hists.push_back(io);
+  SnapshotHist admin = io;
+  admin.kind = nvme_bpf::kSnapshotHistAdmin;
+  snapshot.hists.push_back(admin);
+
+  // Truncating 1.5 per slot would lose half an IO per bucket.
+  nvme_bpf::ScaleSnapshot(1.5, &snapshot);
+  EXPECT_EQ(snapshot.count_scale, 1.5);
+  const SnapshotHist& scaled = snapshot.hists[0];
+  uint64_t slot_count = 0;
+  for (auto slot : scaled.slots) {
+    EXPECT_EQ(slot, 2);
+    slot_count += slot;
+  }
+  EXPECT_EQ(scaled.total_count, slot_count + 2);
+  EXPECT_EQ(scaled.overflow_count, 2);
+  EXPECT_EQ(scaled.total_sum, 11);
+  EXPECT_EQ(snapshot.hists[1].total_count, io.total_count);
+  EXPECT_EQ(snapshot.hists[1].slots[0], 1);
+}
+
+// Every published snapshot has all the values equal, a torn read would mix
+// two publications.
+TEST(LatencySnapshot, ConcurrentReadsAreConsistent) {
+  std::string name = SegmentName("concurrent");
+  auto writer = SnapshotWriter::Create(name);
+  ASSERT_TRUE(writer.ok()) << writer.status();
+  ASSERT_TRUE(writer->Publish(MakeSnapshot(16, 1)).ok());
+
+  std::atomic<bool> done = false;
+  std::thread writer_thread([&]() {
+    for (uint64_t value = 2; value < 20000; ++value) {
+      writer->Publish(MakeSnapshot(16, value)).IgnoreError();
+    }
+    done = true;
+  });
+
+  auto reader = SnapshotReader::Open(name);
+  ASSERT_TRUE(reader.ok()) << reader.status();
+  int reads = 0;
+  while (!done) {
+    auto snapshot = reader->Read();
+    if (!snapshot.ok()) {
+      continue;
+    }
+    ++reads;
+    uint64_t value = snapshot->timestamp_ns;
+    ASSERT_EQ(snapshot->hists.size(), 16);
+    for (const auto& hist : snapshot->hists) {
+      ASSERT_EQ(hist.total_count, value);
+      for (auto slot : hist.slots) {
+        ASSERT_EQ(slot, value);
+      }
+    }
+  }
+  writer_thread.join();
+  EXPECT_GT(reads, 0);
+  ASSERT_TRUE(writer->Unlink().ok());
+}
+
+}  // namespace
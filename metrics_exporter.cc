@@ -0,0 +1,326 @@
+#include "metrics_exporter.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "absl/strings/match.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/strip.h"
+#include "histogram.h"
+#include "nvme_abi.h"
+#include "nvme_strings.h"
+
+namespace nvme_bpf {
+namespace {
+
+// Requests larger than this are answered without reading the rest.
+constexpr size_t kMaxRequestSize = 8192;
+constexpr int kMaxEvents = 64;
+
+// `le` holds the `le="..."} ` label suffixes, indexed by slot. Every line is
+// a few appends of precomputed pieces, the exporter renders hundreds of
+// histograms per interval.
+void AppendHistogram(std::string_view name, std::string_view labels,
+                     const SnapshotHist& hist,
+                     const std::vector<std::string>& le, std::string* out) {
+  const int max_slots = le.size() - 2;
+  const std::string prefix = absl::StrCat(name, "_bucket{", labels);
+
+  // The "< min" slot holds the lowest values, it is stored last.
+  uint64_t cumulative = hist.slots[max_slots];
+  absl::StrAppend(out, prefix, le[max_slots], cumulative, "\n");
+  for (int slot = 0; slot < max_slots; ++slot) {
+    cumulative += hist.slots[slot];
+    absl::StrAppend(out, prefix, le[slot], cumulative, "\n");
+  }
+  // The values above the last bucket are only in the total count.
+  absl::StrAppend(out, prefix, le[max_slots + 1], hist.total_count, "\n");
+
+  std::string_view plain_labels = absl::StripSuffix(labels, ",");
+  absl::StrAppend(out, name, "_sum{", plain_labels, "} ", hist.total_sum / 1e6,
+                  "\n");
+  absl::StrAppend(out, name, "_count{", plain_labels, "} ", hist.total_count,
+                  "\n");
+}
+
+}  // namespace
+
+void AppendPrometheusHistograms(const Snapshot& snapshot, std::string* out) {
+  // The bucket upper bounds in seconds, slot max_slots is the "< min" slot
+  // and max_slots + 1 is +Inf.
+  Histogram layout;
+  layout.lat_min_us = snapshot.lat_min_us;
+  layout.lat_shift = snapshot.lat_shift;
+  layout.max_slots = snapshot.max_slots;
+  LatencyBucketLayout tables;
+  if (snapshot.max_slots == LATENCY_MAX_SLOTS) {
+    tables = LatencyBucketLayout::Make(snapshot.lat_min_us,
+                                       snapshot.lat_shift);
+    layout.SetLayout(tables);
+  }
+  std::vector<std::string> le(snapshot.max_slots + 2);
+  for (int slot = 0; slot <= snapshot.max_slots; ++slot) {
+    le[slot] =
+        absl::StrCat("le=\"", layout.bucket_high(slot) / 1e6, "\"} ");
+  }
+  le[snapshot.max_slots + 1] = "le=\"+Inf\"} ";
+
+  std::string labels;
+  bool io_header = false;
+  bool admin_header = false;
+  for (const auto& hist : snapshot.hists) {
+    auto opcode = static_cast<nvme_abi::NvmeOpcode>(hist.opcode);
+    labels.clear();
+    const char* name;
+    if (hist.kind == kSnapshotHistAdmin) {
+      name = "nvme_admin_latency_seconds";
+      if (!admin_header) {
+        absl::StrAppend(out, "# HELP ", name,
+                        " NVMe admin command latency.\n# TYPE ", name,
+                        " histogram\n");
+        admin_header = true;
+      }
+      absl::StrAppend(&labels, "ctrl=\"nvme", hist.ctrl_id, "\",opcode=\"",
+                      nvme_abi::NvmeAdminOpcodeToString(opcode), "\",");
+    } else {
+      name = "nvme_io_latency_seconds";
+      if (!io_header) {
+        absl::StrAppend(out, "# HELP ", name,
+                        " NVMe IO latency from nvme_setup_cmd to the "
+                        "completion.\n# TYPE ",
+                        name, " histogram\n");
+        io_header = true;
+      }
+      absl::StrAppend(&labels, "ctrl=\"nvme", hist.ctrl_id, "\",opcode=\"",
+                      nvme_abi::NvmeIoOpcodeToString(opcode),
+                      "\",size_class=\"", hist.size_class,
+                      "\",saturated=\"", hist.saturated, "\",");
+    }
+    AppendHistogram(name, labels, hist, le, out);
+  }
+}
+
+absl::StatusOr<std::unique_ptr<MetricsServer>> MetricsServer::Listen(
+    std::string_view address) {
+  int listen_fd = -1;
+  int port = 0;
+  std::string unix_path;
+  if (absl::ConsumePrefix(&address, "unix:")) {
+    unix_path = std::string(address);
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (unix_path.empty() || unix_path.size() >= sizeof(addr.sun_path)) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid unix socket path '", unix_path, "'"));
+    }
+    memcpy(addr.sun_path, unix_path.data(), unix_path.size());
+    listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+      return absl::InternalError(absl::StrCat("socket() errno=", errno));
+    }
+    // A stale socket from a previous run would fail the bind.
+    unlink(unix_path.c_str());
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr),
+             sizeof(addr)) != 0) {
+      int err = errno;
+      close(listen_fd);
+      return absl::InternalError(
+          absl::StrCat("bind(", unix_path, ") errno=", err));
+    }
+  } else {
+    size_t colon = address.rfind(':');
+    int requested_port;
+    if (colon == std::string_view::npos ||
+        !absl::SimpleAtoi(address.substr(colon + 1), &requested_port)) {
+      return absl::InvalidArgumentError(absl::StrCat(
+          "Expected host:port or unix:/path, got '", address, "'"));
+    }
+    std::string host(address.substr(0, colon));
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(requested_port);
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Invalid IPv4 address '", host, "'"));
+    }
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0) {
+      return absl::InternalError(absl::StrCat("socket() errno=", errno));
+    }
+    int one = 1;
+    setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr),
+             sizeof(addr)) != 0) {
+      int err = errno;
+      close(listen_fd);
+      return absl::InternalError(
+          absl::StrCat("bind(", address, ") errno=", err));
+    }
+    socklen_t addr_len = sizeof(addr);
+    getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&addr),
+                &addr_len);
+    port = ntohs(addr.sin_port);
+  }
+
+  if (listen(listen_fd, SOMAXCONN) != 0) {
+    int err = errno;
+    close(listen_fd);
+    return absl::InternalError(absl::StrCat("listen() errno=", err));
+  }
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) {
+    int err = errno;
+    close(listen_fd);
+    return absl::InternalError(absl::StrCat("epoll_create1() errno=", err));
+  }
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = listen_fd;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+  auto server = std::unique_ptr<MetricsServer>(
+      new MetricsServer(listen_fd, epoll_fd, port, std::move(unix_path)));
+  server->SetBody("");
+  return server;
+}
+
+MetricsServer::MetricsServer(int listen_fd, int epoll_fd, int port,
+                             std::string unix_path)
+    : listen_fd_(listen_fd),
+      epoll_fd_(epoll_fd),
+      port_(port),
+      unix_path_(std::move(unix_path)) {}
+
+MetricsServer::~MetricsServer() {
+  for (const auto& [fd, conn] : connections_) {
+    close(fd);
+  }
+  close(epoll_fd_);
+  close(listen_fd_);
+  if (!unix_path_.empty()) {
+    unlink(unix_path_.c_str());
+  }
+}
+
+void MetricsServer::SetBody(std::string_view body) {
+  // A connection still holding the previous response keeps it alive.
+  if (response_ == nullptr || response_.use_count() > 1) {
+    response_ = std::make_shared<std::string>();
+  }
+  response_->clear();
+  absl::StrAppend(response_.get(),
+                  "HTTP/1.1 200 OK\r\n"
+                  "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                  "Connection: close\r\n"
+                  "Content-Length: ",
+                  body.size(), "\r\n\r\n", body);
+}
+
+void MetricsServer::Accept() {
+  while (true) {
+    int fd = accept4(listen_fd_, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) {
+      // EAGAIN once the backlog is drained.
+      return;
+    }
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev) != 0) {
+      close(fd);
+      continue;
+    }
+    connections_[fd];
+  }
+}
+
+bool MetricsServer::Progress(int fd, Connection* conn) {
+  if (conn->response == nullptr) {
+    char buf[1024];
+    while (true) {
+      ssize_t n = read(fd, buf, sizeof(buf));
+      if (n == 0) {
+        // A client that shut down its side after the request still gets the
+        // response.
+        if (conn->request.empty()) {
+          return false;
+        }
+        conn->request.append("\r\n\r\n");
+        break;
+      }
+      if (n < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+          break;
+        }
+        return false;
+      }
+      conn->request.append(buf, n);
+    }
+    if (!absl::StrContains(conn->request, "\r\n\r\n") &&
+        conn->request.size() < kMaxRequestSize) {
+      // Wait for the rest of the request headers.
+      return true;
+    }
+    conn->response = response_;
+    conn->request.clear();
+    struct epoll_event ev = {};
+    ev.events = EPOLLOUT;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+  }
+
+  while (conn->sent < conn->response->size()) {
+    ssize_t n = send(fd, conn->response->data() + conn->sent,
+                     conn->response->size() - conn->sent, MSG_NOSIGNAL);
+    if (n < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    conn->sent += n;
+  }
+  return false;
+}
+
+void MetricsServer::Close(int fd) {
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  connections_.erase(fd);
+}
+
+absl::Status MetricsServer::HandleEvents(int timeout_ms) {
+  struct epoll_event events[kMaxEvents];
+  int n = epoll_wait(epoll_fd_, events, kMaxEvents, timeout_ms);
+  if (n < 0) {
+    if (errno == EINTR) {
+      return absl::OkStatus();
+    }
+    return absl::InternalError(absl::StrCat("epoll_wait() errno=", errno));
+  }
+  for (int i = 0; i < n; ++i) {
+    int fd = events[i].data.fd;
+    if (fd == listen_fd_) {
+      Accept();
+      continue;
+    }
+    auto it = connections_.find(fd);
+    if (it == connections_.end()) {
+      continue;
+    }
+    if ((events[i].events & EPOLLERR) || !Progress(fd, &it->second)) {
+      Close(fd);
+    }
+  }
+  return absl::OkStatus();
+}
+
+}  // namespace nvme_bpf
@@ -0,0 +1,74 @@
+#ifndef METRICS_EXPORTER_H_
+#define METRICS_EXPORTER_H_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "absl/status/status.h"
+#include "absl/status/statusor.h"
+#include "latency_snapshot.h"
+
+namespace nvme_bpf {
+
+// Appends the histograms of `snapshot` to `out` in the Prometheus text
+// exposition format: nvme_io_latency_seconds and nvme_admin_latency_seconds
+// with the cumulative _bucket{le=...}, _sum and _count series. The buckets
+// are the histogram slots, the "< lat_min_us" slot is the first bucket. The
+// series are counters: the sampled IO counts must come from SnapshotSum, not
+// scaled by the current sampling rate which drifts.
+void AppendPrometheusHistograms(const Snapshot& snapshot, std::string* out);
+
+// A minimal HTTP server for Prometheus scrapes. Every request gets the last
+// body set with SetBody(), whatever the path. All the sockets are
+// non-blocking and multiplexed on an internal epoll instance, fd() can be
+// added to an outer event loop which calls HandleEvents() when it's readable.
+class MetricsServer {
+ public:
+  // `address` is "host:port" for TCP, e.g. "127.0.0.1:9464" (port 0 picks a
+  // free port), or "unix:/path/to/socket".
+  static absl::StatusOr<std::unique_ptr<MetricsServer>> Listen(
+      std::string_view address);
+
+  ~MetricsServer();
+
+  // Replaces the served body. The response buffer is reused unless a
+  // connection is still sending the previous one.
+  void SetBody(std::string_view body);
+
+  // Accepts the new connections and progresses the pending ones. Waits up to
+  // `timeout_ms` for events, 0 doesn't block.
+  absl::Status HandleEvents(int timeout_ms = 0);
+
+  int fd() const { return epoll_fd_; }
+
+  // The TCP port the server listens on, 0 for unix sockets.
+  int port() const { return port_; }
+
+ private:
+  struct Connection {
+    std::string request;
+    // Set once the request is complete.
+    std::shared_ptr<const std::string> response;
+    size_t sent = 0;
+  };
+
+  MetricsServer(int listen_fd, int epoll_fd, int port, std::string unix_path);
+
+  void Accept();
+  // Returns false when the connection is done and must be closed.
+  bool Progress(int fd, Connection* conn);
+  void Close(int fd);
+
+  int listen_fd_;
+  int epoll_fd_;
+  int port_;
+  std::string unix_path_;
+  std::shared_ptr<std::string> response_;
+  std::unordered_map<int, Connection> connections_;
+};
+
+}  // namespace nvme_bpf
+
+#endif /* METRICS_EXPORTER_H_ */
@@ -0,0 +1,163 @@
+#include "metrics_exporter.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "absl/strings/match.h"
+#include "absl/strings/str_cat.h"
+#include "gtest/gtest.h"
+
+/*
+bazel test --test_output=streamed :metrics_exporter_test
+ */
+
+namespace {
+
+using nvme_bpf::MetricsServer;
+using nvme_bpf::Snapshot;
+using nvme_bpf::SnapshotHist;
+
+Snapshot TestSnapshot() {
+  Snapshot snapshot;
+  snapshot.lat_min_us = 10;
+  snapshot.lat_shift = 0;
+  snapshot.max_slots = LATENCY_MAX_SLOTS;
+  SnapshotHist hist = {};
+  hist.ctrl_id = 1;
+  hist.opcode = 2;  // Read
+  hist.slots[LATENCY_MAX_SLOTS] = 3;  // [0, 10us)
+  hist.slots[0] = 5;                  // [10us, 11us)
+  hist.slots[3] = 2;                  // [14us, 18us)
+  hist.total_count = 11;              // One above the last bucket.
+  hist.total_sum = 250;
+  snapshot.hists.push_back(hist);
+
+  SnapshotHist admin = {};
+  admin.kind = nvme_bpf::kSnapshotHistAdmin;
+  admin.ctrl_id = 1;
+  admin.opcode = 6;  // Identify
+  admin.slots[5] = 1;
+  admin.total_count = 1;
+  admin.total_sum = 30;
+  snapshot.hists.push_back(admin);
+  return snapshot;
+}
+
+TEST(MetricsExporter, PrometheusHistograms) {
+  std::string out;
+  nvme_bpf::AppendPrometheusHistograms(TestSnapshot(), &out);
+
+  EXPECT_TRUE(absl::StrContains(
+      out, "# TYPE nvme_io_latency_seconds histogram\n"));
+  const std::string labels =
+      "ctrl=\"nvme1\",opcode=\"Read\",size_class=\"0\",saturated=\"0\"";
+  EXPECT_TRUE(absl::StrContains(
+      out, absl::StrCat("nvme_io_latency_seconds_bucket{", labels,
+                        ",le=\"1e-05\"} 3\n")))
+      << out;
+  EXPECT_TRUE(absl::StrContains(
+      out, absl::StrCat("nvme_io_latency_seconds_bucket{", labels,
+                        ",le=\"1.1e-05\"} 8\n")))
+      << out;
+  EXPECT_TRUE(absl::StrContains(
+      out, absl::StrCat("nvme_io_latency_seconds_bucket{", labels,
+                        ",le=\"1.8e-05\"} 10\n")))
+      << out;
+  EXPECT_TRUE(absl::StrContains(
+      out, absl::StrCat("nvme_io_latency_seconds_bucket{", labels,
+                        ",le=\"+Inf\"} 11\n")))
+      << out;
+  EXPECT_TRUE(absl::StrContains(
+      out, absl::StrCat("nvme_io_latency_seconds_sum{", labels, "} 0.00025\n")))
+      << out;
+  EXPECT_TRUE(absl::StrContains(
+      out, absl::StrCat("nvme_io_latency_seconds_count{", labels, "} 11\n")))
+      << out;
+
+  EXPECT_TRUE(absl::StrContains(
+      out, "# TYPE nvme_admin_latency_seconds histogram\n"));
+  EXPECT_TRUE(absl::StrContains(
+      out, "nvme_admin_latency_seconds_count{ctrl=\"nvme1\",opcode=\"Identify\"}"
+           " 1\n"))
+      << out;
+}
+
+// Sends a request on `fd` while the server handles the events, returns the
+// whole response.
+std::string Scrape(MetricsServer* server, int fd) {
+  std::string request = "GET /metrics HTTP/1.1\r\nHost: test\r\n\r\n";
+  EXPECT_EQ(send(fd, request.data(), request.size(), 0), request.size());
+  std::string response;
+  std::atomic<bool> done = false;
+  std::thread reader([&]() {
+    char buf[4096];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+      response.append(buf, n);
+    }
+    done = true;
+  });
+  for (int i = 0; i < 500 && !done; ++i) {
+    EXPECT_TRUE(server->HandleEvents(/*timeout_ms=*/10).ok());
+  }
+  reader.join();
+  close(fd);
+  return response;
+}
+
+TEST(MetricsServer, ServesBodyOverTcpLoopback) {
+  auto server = MetricsServer::Listen("127.0.0.1:0");
+  ASSERT_TRUE(server.ok()) << server.status();
+  ASSERT_NE((*server)->port(), 0);
+  (*server)->SetBody("nvme_test 1\n");
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons((*server)->port());
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                    sizeof(addr)),
+            0);
+
+  std::string response = Scrape(server->get(), fd);
+  EXPECT_TRUE(absl::StartsWith(response, "HTTP/1.1 200 OK\r\n")) << response;
+  EXPECT_TRUE(absl::StrContains(response, "Content-Length: 12\r\n"))
+      << response;
+  EXPECT_TRUE(absl::EndsWith(response, "\r\n\r\nnvme_test 1\n")) << response;
+}
+
+TEST(MetricsServer, ServesBodyOverUnixSocket) {
+  std::string path = absl::StrCat(::testing::TempDir(), "/metrics_", getpid());
+  auto server = MetricsServer::Listen(absl::StrCat("unix:", path));
+  ASSERT_TRUE(server.ok()) << server.status();
+  (*server)->SetBody("first\n");
+  (*server)->SetBody("second\n");
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr = {};
+  addr.sun_family = AF_UNIX;
+  strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+  ASSERT_EQ(connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                    sizeof(addr)),
+            0);
+
+  std::string response = Scrape(server->get(), fd);
+  EXPECT_TRUE(absl::EndsWith(response, "\r\n\r\nsecond\n")) << response;
+}
+
+TEST(MetricsServer, RejectsBadAddress) {
+  EXPECT_FALSE(MetricsServer::Listen("localhost").ok());
+  EXPECT_FALSE(MetricsServer::Listen("not-an-ip:80").ok());
+  EXPECT_FALSE(MetricsServer::Listen("unix:").ok());
+}
+
+}  // namespace
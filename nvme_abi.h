@@ -55,50 +55,62 @@ enum class FusedMode : uint8_t {
   kReserved = 3,
 };
 
-// All possible opcodes NVMe commands.
+// All possible opcodes NVMe commands, as X(name, value) lists. The lists are
+// the one source of the NvmeOpcode enumerators and of the opcode names in
+// nvme_strings.
+#define NVME_IO_OPCODES(X)                                                   \
+  X(Flush, 0x00)                                                             \
+  X(Write, 0x01)                                                             \
+  X(Read, 0x02)                                                              \
+  X(WriteUncorrectable, 0x04)                                                \
+  X(Compare, 0x05)                                                           \
+  X(WriteZeros, 0x08)          /* NVMe 1.1 */                                \
+  X(DatasetMgmt, 0x09)                                                       \
+  X(Verify, 0x0C)              /* NVMe 1.4 */                                \
+  X(ReservationRegister, 0x0D) /* NVMe 1.1 */                                \
+  X(ReservationReport, 0x0E)   /* NVMe 1.1 */                                \
+  X(ReservationAcquire, 0x11)  /* NVMe 1.1 */                                \
+  X(ReservationRelease, 0x15)  /* NVMe 1.1 */
+
+#define NVME_ADMIN_OPCODES(X)                                                \
+  X(DeleteSubQueue, 0x00)                                                    \
+  X(CreateSubQueue, 0x01)                                                    \
+  X(GetLogPage, 0x02)                                                        \
+  X(DeleteCompQueue, 0x04)                                                   \
+  X(CreateCompQueue, 0x05)                                                   \
+  X(Identify, 0x06)                                                          \
+  X(Abort, 0x08)                                                             \
+  X(SetFeatures, 0x09)                                                       \
+  X(GetFeatures, 0x0A)                                                       \
+  X(AsyncEventReq, 0x0C)                                                     \
+  X(NamespaceManagement, 0x0D)      /* NVMe 1.2 */                           \
+  X(FirmwareActivate, 0x10)                                                  \
+  X(FirmwareImgDownload, 0x11)                                               \
+  X(DeviceSelfTest, 0x14)           /* NVMe 1.3 */                           \
+  X(NamespaceAttachment, 0x15)      /* NVMe 1.2 */                           \
+  X(KeepAlive, 0x18)                /* NVMe 1.2.1 */                         \
+  X(DirectiveSend, 0x19)            /* NVMe 1.3 */                           \
+  X(DirectiveReceive, 0x1A)         /* NVMe 1.3 */                           \
+  X(VirtualizationManagement, 0x1C) /* NVMe 1.3 */                           \
+  X(NVMeMISend, 0x1D)               /* NVMe 1.3 */                           \
+  X(NVMeMIReceive, 0x1E)            /* NVMe 1.3 */                           \
+  X(DoorbellMemory, 0x7C) /* NVMe 1.3, aka Doorbell Buffer Config */         \
+  X(FormatNVM, 0x80)                                                         \
+  X(SecurityRead, 0x81)                                                      \
+  X(SecurityWrite, 0x82)                                                     \
+  X(Sanitize, 0x84)                 /* NVMe 1.3 */                           \
+  X(GetLbaStatus, 0x86)             /* NVMe 1.4 */
+
+// Expands an entry of the lists into the enumerator k<name>, undefined after
+// the last enum that uses it.
+#define NVME_ABI_ENUMERATOR(name, value, ...) k##name = value,
+
 enum class NvmeOpcode : uint8_t {
   // IO operation codes:
-  kFlush = 0x00,                //
-  kWrite = 0x01,                //
-  kRead = 0x02,                 //
-  kWriteUncorrectable = 0x04,   //
-  kCompare = 0x005,             //
-  kWriteZeros = 0x08,           // NVMe 1.1
-  kDatasetMgmt = 0x09,          //
-  kVerify = 0x0C,               // NVMe 1.4
-  kReservationRegister = 0x0D,  // NVMe 1.1
-  kReservationReport = 0x0E,    // NVMe 1.1
-  kReservationAcquire = 0x11,   // NVMe 1.1
-  kReservationRelease = 0x15,   // NVMe 1.1
+  NVME_IO_OPCODES(NVME_ABI_ENUMERATOR)
 
   // Admin operation codes:
-  kDeleteSubQueue = 0x00,            //
-  kCreateSubQueue = 0x01,            //
-  kGetLogPage = 0x02,                //
-  kDeleteCompQueue = 0x04,           //
-  kCreateCompQueue = 0x05,           //
-  kIdentify = 0x06,                  //
-  kAbort = 0x08,                     //
-  kSetFeatures = 0x09,               //
-  kGetFeatures = 0x0A,               //
-  kAsyncEventReq = 0x0C,             //
-  kNamespaceManagement = 0xD,        // NVMe 1.2
-  kFirmwareActivate = 0x10,          //
-  kFirmwareImgDownload = 0x11,       //
-  kDeviceSelfTest = 0x14,            // NVMe 1.3
-  kNamespaceAttachment = 0x15,       // NVMe 1.2
-  kKeepAlive = 0x18,                 // NVMe 1.2.1
-  kDirectiveSend = 0x19,             // NVMe 1.3
-  kDirectiveReceive = 0x1A,          // NVMe 1.3
-  kVirtualizationManagement = 0x1C,  // NVMe 1.3
-  kNVMeMISend = 0x1D,                // NVMe 1.3
-  kNVMeMIReceive = 0x1E,             // NVMe 1.3
-  kDoorbellMemory = 0x7C,            // NVMe 1.3, aka Doorbell Buffer Config
-  kFormatNVM = 0x80,                 //
-  kSecurityRead = 0x81,              //
-  kSecurityWrite = 0x82,             //
-  kSanitize = 0x84,                  // NVMe 1.3
-  kGetLbaStatus = 0x86,              // NVMe 1.4
+  NVME_ADMIN_OPCODES(NVME_ABI_ENUMERATOR)
 
   // Everything else is optional or undefined.
 };
@@ -115,115 +127,177 @@ enum class StatusCodeType : uint8_t {
   kPathRelated = 3,
 };
 
+// The status codes of every StatusCodeType, as X(name, value, string) lists.
+// The lists are the one source of the StatusCode enumerators and of the status
+// names in nvme_strings.
+#define NVME_GENERIC_STATUS_CODES(X)                                         \
+  X(Success, 0x0, "GENERIC_STATUS_SUCCESS")                                  \
+  X(InvalidOpcode, 0x1, "GENERIC_STATUS_INVALID_OPCODE")                     \
+  X(InvalidField, 0x2, "GENERIC_STATUS_INVALID_FIELD")                       \
+  X(CommandIdConflict, 0x3, "GENERIC_STATUS_COMMAND_ID_CONFLICT")            \
+  X(DataTransferError, 0x4, "GENERIC_STATUS_DATA_TRANSFER_ERROR")            \
+  X(AbortedPowerLoss, 0x5, "GENERIC_STATUS_ABORTED_POWER_LOSS")              \
+  X(InternalError, 0x6, "GENERIC_STATUS_INTERNAL_ERROR")                     \
+  X(AbortedByRequest, 0x7, "GENERIC_STATUS_ABORTED_REQ")                     \
+  X(AbortedSqDeletion, 0x8, "GENERIC_STATUS_ABORTED_SQDEL")                  \
+  /* Command Aborted due to Failed Fused Command: The command was aborted    \
+     due to the other command in a fused operation failing. */               \
+  X(AbortedFailedFused, 0x9, "GENERIC_STATUS_ABORTED_FAILED_FUSED")          \
+  /* Command Aborted due to Missing Fused Command: The fused command was     \
+     aborted due to the adjacent submission queue entry not containing a     \
+     fused command that is the other command in a supported fused            \
+     operation. */                                                           \
+  X(AbortedMissingFused, 0xA, "GENERIC_STATUS_ABORTED_MISSING_FUSED")        \
+  X(InvalidNamespace, 0xB, "GENERIC_STATUS_INVALID_NAMESPACE")               \
+  X(CommandSeqError, 0xC, "GENERIC_STATUS_COMMAND_SEQ_ERROR")                \
+  X(InvalidSglDesc, 0xD, "GENERIC_STATUS_INVALID_SGL_DESC")                  \
+  X(InvalidNumOfSglDesc, 0xE, "GENERIC_STATUS_INVALID_NUM_OF_SGL_DESC")      \
+  X(InvalidSglDataLength, 0xF, "GENERIC_STATUS_INVALID_SGL_DATA_LENGTH")     \
+  X(InvalidSglMetadataLength, 0x10,                                          \
+    "GENERIC_STATUS_INVALID_SGLMETADATA_LENGTH")                             \
+  X(InvalidSglDescType, 0x11, "GENERIC_STATUS_INVALID_SGL_DESC_TYPE")        \
+  X(InvalidUseCtrlMemBuff, 0x12, "GENERIC_STATUS_INVALID_USE_CTRL_MEMBUFF")  \
+  X(InvalidPrpOffset, 0x13, "GENERIC_STATUS_INVALID_PRP_OFFSET")             \
+  X(AtomicWriteUnitExceeded, 0x14,                                           \
+    "GENERIC_STATUS_ATOMIC_WRITE_UNIT_EXCEEDED")                             \
+  X(OpDenied, 0x15, "GENERIC_STATUS_OP_DENIED")                              \
+  X(InvalidSglOffset, 0x16, "GENERIC_STATUS_INVALID_SGL_OFFSET")             \
+  X(HostIdInconsistentFormat, 0x18,                                          \
+    "GENERIC_STATUS_HOST_ID_INCONSISTENT_FORMAT")                            \
+  X(KeepAliveTimerExpired, 0x19, "GENERIC_STATUS_KEEP_ALIVE_TIMER_EXPIRED")  \
+  X(InvalidKeepAliveTimeout, 0x1A,                                           \
+    "GENERIC_STATUS_INVALID_KEEP_ALIVE_TIMEOUT")                             \
+  X(AbortedDuePreemptAbort, 0x1B,                                            \
+    "GENERIC_STATUS_ABORTED_DUE_PREEMPT_ABORT")                              \
+  X(SanitizeFailed, 0x1C, "GENERIC_STATUS_SANITIZE_FAILED")                  \
+  X(SanitizeInProgress, 0x1D, "GENERIC_STATUS_SANITIZE_IN_PROGRESS")         \
+  X(InvalidSglDataBlckGranularity, 0x1E,                                     \
+    "GENERIC_STATUS_INVALID_SGL_DATA_BLCK_GRANULARITY")                      \
+  X(NotSupportedForQueueInCMB, 0x1F,                                         \
+    "GENERIC_STATUS_NOT_SUPPORTED_FOR_QUEUE_IN_CMB")                         \
+  X(NamespaceIsWriteProtected, 0x20,                                         \
+    "GENERIC_STATUS_NAMESPACE_IS_WRITE_PROTECTED")                           \
+  X(CommandInterrupted, 0x21, "GENERIC_STATUS_COMMAND_INTERRUPTED")          \
+  X(TransientTransportError, 0x22,                                           \
+    "GENERIC_STATUS_TRANSIENT_TRANSPORT_ERROR")                              \
+  /* Generic status, NVM command set: */                                     \
+  X(LbaOutOfRange, 0x80, "GENERIC_STATUS_LBA_OUT_OF_RANGE")                  \
+  X(Capacity_exceeded, 0x81, "GENERIC_STATUS_CAPACITY_EXCEEDED")             \
+  X(NamespaceNotReady, 0x82, "GENERIC_STATUS_NAMESPACE_NOT_READY")           \
+  X(ReservationConflict, 0x83, "GENERIC_STATUS_RESERVATION_CONFLICT")        \
+  X(FormatInProgress, 0x84, "GENERIC_STATUS_FORMAT_IN_PROGRESS")
+
+#define NVME_CMD_SPECIFIC_STATUS_CODES(X)                                    \
+  X(CompletionQueueInvalid, 0x00,                                            \
+    "COMMAND_SPECIFIC_STATUS_COMPLETION_QUEUE_INVALID")                      \
+  X(InvalidQueueId, 0x01, "COMMAND_SPECIFIC_STATUS_INVALID_QUEUE_ID")        \
+  X(InvalidQueueSize, 0x02,                                                  \
+    "COMMAND_SPECIFIC_STATUS_MAX_QUEUE_SIZE_EXCEEDED")                       \
+  X(AbortCommandLimitExceeded, 0x03,                                         \
+    "COMMAND_SPECIFIC_STATUS_ABORT_COMMAND_LIMIT_EXCEEDED")                  \
+  X(AsyncEventRequestLimitExceeded, 0x05,                                    \
+    "COMMAND_SPECIFIC_ASYNC_EVENT_REQUEST_LIMIT_EXCEEDED")                   \
+  X(InvalidFirmwareSlot, 0x06, "COMMAND_SPECIFIC_INVALID_FIRMWARE_SLOT")     \
+  X(InvalidFirmwareImage, 0x07, "COMMAND_SPECIFIC_INVALID_FIRMWARE_IMAGE")   \
+  X(InvalidInterruptVector, 0x08,                                            \
+    "COMMAND_SPECIFIC_STATUS_INVALID_INTERRUPT_VECTOR")                      \
+  X(InvalidLogPage, 0x09, "COMMAND_SPECIFIC_STATUS_INVALID_LOG_PAGE")        \
+  X(InvalidFormat, 0x0A, "COMMAND_SPECIFIC_STATUS_INVALID_FORMAT")           \
+  X(FwActivationReqConventionalReset, 0x0B,                                  \
+    "COMMAND_SPECIFIC_FW_ACTIVATION_REQ_CONVENTIONAL_RESET")                 \
+  X(InvalidQueueDeletion, 0x0C,                                              \
+    "COMMAND_SPECIFIC_STATUS_INVALID_QUEUE_DELETION")                        \
+  X(FeatureIdentifierNotSaveable, 0x0D,                                      \
+    "COMMAND_SPECIFIC_FEATURE_IDENTIFIER_NOT_SAVEABLE")                      \
+  X(FeatureNotChangeable, 0x0E, "COMMAND_SPECIFIC_FEATURE_NOT_CHANGEABLE")   \
+  X(FeatureNotNamespaceSpecific, 0x0F,                                       \
+    "COMMAND_SPECIFIC_FEATURE_NOT_NAMESPACE_SPECIFIC")                       \
+  X(FwActivationReqNVMReset, 0x10,                                           \
+    "COMMAND_SPECIFIC_FW_ACTIVATION_REQNVM_RESET")                           \
+  X(FwActivationReqCtrlLevelReset, 0x11,                                     \
+    "COMMAND_SPECIFIC_FW_ACTIVATION_REQ_CTRL_LEVEL_RESET")                   \
+  X(FwActivationReqMaxTimeViolation, 0x12,                                   \
+    "COMMAND_SPECIFIC_FW_ACTIVATION_REQ_MAX_TIME_VIOLATION")                 \
+  X(FwActivationProhibited, 0x13,                                            \
+    "COMMAND_SPECIFIC_FW_ACTIVATION_PROHIBITED")                             \
+  X(OverlappingRangeFirmwareCommit, 0x14,                                    \
+    "COMMAND_SPECIFIC_OVERLAPPING_RANGE_FIRMWARE_COMMIT")                    \
+  X(NsInsufficientCapacity, 0x15,                                            \
+    "COMMAND_SPECIFIC_NS_INSUFFICIENT_CAPACITY")                             \
+  X(NsIdentifierUnavailable, 0x16,                                           \
+    "COMMAND_SPECIFIC_NS_IDENTIFIER_UNAVAILABLE")                            \
+  X(NsAlreadyAttached, 0x18, "COMMAND_SPECIFIC_NS_ALREADY_ATTACHED")         \
+  X(NsIsPrivate, 0x19, "COMMAND_SPECIFIC_NS_IS_PRIVATE")                     \
+  X(NsNotAttached, 0x1A, "COMMAND_SPECIFIC_NS_NOT_ATTACHED")                 \
+  X(ThinProvisioningNotSupported, 0x1B,                                      \
+    "COMMAND_SPECIFIC_THIN_PROVISIONING_NOT_SUPPORTED")                      \
+  X(ControllerListInvalid, 0x1C,                                             \
+    "COMMAND_SPECIFIC_CONTROLLER_LIST_INVALID")                              \
+  X(DeviceSelfTestInProgress, 0x1D,                                          \
+    "COMMAND_SPECIFIC_DEVICE_SELF_TEST_IN_PROGRESS")                         \
+  X(BootPartitionWriteProhibited, 0x1E,                                      \
+    "COMMAND_SPECIFIC_BOOT_PARTITION_WRITE_PROHIBITED")                      \
+  X(InvalidControllerIdentifier, 0x1F,                                       \
+    "COMMAND_SPECIFIC_INVALID_CONTROLLER_IDENTIFIER")                        \
+  X(InvalidSecondaryControllerState, 0x20,                                   \
+    "COMMAND_SPECIFIC_INVALID_SECONDARY_CONTROLLER_STATE")                   \
+  X(InvalidNumCtrlResources, 0x21,                                           \
+    "COMMAND_SPECIFIC_INVALID_NUM_CTRL_RESOURCES")                           \
+  X(InvalidResourceIdentifier, 0x22,                                         \
+    "COMMAND_SPECIFIC_INVALID_RESOURCE_IDENTIFIER")                          \
+  X(SanitizeProhibitedWithPMR, 0x23,                                         \
+    "COMMAND_SPECIFIC_SANITIZE_PROHIBITED_WITHPMR")                          \
+  X(ANAGroupIdentifierInvalid, 0x24,                                         \
+    "COMMAND_SPECIFIC_ANA_GROUP_IDENTIFIER_INVALID")                         \
+  X(ANAAttachFailed, 0x25, "COMMAND_SPECIFIC_ANA_ATTACH_FAILED")             \
+  X(InvalidControllerDataQueue, 0x37,                                        \
+    "COMMAND_SPECIFIC_INVALID_CONTROLLER_DATA_QUEUE")                        \
+  X(ControllerNotSuspended, 0x3a,                                            \
+    "COMMAND_SPECIFIC_STATUS_CONTROLLER_NOT_SUSPENDED")                      \
+  /* Command specific, NVM command set: */                                   \
+  X(ConflictingAttributes, 0x80,                                             \
+    "COMMAND_SPECIFIC_STATUS_CONFLICTING_ATTRIBUTES")                        \
+  X(InvalidProtectionInformation, 0x81,                                      \
+    "COMMAND_SPECIFIC_INVALID_PROTECTION_INFORMATION")                       \
+  X(AttemptedWriteToReadOnlyRange, 0x82,                                     \
+    "COMMAND_SPECIFIC_STATUS_ATTEMPTED_WRITE_TO_RO_RANGE")
+
+// Media error, NVM command set.
+#define NVME_MEDIA_ERROR_STATUS_CODES(X)                                     \
+  X(WriteFault, 0x80, "MEDIA_ERROR_STATUS_WRITE_FAULT")                      \
+  X(UnrecoveredReadError, 0x81, "MEDIA_ERROR_STATUS_READ_ERROR")             \
+  X(E2EGuardCheckError, 0x82, "MEDIA_ERROR_E2E_GUARD_CHECK_ERROR")           \
+  X(E2EAppTagCheckError, 0x83, "MEDIA_ERROR_E2E_APP_TAG_CHECK_ERROR")        \
+  X(E2EReferenceTagCheckError, 0x84,                                         \
+    "MEDIA_ERROR_E2E_REFERENCE_TAG_CHECK_ERROR")                             \
+  X(CompareFailure, 0x85, "MEDIA_ERROR_COMPARE_FAILURE")                     \
+  X(AccessDenied, 0x86, "MEDIA_ERROR_STATUS_ACCESS_DENIED")                  \
+  X(DeallocOrUnwrittenLogicalBlck, 0x87,                                     \
+    "MEDIA_ERROR_DEALLOC_OR_UNWRITTEN_LOGICAL_BLCK")
+
+#define NVME_PATH_RELATED_STATUS_CODES(X)                                    \
+  X(InternalPathError, 0x0, "PATH_RELATED_INTERNAL_PATH_ERROR")              \
+  X(AsymmetricAccessPersistentLoss, 0x01,                                    \
+    "PATH_RELATED_ASYMMETRIC_ACCESS_PERSISTENT_LOSS")                        \
+  X(AsymmetricAccessInaccessible, 0x02,                                      \
+    "PATH_RELATED_ASYMMETRIC_ACCESS_INACCESSIBLE")                           \
+  X(AsymmetricAccessTransition, 0x03,                                        \
+    "PATH_RELATED_ASYMMETRIC_ACCESS_TRANSITION")                             \
+  X(ControllerPathingError, 0x60, "PATH_RELATED_CONTROLLER_PATHING_ERROR")   \
+  X(HostPathingError, 0x70, "PATH_RELATED_HOST_PATHING_ERROR")
+
 enum class StatusCode : uint8_t {
   // Generic status codes:
-  kSuccess = 0x0,
-  kInvalidOpcode = 0x1,
-  kInvalidField = 0x2,
-  kCommandIdConflict = 0x3,
-  kDataTransferError = 0x4,
-  kAbortedPowerLoss = 0x5,
-  kInternalError = 0x6,
-  kAbortedByRequest = 0x7,
-  kAbortedSqDeletion = 0x8,
-  // Command Aborted due to Failed Fused Command: The command was aborted due to
-  // the other command in a fused operation failing.
-  kAbortedFailedFused = 0x9,
-  // Command Aborted due to Missing Fused Command: The fused command was aborted
-  // due to the adjacent submission queue entry not containing a fused command
-  // that is the other command in a supported fused operation.
-  kAbortedMissingFused = 0xA,
-  kInvalidNamespace = 0xB,
-  kCommandSeqError = 0xC,
-  kInvalidSglDesc = 0xD,
-  kInvalidNumOfSglDesc = 0xE,
-  kInvalidSglDataLength = 0xF,
-  kInvalidSglMetadataLength = 0x10,
-  kInvalidSglDescType = 0x11,
-  kInvalidUseCtrlMemBuff = 0x12,
-  kInvalidPrpOffset = 0x13,
-  kAtomicWriteUnitExceeded = 0x14,
-  kOpDenied = 0x15,
-  kInvalidSglOffset = 0x16,
-  kHostIdInconsistentFormat = 0x18,
-  kKeepAliveTimerExpired = 0x19,
-  kInvalidKeepAliveTimeout = 0x1A,
-  kAbortedDuePreemptAbort = 0x1B,
-  kSanitizeFailed = 0x1C,
-  kSanitizeInProgress = 0x1D,
-  kInvalidSglDataBlckGranularity = 0x1E,
-  kNotSupportedForQueueInCMB = 0x1F,
-  kNamespaceIsWriteProtected = 0x20,
-  kCommandInterrupted = 0x21,
-  kTransientTransportError = 0x22,
-  // Generic status, NVM command set:
-  kLbaOutOfRange = 0x80,
-  kCapacity_exceeded = 0x81,
-  kNamespaceNotReady = 0x82,
-  kReservationConflict = 0x83,
-  kFormatInProgress = 0x84,
+  NVME_GENERIC_STATUS_CODES(NVME_ABI_ENUMERATOR)
 
   // Command specific:
-  kCompletionQueueInvalid = 0x00,
-  kInvalidQueueId = 0x01,
-  kInvalidQueueSize = 0x02,
-  kAbortCommandLimitExceeded = 0x03,
-  kAsyncEventRequestLimitExceeded = 0x05,
-  kInvalidFirmwareSlot = 0x06,
-  kInvalidFirmwareImage = 0x07,
-  kInvalidInterruptVector = 0x08,
-  kInvalidLogPage = 0x09,
-  kInvalidFormat = 0x0A,
-  kFwActivationReqConventionalReset = 0x0B,
-  kInvalidQueueDeletion = 0x0C,
-  kFeatureIdentifierNotSaveable = 0x0D,
-  kFeatureNotChangeable = 0x0E,
-  kFeatureNotNamespaceSpecific = 0x0F,
-  kFwActivationReqNVMReset = 0x10,
-  kFwActivationReqCtrlLevelReset = 0x11,
-  kFwActivationReqMaxTimeViolation = 0x12,
-  kFwActivationProhibited = 0x13,
-  kOverlappingRangeFirmwareCommit = 0x14,
-  kNsInsufficientCapacity = 0x15,
-  kNsIdentifierUnavailable = 0x16,
-  kNsAlreadyAttached = 0x18,
-  kNsIsPrivate = 0x19,
-  kNsNotAttached = 0x1A,
-  kThinProvisioningNotSupported = 0x1B,
-  kControllerListInvalid = 0x1C,
-  kDeviceSelfTestInProgress = 0x1D,
-  kBootPartitionWriteProhibited = 0x1E,
-  kInvalidControllerIdentifier = 0x1F,
-  kInvalidSecondaryControllerState = 0x20,
-  kInvalidNumCtrlResources = 0x21,
-  kInvalidResourceIdentifier = 0x22,
-  kSanitizeProhibitedWithPMR = 0x23,
-  kANAGroupIdentifierInvalid = 0x24,
-  kANAAttachFailed = 0x25,
-  kInvalidControllerDataQueue = 0x37,
-  kControllerNotSuspended = 0x3a,
-  // Command specific, NVM command set:
-  kConflictingAttributes = 0x80,
-  kInvalidProtectionInformation = 0x81,
-  kAttemptedWriteToReadOnlyRange = 0x82,
+  NVME_CMD_SPECIFIC_STATUS_CODES(NVME_ABI_ENUMERATOR)
 
   // Media error, NVM command set:
-  kWriteFault = 0x80,
-  kUnrecoveredReadError = 0x81,
-  kE2EGuardCheckError = 0x82,
-  kE2EAppTagCheckError = 0x83,
-  kE2EReferenceTagCheckError = 0x84,
-  kCompareFailure = 0x85,
-  kAccessDenied = 0x86,
-  kDeallocOrUnwrittenLogicalBlck = 0x87,
+  NVME_MEDIA_ERROR_STATUS_CODES(NVME_ABI_ENUMERATOR)
 
   // Path Related:
-  kInternalPathError = 0x0,
-  kAsymmetricAccessPersistentLoss = 0x01,
-  kAsymmetricAccessInaccessible = 0x02,
-  kAsymmetricAccessTransition = 0x03,
-  kControllerPathingError = 0x60,
-  kHostPathingError = 0x70,
+  NVME_PATH_RELATED_STATUS_CODES(NVME_ABI_ENUMERATOR)
 };
 
 // Used to determine if command uses PRP (physical region page) or SGLs (scatter
@@ -1346,27 +1420,34 @@ enum class AsyncEvtType : uint8_t {
   kVendorSpecific = 0x7,
 };
 
+// The log page identifiers as an X(name, value) list, the one source of the
+// LogPageId enumerators and of their names in nvme_strings.
+#define NVME_LOG_PAGE_IDS(X)                                                 \
+  X(ErrorInfo, 0x01)                /* Ctrl scope */                         \
+  X(SmartHealthInfo, 0x02)          /* Namespace or NVM scope */             \
+  X(FirmwareSlotInfo, 0x03)         /* NVM scope */                          \
+  X(ChangedNamespaceList, 0x04)     /* Ctrl scope */                         \
+  X(CmdsSupportedAndEffects, 0x05)  /* Ctrl scope */                         \
+  X(DeviceSelfTest, 0x06)           /* Ctrl scope */                         \
+  X(TelemetryHostInitiated, 0x07)   /* Ctrl scope */                         \
+  X(TelemetryCtrlInitiated, 0x08)   /* Ctrl scope */                         \
+  X(EnduranceGrpInfo, 0x09)         /* NVM scope, NVMe 1.4+ */               \
+  X(PredictableLatPerNvmSet, 0x0A)  /* NVM scope, NVMe 1.4+ */               \
+  X(PredictableLatEvtAggr, 0x0B)    /* NVM scope, NVMe 1.4+ */               \
+  X(AsymmNmspAccess, 0x0C)          /* Ctrl scope, NVMe 1.4+ */              \
+  X(PersistentEvtLog, 0x0D)         /* NVM scope, NVMe 1.4+ */               \
+  X(LbaStatusInfo, 0x0E)            /* Ctrl scope, NVMe 1.4+ */              \
+  X(EnduranceGrpEvtAggr, 0x0F)      /* NVM scope, NVMe 1.4+ */               \
+  X(Discovery, 0x70)                                                         \
+  X(ReservationNotification, 0x80)  /* NVM specific, Ctrl scope */           \
+  X(SanitizeStatus, 0x81)           /* NVM specific, NVM scope */
+
 enum class LogPageId : uint8_t {
-  kErrorInfo = 0x01,                // Ctrl scope
-  kSmartHealthInfo = 0x02,          // Namespace or NVM scope
-  kFirmwareSlotInfo = 0x03,         // NVM scope
-  kChangedNamespaceList = 0x04,     // Ctrl scope
-  kCmdsSupportedAndEffects = 0x05,  // Ctrl scope
-  kDeviceSelfTest = 0x06,           // Ctrl scope
-  kTelemetryHostInitiated = 0x07,   // Ctrl scope
-  kTelemetryCtrlInitiated = 0x08,   // Ctrl scope
-  kEnduranceGrpInfo = 0x09,         // NVM scope, NVMe 1.4+
-  kPredictableLatPerNvmSet = 0x0A,  // NVM scope, NVMe 1.4+
-  kPredictableLatEvtAggr = 0x0B,    // NVM scope, NVMe 1.4+
-  kAsymmNmspAccess = 0x0C,          // Ctrl scope, NVMe 1.4+
-  kPersistentEvtLog = 0x0D,         // NVM scope, NVMe 1.4+
-  kLbaStatusInfo = 0x0E,            // Ctrl scope, NVMe 1.4+
-  kEnduranceGrpEvtAggr = 0x0F,      // NVM scope, NVMe 1.4+
-  kDiscovery = 0x70,
-  kReservationNotification = 0x80,  // NVM specific, Ctrl scope
-  kSanitizeStatus = 0x81,           // NVM specific, NVM scope
+  NVME_LOG_PAGE_IDS(NVME_ABI_ENUMERATOR)
 };
 
+#undef NVME_ABI_ENUMERATOR
+
 enum class AsyncEvtInfoNotice : uint8_t {
   kNamespaceAttributeChanged = 0x00,
   kFirmwareActivationStarting = 0x01,
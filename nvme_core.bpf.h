@@ -0,0 +1,161 @@
+#ifndef NVME_CORE_BPF_H
+#define NVME_CORE_BPF_H
+
+// Minimal CO-RE definitions of the kernel types used by the BPF programs, in
+// place of a full `bpftool btf dump` of the build host. Only the accessed
+// fields are declared. preserve_access_index makes clang record every access
+// as a relocation that libbpf resolves against the running kernel BTF, so the
+// field offsets and sizes don't have to match the kernel the program was
+// built on.
+//
+// Must be included before <bpf/bpf_helpers.h>, it provides the basic types
+// and the BPF UAPI constants that the libbpf headers expect.
+
+typedef unsigned char __u8;
+typedef unsigned short __u16;
+typedef unsigned int __u32;
+typedef unsigned long long __u64;
+typedef signed char __s8;
+typedef short __s16;
+typedef int __s32;
+typedef long long __s64;
+typedef __u16 __le16;
+typedef __u32 __le32;
+typedef __u64 __le64;
+typedef __u16 __be16;
+typedef __u32 __be32;
+typedef __u64 __be64;
+typedef __u32 __wsum;
+
+typedef __u8 u8;
+typedef __u16 u16;
+typedef __u32 u32;
+typedef __u64 u64;
+typedef __s32 s32;
+typedef __s64 s64;
+
+#ifndef __cplusplus
+typedef _Bool bool;
+enum {
+  false = 0,
+  true = 1,
+};
+#endif
+
+typedef __u8 blk_status_t;
+
+// From include/uapi/linux/bpf.h, the values are part of the kernel ABI.
+enum bpf_map_type {
+  BPF_MAP_TYPE_HASH = 1,
+  BPF_MAP_TYPE_ARRAY = 2,
+  BPF_MAP_TYPE_PERCPU_HASH = 5,
+  BPF_MAP_TYPE_PERCPU_ARRAY = 6,
+  BPF_MAP_TYPE_LRU_HASH = 9,
+  BPF_MAP_TYPE_RINGBUF = 27,
+};
+
+enum {
+  BPF_ANY = 0,
+  BPF_NOEXIST = 1,
+  BPF_EXIST = 2,
+};
+
+// The relocations only exist in the BPF target, the host build of the
+// programs (bpf_host.h) uses the declared layout as is.
+#ifdef __bpf__
+#pragma clang attribute push(__attribute__((preserve_access_index)), \
+                             apply_to = record)
+#endif
+
+// Tracepoint contexts, see /sys/kernel/tracing/events/nvme/*/format.
+
+struct trace_entry {
+  unsigned short type;
+  unsigned char flags;
+  unsigned char preempt_count;
+  int pid;
+};
+
+struct trace_event_raw_nvme_setup_cmd {
+  struct trace_entry ent;
+  char disk[32];
+  int ctrl_id;
+  int qid;
+  u8 opcode;
+  u8 flags;
+  u8 fctype;
+  // u16 in the current kernels, was an int. Read with
+  // BPF_CORE_READ_BITFIELD_PROBED which relocates the size too.
+  u16 cid;
+  u32 nsid;
+  bool metadata;
+  u8 cdw10[24];
+};
+
+struct trace_event_raw_nvme_complete_rq {
+  struct trace_entry ent;
+  char disk[32];
+  int ctrl_id;
+  int qid;
+  // Same as trace_event_raw_nvme_setup_cmd::cid.
+  int cid;
+  u64 result;
+  u8 retries;
+  u8 flags;
+  u16 status;
+};
+
+// The block layer and driver structures used by the fentry backend.
+
+struct request_queue {
+  void* queuedata;
+};
+
+struct blk_mq_hw_ctx {
+  unsigned int queue_num;
+};
+
+struct request {
+  struct request_queue* q;
+  struct blk_mq_hw_ctx* mq_hctx;
+};
+
+struct nvme_ctrl {
+  int instance;
+};
+
+struct nvme_common_command {
+  __u8 opcode;
+  __u8 flags;
+  __u16 command_id;
+  __le32 nsid;
+  __le32 cdw2[2];
+  __le64 metadata;
+  __le64 dptr[2];
+  __le32 cdw10;
+  __le32 cdw11;
+  __le32 cdw12;
+  __le32 cdw13;
+  __le32 cdw14;
+  __le32 cdw15;
+};
+
+struct nvme_command {
+  union {
+    struct nvme_common_command common;
+  };
+};
+
+struct nvme_request {
+  struct nvme_command* cmd;
+  u16 status;
+  struct nvme_ctrl* ctrl;
+};
+
+struct nvme_ns;
+
+#ifdef __bpf__
+#pragma clang attribute pop
+#endif
+
+#endif /* NVME_CORE_BPF_H */
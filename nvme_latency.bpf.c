@@ -1,164 +1,86 @@
 // clang-format off
-#include "nvme_core_gen.h"
+#include "nvme_core.bpf.h"
 // clang-format on
 
 #include "nvme_latency.h"
 
+#include <bpf/bpf_core_read.h>
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_tracing.h>
 
-#include "histogram.bpf.h"
 #include "types.bpf.h"
 
-char LICENSE[] SEC("license") = "Dual BSD/GPL";
-
-#define MAX_LATENCY_ENTRIES 20
-#define ALL_CTRL_ID 0xFFFFFFFF
-#define ALL_NSID 0xFFFFFFFF
-#define ALL_OPCODE 0xFF
+// The context fields are accessed directly, the CO-RE relocations of
+// nvme_core.bpf.h adjust their offsets to the running kernel. cid changed size
+// between kernel versions and is read with BPF_CORE_READ_BITFIELD_PROBED,
+// which also relocates the load size.
 
-// Variables set from the userspace program.
-const volatile __u32 filter_ctrl_id = ALL_CTRL_ID;
-const volatile __u32 filter_nsid = ALL_NSID;
-const volatile __u8 filter_opcode = ALL_OPCODE;
-const volatile __u64 latency_min = 20;
-const volatile __u64 latency_shift = 0;
+// The nvme tracepoints don't expose the request pointer, the requests are
+// identified by controller, queue and command id instead.
+typedef struct request_key in_flight_key_t;
 
-#define SIZE_CLASS_DISABLED 0xFFFF
+#include "nvme_latency_core.bpf.h"
 
-const volatile int class1_size_nlb = SIZE_CLASS_DISABLED;
-const volatile int class2_size_nlb = SIZE_CLASS_DISABLED;
-
-struct {
-  __uint(type, BPF_MAP_TYPE_HASH);
-  __uint(max_entries, 10240);
-  __type(key, struct request_key);
-  __type(value, struct request_data);
-} in_flight SEC(".maps");
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
-struct {
-  __uint(type, BPF_MAP_TYPE_HASH);
-  __uint(max_entries, MAX_LATENCY_ENTRIES);
-  __type(key, struct latency_hist_key);
-  __type(value, struct latency_hist);
-} hists SEC(".maps");
+// Assembles a little endian command dword from the tracepoint cdw10 bytes,
+// index 0 is cdw10, 2 is cdw12.
+static __always_inline u32 tp_cdw(const u8* cdw10, int index) {
+  u32 dw = cdw10[index * 4 + 3];
+  dw <<= 8;
+  dw |= cdw10[index * 4 + 2];
+  dw <<= 8;
+  dw |= cdw10[index * 4 + 1];
+  dw <<= 8;
+  dw |= cdw10[index * 4];
+  return dw;
+}
 
 SEC("tp/nvme/nvme_setup_cmd")
 int handle_nvme_setup_cmd(struct trace_event_raw_nvme_setup_cmd* ctx) {
+  u16 cid = BPF_CORE_READ_BITFIELD_PROBED(ctx, cid);
 #ifdef VLOG
   bpf_printk("nvme_setup_cmd: PID %d, qid=%d, cid=%d, opcode=0x%x",
-             bpf_get_current_pid_tgid() >> 32, ctx->qid, ctx->cid, ctx->opcode);
+             bpf_get_current_pid_tgid() >> 32, ctx->qid, cid, ctx->opcode);
 #endif
-  if (filter_ctrl_id != ALL_CTRL_ID && ctx->ctrl_id != (int)filter_ctrl_id) {
-    return 0;
-  }
-  if (filter_opcode != ALL_OPCODE && ctx->opcode != (u8)filter_opcode) {
-    return 0;
-  }
-  if (filter_nsid != ALL_NSID && ctx->nsid != filter_nsid) {
-    return 0;
-  }
-  if (ctx->qid == 0) {
-    // Skip measuring the latency of the admin commands
-    return 0;
-  }
+  struct nvme_cmd_info cmd = {};
+  cmd.ctrl_id = ctx->ctrl_id;
+  cmd.qid = ctx->qid;
+  cmd.nsid = ctx->nsid;
+  cmd.cdw10 = tp_cdw(ctx->cdw10, 0);
+  cmd.cdw12 = tp_cdw(ctx->cdw10, 2);
+  cmd.cid = cid;
+  cmd.opcode = ctx->opcode;
 
-  u64 ts = bpf_ktime_get_ns();
   // Important to initialize the key, outherwise garbage padding (probably) may
   // lead to lookup failures.
   struct request_key req_key = {};
   req_key.ctrl_id = ctx->ctrl_id;
   req_key.qid = ctx->qid;
-  req_key.cid = ctx->cid;
-
-  struct request_data req_data;
-  req_data.start_ns = ts;
-  req_data.opcode = ctx->opcode;
-
-  if (class1_size_nlb == SIZE_CLASS_DISABLED) {
-    req_data.size_class = 0;
-  } else {
-    // sqe.cdw12 contains the zero-based size in blocks in lsb format.
-    u32 nlb = ctx->cdw10[11];
-    nlb <<= 8;
-    nlb |= ctx->cdw10[10];
-    nlb <<= 8;
-    nlb |= ctx->cdw10[9];
-    nlb <<= 8;
-    nlb |= ctx->cdw10[8];
-    nlb += 1;  // Convert from zero-based to one-based.
+  req_key.cid = cid;
 
-    if (nlb <= class1_size_nlb) {
-      req_data.size_class = 0;
-    } else if (nlb <= class2_size_nlb) {
-      req_data.size_class = 1;
-    } else {
-      req_data.size_class = 2;
-    }
-  }
-
-  long ret = bpf_map_update_elem(&in_flight, &req_key, &req_data, BPF_ANY);
-  if (ret != 0) {
-    // TODO(mogo): Record lost starts.
-  }
-  return 0;
+  return latency_setup_cmd(&cmd, &req_key);
 }
 
-// TODO(mogo): Periodic cleanup of in_flight requests that exceed unreasonable
-// duration.
-
 SEC("tp/nvme/nvme_complete_rq")
 int handle_nvme_complete_rq(struct trace_event_raw_nvme_complete_rq* ctx) {
+  u16 cid = BPF_CORE_READ_BITFIELD_PROBED(ctx, cid);
 #ifdef VLOG
   bpf_printk("nvme_complete_rq: PID %d, disk=%s, qid=%d, cid=%d",
-             bpf_get_current_pid_tgid() >> 32, ctx->disk, ctx->qid, ctx->cid);
+             bpf_get_current_pid_tgid() >> 32, ctx->disk, ctx->qid, cid);
 #endif
+  struct nvme_cpl_info cpl = {};
+  cpl.ctrl_id = ctx->ctrl_id;
+  cpl.qid = ctx->qid;
+  cpl.cid = cid;
+  cpl.status = ctx->status;
 
   // Important to initialize the key, outherwise garbage padding (probably) may
   // lead to lookup failures.
   struct request_key req_key = {};
   req_key.ctrl_id = ctx->ctrl_id;
   req_key.qid = ctx->qid;
-  req_key.cid = ctx->cid;
-
-  struct request_data* req_data;
-  req_data = bpf_map_lookup_elem(&in_flight, &req_key);
-  if (req_data == NULL) {
-    // TODO(mogo): Record missed starts. We expect some missing entries at the
-    // very beginning on the operation, but a continuous increase may indicate
-    // either logic errors or in-flight map overflow.
-    return 0;
-  }
-  u64 ts = bpf_ktime_get_ns();
-
-  struct latency_hist_key hist_key = {};
-  hist_key.ctrl_id = ctx->ctrl_id;
-  hist_key.opcode = req_data->opcode;
-  hist_key.size_class = req_data->size_class;
-
-  struct latency_hist* hist;
-  hist = bpf_map_lookup_elem(&hists, &hist_key);
-  if (hist == NULL) {
-    struct latency_hist new_hist = {};
-    bpf_map_update_elem(&hists, &hist_key, &new_hist, BPF_ANY);
-    hist = bpf_map_lookup_elem(&hists, &hist_key);
-    if (!hist) {
-      // TODO(mogo): Record histogram overflow.
-      goto cleanup;
-    }
-  }
-  u64 delta_us = (ts - req_data->start_ns) / 1000;
-
-  __sync_fetch_and_add(&hist->total_count, 1);
-  __sync_fetch_and_add(&hist->total_sum, delta_us);
-
-  int slot =
-      bpf_get_bucket(delta_us, latency_min, latency_shift, LATENCY_MAX_SLOTS);
-  if (slot >= 0) {
-    __sync_fetch_and_add(&hist->slots[slot], 1);
-  }
+  req_key.cid = cid;
 
-cleanup:
-  bpf_map_delete_elem(&in_flight, &req_key);
-  return 0;
+  return latency_complete_rq(&cpl, &req_key);
 }
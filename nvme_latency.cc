@@ -9,11 +9,17 @@
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <optional>
 #include <set>
 #include <string>
-#include <unordered_set>
+#include <tuple>
 #include <vector>
 
 #include "absl/cleanup/cleanup.h"
@@ -23,16 +29,30 @@
 #include "absl/log/initialize.h"
 #include "absl/log/log.h"
 #include "absl/status/status.h"
+#include "absl/status/statusor.h"
 #include "absl/strings/ascii.h"
+#include "absl/strings/str_cat.h"
 #include "absl/strings/str_join.h"
 #include "absl/strings/strip.h"
 #include "absl/time/time.h"
+#include "bpf_utils.h"
+#include "cgroup_top.h"
+#include "device_health.h"
+#include "event_loop.h"
+#include "heatmap.h"
 #include "histogram.bpf.h"
 #include "histogram.h"
+#include "histogram_kernels.h"
+#include "latency_history.h"
+#include "latency_snapshot.h"
+#include "metrics_exporter.h"
 #include "nvme_abi.h"
 #include "nvme_latency_bpf.skel.h"
+#include "nvme_latency_kf_bpf.skel.h"
+#include "nvme_latency_kf_vlog_bpf.skel.h"
 #include "nvme_latency_vlog_bpf.skel.h"
 #include "nvme_strings.h"
+#include "stuck_io.h"
 
 /*
 Program used to monitor NVMe request latency.
@@ -47,6 +67,51 @@ Useful flags / settings:
   <=16KiB, (16KiB,64KiB], >64KiB
 * --lbs512. If set, the size classes are computed assuming 512 byte logical
   block size. By default 4KiB logical block size is assumed.
+* --shed_in_flight_cmds=X, --shed_in_flight_kib=X. Stop measuring new IOs on
+  a controller while its in-flight commands or KiB, measured or not, exceed
+  the limits.
+  With --shed_to_saturated the IOs are measured into separate "saturated"
+  histograms instead.
+* --admin. Also measure the admin commands, in separate histograms keyed by
+  the admin opcode. --admin_slow_us=X logs every admin command slower than X.
+* --backend=auto|fentry|tracepoint. Selects how the BPF programs attach. The
+  fentry backend keys the requests by the request pointer and also sees the
+  batched completions. auto picks fentry when the kernel BTF supports it.
+* --prog_stats. Prints the BPF run time of each program and the per-IO
+  overhead. --compare_backends=10s measures every backend in turn.
+* --sample_rate=N. Measure only 1 in N IOs, N must be a power of two. The
+  printed counts are scaled back up by the effective sampling rate.
+* --top. Attributes the IOs to the issuing cgroup and process and prints the
+  heaviest / slowest cgroups every interval instead of the histograms.
+  --top_sort=iops|bytes|avg_lat|p99 selects the order, --top_n the rows.
+* --pin_path=/sys/fs/bpf/nvme_latency. Pins the maps under bpffs and reuses
+  them on the next start, the histograms and the in-flight IOs survive a
+  restart. With --pin_links the probes also stay attached while the monitor
+  is not running, until a run without --pin_links replaces them.
+* --shm_name=/nvme_latency. Publishes the histograms of every interval into a
+  shared memory segment, read them with latency_snapshot_dump or the
+  latency_snapshot library.
+* --metrics_address=127.0.0.1:9464 or unix:/run/nvme_latency.sock. Serves the
+  histograms to Prometheus scrapes.
+* --history_dir=/var/lib/nvme_latency. Records the histograms of every
+  interval into rotating files within --history_max_mb, extract a time range
+  with latency_history_dump.
+* --auto_tune=10s. Measures the latency for 10s with a wide histogram layout,
+  then restarts with the --lat_min_us and --lat_shift that spread p1-p99.99
+  over the most buckets. The chosen values are printed so they can be pinned.
+* --heatmap. Draws the latency over time per controller and opcode, one
+  column per interval, instead of printing the histogram tables. Only the new
+  column is redrawn every interval.
+* --health_interval=1m. Reads the SMART / Health and the Error Information
+  logs of the measured controllers every minute through the admin passthrough
+  ioctl and prints the temperature, thermal throttling time, media errors and
+  the new error log entries under the histograms.
+* --stuck_io_ms=1000. Reports the IOs in flight for longer than 1s with their
+  queue, cid and submitting process, the age histogram of the outstanding IOs,
+  and the queues that stopped completing commands.
+* --blk_stages. Splits the latency into the block layer queue time
+  (insert->nvme_setup_cmd), the driver submission (nvme_setup_cmd->issue) and
+  the device time (issue->completion). Requires the fentry backend.
 
 bazel build :nvme_latency && sudo $(pwd)/bazel-bin/nvme_latency
 
@@ -77,8 +142,6 @@ https://docs.ebpf.io/linux/helper-function/bpf_timer_set_callback/
 * Query the namespace block sizes and supply them to the BPF to filter sizes
 correctly
 * Print one percent lows and point one percent lows latency
-* Add the ability to skip the latency measurements if the in-flight command
-count or in-flight byte count exceeds a certain threshold
 */
 
 ABSL_DECLARE_FLAG(int, stderrthreshold);
@@ -91,6 +154,10 @@ ABSL_FLAG(int, lat_min_us, -1,
           "The minimum histogram latency to be considered. Provides more "
           "granularity around this value.");
 ABSL_FLAG(int, lat_shift, -1, "");
+ABSL_FLAG(absl::Duration, auto_tune, absl::ZeroDuration(),
+          "If set first measures the latency distribution for this long with "
+          "a wide histogram layout, then picks --lat_min_us and --lat_shift "
+          "that spread p1-p99.99 over the most buckets and starts with them.");
 
 ABSL_FLAG(bool, split_size, false, "If set splits the histograms by size");
 
@@ -101,10 +168,108 @@ ABSL_FLAG(bool, bpf_trace, false,
 
 ABSL_FLAG(bool, lbs512, false, "");
 
-static volatile bool exiting = false;
-static void sig_handler(int sig) {
-  exiting = true;
-  std::cout << "Exiting on signal " << sig << std::endl;
+ABSL_FLAG(int64_t, shed_in_flight_cmds, 0,
+          "If non-zero new IOs are not measured while a controller has at "
+          "least this many commands in flight.");
+ABSL_FLAG(int64_t, shed_in_flight_kib, 0,
+          "If non-zero new IOs are not measured while a controller has at "
+          "least this many KiB of commands in flight.");
+ABSL_FLAG(bool, shed_to_saturated, false,
+          "If set the IOs above the --shed_in_flight_* limits are measured "
+          "into separate saturated histograms instead of being skipped.");
+
+ABSL_FLAG(bool, admin, false,
+          "If set also measures the admin command latency, the histograms are "
+          "keyed by controller and admin opcode.");
+ABSL_FLAG(int, admin_slow_us, -1,
+          "If non-negative, logs every admin command slower than this. "
+          "Requires --admin.");
+
+ABSL_FLAG(std::string, backend, "auto",
+          "BPF attach backend: 'fentry' (fexit:nvme_setup_cmd and "
+          "fentry:nvme_complete_rq/nvme_complete_batch_req, keyed by the "
+          "request pointer), 'tracepoint' (tp/nvme/*) or 'auto' to use fentry "
+          "when the kernel BTF supports it.");
+ABSL_FLAG(bool, prog_stats, false,
+          "If set enables the kernel BPF run-time stats and prints the "
+          "average run time of each BPF program and the per-IO overhead.");
+ABSL_FLAG(absl::Duration, compare_backends, absl::ZeroDuration(),
+          "If set runs each available backend for this long, one after the "
+          "other, and prints their per-IO overhead side by side.");
+
+ABSL_FLAG(int, sample_rate, 1,
+          "Measure the latency of only 1 in N IOs. Must be a power of two, 1 "
+          "measures every IO.");
+
+ABSL_FLAG(bool, blk_stages, false,
+          "If set also attaches to the block_rq_insert/block_rq_issue "
+          "tracepoints and prints the queue, driver submission and device "
+          "time histograms per controller and opcode. Requires the fentry "
+          "backend.");
+
+ABSL_FLAG(bool, heatmap, false,
+          "If set draws the IO latency over time as a heatmap per controller "
+          "and opcode instead of printing the histograms every interval.");
+ABSL_FLAG(int, heatmap_width, 60,
+          "The number of intervals shown by --heatmap.");
+ABSL_FLAG(absl::Duration, health_interval, absl::ZeroDuration(),
+          "If set reads the SMART / Health and the Error Information logs of "
+          "the controllers at this interval, e.g. 1m, and prints the "
+          "temperature, throttling and error counters under the histograms.");
+ABSL_FLAG(bool, top, false,
+          "If set attributes every measured IO to the cgroup and process that "
+          "issued it and prints the top cgroups every interval, like top.");
+ABSL_FLAG(int, top_n, 20, "The number of cgroups printed by --top.");
+ABSL_FLAG(std::string, top_sort, "iops",
+          "The --top order: iops, bytes, avg_lat or p99.");
+
+ABSL_FLAG(int, stuck_io_ms, 0,
+          "If set reports the IOs in flight for longer than this, the age "
+          "histogram of the outstanding IOs, and alerts on the queues that "
+          "complete nothing for as long. With --sample_rate only the sampled "
+          "IOs are seen.");
+ABSL_FLAG(int, stuck_scan_batch, 4096,
+          "The in-flight entries read per interval by --stuck_io_ms, a sweep "
+          "over a larger map spans several intervals.");
+ABSL_FLAG(int, stuck_max_rows, 20,
+          "The number of stuck IOs printed by --stuck_io_ms.");
+
+ABSL_FLAG(std::string, pin_path, "",
+          "If set pins the BPF maps in this bpffs directory and reuses the "
+          "ones pinned by a previous run. The histogram layout flags "
+          "(--lat_min_us, --lat_shift, --split_size) must not change between "
+          "runs sharing the directory.");
+ABSL_FLAG(bool, pin_links, false,
+          "If set the probes are pinned in --pin_path too and stay attached "
+          "after exit, the next run takes over without a measurement gap. "
+          "A later run with --pin_path alone detaches them once its own "
+          "probes are attached, or remove the directory.");
+
+ABSL_FLAG(std::string, shm_name, "",
+          "If set publishes the histograms every interval into this POSIX "
+          "shared memory object, e.g. /nvme_latency. See latency_snapshot.h "
+          "for the layout and latency_snapshot_dump for a reader.");
+
+ABSL_FLAG(std::string, metrics_address, "",
+          "If set serves the histograms in the Prometheus text format on this "
+          "address, host:port (e.g. 127.0.0.1:9464) or unix:/path.");
+
+ABSL_FLAG(std::string, history_dir, "",
+          "If set records the histograms of every interval into this "
+          "directory. See latency_history.h for the format and "
+          "latency_history_dump for a reader.");
+ABSL_FLAG(int64_t, history_max_mb, 256,
+          "The disk budget of --history_dir, the oldest files are removed.");
+ABSL_FLAG(int64_t, history_file_mb, 16,
+          "The size at which --history_dir starts a new file.");
+
+// Stops `loop` on SIGINT and SIGTERM.
+static absl::Status StopOnSignals(nvme_bpf::EventLoop* loop) {
+  return loop->AddSignals({SIGINT, SIGTERM}, [loop](int sig) {
+    std::cout << "Exiting on signal " << sig << std::endl;
+    loop->Stop();
+    return absl::OkStatus();
+  });
 }
 
 static int libbpf_print_fn(enum libbpf_print_level level, const char* format,
@@ -115,189 +280,607 @@ static int libbpf_print_fn(enum libbpf_print_level level, const char* format,
   return 0;
 }
 
-// Latency histogram parameters.
+// Latency histogram parameters, with the bound tables of g_lat_layout.
+nvme_bpf::LatencyBucketLayout g_lat_layout;
 nvme_bpf::Histogram g_lat_hist;
 
-absl::Status PrintHist(const struct latency_hist& hist) {
-  nvme_bpf::Histogram histogram = g_lat_hist;
+void SetLatencyLayout(int lat_min_us, int lat_shift) {
+  g_lat_layout = nvme_bpf::LatencyBucketLayout::Make(lat_min_us, lat_shift);
+  g_lat_hist.SetLayout(g_lat_layout);
+}
+
+// Multiplier applied to the histogram counts to compensate for sampling.
+double g_count_scale = 1.0;
 
-  histogram.slots = hist.slots;
-  histogram.total_count = hist.total_count;
-  histogram.total_sum = hist.total_sum;
-  return nvme_bpf::PrintHistogram(histogram);
+// A view of `hist` with the configured layout.
+nvme_bpf::Histogram HistView(const struct latency_hist& hist) {
+  nvme_bpf::Histogram view = g_lat_hist;
+  view.slots = hist.slots;
+  view.total_count = hist.total_count;
+  view.total_sum = hist.total_sum;
+  view.total_sum_sq = hist.total_sum_sq;
+  view.overflow_count = hist.overflow_count;
+  view.min = hist.min;
+  view.max = hist.max;
+  return view;
 }
 
-template <typename T1, typename T2, typename T3>
-struct TupleHash {
-  size_t operator()(const std::tuple<T1, T2, T3>& t) const {
-    // Combine hashes of individual elements
-    return std::hash<T1>()(std::get<0>(t)) ^
-           (std::hash<T2>()(std::get<1>(t)) << 1) ^
-           (std::hash<T3>()(std::get<2>(t)) << 2);
+absl::Status PrintHist(const struct latency_hist& hist,
+                       double count_scale = g_count_scale) {
+  auto histogram =
+      nvme_bpf::OwnedHistogram<LATENCY_MAX_SLOTS>::FromView(HistView(hist));
+  if (!histogram.ok()) {
+    return histogram.status();
   }
-};
+  if (count_scale != 1.0) {
+    histogram->Scale(count_scale);
+  }
+  return nvme_bpf::PrintHistogram(histogram->view());
+}
+
+// Sums the per-CPU counters from the `stats` map.
+absl::Status ReadStats(struct bpf_map* stats_map, struct latency_stats* total) {
+  int fd = bpf_map__fd(stats_map);
+  if (fd < 0) {
+    return absl::InternalError("BPF stats map fd error");
+  }
+  int num_cpus = libbpf_num_possible_cpus();
+  if (num_cpus <= 0) {
+    return absl::InternalError("Failed to get the number of possible CPUs");
+  }
+  std::vector<struct latency_stats> per_cpu(num_cpus);
+  u32 zero = 0;
+  if (bpf_map_lookup_elem(fd, &zero, per_cpu.data()) != 0) {
+    return absl::InternalError("Failed to read the BPF stats map");
+  }
+  *total = {};
+  for (const auto& cpu_stats : per_cpu) {
+    total->sampled += cpu_stats.sampled;
+    total->unsampled += cpu_stats.unsampled;
+    total->shed += cpu_stats.shed;
+    total->saturated += cpu_stats.saturated;
+    total->load_untracked += cpu_stats.load_untracked;
+  }
+  return absl::OkStatus();
+}
+
+void PrintShedding(struct bpf_map* stats_map) {
+  struct latency_stats stats;
+  auto s = ReadStats(stats_map, &stats);
+  if (!s.ok()) {
+    std::cerr << "Failed to read load shedding stats: " << s.message()
+              << std::endl;
+    return;
+  }
+  std::cout << "Load shedding: shed=" << stats.shed
+            << ", saturated=" << stats.saturated;
+  if (stats.load_untracked != 0) {
+    std::cout << ", untracked=" << stats.load_untracked;
+  }
+  std::cout << std::endl;
+}
+
+// Updates g_count_scale from the number of sampled and skipped IOs and prints
+// the effective sampling rate if `print`.
+void UpdateSampling(struct bpf_map* stats_map, bool print = true) {
+  struct latency_stats stats;
+  auto s = ReadStats(stats_map, &stats);
+  if (!s.ok()) {
+    std::cerr << "Failed to read sampling stats: " << s.message() << std::endl;
+    return;
+  }
+  if (stats.sampled == 0) {
+    if (print) {
+      std::cout << "Sampling 1 in " << absl::GetFlag(FLAGS_sample_rate)
+                << ", no IOs sampled yet." << std::endl;
+    }
+    return;
+  }
+  g_count_scale =
+      static_cast<double>(stats.sampled + stats.unsampled) / stats.sampled;
+  if (!print) {
+    return;
+  }
+  std::cout << "Sampling 1 in " << absl::GetFlag(FLAGS_sample_rate)
+            << ", effective 1 in " << g_count_scale
+            << " (sampled=" << stats.sampled
+            << ", skipped=" << stats.unsampled << ")" << std::endl;
+}
 
-absl::Status PrintAllHists(struct bpf_map* hists) {
+// Reads the per-CPU copies of a `hists` or `admin_hists` entry and combines
+// them: the counters are summed, min and max are over the CPUs that recorded
+// anything.
+absl::StatusOr<struct latency_hist> LookupPerCpuHist(int fd, const void* key) {
+  int num_cpus = libbpf_num_possible_cpus();
+  if (num_cpus <= 0) {
+    return absl::InternalError("Failed to get the number of possible CPUs");
+  }
+  std::vector<struct latency_hist> per_cpu(num_cpus);
+  if (bpf_map_lookup_elem(fd, key, per_cpu.data()) != 0) {
+    return absl::NotFoundError("Histogram entry not found");
+  }
+  struct latency_hist total = {};
+  for (const struct latency_hist& hist : per_cpu) {
+    if (hist.total_count == 0) {
+      continue;
+    }
+    if (total.total_count == 0 || hist.min < total.min) {
+      total.min = hist.min;
+    }
+    total.max = std::max(total.max, hist.max);
+    nvme_bpf::AddSlots(total.slots, hist.slots, LATENCY_MAX_SLOTS + 1);
+    total.total_sum += hist.total_sum;
+    total.total_count += hist.total_count;
+    total.total_sum_sq += hist.total_sum_sq;
+    total.overflow_count += hist.overflow_count;
+  }
+  return total;
+}
+
+using HistEntry = std::pair<struct latency_hist_key, struct latency_hist>;
+
+// Reads all the IO histograms, ordered by controller, opcode, size class and
+// saturation so that they are reported in a meaningful order.
+absl::StatusOr<std::vector<HistEntry>> ReadAllHists(struct bpf_map* hists) {
   int fd = bpf_map__fd(hists);
   if (fd < 0) {
     if (fd == -1) {
-      std::cerr << "BPF latency histogram map not created. " << std::endl;
-    } else {
-      std::cerr << "BPF latency histogram map error. err=" << fd << std::endl;
+      return absl::InternalError("BPF latency histogram map not created.");
     }
-    return absl::InternalError("BPF map fd error");
+    return absl::InternalError(
+        absl::StrCat("BPF latency histogram map error. err=", fd));
   }
 
   struct latency_hist_key dummy_key;
   using TCtrlId = decltype(dummy_key.ctrl_id);
   using TOpcode = decltype(dummy_key.opcode);
   using TSizeClass = decltype(dummy_key.size_class);
+  using TSaturated = decltype(dummy_key.saturated);
 
-  std::set<TCtrlId> controllers;
-  std::set<TOpcode> opcodes;
-  std::set<TSizeClass> sizes;
-  std::unordered_set<std::tuple<TCtrlId, TOpcode, TSizeClass>,
-                     TupleHash<TCtrlId, TOpcode, TSizeClass>>
-      keys;
-
+  std::set<std::tuple<TCtrlId, TOpcode, TSizeClass, TSaturated>> keys;
   {
     struct latency_hist_key lookup_key = {};
     lookup_key.ctrl_id = std::numeric_limits<TCtrlId>::max();
     lookup_key.opcode = 0;
     struct latency_hist_key next_key;
 
-    if (bpf_map_get_next_key(fd, &lookup_key, &next_key) != 0) {
-      std::cout << "No entries in histogram map." << std::endl;
-      return absl::OkStatus();
-    }
-
     // Scan the map and find all controllers / opcodes / sizes.
     while (0 == bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
-      controllers.insert(next_key.ctrl_id);
-      opcodes.insert(next_key.opcode);
-      sizes.insert(next_key.size_class);
-
       keys.insert(std::make_tuple(next_key.ctrl_id, next_key.opcode,
-                                  next_key.size_class));
+                                  next_key.size_class, next_key.saturated));
 
       lookup_key = next_key;
     }
   }
 
-  // Print the histograms in a meaningful order.
-  for (const auto& ctrl_id : controllers) {
-    for (const auto& opcode : opcodes) {
-      for (const auto& size_class : sizes) {
-        if (keys.find(std::make_tuple(ctrl_id, opcode, size_class)) ==
-            keys.end()) {
-          // Short circuit to avoid going through the BPF functions.
-          continue;
-        }
+  std::vector<HistEntry> result;
+  for (const auto& [ctrl_id, opcode, size_class, saturated] : keys) {
+    struct latency_hist_key lookup_key = {};
+    lookup_key.ctrl_id = ctrl_id;
+    lookup_key.opcode = opcode;
+    lookup_key.size_class = size_class;
+    lookup_key.saturated = saturated;
 
-        struct latency_hist_key lookup_key = {};
-        lookup_key.ctrl_id = ctrl_id;
-        lookup_key.opcode = opcode;
-        lookup_key.size_class = size_class;
+    auto hist = LookupPerCpuHist(fd, &lookup_key);
+    if (!hist.ok()) {
+      // Shouldn't really happen ...
+      continue;
+    }
+    result.emplace_back(lookup_key, *hist);
+  }
+  return result;
+}
 
-        struct latency_hist hist;
-        int err = bpf_map_lookup_elem(fd, &lookup_key, &hist);
-        if (err < 0) {
-          // Shouldn't really happen ...
-          continue;
-        }
+// E.g. "ctrl_id=0, opcode=2 Read, <=16KiB".
+std::string HistKeyName(const struct latency_hist_key& key) {
+  std::string name = absl::StrCat(
+      "ctrl_id=", key.ctrl_id, ", opcode=", static_cast<int>(key.opcode), " ",
+      nvme_abi::NvmeIoOpcodeToString(
+          static_cast<nvme_abi::NvmeOpcode>(key.opcode)));
+  if (absl::GetFlag(FLAGS_split_size)) {
+    if (key.size_class == 0) {
+      name += ", <=16KiB";
+    } else if (key.size_class == 1) {
+      name += ", (16KiB, 64KiB]";
+    } else {
+      name += ", (64KiB, inf)";
+    }
+  } else {
+    LOG_IF_EVERY_N_SEC(ERROR, key.size_class != 0, 1)
+        << "Unexpected size_class " << static_cast<int>(key.size_class)
+        << " when --split_size is not set.";
+  }
+  if (key.saturated) {
+    name += ", saturated";
+  }
+  return name;
+}
 
-        std::cout << "key: ctrl_id=" << ctrl_id
-                  << ", opcode=" << static_cast<int>(opcode) << " "
-                  << nvme_abi::NvmeIoOpcodeToString(
-                         static_cast<nvme_abi::NvmeOpcode>(opcode));
-        if (absl::GetFlag(FLAGS_split_size)) {
-          if (size_class == 0) {
-            std::cout << ", <=16KiB";
-          } else if (size_class == 1) {
-            std::cout << ", (16KiB, 64KiB]";
-          } else {
-            std::cout << ", (64KiB, inf)";
-          }
-        } else {
-          LOG_IF_EVERY_N_SEC(ERROR, size_class != 0, 1)
-              << "Unexpected size_class " << static_cast<int>(size_class)
-              << " when --split_size is not set.";
-        }
-        std::cout << std::endl;
+absl::Status PrintAllHists(const std::vector<HistEntry>& hists) {
+  if (hists.empty()) {
+    std::cout << "No entries in histogram map." << std::endl;
+    return absl::OkStatus();
+  }
 
-        auto ps = PrintHist(hist);
-        if (!ps.ok()) {
-          std::cerr << "Failed to print histogram: " << ps.message()
-                    << std::endl;
-          break;
-        }
-      }
+  for (const auto& [key, hist] : hists) {
+    std::cout << "key: " << HistKeyName(key) << std::endl;
+
+    auto ps = PrintHist(hist);
+    if (!ps.ok()) {
+      std::cerr << "Failed to print histogram: " << ps.message() << std::endl;
+      break;
     }
   }
   return absl::OkStatus();
 }
 
-absl::Status PrintAllInFlight(struct nvme_latency_bpf* skel) {
-  int fd = bpf_map__fd(skel->maps.in_flight);
+using AdminHistEntry =
+    std::pair<struct admin_hist_key, struct latency_hist>;
+
+absl::StatusOr<std::vector<AdminHistEntry>> ReadAdminHists(
+    struct bpf_map* admin_hists) {
+  int fd = bpf_map__fd(admin_hists);
   if (fd < 0) {
-    if (fd == -1) {
-      std::cerr << "BPF in-flight map not created. " << std::endl;
-    } else {
-      std::cerr << "BPF in-flight map error. err=" << fd << std::endl;
-    }
-    return absl::InternalError("BPF map fd error");
+    return absl::InternalError(
+        absl::StrCat("BPF admin histogram map error. err=", fd));
   }
-  struct request_data rdata;
 
-  struct request_key rkey;
-  rkey.ctrl_id = std::numeric_limits<u32>::max();
-  rkey.qid = 0;
-  rkey.cid = 0;
-  struct request_key rnkey;
+  std::set<std::pair<u32, u8>> keys;
+  struct admin_hist_key lookup_key = {};
+  lookup_key.ctrl_id = std::numeric_limits<u32>::max();
+  struct admin_hist_key next_key;
+  while (0 == bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
+    keys.insert(std::make_pair(next_key.ctrl_id, next_key.opcode));
+    lookup_key = next_key;
+  }
 
-  uint32_t in_flight_count = 0;
+  std::vector<AdminHistEntry> result;
+  for (const auto& [ctrl_id, opcode] : keys) {
+    struct admin_hist_key key = {};
+    key.ctrl_id = ctrl_id;
+    key.opcode = opcode;
+    auto hist = LookupPerCpuHist(fd, &key);
+    if (!hist.ok()) {
+      continue;
+    }
+    result.emplace_back(key, *hist);
+  }
+  return result;
+}
 
-  if (bpf_map_get_next_key(fd, &rkey, &rnkey) != 0) {
-    std::cout << "No entries in in-flight request map." << std::endl;
+absl::Status PrintAdminHists(const std::vector<AdminHistEntry>& hists) {
+  if (hists.empty()) {
+    std::cout << "No entries in admin histogram map." << std::endl;
     return absl::OkStatus();
   }
 
-  while (0 == bpf_map_get_next_key(fd, &rkey, &rnkey)) {
-    // std::cout << "key: ctrl_id=" << rkey.ctrl_id
-    //           << ", qid=" << rkey.qid
-    //           << ", cid=" << rkey.cid << std::endl;
-    ++in_flight_count;
-    int err = bpf_map_lookup_elem(fd, &rnkey, &rdata);
-    if (err < 0) {
-      std::cerr << "Histogram not found for key." << std::endl;
+  for (const auto& [key, hist] : hists) {
+    std::cout << "admin key: ctrl_id=" << key.ctrl_id
+              << ", opcode=" << static_cast<int>(key.opcode) << " "
+              << nvme_abi::NvmeAdminOpcodeToString(
+                     static_cast<nvme_abi::NvmeOpcode>(key.opcode))
+              << std::endl;
+    // Admin commands are never sampled.
+    auto ps = PrintHist(hist, /*count_scale=*/1.0);
+    if (!ps.ok()) {
+      std::cerr << "Failed to print histogram: " << ps.message() << std::endl;
       break;
     }
-    rkey = rnkey;
   }
-  std::cout << "Total in-flight requests: " << in_flight_count << std::endl;
   return absl::OkStatus();
 }
 
-template <typename TSkel>
-absl::Status RunMain() {
-  // Set up libbpf errors and debug info callback.
-  libbpf_set_print(libbpf_print_fn);
+// Builds the snapshot of the cumulative histograms with the raw counts, see
+// ScaleSnapshot for the sampled IO counts.
+nvme_bpf::Snapshot MakeSnapshot(const std::vector<HistEntry>& hists,
+                                const std::vector<AdminHistEntry>& admin) {
+  nvme_bpf::Snapshot snapshot;
+  snapshot.timestamp_ns = absl::ToUnixNanos(absl::Now());
+  snapshot.lat_min_us = g_lat_hist.lat_min_us;
+  snapshot.lat_shift = g_lat_hist.lat_shift;
+  snapshot.max_slots = g_lat_hist.max_slots;
+  auto add = [&snapshot](const struct latency_hist& hist) {
+    nvme_bpf::SnapshotHist& out = snapshot.hists.emplace_back();
+    memset(&out, 0, sizeof(out));
+    out.total_count = hist.total_count;
+    out.total_sum = hist.total_sum;
+    out.total_sum_sq = hist.total_sum_sq;
+    out.overflow_count = hist.overflow_count;
+    out.min = hist.min;
+    out.max = hist.max;
+    memcpy(out.slots, hist.slots, sizeof(out.slots));
+    return &out;
+  };
+  for (const auto& [key, hist] : hists) {
+    auto* out = add(hist);
+    out->kind = nvme_bpf::kSnapshotHistIo;
+    out->ctrl_id = key.ctrl_id;
+    out->opcode = key.opcode;
+    out->size_class = key.size_class;
+    out->saturated = key.saturated;
+  }
+  for (const auto& [key, hist] : admin) {
+    auto* out = add(hist);
+    out->kind = nvme_bpf::kSnapshotHistAdmin;
+    out->ctrl_id = key.ctrl_id;
+    out->opcode = key.opcode;
+  }
+  return snapshot;
+}
+
+// The clock of bpf_ktime_get_ns().
+uint64_t MonotonicNanos() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
 
-  // Handle SIGINT and SIGTERM to exit gracefully.
-  signal(SIGINT, sig_handler);
-  signal(SIGTERM, sig_handler);
+absl::StatusOr<std::map<std::pair<int, int>, queue_progress>>
+ReadQueueProgress(struct bpf_map* queues) {
+  int fd = bpf_map__fd(queues);
+  if (fd < 0) {
+    return absl::InternalError(
+        absl::StrCat("BPF queues map fd error, err=", fd));
+  }
+  std::map<std::pair<int, int>, queue_progress> progress;
+  struct queue_key lookup_key = {};
+  struct queue_key next_key;
+  void* lookup_key_ptr = nullptr;
+  while (0 == bpf_map_get_next_key(fd, lookup_key_ptr, &next_key)) {
+    struct queue_progress value;
+    if (bpf_map_lookup_elem(fd, &next_key, &value) == 0) {
+      progress[{next_key.ctrl_id, next_key.qid}] = value;
+    }
+    lookup_key = next_key;
+    lookup_key_ptr = &lookup_key;
+  }
+  return progress;
+}
 
-  TSkel* skel;
-  int err;
+// Feeds the next batch of the in-flight map to `detector`. When the batch
+// completes a sweep prints the stuck IOs and the stalled queues, a new stall
+// is also logged as a warning.
+absl::Status ScanInFlight(nvme_bpf::MapBatchCursor* cursor,
+                          struct bpf_map* queues,
+                          nvme_bpf::StuckIoDetector* detector) {
+  std::vector<char> values;
+  auto done = cursor->Next(absl::GetFlag(FLAGS_stuck_scan_batch), &values);
+  if (!done.ok()) {
+    return done.status();
+  }
+  uint64_t now_ns = MonotonicNanos();
+  for (size_t offset = 0; offset + sizeof(request_data) <= values.size();
+       offset += sizeof(request_data)) {
+    struct request_data data;
+    memcpy(&data, values.data() + offset, sizeof(data));
+    nvme_bpf::InFlightIo io;
+    io.ctrl_id = data.ctrl_id;
+    io.qid = data.qid;
+    io.cid = data.cid;
+    io.opcode = data.opcode;
+    io.tgid = data.tgid;
+    io.comm.assign(data.comm, strnlen(data.comm, sizeof(data.comm)));
+    io.start_ns = data.start_ns;
+    detector->Add(io, now_ns);
+  }
+  if (!*done) {
+    return absl::OkStatus();
+  }
+  detector->EndSweep();
+  nvme_bpf::PrintStuckIos(*detector, absl::GetFlag(FLAGS_stuck_max_rows));
 
-  skel = TSkel::open();
-  if (skel == nullptr) {
-    return absl::InternalError("Failed to open and load BPF skeleton");
+  auto progress = ReadQueueProgress(queues);
+  if (!progress.ok()) {
+    return progress.status();
+  }
+  for (const auto& stall : detector->UpdateQueues(*progress, MonotonicNanos())) {
+    std::string message = absl::StrCat(
+        "nvme", stall.ctrl_id, " qid=", stall.qid, " completed nothing for ",
+        stall.stalled_ns / 1000000, "ms with ", stall.stuck_commands,
+        " stuck commands, ", stall.completions, " completions so far");
+    std::cout << "Stalled queue: " << message << std::endl;
+    LOG_IF(WARNING, stall.new_stall) << "Queue stall: " << message;
+  }
+  return absl::OkStatus();
+}
+
+std::string_view LatencyStageToString(int stage) {
+  switch (stage) {
+    case kLatencyStageQueue:
+      return "queue (insert->setup)";
+    case kLatencyStageSubmit:
+      return "submit (setup->issue)";
+    case kLatencyStageDevice:
+      return "device (issue->complete)";
+  }
+  return "unknown";
+}
+
+absl::Status PrintStageHists(struct bpf_map* stage_hists) {
+  int fd = bpf_map__fd(stage_hists);
+  if (fd < 0) {
+    std::cerr << "BPF stage histogram map error. err=" << fd << std::endl;
+    return absl::InternalError("BPF map fd error");
+  }
+
+  std::set<std::pair<u32, u8>> keys;
+  struct stage_hist_key lookup_key = {};
+  lookup_key.ctrl_id = std::numeric_limits<u32>::max();
+  struct stage_hist_key next_key;
+  while (0 == bpf_map_get_next_key(fd, &lookup_key, &next_key)) {
+    keys.insert(std::make_pair(next_key.ctrl_id, next_key.opcode));
+    lookup_key = next_key;
+  }
+  if (keys.empty()) {
+    std::cout << "No entries in stage histogram map." << std::endl;
+    return absl::OkStatus();
+  }
+
+  for (const auto& [ctrl_id, opcode] : keys) {
+    struct stage_hist_key key = {};
+    key.ctrl_id = ctrl_id;
+    key.opcode = opcode;
+    struct stage_hists hists;
+    if (bpf_map_lookup_elem(fd, &key, &hists) < 0) {
+      continue;
+    }
+    for (int stage = 0; stage < kLatencyStageCount; ++stage) {
+      if (hists.stages[stage].total_count == 0) {
+        continue;
+      }
+      std::cout << "stage key: ctrl_id=" << ctrl_id
+                << ", opcode=" << static_cast<int>(opcode) << " "
+                << nvme_abi::NvmeIoOpcodeToString(
+                       static_cast<nvme_abi::NvmeOpcode>(opcode))
+                << ", " << LatencyStageToString(stage) << std::endl;
+      auto ps = PrintHist(hists.stages[stage]);
+      if (!ps.ok()) {
+        std::cerr << "Failed to print histogram: " << ps.message()
+                  << std::endl;
+        return absl::OkStatus();
+      }
+    }
+  }
+  return absl::OkStatus();
+}
+
+// Reads the per-cgroup counters and returns what each cgroup did since the
+// previous call, `prev` holds the previous snapshot.
+absl::StatusOr<std::vector<nvme_bpf::CgroupUsage>> ReadCgroupUsage(
+    struct bpf_map* cgroup_ios, std::map<u64, cgroup_io>* prev,
+    nvme_bpf::CgroupPathResolver* resolver) {
+  int fd = bpf_map__fd(cgroup_ios);
+  if (fd < 0) {
+    return absl::InternalError(
+        absl::StrCat("BPF cgroup map fd error, err=", fd));
   }
-  auto skel_destroy_cleanup =
-      absl::MakeCleanup([&skel]() { TSkel::destroy(skel); });
 
-  // Initialize skel filters and parameters.
+  std::map<u64, cgroup_io> current;
+  u64 lookup_key = 0;
+  u64 next_key;
+  void* lookup_key_ptr = nullptr;
+  while (0 == bpf_map_get_next_key(fd, lookup_key_ptr, &next_key)) {
+    struct cgroup_io cg;
+    if (bpf_map_lookup_elem(fd, &next_key, &cg) == 0) {
+      current[next_key] = cg;
+    }
+    lookup_key = next_key;
+    lookup_key_ptr = &lookup_key;
+  }
+
+  std::vector<nvme_bpf::CgroupUsage> usage;
+  for (auto& [cgroup_id, cg] : current) {
+    auto prev_it = prev->find(cgroup_id);
+    struct cgroup_io delta = prev_it != prev->end()
+                                 ? nvme_bpf::CgroupIoDelta(prev_it->second, cg)
+                                 : cg;
+    if (delta.ios == 0) {
+      continue;
+    }
+    // The whole delta, the slowest IOs can be above the last bucket and only
+    // in the overflow.
+    nvme_bpf::Histogram hist = HistView(delta.hist);
+
+    nvme_bpf::CgroupUsage u;
+    u.cgroup_id = cgroup_id;
+    u.path = resolver->Resolve(cgroup_id);
+    u.tgid = cg.tgid;
+    u.comm.assign(cg.comm, strnlen(cg.comm, sizeof(cg.comm)));
+    // The counts are scaled back up when sampling, the latencies are not.
+    u.ios = delta.ios * g_count_scale;
+    u.bytes = delta.bytes * g_count_scale;
+    u.latency_sum_us = delta.hist.total_sum * g_count_scale;
+    u.p99_us = hist.percentile(0.99);
+    usage.push_back(std::move(u));
+  }
+  *prev = std::move(current);
+  return usage;
+}
+
+int HandleAdminSlowEvent(void* ctx, void* data, size_t data_sz) {
+  if (data_sz < sizeof(struct admin_slow_event)) {
+    return -1;
+  }
+  const auto* e = reinterpret_cast<const struct admin_slow_event*>(data);
+  auto opcode = static_cast<nvme_abi::NvmeOpcode>(e->opcode);
+  std::cout << "Slow admin command nvme" << e->ctrl_id << ": cid=" << e->cid
+            << ", opcode=" << static_cast<int>(e->opcode) << " ("
+            << nvme_abi::NvmeAdminOpcodeToString(opcode) << ")";
+  // Decode the cdw10 fields that identify what the command was doing.
+  u8 cdw10_low = e->cdw10 & 0xFF;
+  if (opcode == nvme_abi::NvmeOpcode::kGetLogPage) {
+    std::cout << ", lid="
+              << nvme_abi::LogPageIdToString(
+                     static_cast<nvme_abi::LogPageId>(cdw10_low));
+  } else if (opcode == nvme_abi::NvmeOpcode::kSetFeatures ||
+             opcode == nvme_abi::NvmeOpcode::kGetFeatures) {
+    std::cout << ", fid="
+              << nvme_abi::FeatureIdentifierToString(
+                     static_cast<nvme_abi::FeatureType>(cdw10_low));
+  } else if (opcode == nvme_abi::NvmeOpcode::kIdentify) {
+    std::cout << ", cns="
+              << nvme_abi::NvmeIdentifyTypeToString(
+                     static_cast<nvme_abi::IdentifyType>(cdw10_low));
+  }
+  std::cout << ", nsid=" << e->nsid << ", cdw10=0x" << std::hex << e->cdw10
+            << ", status=0x" << e->status << std::dec
+            << ", latency=" << e->latency_ns / 1000 << "us" << std::endl;
+  return 0;
+}
+
+// Set when the kernel BTF has the functions required by the fentry backend.
+bool g_has_complete_batch_req = false;
+
+// Latency measurement BPF backends, from the cheapest to the most portable.
+enum class Backend {
+  // fexit:nvme_setup_cmd + fentry:nvme_complete_rq/nvme_complete_batch_req.
+  kFentry,
+  // tp/nvme/nvme_setup_cmd + tp/nvme/nvme_complete_rq.
+  kTracepoint,
+};
+
+std::string_view BackendToString(Backend backend) {
+  switch (backend) {
+    case Backend::kFentry:
+      return "fentry";
+    case Backend::kTracepoint:
+      return "tracepoint";
+  }
+  return "unknown";
+}
+
+bool FentryBackendAvailable() {
+  return nvme_bpf::KernelBtfHasFunc("nvme_core", "nvme_setup_cmd") &&
+         nvme_bpf::KernelBtfHasFunc("nvme_core", "nvme_complete_rq");
+}
+
+absl::StatusOr<Backend> ChooseBackend() {
+  auto flag_backend = absl::GetFlag(FLAGS_backend);
+  g_has_complete_batch_req =
+      nvme_bpf::KernelBtfHasFunc("nvme_core", "nvme_complete_batch_req");
+  if (flag_backend == "tracepoint") {
+    return Backend::kTracepoint;
+  }
+  bool fentry_available = FentryBackendAvailable();
+  if (flag_backend == "fentry") {
+    if (!fentry_available) {
+      return absl::FailedPreconditionError(
+          "--backend=fentry requires kernel BTF for nvme_setup_cmd and "
+          "nvme_complete_rq");
+    }
+    return Backend::kFentry;
+  }
+  if (flag_backend != "auto") {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Unknown --backend=", flag_backend));
+  }
+  return fentry_available ? Backend::kFentry : Backend::kTracepoint;
+}
+
+// Initializes the skel filters and parameters from the flags. Must be called
+// between TSkel::open and TSkel::load.
+template <typename TSkel>
+absl::Status ConfigureSkel(TSkel* skel) {
   auto filter_ctrl_id = absl::GetFlag(FLAGS_ctrl_id);
   if (filter_ctrl_id >= 0) {
     skel->rodata->filter_ctrl_id = filter_ctrl_id;
@@ -309,6 +892,12 @@ absl::Status RunMain() {
 
   auto flag_lat_shift = absl::GetFlag(FLAGS_lat_shift);
   if (flag_lat_shift >= 0) {
+    // The bound of TuneLatencyRange, the last bucket must fit the u64.
+    if (flag_lat_shift > 63 - LATENCY_MAX_SLOTS) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("--lat_shift must be at most ",
+                       63 - LATENCY_MAX_SLOTS, ", got ", flag_lat_shift));
+    }
     skel->rodata->latency_shift = flag_lat_shift;
   }
 
@@ -328,39 +917,651 @@ absl::Status RunMain() {
     }
   }
 
-  // Read global values, either set in the skel or overridden from flags above.
-  g_lat_hist.lat_min_us = skel->rodata->latency_min;
-  g_lat_hist.lat_shift = skel->rodata->latency_shift;
-  g_lat_hist.max_slots = LATENCY_MAX_SLOTS;
+  if (absl::GetFlag(FLAGS_lbs512)) {
+    skel->rodata->lba_shift = 9;
+  }
+  auto flag_shed_cmds = absl::GetFlag(FLAGS_shed_in_flight_cmds);
+  if (flag_shed_cmds > 0) {
+    skel->rodata->shed_in_flight_cmds = flag_shed_cmds;
+  }
+  auto flag_shed_kib = absl::GetFlag(FLAGS_shed_in_flight_kib);
+  if (flag_shed_kib > 0) {
+    skel->rodata->shed_in_flight_bytes = flag_shed_kib * 1024;
+  }
+  skel->rodata->shed_to_saturated = absl::GetFlag(FLAGS_shed_to_saturated);
 
-  err = TSkel::load(skel);
+  auto flag_admin = absl::GetFlag(FLAGS_admin);
+  skel->rodata->track_admin = flag_admin;
+  auto flag_admin_slow_us = absl::GetFlag(FLAGS_admin_slow_us);
+  if (flag_admin && flag_admin_slow_us >= 0) {
+    // Zero disables the slow command log in the BPF program, use 1ns instead
+    // to log every admin command.
+    skel->rodata->admin_slow_ns =
+        std::max<uint64_t>(1, static_cast<uint64_t>(flag_admin_slow_us) * 1000);
+  }
+
+  auto flag_sample_rate = absl::GetFlag(FLAGS_sample_rate);
+  if (flag_sample_rate <= 0 ||
+      (flag_sample_rate & (flag_sample_rate - 1)) != 0) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        "--sample_rate must be a power of two, got ", flag_sample_rate));
+  }
+  skel->rodata->sample_mask = flag_sample_rate - 1;
+
+  // Only the fentry backend has this program.
+  struct bpf_program* batch_prog = bpf_object__find_program_by_name(
+      skel->obj, "handle_nvme_complete_batch_req");
+  if (batch_prog != nullptr && !g_has_complete_batch_req) {
+    bpf_program__set_autoload(batch_prog, false);
+  }
+
+  // Only the fentry backend has the block layer programs, they are loaded on
+  // demand.
+  auto flag_blk_stages = absl::GetFlag(FLAGS_blk_stages);
+  skel->rodata->track_blk_stages = flag_blk_stages;
+  skel->rodata->track_cgroups = absl::GetFlag(FLAGS_top);
+  skel->rodata->track_stuck_ios = absl::GetFlag(FLAGS_stuck_io_ms) > 0;
+  for (const char* name : {"handle_block_rq_insert", "handle_block_rq_issue"}) {
+    struct bpf_program* prog =
+        bpf_object__find_program_by_name(skel->obj, name);
+    if (prog == nullptr) {
+      if (flag_blk_stages) {
+        return absl::FailedPreconditionError(
+            "--blk_stages requires the fentry backend");
+      }
+      continue;
+    }
+    if (!flag_blk_stages) {
+      bpf_program__set_autoload(prog, false);
+    }
+  }
+  return absl::OkStatus();
+}
+
+// Prints the average BPF run time of each program and the resulting per-IO
+// probe overhead: the time of all the programs divided by the number of
+// nvme_setup_cmd invocations.
+void PrintProgRunStats(const std::vector<nvme_bpf::ProgRunStats>& stats) {
+  uint64_t setup_cnt = 0;
+  uint64_t total_time_ns = 0;
+  for (const auto& prog : stats) {
+    std::cout << "  " << std::left << std::setw(34) << prog.name
+              << " runs=" << prog.run_cnt << " avg=" << prog.avg_ns() << "ns"
+              << std::endl;
+    if (prog.name == "handle_nvme_setup_cmd") {
+      setup_cnt = prog.run_cnt;
+    }
+    total_time_ns += prog.run_time_ns;
+  }
+  if (setup_cnt != 0) {
+    std::cout << "  Per IO overhead: "
+              << static_cast<double>(total_time_ns) / setup_cnt << "ns"
+              << std::endl;
+  }
+}
+
+struct BackendOverhead {
+  Backend backend;
+  std::vector<nvme_bpf::ProgRunStats> stats;
+};
+
+// Loads the backend, lets it run for `duration` and collects the program
+// run-time statistics. Run-time stats must already be enabled.
+template <typename TSkel>
+absl::StatusOr<BackendOverhead> MeasureBackendOverhead(
+    Backend backend, absl::Duration duration, nvme_bpf::EventLoop* loop) {
+  TSkel* skel = TSkel::open();
+  if (skel == nullptr) {
+    return absl::InternalError("Failed to open BPF skeleton");
+  }
+  auto skel_destroy_cleanup =
+      absl::MakeCleanup([&skel]() { TSkel::destroy(skel); });
+  auto s = ConfigureSkel(skel);
+  if (!s.ok()) {
+    return s;
+  }
+  int err = TSkel::load(skel);
   if (err) {
     return absl::InternalError(
         absl::StrCat("Failed to load and verify BPF skeleton, err=", err));
   }
+  err = TSkel::attach(skel);
+  if (err) {
+    return absl::InternalError(
+        absl::StrCat("Failed to attach BPF skeleton, err=", err));
+  }
+  std::cout << "Measuring the " << BackendToString(backend)
+            << " backend overhead for " << duration << std::endl;
+  auto run_status = loop->RunUntil(absl::Now() + duration);
+  TSkel::detach(skel);
+  if (!run_status.ok()) {
+    return run_status;
+  }
 
+  auto stats = nvme_bpf::ReadProgRunStats(skel->obj);
+  if (!stats.ok()) {
+    return stats.status();
+  }
+  return BackendOverhead{backend, *std::move(stats)};
+}
+
+// Runs each available backend in turn on the same workload and prints their
+// per-IO overhead side by side.
+absl::Status CompareBackends(absl::Duration duration) {
+  libbpf_set_print(libbpf_print_fn);
+  auto loop = nvme_bpf::EventLoop::Create();
+  if (!loop.ok()) {
+    return loop.status();
+  }
+  auto signal_status = StopOnSignals(loop->get());
+  if (!signal_status.ok()) {
+    return signal_status;
+  }
+
+  auto stats_fd = nvme_bpf::EnableRunTimeStats();
+  if (!stats_fd.ok()) {
+    return stats_fd.status();
+  }
+  auto stats_fd_cleanup = absl::MakeCleanup([&]() { close(*stats_fd); });
+  g_has_complete_batch_req =
+      nvme_bpf::KernelBtfHasFunc("nvme_core", "nvme_complete_batch_req");
+
+  std::vector<BackendOverhead> results;
+  auto tp = MeasureBackendOverhead<nvme_latency_bpf>(Backend::kTracepoint,
+                                                     duration, loop->get());
+  if (!tp.ok()) {
+    return tp.status();
+  }
+  results.push_back(*std::move(tp));
+  if (FentryBackendAvailable()) {
+    auto kf = MeasureBackendOverhead<nvme_latency_kf_bpf>(
+        Backend::kFentry, duration, loop->get());
+    if (!kf.ok()) {
+      return kf.status();
+    }
+    results.push_back(*std::move(kf));
+  } else {
+    std::cout << "The fentry backend is not available on this kernel."
+              << std::endl;
+  }
+
+  std::cout << std::left << std::setw(12) << "Backend" << std::setw(12)
+            << "IOs" << std::setw(16) << "setup ns/IO" << std::setw(18)
+            << "complete ns/IO" << "total ns/IO" << std::endl;
+  for (const auto& result : results) {
+    uint64_t ios = 0;
+    uint64_t setup_ns = 0;
+    uint64_t complete_ns = 0;
+    for (const auto& prog : result.stats) {
+      if (prog.name == "handle_nvme_setup_cmd") {
+        ios = prog.run_cnt;
+        setup_ns += prog.run_time_ns;
+      } else {
+        complete_ns += prog.run_time_ns;
+      }
+    }
+    double per_io = ios == 0 ? 0.0 : 1.0 / ios;
+    std::cout << std::left << std::setw(12) << BackendToString(result.backend)
+              << std::setw(12) << ios << std::setw(16) << setup_ns * per_io
+              << std::setw(18) << complete_ns * per_io
+              << (setup_ns + complete_ns) * per_io << std::endl;
+  }
+  return absl::OkStatus();
+}
+
+// Runs the programs for `duration` with the widest layout, 1us buckets from
+// 0us, and sets --lat_min_us and --lat_shift from the measured distribution.
+// The calibration runs the same programs as the measurement, it only differs
+// in the rodata.
+template <typename TSkel>
+absl::Status AutoTuneLatencyRange(absl::Duration duration,
+                                  nvme_bpf::EventLoop* loop) {
+  TSkel* skel = TSkel::open();
+  if (skel == nullptr) {
+    return absl::InternalError("Failed to open BPF skeleton");
+  }
+  auto skel_destroy_cleanup =
+      absl::MakeCleanup([&skel]() { TSkel::destroy(skel); });
+  auto s = ConfigureSkel(skel);
+  if (!s.ok()) {
+    return s;
+  }
+  skel->rodata->latency_min = 0;
+  skel->rodata->latency_shift = 0;
+  SetLatencyLayout(0, 0);
+  int err = TSkel::load(skel);
+  if (err) {
+    return absl::InternalError(
+        absl::StrCat("Failed to load and verify BPF skeleton, err=", err));
+  }
   err = TSkel::attach(skel);
   if (err) {
     return absl::InternalError(
         absl::StrCat("Failed to attach BPF skeleton, err=", err));
   }
-  auto skel_detach_cleanup =
-      absl::MakeCleanup([&skel]() { TSkel::detach(skel); });
+  std::cout << "Calibrating the histogram layout for " << duration
+            << std::endl;
+  auto run_status = loop->RunUntil(absl::Now() + duration);
+  TSkel::detach(skel);
+  if (!run_status.ok() || loop->stopped()) {
+    return run_status;
+  }
+
+  auto hists = ReadAllHists(skel->maps.hists);
+  if (!hists.ok()) {
+    return hists.status();
+  }
+  // All the controllers and opcodes, the layout is shared.
+  nvme_bpf::OwnedHistogram<LATENCY_MAX_SLOTS> calibration(0, 0);
+  for (const auto& [key, hist] : *hists) {
+    auto owned =
+        nvme_bpf::OwnedHistogram<LATENCY_MAX_SLOTS>::FromView(HistView(hist));
+    if (!owned.ok()) {
+      return owned.status();
+    }
+    auto merge_status = calibration.Merge(*owned);
+    if (!merge_status.ok()) {
+      return merge_status;
+    }
+  }
+  auto range =
+      nvme_bpf::TuneLatencyRange(calibration.view(), LATENCY_MAX_SLOTS);
+  if (!range.ok()) {
+    return absl::FailedPreconditionError(
+        absl::StrCat("Failed to calibrate the histogram layout: ",
+                     range.status().message()));
+  }
+  std::cout << "Calibrated on " << calibration.total_count()
+            << " IOs: p1=" << calibration.percentile(0.01)
+            << "us p99.99=" << calibration.percentile(0.9999)
+            << "us, using --lat_min_us=" << range->lat_min_us
+            << " --lat_shift=" << range->lat_shift << std::endl;
+  absl::SetFlag(&FLAGS_lat_min_us, range->lat_min_us);
+  absl::SetFlag(&FLAGS_lat_shift, range->lat_shift);
+  return absl::OkStatus();
+}
+
+template <typename TSkel>
+absl::Status RunMain() {
+  // Set up libbpf errors and debug info callback.
+  libbpf_set_print(libbpf_print_fn);
+
+  // Handle SIGINT and SIGTERM to exit gracefully. The signals are blocked
+  // from here on and delivered to the loop.
+  auto loop = nvme_bpf::EventLoop::Create();
+  if (!loop.ok()) {
+    return loop.status();
+  }
+  auto signal_status = StopOnSignals(loop->get());
+  if (!signal_status.ok()) {
+    return signal_status;
+  }
+
+  auto flag_auto_tune = absl::GetFlag(FLAGS_auto_tune);
+  if (flag_auto_tune > absl::ZeroDuration()) {
+    if (absl::GetFlag(FLAGS_lat_min_us) >= 0 ||
+        absl::GetFlag(FLAGS_lat_shift) >= 0) {
+      return absl::InvalidArgumentError(
+          "--auto_tune picks --lat_min_us and --lat_shift, don't set them");
+    }
+    // The pinned histograms keep the layout of the previous runs.
+    if (!absl::GetFlag(FLAGS_pin_path).empty()) {
+      return absl::InvalidArgumentError(
+          "--auto_tune can't be combined with --pin_path, pin the printed "
+          "--lat_min_us and --lat_shift instead");
+    }
+    auto tune_status =
+        AutoTuneLatencyRange<TSkel>(flag_auto_tune, loop->get());
+    if (!tune_status.ok() || (*loop)->stopped()) {
+      return tune_status;
+    }
+  }
+
+  TSkel* skel;
+  int err;
+
+  skel = TSkel::open();
+  if (skel == nullptr) {
+    return absl::InternalError("Failed to open and load BPF skeleton");
+  }
+  auto skel_destroy_cleanup =
+      absl::MakeCleanup([&skel]() { TSkel::destroy(skel); });
+
+  auto configure_status = ConfigureSkel(skel);
+  if (!configure_status.ok()) {
+    return configure_status;
+  }
+
+  // Read global values, either set in the skel or overridden from flags above.
+  SetLatencyLayout(skel->rodata->latency_min, skel->rodata->latency_shift);
+
+  int stats_fd = -1;
+  if (absl::GetFlag(FLAGS_prog_stats)) {
+    auto fd = nvme_bpf::EnableRunTimeStats();
+    if (!fd.ok()) {
+      return fd.status();
+    }
+    stats_fd = *fd;
+  }
+  auto stats_fd_cleanup = absl::MakeCleanup([stats_fd]() {
+    if (stats_fd >= 0) close(stats_fd);
+  });
+
+  auto pin_path = absl::GetFlag(FLAGS_pin_path);
+  auto flag_pin_links = absl::GetFlag(FLAGS_pin_links);
+  if (flag_pin_links && pin_path.empty()) {
+    return absl::InvalidArgumentError("--pin_links requires --pin_path");
+  }
+  if (!pin_path.empty()) {
+    auto reuse_status = nvme_bpf::ReusePinnedMaps(skel->obj, pin_path);
+    if (!reuse_status.ok()) {
+      return reuse_status;
+    }
+  }
+
+  err = TSkel::load(skel);
+  if (err) {
+    return absl::InternalError(
+        absl::StrCat("Failed to load and verify BPF skeleton, err=", err));
+  }
+
+  if (!pin_path.empty()) {
+    auto pin_status = nvme_bpf::PinMaps(skel->obj, pin_path);
+    if (!pin_status.ok()) {
+      return pin_status;
+    }
+  }
+
+  std::vector<struct bpf_link*> pinned_links;
+  if (flag_pin_links) {
+    auto links = nvme_bpf::AttachPinnedLinks(skel->obj, pin_path);
+    if (!links.ok()) {
+      return links.status();
+    }
+    pinned_links = *std::move(links);
+  } else {
+    err = TSkel::attach(skel);
+    if (err) {
+      return absl::InternalError(
+          absl::StrCat("Failed to attach BPF skeleton, err=", err));
+    }
+    if (!pin_path.empty()) {
+      int detached = nvme_bpf::DetachPinnedLinks(pin_path);
+      if (detached > 0) {
+        LOG(INFO) << "Detached " << detached << " probes pinned under "
+                  << pin_path << " by a run with --pin_links";
+      }
+    }
+  }
+  auto skel_detach_cleanup = absl::MakeCleanup([&skel, &pinned_links]() {
+    nvme_bpf::ReleasePinnedLinks(pinned_links);
+    TSkel::detach(skel);
+  });
+
+  auto flag_admin = absl::GetFlag(FLAGS_admin);
+  struct ring_buffer* admin_slow_events = nullptr;
+  if (flag_admin && skel->rodata->admin_slow_ns != 0) {
+    admin_slow_events =
+        ring_buffer__new(bpf_map__fd(skel->maps.admin_slow_events),
+                         HandleAdminSlowEvent, /*ctx=*/nullptr,
+                         /*opts=*/nullptr);
+    if (!admin_slow_events) {
+      return absl::InternalError("Failed to create admin ring buffer");
+    }
+  }
+  auto ringbuf_free_cleanup = absl::MakeCleanup([&admin_slow_events]() {
+    if (admin_slow_events) ring_buffer__free(admin_slow_events);
+  });
+
+  auto flag_top = absl::GetFlag(FLAGS_top);
+  auto top_sort = nvme_bpf::ParseTopSortKey(absl::GetFlag(FLAGS_top_sort));
+  if (!top_sort.ok()) {
+    return top_sort.status();
+  }
+  nvme_bpf::CgroupPathResolver cgroup_resolver;
+  std::map<u64, cgroup_io> prev_cgroup_ios;
+
+  // The heatmap owns the terminal, the other periodic printouts would scroll
+  // it away.
+  std::optional<nvme_bpf::LatencyHeatmap> heatmap;
+  if (absl::GetFlag(FLAGS_heatmap)) {
+    if (flag_top || flag_admin || skel->rodata->track_blk_stages ||
+        skel->rodata->track_stuck_ios || stats_fd >= 0) {
+      return absl::InvalidArgumentError(
+          "--heatmap can't be combined with --top, --admin, --blk_stages, "
+          "--stuck_io_ms or --prog_stats");
+    }
+    heatmap.emplace(absl::GetFlag(FLAGS_heatmap_width));
+  }
+
+  // Polled at its own, low rate, printed with every report.
+  std::optional<nvme_bpf::DeviceHealthPoller> health_poller;
+  std::set<int> health_ctrl_ids;
+  const absl::Duration health_interval = absl::GetFlag(FLAGS_health_interval);
+  if (health_interval > absl::ZeroDuration()) {
+    if (heatmap.has_value() || flag_top) {
+      return absl::InvalidArgumentError(
+          "--health_interval can't be combined with --heatmap or --top");
+    }
+    health_poller.emplace();
+  }
+
+  std::optional<nvme_bpf::StuckIoDetector> stuck_detector;
+  std::optional<nvme_bpf::MapBatchCursor> in_flight_cursor;
+  if (skel->rodata->track_stuck_ios) {
+    stuck_detector.emplace(
+        static_cast<uint64_t>(absl::GetFlag(FLAGS_stuck_io_ms)) * 1000000,
+        g_lat_hist);
+    in_flight_cursor.emplace(bpf_map__fd(skel->maps.in_flight),
+                             bpf_map__key_size(skel->maps.in_flight),
+                             sizeof(request_data));
+  }
+
+  std::optional<nvme_bpf::SnapshotWriter> snapshot_writer;
+  auto shm_name = absl::GetFlag(FLAGS_shm_name);
+  if (!shm_name.empty()) {
+    auto writer = nvme_bpf::SnapshotWriter::Create(shm_name);
+    if (!writer.ok()) {
+      return writer.status();
+    }
+    snapshot_writer.emplace(*std::move(writer));
+  }
+  auto snapshot_cleanup = absl::MakeCleanup([&snapshot_writer]() {
+    if (snapshot_writer.has_value()) {
+      snapshot_writer->Unlink().IgnoreError();
+    }
+  });
+
+  std::unique_ptr<nvme_bpf::MetricsServer> metrics_server;
+  // Reused between the intervals.
+  std::string metrics_body;
+  auto metrics_address = absl::GetFlag(FLAGS_metrics_address);
+  if (!metrics_address.empty()) {
+    auto server = nvme_bpf::MetricsServer::Listen(metrics_address);
+    if (!server.ok()) {
+      return server.status();
+    }
+    metrics_server = *std::move(server);
+  }
+
+  std::optional<nvme_bpf::HistoryWriter> history_writer;
+  auto history_dir = absl::GetFlag(FLAGS_history_dir);
+  if (!history_dir.empty()) {
+    nvme_bpf::HistoryOptions options;
+    options.dir = history_dir;
+    options.max_bytes = absl::GetFlag(FLAGS_history_max_mb) << 20;
+    options.file_bytes = absl::GetFlag(FLAGS_history_file_mb) << 20;
+    auto writer = nvme_bpf::HistoryWriter::Open(std::move(options));
+    if (!writer.ok()) {
+      return writer.status();
+    }
+    history_writer.emplace(*std::move(writer));
+  }
+  // The history records the IOs of every interval and the exported counters
+  // are their sums. The maps reused from --pin_path already hold the counts of
+  // a previous run, those were recorded by that run.
+  nvme_bpf::SnapshotDelta interval_delta;
+  nvme_bpf::SnapshotSum metrics_sum;
+  if (history_writer.has_value() || metrics_server != nullptr) {
+    auto hists = ReadAllHists(skel->maps.hists);
+    std::vector<AdminHistEntry> admin_hists;
+    if (flag_admin) {
+      auto read_admin = ReadAdminHists(skel->maps.admin_hists);
+      if (read_admin.ok()) {
+        admin_hists = *std::move(read_admin);
+      }
+    }
+    if (hists.ok()) {
+      interval_delta.Next(MakeSnapshot(*hists, admin_hists));
+    }
+  }
 
   std::cout << "Successfully started!" << std::endl;
 
-  absl::Time next_print = absl::Now() + absl::Seconds(1);
-  while (!exiting) {
-    auto now = absl::Now();
-    if (now > next_print) {
+  // Prints and publishes the histograms of the interval.
+  auto report = [&]() -> absl::Status {
+    if (!heatmap.has_value()) {
       std::cout << "=====================" << std::endl;
-      PrintAllHists(skel->maps.hists).IgnoreError();
-      next_print = now + absl::Seconds(1);
     }
-    absl::SleepFor(absl::Milliseconds(50));
+    if (skel->rodata->sample_mask != 0) {
+      UpdateSampling(skel->maps.stats, /*print=*/!heatmap.has_value());
+    }
+    if (!heatmap.has_value() && (skel->rodata->shed_in_flight_cmds != 0 ||
+                                 skel->rodata->shed_in_flight_bytes != 0)) {
+      PrintShedding(skel->maps.stats);
+    }
+    auto hists = ReadAllHists(skel->maps.hists);
+    if (!hists.ok()) {
+      std::cerr << hists.status() << std::endl;
+      hists = std::vector<HistEntry>();
+    }
+    std::vector<AdminHistEntry> admin_hists;
+    if (flag_admin) {
+      auto read_admin = ReadAdminHists(skel->maps.admin_hists);
+      if (read_admin.ok()) {
+        admin_hists = *std::move(read_admin);
+      } else {
+        std::cerr << read_admin.status() << std::endl;
+      }
+    }
+    if (snapshot_writer.has_value() || metrics_server != nullptr ||
+        history_writer.has_value()) {
+      auto snapshot = MakeSnapshot(*hists, admin_hists);
+      if (history_writer.has_value() || metrics_server != nullptr) {
+        // g_count_scale changes every interval, the delta of the raw counts
+        // is scaled so an idle histogram stays empty and the sums never go
+        // back.
+        nvme_bpf::Snapshot interval = interval_delta.Next(snapshot);
+        nvme_bpf::ScaleSnapshot(g_count_scale, &interval);
+        if (history_writer.has_value()) {
+          auto append_status = history_writer->Append(interval);
+          LOG_IF(ERROR, !append_status.ok()) << append_status;
+        }
+        if (metrics_server != nullptr) {
+          metrics_body.clear();
+          nvme_bpf::AppendPrometheusHistograms(metrics_sum.Add(interval),
+                                               &metrics_body);
+          metrics_server->SetBody(metrics_body);
+        }
+      }
+      if (snapshot_writer.has_value()) {
+        // The IO counts are scaled and rounded like the printed ones.
+        nvme_bpf::ScaleSnapshot(g_count_scale, &snapshot);
+        auto publish_status = snapshot_writer->Publish(snapshot);
+        LOG_IF(ERROR, !publish_status.ok()) << publish_status;
+      }
+    }
+
+    if (flag_top) {
+      auto usage = ReadCgroupUsage(skel->maps.cgroup_ios, &prev_cgroup_ios,
+                                   &cgroup_resolver);
+      if (usage.ok()) {
+        nvme_bpf::SortCgroupUsage(*top_sort, &*usage);
+        nvme_bpf::PrintCgroupUsage(*usage, absl::GetFlag(FLAGS_top_n),
+                                   absl::Seconds(1));
+      } else {
+        std::cerr << usage.status() << std::endl;
+      }
+    } else if (heatmap.has_value()) {
+      for (const auto& [key, hist] : *hists) {
+        heatmap->Update(HistKeyName(key), HistView(hist));
+      }
+      std::cout << heatmap->Render() << std::flush;
+    } else {
+      PrintAllHists(*hists).IgnoreError();
+    }
+    if (health_poller.has_value()) {
+      // The controllers seen for the first time are polled right away.
+      std::set<int> new_ctrl_ids;
+      for (const auto& [key, hist] : *hists) {
+        if (health_ctrl_ids.insert(key.ctrl_id).second) {
+          new_ctrl_ids.insert(key.ctrl_id);
+        }
+      }
+      if (!new_ctrl_ids.empty()) {
+        health_poller->Poll(new_ctrl_ids);
+      }
+      health_poller->Print(std::cout);
+    }
+    if (flag_admin) {
+      PrintAdminHists(admin_hists).IgnoreError();
+    }
+    if (skel->rodata->track_blk_stages) {
+      PrintStageHists(skel->maps.stage_hists).IgnoreError();
+    }
+    if (stuck_detector.has_value()) {
+      auto scan_status = ScanInFlight(&*in_flight_cursor, skel->maps.queues,
+                                      &*stuck_detector);
+      if (!scan_status.ok()) {
+        std::cerr << scan_status << std::endl;
+      }
+    }
+    if (stats_fd >= 0) {
+      auto prog_stats = nvme_bpf::ReadProgRunStats(skel->obj);
+      if (prog_stats.ok()) {
+        PrintProgRunStats(*prog_stats);
+      } else {
+        std::cerr << prog_stats.status() << std::endl;
+      }
+    }
+    return absl::OkStatus();
+  };
+  auto timer = (*loop)->AddTimer(absl::Seconds(1), report);
+  if (!timer.ok()) {
+    return timer.status();
+  }
+  if (health_poller.has_value()) {
+    auto health_timer = (*loop)->AddTimer(health_interval, [&]() {
+      health_poller->Poll(health_ctrl_ids);
+      return absl::OkStatus();
+    });
+    if (!health_timer.ok()) {
+      return health_timer.status();
+    }
+  }
+  if (admin_slow_events) {
+    auto add_status =
+        (*loop)->AddFd(ring_buffer__epoll_fd(admin_slow_events), [&]() {
+          int n = ring_buffer__consume(admin_slow_events);
+          LOG_IF(ERROR, n < 0) << "Failed to consume admin events, err=" << n;
+          return absl::OkStatus();
+        });
+    if (!add_status.ok()) {
+      return add_status;
+    }
+  }
+  if (metrics_server != nullptr) {
+    auto add_status = (*loop)->AddFd(metrics_server->fd(), [&]() {
+      auto metrics_status = metrics_server->HandleEvents();
+      LOG_IF(ERROR, !metrics_status.ok()) << metrics_status;
+      return absl::OkStatus();
+    });
+    if (!add_status.ok()) {
+      return add_status;
+    }
   }
 
-  return absl::OkStatus();
+  return (*loop)->Run();
 }
 
 int main(int argc, char** argv) {
@@ -368,10 +1569,25 @@ int main(int argc, char** argv) {
   absl::InitializeLog();
 
   absl::Status main_status;
-  if (absl::GetFlag(FLAGS_bpf_trace)) {
-    main_status = RunMain<nvme_latency_vlog_bpf>();
+  auto flag_compare_backends = absl::GetFlag(FLAGS_compare_backends);
+  if (flag_compare_backends > absl::ZeroDuration()) {
+    main_status = CompareBackends(flag_compare_backends);
   } else {
-    main_status = RunMain<nvme_latency_bpf>();
+    auto backend = ChooseBackend();
+    if (!backend.ok()) {
+      std::cerr << backend.status();
+      return EXIT_FAILURE;
+    }
+    std::cout << "Using the " << BackendToString(*backend) << " backend."
+              << std::endl;
+    bool bpf_trace = absl::GetFlag(FLAGS_bpf_trace);
+    if (*backend == Backend::kFentry) {
+      main_status = bpf_trace ? RunMain<nvme_latency_kf_vlog_bpf>()
+                              : RunMain<nvme_latency_kf_bpf>();
+    } else {
+      main_status = bpf_trace ? RunMain<nvme_latency_vlog_bpf>()
+                              : RunMain<nvme_latency_bpf>();
+    }
   }
   if (!main_status.ok()) {
     std::cerr << main_status;
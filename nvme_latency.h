@@ -4,6 +4,11 @@
 #include "types.bpf.h"
 
 #define LATENCY_MAX_SLOTS 27
+// The default histogram layout, --lat_min_us and --lat_shift override it.
+#define LATENCY_DEFAULT_MIN_US 20
+#define LATENCY_DEFAULT_SHIFT 0
+// Number of controllers for which the in-flight load is tracked.
+#define MAX_CTRL_LOADS 64
 
 struct request_key {
   int ctrl_id;
@@ -11,24 +16,150 @@ struct request_key {
   u16 cid;
 };
 
+// Number of IO queues for which the completion progress is tracked.
+#define MAX_QUEUE_PROGRESS 4096
+
+// Same as the kernel TASK_COMM_LEN.
+#define NVME_LATENCY_COMM_LEN 16
+
 struct request_data {
   u64 start_ns;
+  // Issuer of the command, only populated when the cgroups or the stuck IOs
+  // are tracked. The cgroup id only with the cgroups.
+  u64 cgroup_id;
+  u32 tgid;
+  char comm[NVME_LATENCY_COMM_LEN];
+  // The command, for the stuck IO report. The fentry backend keys the
+  // in-flight map by the request pointer.
+  int ctrl_id;
+  int qid;
+  u16 cid;
+  // Transfer size of the commands that carry an NLB, zero for the others.
+  u32 bytes;
   u8 opcode;
   u8 size_class;
+  // Set when the command was submitted above the load shedding thresholds.
+  u8 saturated;
+};
+
+// Completions of an IO queue, only maintained when the stuck IOs are
+// tracked. A queue with old commands in flight and no recent completion is
+// stalled.
+struct queue_key {
+  int ctrl_id;
+  int qid;
+};
+
+struct queue_progress {
+  u64 completions;
+  // bpf_ktime_get_ns() of the last completion.
+  u64 last_complete_ns;
 };
 
 struct latency_hist_key {
   u32 ctrl_id;
   u8 opcode;
   u8 size_class;
+  u8 saturated;
 };
 
 // The mapping from raw value to slot and the other way around is done using the
 // `histogram.bpf.h` helper functions: bpf_get_bucket and bpf_bucket_{low,high}.
+//
+// The IO and admin histograms are per-CPU, userspace sums the counters and
+// takes the min / max across the CPUs. The shared histograms (block layer
+// stages, cgroups) are updated atomically and don't track min and max, which
+// would need a CAS loop.
 struct latency_hist {
   u64 slots[LATENCY_MAX_SLOTS + 1];
   u64 total_sum;
   u64 total_count;
+  // Sum of the squared latencies in us^2, for the standard deviation.
+  u64 total_sum_sq;
+  // The latencies above the last bucket, also in total_count.
+  u64 overflow_count;
+  // Exact extremes in us, only valid when total_count is non-zero.
+  u64 min;
+  u64 max;
+};
+
+// Per-CPU counters maintained by the BPF program. The userspace program sums
+// them across all the CPUs.
+struct latency_stats {
+  // Per-CPU sequence mixed into the sampling decision, see `sample_mask`.
+  u64 sample_seq;
+  // Number of IOs selected for the latency measurement.
+  u64 sampled;
+  // Number of IOs skipped by the sampling.
+  u64 unsampled;
+  // Number of IOs not measured because of the load shedding.
+  u64 shed;
+  // Number of IOs measured in the saturated histograms.
+  u64 saturated;
+  // Number of IOs of the controllers beyond MAX_CTRL_LOADS, which have no
+  // load counters and are never shed.
+  u64 load_untracked;
+};
+
+struct admin_request_data {
+  u64 start_ns;
+  u32 nsid;
+  u32 cdw10;
+  u8 opcode;
+};
+
+struct admin_hist_key {
+  u32 ctrl_id;
+  u8 opcode;
+};
+
+// Emitted for the admin commands that take longer than `admin_slow_ns`.
+struct admin_slow_event {
+  u64 latency_ns;
+  int ctrl_id;
+  u32 nsid;
+  u32 cdw10;
+  u16 cid;
+  u16 status;
+  u8 opcode;
+};
+
+// Stages of an IO between the block layer and the device, in the order of the
+// events: nvme_queue_rq() sets up the command and then starts the request,
+// which fires block_rq_issue right before the doorbell.
+enum latency_stage {
+  // block_rq_insert -> nvme_setup_cmd, time spent in the blk-mq scheduler and
+  // the dispatch.
+  kLatencyStageQueue = 0,
+  // nvme_setup_cmd -> block_rq_issue, driver submission overhead.
+  kLatencyStageSubmit = 1,
+  // block_rq_issue -> nvme completion, time spent in the device.
+  kLatencyStageDevice = 2,
+  kLatencyStageCount = 3,
+};
+
+struct stage_hist_key {
+  u32 ctrl_id;
+  u8 opcode;
+};
+
+struct stage_hists {
+  struct latency_hist stages[kLatencyStageCount];
+};
+
+// IOs issued from a cgroup, keyed by the cgroup id.
+struct cgroup_io {
+  u64 ios;
+  u64 bytes;
+  // The last process seen issuing IOs from the cgroup.
+  u32 tgid;
+  char comm[NVME_LATENCY_COMM_LEN];
+  struct latency_hist hist;
+};
+
+struct ctrl_load {
+  u64 in_flight_cmds;
+  u64 in_flight_bytes;
 };
 
 #endif  // NVME_LATENCY_H_
\ No newline at end of file
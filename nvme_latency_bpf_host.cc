@@ -0,0 +1,43 @@
+#include "nvme_latency_bpf_host.h"
+
+#include "bpf_host.h"
+#include "nvme_latency.h"
+
+// The rodata become ordinary, writable globals.
+#define BPF_RODATA
+
+// The headers shared with userspace were included above, the programs and
+// their maps land in the namespace.
+namespace nvme_latency_bpf {
+#include "nvme_latency.bpf.c"
+}  // namespace nvme_latency_bpf
+
+namespace nvme_latency_bpf {
+namespace {
+
+struct Rodata {
+#define NVME_LATENCY_BPF_FIELD(type, name) type name;
+  NVME_LATENCY_BPF_RODATA(NVME_LATENCY_BPF_FIELD)
+#undef NVME_LATENCY_BPF_FIELD
+};
+
+// The initial values from the program source, captured before any test
+// changes them.
+const Rodata kDefaultRodata = {
+#define NVME_LATENCY_BPF_VALUE(type, name) name,
+    NVME_LATENCY_BPF_RODATA(NVME_LATENCY_BPF_VALUE)
+#undef NVME_LATENCY_BPF_VALUE
+};
+
+}  // namespace
+
+void Load(nvme_bpf::BpfHost* host) {
+#define NVME_LATENCY_BPF_ADD_MAP(name) host->AddMap(&name, #name);
+  NVME_LATENCY_BPF_MAPS(NVME_LATENCY_BPF_ADD_MAP)
+#undef NVME_LATENCY_BPF_ADD_MAP
+#define NVME_LATENCY_BPF_RESET(type, name) name = kDefaultRodata.name;
+  NVME_LATENCY_BPF_RODATA(NVME_LATENCY_BPF_RESET)
+#undef NVME_LATENCY_BPF_RESET
+}
+
+}  // namespace nvme_latency_bpf
@@ -0,0 +1,88 @@
+#ifndef NVME_LATENCY_BPF_HOST_H_
+#define NVME_LATENCY_BPF_HOST_H_
+
+// The programs of nvme_latency.bpf.c and nvme_latency_kf.bpf.c built for the
+// host, see bpf_host.h. The handlers are called directly with synthetic
+// contexts, in the order the kernel would fire them.
+
+// clang-format off
+#include "nvme_core.bpf.h"
+// clang-format on
+
+#include "bpf_host.h"
+#include "nvme_latency.h"
+
+// The rodata of nvme_latency_core.bpf.h. Plain globals here, set by the tests
+// in place of the skeleton rodata.
+#define NVME_LATENCY_BPF_RODATA(X) \
+  X(__u32, filter_ctrl_id)         \
+  X(__u32, filter_nsid)            \
+  X(__u8, filter_opcode)           \
+  X(__u64, latency_min)            \
+  X(__u64, latency_shift)          \
+  X(__u32, sample_mask)            \
+  X(__u64, shed_in_flight_cmds)    \
+  X(__u64, shed_in_flight_bytes)   \
+  X(__u8, shed_to_saturated)       \
+  X(__u8, track_admin)             \
+  X(__u64, admin_slow_ns)          \
+  X(__u8, track_blk_stages)        \
+  X(__u8, track_cgroups)           \
+  X(__u8, track_stuck_ios)         \
+  X(__u32, lba_shift)              \
+  X(int, class1_size_nlb)          \
+  X(int, class2_size_nlb)
+
+// The maps of nvme_latency_core.bpf.h, shared by both backends.
+#define NVME_LATENCY_BPF_MAPS(X) \
+  X(in_flight)                   \
+  X(hists)                       \
+  X(hists_zero)                  \
+  X(stats)                       \
+  X(ctrl_loads)                  \
+  X(load_in_flight)              \
+  X(admin_in_flight)             \
+  X(admin_hists)                 \
+  X(admin_slow_events)           \
+  X(stage_hists)                 \
+  X(stage_hists_zero)            \
+  X(cgroup_ios)                  \
+  X(cgroup_ios_zero)             \
+  X(queues)
+
+#define NVME_LATENCY_BPF_DECLARE(type, name) extern type name;
+
+namespace nvme_latency_bpf {
+
+NVME_LATENCY_BPF_RODATA(NVME_LATENCY_BPF_DECLARE)
+
+int handle_nvme_setup_cmd(struct trace_event_raw_nvme_setup_cmd* ctx);
+int handle_nvme_complete_rq(struct trace_event_raw_nvme_complete_rq* ctx);
+
+// Adds the maps of the programs to `host` under their BPF names and restores
+// the rodata defaults, like a fresh load of the skeleton.
+void Load(nvme_bpf::BpfHost* host);
+
+}  // namespace nvme_latency_bpf
+
+// The fentry backend. The request pointers only serve as keys and for the
+// nvme_request that follows them, see kf_nvme_req().
+namespace nvme_latency_kf_bpf {
+
+NVME_LATENCY_BPF_RODATA(NVME_LATENCY_BPF_DECLARE)
+
+int handle_nvme_setup_cmd(struct nvme_ns* ns, struct request* req,
+                          blk_status_t ret);
+int handle_nvme_complete_rq(struct request* req);
+int handle_nvme_complete_batch_req(struct request* req);
+int handle_block_rq_insert(struct request* rq);
+int handle_block_rq_issue(struct request* rq);
+
+// Same as nvme_latency_bpf::Load(), also adds blk_in_flight.
+void Load(nvme_bpf::BpfHost* host);
+
+}  // namespace nvme_latency_kf_bpf
+
+#undef NVME_LATENCY_BPF_DECLARE
+
+#endif  // NVME_LATENCY_BPF_HOST_H_
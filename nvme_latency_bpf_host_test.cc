@@ -0,0 +1,348 @@
+#include "nvme_latency_bpf_host.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "bpf_host.h"
+#include "gtest/gtest.h"
+#include "histogram.bpf.h"
+#include "nvme_latency.h"
+
+/*
+bazel test --test_output=streamed :nvme_latency_bpf_host_test
+ */
+
+namespace {
+
+using nvme_bpf::BpfHost;
+
+constexpr u8 kWrite = 0x01;
+constexpr u8 kRead = 0x02;
+
+trace_event_raw_nvme_setup_cmd SetupCmd(int ctrl_id, int qid, u16 cid,
+                                        u8 opcode, u32 nlb) {
+  trace_event_raw_nvme_setup_cmd ctx = {};
+  ctx.ctrl_id = ctrl_id;
+  ctx.qid = qid;
+  ctx.cid = cid;
+  ctx.opcode = opcode;
+  ctx.nsid = 1;
+  // cdw12, the zero based NLB, little endian at cdw10[8].
+  u32 cdw12 = nlb - 1;
+  std::memcpy(&ctx.cdw10[8], &cdw12, sizeof(cdw12));
+  return ctx;
+}
+
+trace_event_raw_nvme_complete_rq CompleteRq(int ctrl_id, int qid, u16 cid) {
+  trace_event_raw_nvme_complete_rq ctx = {};
+  ctx.ctrl_id = ctrl_id;
+  ctx.qid = qid;
+  ctx.cid = cid;
+  return ctx;
+}
+
+class NvmeLatencyBpfTest : public testing::Test {
+ protected:
+  NvmeLatencyBpfTest() : host_(/*num_cpus=*/2) {
+    nvme_latency_bpf::Load(&host_);
+    host_.set_ktime_ns(1'000'000);
+  }
+
+  // Submits and completes an IO that takes `latency_us`.
+  void Io(int ctrl_id, int qid, u16 cid, u8 opcode, u32 nlb,
+          u64 latency_us) {
+    auto setup = SetupCmd(ctrl_id, qid, cid, opcode, nlb);
+    nvme_latency_bpf::handle_nvme_setup_cmd(&setup);
+    host_.advance_ktime_ns(latency_us * 1000);
+    auto complete = CompleteRq(ctrl_id, qid, cid);
+    nvme_latency_bpf::handle_nvme_complete_rq(&complete);
+  }
+
+  const latency_hist* Hist(u32 ctrl_id, u8 opcode, u8 size_class = 0,
+                           int cpu = 0) {
+    latency_hist_key key = {};
+    key.ctrl_id = ctrl_id;
+    key.opcode = opcode;
+    key.size_class = size_class;
+    return host_.map("hists").Get<latency_hist>(key, cpu);
+  }
+
+  BpfHost host_;
+};
+
+TEST_F(NvmeLatencyBpfTest, RecordsTheLatency) {
+  Io(/*ctrl_id=*/0, /*qid=*/1, /*cid=*/7, kRead, /*nlb=*/8,
+     /*latency_us=*/100);
+  Io(0, 1, 7, kRead, 8, 30);
+  Io(0, 2, 9, kWrite, 8, 500);
+
+  const latency_hist* read = Hist(0, kRead);
+  ASSERT_NE(read, nullptr);
+  EXPECT_EQ(read->total_count, 2);
+  EXPECT_EQ(read->total_sum, 130);
+  EXPECT_EQ(read->min, 30);
+  EXPECT_EQ(read->max, 100);
+  int slot = bpf_get_bucket(100, LATENCY_DEFAULT_MIN_US,
+                            LATENCY_DEFAULT_SHIFT, LATENCY_MAX_SLOTS);
+  EXPECT_EQ(read->slots[slot], 1);
+  ASSERT_NE(Hist(0, kWrite), nullptr);
+  EXPECT_EQ(Hist(0, kWrite)->total_count, 1);
+  EXPECT_EQ(host_.map("in_flight").size(), 0);
+}
+
+TEST_F(NvmeLatencyBpfTest, CompletionWithoutSetupIsIgnored) {
+  auto complete = CompleteRq(0, 1, 7);
+  nvme_latency_bpf::handle_nvme_complete_rq(&complete);
+  EXPECT_EQ(host_.map("hists").size(), 0);
+}
+
+TEST_F(NvmeLatencyBpfTest, PerCpuHistograms) {
+  auto setup = SetupCmd(0, 1, 7, kRead, 8);
+  nvme_latency_bpf::handle_nvme_setup_cmd(&setup);
+  host_.advance_ktime_ns(50'000);
+  // Completed on another CPU than submitted.
+  host_.set_cpu(1);
+  auto complete = CompleteRq(0, 1, 7);
+  nvme_latency_bpf::handle_nvme_complete_rq(&complete);
+
+  ASSERT_NE(Hist(0, kRead, 0, /*cpu=*/0), nullptr);
+  EXPECT_EQ(Hist(0, kRead, 0, /*cpu=*/0)->total_count, 0);
+  EXPECT_EQ(Hist(0, kRead, 0, /*cpu=*/1)->total_count, 1);
+}
+
+TEST_F(NvmeLatencyBpfTest, SizeClassesFromNlb) {
+  nvme_latency_bpf::class1_size_nlb = 8;
+  nvme_latency_bpf::class2_size_nlb = 64;
+  Io(0, 1, 1, kRead, 8, 100);
+  Io(0, 1, 2, kRead, 9, 100);
+  Io(0, 1, 3, kRead, 64, 100);
+  Io(0, 1, 4, kRead, 65536, 100);
+
+  ASSERT_NE(Hist(0, kRead, 0), nullptr);
+  EXPECT_EQ(Hist(0, kRead, 0)->total_count, 1);
+  EXPECT_EQ(Hist(0, kRead, 1)->total_count, 2);
+  EXPECT_EQ(Hist(0, kRead, 2)->total_count, 1);
+}
+
+TEST_F(NvmeLatencyBpfTest, Filters) {
+  nvme_latency_bpf::filter_ctrl_id = 1;
+  nvme_latency_bpf::filter_opcode = kWrite;
+  Io(0, 1, 1, kWrite, 8, 100);
+  Io(1, 1, 1, kRead, 8, 100);
+  Io(1, 1, 1, kWrite, 8, 100);
+
+  std::vector<latency_hist_key> keys =
+      host_.map("hists").Keys<latency_hist_key>();
+  ASSERT_EQ(keys.size(), 1);
+  EXPECT_EQ(keys[0].ctrl_id, 1);
+  EXPECT_EQ(keys[0].opcode, kWrite);
+}
+
+TEST_F(NvmeLatencyBpfTest, LoadShedding) {
+  nvme_latency_bpf::shed_in_flight_cmds = 2;
+  for (u16 cid = 0; cid < 3; ++cid) {
+    auto setup = SetupCmd(0, 1, cid, kRead, 8);
+    nvme_latency_bpf::handle_nvme_setup_cmd(&setup);
+  }
+  // The shed IO is in flight on the device too.
+  u32 ctrl = 0;
+  const auto* load = host_.map("ctrl_loads").Get<ctrl_load>(ctrl);
+  EXPECT_EQ(load->in_flight_cmds, 3);
+  EXPECT_EQ(load->in_flight_bytes, 3 * 8 * 4096);
+  u32 zero = 0;
+  EXPECT_EQ(host_.map("stats").Get<latency_stats>(zero)->shed, 1);
+
+  host_.advance_ktime_ns(100'000);
+  for (u16 cid = 0; cid < 3; ++cid) {
+    auto complete = CompleteRq(0, 1, cid);
+    nvme_latency_bpf::handle_nvme_complete_rq(&complete);
+  }
+  EXPECT_EQ(load->in_flight_cmds, 0);
+  EXPECT_EQ(load->in_flight_bytes, 0);
+  EXPECT_EQ(Hist(0, kRead)->total_count, 2);
+}
+
+TEST_F(NvmeLatencyBpfTest, LoadCountsTheUnmeasuredIos) {
+  nvme_latency_bpf::shed_in_flight_cmds = 2;
+  nvme_latency_bpf::filter_opcode = kWrite;
+  // The reads are not measured but load the controller.
+  for (u16 cid = 0; cid < 2; ++cid) {
+    auto setup = SetupCmd(0, 1, cid, kRead, 8);
+    nvme_latency_bpf::handle_nvme_setup_cmd(&setup);
+  }
+  Io(0, 1, 2, kWrite, 8, 100);
+  u32 zero = 0;
+  EXPECT_EQ(host_.map("stats").Get<latency_stats>(zero)->shed, 1);
+  EXPECT_EQ(host_.map("hists").size(), 0);
+
+  for (u16 cid = 0; cid < 2; ++cid) {
+    auto complete = CompleteRq(0, 1, cid);
+    nvme_latency_bpf::handle_nvme_complete_rq(&complete);
+  }
+  Io(0, 1, 2, kWrite, 8, 100);
+  ASSERT_NE(Hist(0, kWrite), nullptr);
+  EXPECT_EQ(Hist(0, kWrite)->total_count, 1);
+  u32 ctrl = 0;
+  EXPECT_EQ(host_.map("ctrl_loads").Get<ctrl_load>(ctrl)->in_flight_cmds, 0);
+  EXPECT_EQ(host_.map("load_in_flight").size(), 0);
+}
+
+TEST_F(NvmeLatencyBpfTest, LoadOfUntrackedControllers) {
+  nvme_latency_bpf::shed_in_flight_cmds = 1;
+  for (u16 cid = 0; cid < 3; ++cid) {
+    Io(MAX_CTRL_LOADS, 1, cid, kRead, 8, 100);
+  }
+  u32 zero = 0;
+  const auto* stats = host_.map("stats").Get<latency_stats>(zero);
+  EXPECT_EQ(stats->load_untracked, 3);
+  EXPECT_EQ(stats->shed, 0);
+  EXPECT_EQ(Hist(MAX_CTRL_LOADS, kRead)->total_count, 3);
+}
+
+TEST_F(NvmeLatencyBpfTest, SlowAdminCommandEvents) {
+  nvme_latency_bpf::track_admin = 1;
+  nvme_latency_bpf::admin_slow_ns = 1'000'000;
+  // Get Log Page, then Identify, on the admin queue.
+  Io(0, /*qid=*/0, 1, 0x02, 1, /*latency_us=*/10);
+  Io(0, 0, 2, 0x06, 1, 5000);
+
+  std::vector<admin_slow_event> events =
+      host_.map("admin_slow_events").ConsumeRecords<admin_slow_event>();
+  ASSERT_EQ(events.size(), 1);
+  EXPECT_EQ(events[0].opcode, 0x06);
+  EXPECT_EQ(events[0].cid, 2);
+  EXPECT_EQ(events[0].latency_ns, 5'000'000);
+  // The IO histograms are untouched.
+  EXPECT_EQ(host_.map("hists").size(), 0);
+  EXPECT_EQ(host_.map("admin_hists").size(), 2);
+}
+
+TEST_F(NvmeLatencyBpfTest, AsyncEventRequestsAreNotMeasured) {
+  nvme_latency_bpf::track_admin = 1;
+  nvme_latency_bpf::admin_slow_ns = 1'000'000;
+  // An Asynchronous Event Request completed after an hour.
+  auto setup = SetupCmd(0, /*qid=*/0, 1, 0x0C, 1);
+  nvme_latency_bpf::handle_nvme_setup_cmd(&setup);
+  EXPECT_EQ(host_.map("admin_in_flight").size(), 0);
+  host_.advance_ktime_ns(3600'000'000'000);
+  auto complete = CompleteRq(0, 0, 1);
+  nvme_latency_bpf::handle_nvme_complete_rq(&complete);
+
+  EXPECT_EQ(host_.map("admin_hists").size(), 0);
+  EXPECT_TRUE(host_.map("admin_slow_events")
+                  .ConsumeRecords<admin_slow_event>()
+                  .empty());
+}
+
+TEST_F(NvmeLatencyBpfTest, CgroupAttribution) {
+  nvme_latency_bpf::track_cgroups = 1;
+  host_.set_task({.tgid = 42, .pid = 43, .cgroup_id = 1234, .comm = "fio"});
+  Io(0, 1, 1, kWrite, 16, 100);
+
+  u64 cgroup_id = 1234;
+  const auto* cg = host_.map("cgroup_ios").Get<cgroup_io>(cgroup_id);
+  ASSERT_NE(cg, nullptr);
+  EXPECT_EQ(cg->ios, 1);
+  EXPECT_EQ(cg->bytes, 16 * 4096);
+  EXPECT_EQ(cg->tgid, 42);
+  EXPECT_STREQ(cg->comm, "fio");
+}
+
+TEST_F(NvmeLatencyBpfTest, CgroupsAreEvicted) {
+  nvme_latency_bpf::track_cgroups = 1;
+  constexpr u64 kCgroups = 2000;
+  for (u64 cgroup_id = 1; cgroup_id <= kCgroups; ++cgroup_id) {
+    host_.set_task({.cgroup_id = cgroup_id, .comm = "fio"});
+    Io(0, 1, 1, kRead, 8, 100);
+  }
+  // The cgroups that appeared last are still counted.
+  EXPECT_LT(host_.map("cgroup_ios").size(), kCgroups);
+  const auto* cg = host_.map("cgroup_ios").Get<cgroup_io>(kCgroups);
+  ASSERT_NE(cg, nullptr);
+  EXPECT_EQ(cg->ios, 1);
+}
+
+// A request of the fentry backend, the nvme_request PDU follows the request
+// like in the blk-mq allocation.
+struct KfRequest {
+  struct request rq;
+  struct nvme_request nreq;
+  request_queue q;
+  blk_mq_hw_ctx hctx;
+  nvme_ctrl ctrl;
+  nvme_command cmd;
+};
+
+class NvmeLatencyKfBpfTest : public testing::Test {
+ protected:
+  NvmeLatencyKfBpfTest() : host_(/*num_cpus=*/2) {
+    nvme_latency_kf_bpf::Load(&host_);
+    nvme_latency_kf_bpf::track_blk_stages = 1;
+    host_.set_ktime_ns(1'000'000);
+  }
+
+  // An IO request on the first IO queue of controller 0.
+  static void InitRequest(KfRequest* req, u16 cid, u8 opcode) {
+    *req = {};
+    req->rq.q = &req->q;
+    req->q.queuedata = &req->q;
+    req->rq.mq_hctx = &req->hctx;
+    req->nreq.ctrl = &req->ctrl;
+    req->nreq.cmd = &req->cmd;
+    req->cmd.common.opcode = opcode;
+    req->cmd.common.command_id = cid;
+    req->cmd.common.nsid = 1;
+  }
+
+  const latency_hist* Stage(latency_stage stage) {
+    stage_hist_key key = {};
+    key.opcode = kRead;
+    const auto* hists = host_.map("stage_hists").Get<stage_hists>(key);
+    return hists != nullptr ? &hists->stages[stage] : nullptr;
+  }
+
+  BpfHost host_;
+};
+
+TEST_F(NvmeLatencyKfBpfTest, StagesInTheKernelOrder) {
+  KfRequest req;
+  InitRequest(&req, /*cid=*/7, kRead);
+  nvme_latency_kf_bpf::handle_block_rq_insert(&req.rq);
+  host_.advance_ktime_ns(10'000);
+  nvme_latency_kf_bpf::handle_nvme_setup_cmd(nullptr, &req.rq, /*ret=*/0);
+  host_.advance_ktime_ns(2'000);
+  nvme_latency_kf_bpf::handle_block_rq_issue(&req.rq);
+  host_.advance_ktime_ns(100'000);
+  nvme_latency_kf_bpf::handle_nvme_complete_rq(&req.rq);
+
+  ASSERT_NE(Stage(kLatencyStageQueue), nullptr);
+  EXPECT_EQ(Stage(kLatencyStageQueue)->total_count, 1);
+  EXPECT_EQ(Stage(kLatencyStageQueue)->total_sum, 10);
+  EXPECT_EQ(Stage(kLatencyStageSubmit)->total_sum, 2);
+  EXPECT_EQ(Stage(kLatencyStageDevice)->total_sum, 100);
+  EXPECT_EQ(host_.map("blk_in_flight").size(), 0);
+  EXPECT_EQ(host_.map("in_flight").size(), 0);
+}
+
+TEST_F(NvmeLatencyKfBpfTest, StaleIssueIsNotUsed) {
+  KfRequest req;
+  InitRequest(&req, 7, kRead);
+  // Issued, but the completion was missed.
+  nvme_latency_kf_bpf::handle_block_rq_issue(&req.rq);
+  host_.advance_ktime_ns(1'000'000);
+
+  // Reused without an insert, issued directly.
+  nvme_latency_kf_bpf::handle_nvme_setup_cmd(nullptr, &req.rq, 0);
+  EXPECT_EQ(host_.map("blk_in_flight").size(), 0);
+  host_.advance_ktime_ns(100'000);
+  nvme_latency_kf_bpf::handle_nvme_complete_rq(&req.rq);
+  EXPECT_EQ(host_.map("stage_hists").size(), 0);
+
+  // A setup that fails drops the insert stamp.
+  nvme_latency_kf_bpf::handle_block_rq_insert(&req.rq);
+  nvme_latency_kf_bpf::handle_nvme_setup_cmd(nullptr, &req.rq, /*ret=*/1);
+  EXPECT_EQ(host_.map("blk_in_flight").size(), 0);
+}
+
+}  // namespace
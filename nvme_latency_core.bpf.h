@@ -0,0 +1,602 @@
+#ifndef NVME_LATENCY_CORE_BPF_H
+#define NVME_LATENCY_CORE_BPF_H
+
+// The latency measurement logic shared by the BPF attach backends. Each backend
+// decodes its own probe arguments into `struct nvme_cmd_info` /
+// `struct nvme_cpl_info` and calls latency_setup_cmd / latency_complete_rq.
+//
+// The includer must define `in_flight_key_t`, the key that identifies a request
+// between its setup and its completion, before including this header.
+
+#include <bpf/bpf_helpers.h>
+
+#include "histogram.bpf.h"
+#include "nvme_latency.h"
+#include "types.bpf.h"
+
+#define MAX_LATENCY_ENTRIES 20
+#define MAX_ADMIN_LATENCY_ENTRIES 256
+#define MAX_CGROUP_ENTRIES 1024
+#define ALL_CTRL_ID 0xFFFFFFFF
+#define ALL_NSID 0xFFFFFFFF
+#define ALL_OPCODE 0xFF
+
+// Variables set from the userspace program, through the skeleton rodata
+// before the load. The host build (nvme_latency_bpf_host.cc) makes them plain
+// globals that the tests set.
+#ifndef BPF_RODATA
+#define BPF_RODATA const volatile
+#endif
+
+BPF_RODATA __u32 filter_ctrl_id = ALL_CTRL_ID;
+BPF_RODATA __u32 filter_nsid = ALL_NSID;
+BPF_RODATA __u8 filter_opcode = ALL_OPCODE;
+BPF_RODATA __u64 latency_min = LATENCY_DEFAULT_MIN_US;
+BPF_RODATA __u64 latency_shift = LATENCY_DEFAULT_SHIFT;
+// When non-zero only 1 in (sample_mask + 1) IOs is measured. Must be one less
+// than a power of two.
+BPF_RODATA __u32 sample_mask = 0;
+
+// Load shedding: when the commands measured on a controller exceed either
+// limit new IOs are not measured, or are measured in the saturated histograms
+// if shed_to_saturated is set. Zero disables the limit.
+BPF_RODATA __u64 shed_in_flight_cmds = 0;
+BPF_RODATA __u64 shed_in_flight_bytes = 0;
+BPF_RODATA __u8 shed_to_saturated = 0;
+// Admin commands are measured in the separate admin_* maps when set. The ones
+// slower than admin_slow_ns are also reported through admin_slow_events.
+BPF_RODATA __u8 track_admin = 0;
+BPF_RODATA __u64 admin_slow_ns = 0;
+// When set the kf backend records the block layer timestamps and the
+// completions populate the per stage histograms.
+BPF_RODATA __u8 track_blk_stages = 0;
+// When set every measured IO is attributed to the cgroup and process that
+// submitted it, aggregated in cgroup_ios.
+BPF_RODATA __u8 track_cgroups = 0;
+// When set the in-flight entries carry the submitting process and the
+// completions maintain the per-queue progress in `queues`, for the stuck IO
+// detection.
+BPF_RODATA __u8 track_stuck_ios = 0;
+// log2 of the logical block size, used to convert NLB to bytes.
+BPF_RODATA __u32 lba_shift = 12;
+
+#define SIZE_CLASS_DISABLED 0xFFFF
+
+BPF_RODATA int class1_size_nlb = SIZE_CLASS_DISABLED;
+BPF_RODATA int class2_size_nlb = SIZE_CLASS_DISABLED;
+
+// The submission queue entry fields used by the latency measurement.
+struct nvme_cmd_info {
+  int ctrl_id;
+  int qid;
+  u32 nsid;
+  u32 cdw10;
+  u32 cdw12;
+  u16 cid;
+  u8 opcode;
+};
+
+// The completion fields used by the latency measurement.
+struct nvme_cpl_info {
+  int ctrl_id;
+  int qid;
+  u16 cid;
+  u16 status;
+  // Block layer timestamps, only set when the block layer stages are tracked.
+  // Zero when the corresponding event was not seen.
+  u64 insert_ns;
+  u64 issue_ns;
+};
+
+struct {
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __uint(max_entries, 10240);
+  __type(key, in_flight_key_t);
+  __type(value, struct request_data);
+} in_flight SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+  __uint(max_entries, MAX_LATENCY_ENTRIES);
+  __type(key, struct latency_hist_key);
+  __type(value, struct latency_hist);
+} hists SEC(".maps");
+
+// All-zero initializer for the new hists and admin_hists entries, keeps the
+// struct off the BPF stack.
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, u32);
+  __type(value, struct latency_hist);
+} hists_zero SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, u32);
+  __type(value, struct latency_stats);
+} stats SEC(".maps");
+
+// Commands and bytes currently in flight, indexed by ctrl_id. Only
+// maintained when the load shedding is enabled.
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __uint(max_entries, MAX_CTRL_LOADS);
+  __type(key, u32);
+  __type(value, struct ctrl_load);
+} ctrl_loads SEC(".maps");
+
+// The bytes every IO in ctrl_loads added to its controller's load, measured or
+// not, to give them back at completion.
+struct {
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __uint(max_entries, 10240);
+  __type(key, in_flight_key_t);
+  __type(value, u32);
+} load_in_flight SEC(".maps");
+
+// Admin commands are rare, they are kept apart from the IO maps so that they
+// never compete with the IOs for the map capacity.
+struct {
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __uint(max_entries, 1024);
+  __type(key, in_flight_key_t);
+  __type(value, struct admin_request_data);
+} admin_in_flight SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+  __uint(max_entries, MAX_ADMIN_LATENCY_ENTRIES);
+  __type(key, struct admin_hist_key);
+  __type(value, struct latency_hist);
+} admin_hists SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_RINGBUF);
+  __uint(max_entries, 64 * 1024);
+} admin_slow_events SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __uint(max_entries, MAX_LATENCY_ENTRIES);
+  __type(key, struct stage_hist_key);
+  __type(value, struct stage_hists);
+} stage_hists SEC(".maps");
+
+// struct stage_hists doesn't fit on the BPF stack, new entries are
+// initialized from this all-zero element instead.
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, u32);
+  __type(value, struct stage_hists);
+} stage_hists_zero SEC(".maps");
+
+// Every cgroup that ever issued an IO gets an entry, the least recently active
+// ones are evicted when the map is full.
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, MAX_CGROUP_ENTRIES);
+  __type(key, u64);
+  __type(value, struct cgroup_io);
+} cgroup_ios SEC(".maps");
+
+// All-zero initializer for the new cgroup_ios entries, the struct is too large
+// to be built on the stack next to the rest of the completion path.
+struct {
+  __uint(type, BPF_MAP_TYPE_ARRAY);
+  __uint(max_entries, 1);
+  __type(key, u32);
+  __type(value, struct cgroup_io);
+} cgroup_ios_zero SEC(".maps");
+
+struct {
+  __uint(type, BPF_MAP_TYPE_HASH);
+  __uint(max_entries, MAX_QUEUE_PROGRESS);
+  __type(key, struct queue_key);
+  __type(value, struct queue_progress);
+} queues SEC(".maps");
+
+static __always_inline struct latency_stats* get_stats(void) {
+  u32 zero = 0;
+  return bpf_map_lookup_elem(&stats, &zero);
+}
+
+// Returns non-zero for the IO commands that carry the NLB field in cdw12.
+static __always_inline int opcode_has_nlb(u8 opcode) {
+  // Write, Read, WriteUncorrectable, Compare, WriteZeros, Verify.
+  return opcode == 0x01 || opcode == 0x02 || opcode == 0x04 ||
+         opcode == 0x05 || opcode == 0x08 || opcode == 0x0C;
+}
+
+// Records into the calling CPU's copy of a per-CPU histogram, no atomics
+// needed.
+static __always_inline void record_hist(struct latency_hist* hist,
+                                        u64 delta_us) {
+  if (hist->total_count == 0 || delta_us < hist->min) {
+    hist->min = delta_us;
+  }
+  if (delta_us > hist->max) {
+    hist->max = delta_us;
+  }
+  hist->total_count++;
+  hist->total_sum += delta_us;
+  hist->total_sum_sq += delta_us * delta_us;
+
+  int slot =
+      bpf_get_bucket(delta_us, latency_min, latency_shift, LATENCY_MAX_SLOTS);
+  if (slot >= 0) {
+    hist->slots[slot]++;
+  } else {
+    hist->overflow_count++;
+  }
+}
+
+// Records into a histogram shared by all the CPUs, without min and max.
+static __always_inline void record_hist_shared(struct latency_hist* hist,
+                                               u64 delta_us) {
+  __sync_fetch_and_add(&hist->total_count, 1);
+  __sync_fetch_and_add(&hist->total_sum, delta_us);
+  __sync_fetch_and_add(&hist->total_sum_sq, delta_us * delta_us);
+
+  int slot =
+      bpf_get_bucket(delta_us, latency_min, latency_shift, LATENCY_MAX_SLOTS);
+  if (slot >= 0) {
+    __sync_fetch_and_add(&hist->slots[slot], 1);
+  } else {
+    __sync_fetch_and_add(&hist->overflow_count, 1);
+  }
+}
+
+// Returns the calling CPU's copy of the `map` entry of `key`, creating it if
+// needed.
+static __always_inline struct latency_hist* get_percpu_hist(void* map,
+                                                            const void* key) {
+  struct latency_hist* hist = bpf_map_lookup_elem(map, key);
+  if (hist != NULL) {
+    return hist;
+  }
+  u32 zero = 0;
+  struct latency_hist* init = bpf_map_lookup_elem(&hists_zero, &zero);
+  if (init == NULL) {
+    return NULL;
+  }
+  // NOEXIST, an update of an existing per-CPU entry would reset this CPU's
+  // copy.
+  bpf_map_update_elem(map, key, init, BPF_NOEXIST);
+  return bpf_map_lookup_elem(map, key);
+}
+
+static __always_inline void record_stages(const struct nvme_cpl_info* cpl,
+                                          const struct request_data* req_data,
+                                          u64 ts) {
+  struct stage_hist_key key = {};
+  key.ctrl_id = cpl->ctrl_id;
+  key.opcode = req_data->opcode;
+
+  struct stage_hists* hists = bpf_map_lookup_elem(&stage_hists, &key);
+  if (hists == NULL) {
+    u32 zero = 0;
+    struct stage_hists* zero_hists =
+        bpf_map_lookup_elem(&stage_hists_zero, &zero);
+    if (zero_hists == NULL) {
+      return;
+    }
+    bpf_map_update_elem(&stage_hists, &key, zero_hists, BPF_NOEXIST);
+    hists = bpf_map_lookup_elem(&stage_hists, &key);
+    if (hists == NULL) {
+      return;
+    }
+  }
+  if (cpl->insert_ns != 0 && cpl->insert_ns <= req_data->start_ns) {
+    record_hist_shared(&hists->stages[kLatencyStageQueue],
+                       (req_data->start_ns - cpl->insert_ns) / 1000);
+  }
+  record_hist_shared(&hists->stages[kLatencyStageSubmit],
+                     (cpl->issue_ns - req_data->start_ns) / 1000);
+  record_hist_shared(&hists->stages[kLatencyStageDevice],
+                     (ts - cpl->issue_ns) / 1000);
+}
+
+// The attribution costs a single map operation per IO, the lookup below. The
+// issuer is captured with helpers at setup and carried in the request_data.
+static __always_inline void record_cgroup(const struct request_data* req_data,
+                                          u64 delta_us) {
+  u64 cgroup_id = req_data->cgroup_id;
+  struct cgroup_io* cg = bpf_map_lookup_elem(&cgroup_ios, &cgroup_id);
+  if (cg == NULL) {
+    u32 zero = 0;
+    struct cgroup_io* zero_cg = bpf_map_lookup_elem(&cgroup_ios_zero, &zero);
+    if (zero_cg == NULL) {
+      return;
+    }
+    bpf_map_update_elem(&cgroup_ios, &cgroup_id, zero_cg, BPF_NOEXIST);
+    cg = bpf_map_lookup_elem(&cgroup_ios, &cgroup_id);
+    if (cg == NULL) {
+      return;
+    }
+  }
+  __sync_fetch_and_add(&cg->ios, 1);
+  __sync_fetch_and_add(&cg->bytes, req_data->bytes);
+  // Racy, but any recent issuer is good enough for display.
+  cg->tgid = req_data->tgid;
+  __builtin_memcpy(cg->comm, req_data->comm, sizeof(cg->comm));
+  record_hist_shared(&cg->hist, delta_us);
+}
+
+// Counts every IO completion of the queue, measured or not.
+static __always_inline void record_queue_progress(
+    const struct nvme_cpl_info* cpl) {
+  struct queue_key key = {};
+  key.ctrl_id = cpl->ctrl_id;
+  key.qid = cpl->qid;
+  struct queue_progress* progress = bpf_map_lookup_elem(&queues, &key);
+  if (progress == NULL) {
+    struct queue_progress new_progress = {};
+    bpf_map_update_elem(&queues, &key, &new_progress, BPF_NOEXIST);
+    progress = bpf_map_lookup_elem(&queues, &key);
+    if (progress == NULL) {
+      return;
+    }
+  }
+  __sync_fetch_and_add(&progress->completions, 1);
+  progress->last_complete_ns = bpf_ktime_get_ns();
+}
+
+static __always_inline void admin_setup_cmd(const struct nvme_cmd_info* cmd,
+                                            const in_flight_key_t* req_key) {
+  // Asynchronous Event Requests stay outstanding until the controller has an
+  // event to report, their completion time says nothing about the device.
+  if (cmd->opcode == 0x0C) {
+    return;
+  }
+  struct admin_request_data req_data = {};
+  req_data.start_ns = bpf_ktime_get_ns();
+  req_data.nsid = cmd->nsid;
+  req_data.opcode = cmd->opcode;
+  req_data.cdw10 = cmd->cdw10;
+
+  bpf_map_update_elem(&admin_in_flight, req_key, &req_data, BPF_ANY);
+}
+
+static __always_inline void admin_complete_rq(const struct nvme_cpl_info* cpl,
+                                              const in_flight_key_t* req_key) {
+  struct admin_request_data* req_data =
+      bpf_map_lookup_elem(&admin_in_flight, req_key);
+  if (req_data == NULL) {
+    return;
+  }
+  u64 delta_ns = bpf_ktime_get_ns() - req_data->start_ns;
+
+  struct admin_hist_key hist_key = {};
+  hist_key.ctrl_id = cpl->ctrl_id;
+  hist_key.opcode = req_data->opcode;
+
+  struct latency_hist* hist = get_percpu_hist(&admin_hists, &hist_key);
+  if (hist != NULL) {
+    record_hist(hist, delta_ns / 1000);
+  }
+
+  if (admin_slow_ns != 0 && delta_ns >= admin_slow_ns) {
+    struct admin_slow_event* e;
+    e = bpf_ringbuf_reserve(&admin_slow_events, sizeof(*e), 0);
+    if (e) {
+      e->latency_ns = delta_ns;
+      e->ctrl_id = cpl->ctrl_id;
+      e->nsid = req_data->nsid;
+      e->cdw10 = req_data->cdw10;
+      e->cid = cpl->cid;
+      e->status = cpl->status;
+      e->opcode = req_data->opcode;
+      bpf_ringbuf_submit(e, 0);
+    }
+  }
+
+  bpf_map_delete_elem(&admin_in_flight, req_key);
+}
+
+// Adds the IO to its controller's load. Returns non-zero when the controller
+// was already at a shedding limit.
+static __always_inline int load_setup_cmd(const struct nvme_cmd_info* cmd,
+                                          const in_flight_key_t* req_key,
+                                          u32 bytes) {
+  u32 load_idx = cmd->ctrl_id;
+  struct ctrl_load* load = bpf_map_lookup_elem(&ctrl_loads, &load_idx);
+  if (load == NULL) {
+    // ctrl_id >= MAX_CTRL_LOADS, the controller is never shed.
+    struct latency_stats* stats_data = get_stats();
+    if (stats_data != NULL) {
+      stats_data->load_untracked++;
+    }
+    return 0;
+  }
+  int overloaded =
+      (shed_in_flight_cmds != 0 &&
+       load->in_flight_cmds >= shed_in_flight_cmds) ||
+      (shed_in_flight_bytes != 0 &&
+       load->in_flight_bytes >= shed_in_flight_bytes);
+
+  // A stale entry with the same key is about to be overwritten, give back its
+  // share of the load so that the counters don't drift upwards.
+  u32* stale = bpf_map_lookup_elem(&load_in_flight, req_key);
+  if (stale != NULL) {
+    __sync_fetch_and_add(&load->in_flight_cmds, -1);
+    __sync_fetch_and_add(&load->in_flight_bytes, -(u64)*stale);
+  }
+  if (bpf_map_update_elem(&load_in_flight, req_key, &bytes, BPF_ANY) == 0) {
+    __sync_fetch_and_add(&load->in_flight_cmds, 1);
+    __sync_fetch_and_add(&load->in_flight_bytes, bytes);
+  }
+  return overloaded;
+}
+
+static __always_inline void load_complete_rq(const struct nvme_cpl_info* cpl,
+                                             const in_flight_key_t* req_key) {
+  u32* bytes = bpf_map_lookup_elem(&load_in_flight, req_key);
+  if (bytes == NULL) {
+    return;
+  }
+  u32 load_idx = cpl->ctrl_id;
+  struct ctrl_load* load = bpf_map_lookup_elem(&ctrl_loads, &load_idx);
+  if (load != NULL) {
+    __sync_fetch_and_add(&load->in_flight_cmds, -1);
+    __sync_fetch_and_add(&load->in_flight_bytes, -(u64)*bytes);
+  }
+  bpf_map_delete_elem(&load_in_flight, req_key);
+}
+
+static __always_inline int latency_setup_cmd(const struct nvme_cmd_info* cmd,
+                                             const in_flight_key_t* req_key) {
+  if (filter_ctrl_id != ALL_CTRL_ID && cmd->ctrl_id != (int)filter_ctrl_id) {
+    return 0;
+  }
+  if (cmd->qid == 0) {
+    // The opcode and nsid filters apply to the IO commands only.
+    if (track_admin) {
+      admin_setup_cmd(cmd, req_key);
+    }
+    return 0;
+  }
+
+  // sqe.cdw12[15:0] contains the zero-based size in blocks, the upper bits are
+  // command flags (FUA, LR, PRINFO).
+  u32 nlb = (cmd->cdw12 & 0xFFFF) + 1;
+  u32 bytes = opcode_has_nlb(cmd->opcode) ? nlb << lba_shift : 0;
+
+  // The load counts every IO of the controller, ahead of the filters and the
+  // sampling, so that the shedding follows the real device load.
+  int overloaded = 0;
+  if (shed_in_flight_cmds != 0 || shed_in_flight_bytes != 0) {
+    overloaded = load_setup_cmd(cmd, req_key, bytes);
+  }
+
+  if (filter_opcode != ALL_OPCODE && cmd->opcode != (u8)filter_opcode) {
+    return 0;
+  }
+  if (filter_nsid != ALL_NSID && cmd->nsid != filter_nsid) {
+    return 0;
+  }
+
+  struct latency_stats* stats_data = NULL;
+  if (sample_mask != 0) {
+    // Deterministic 1-in-N sampling. The per-CPU sequence keeps the decision
+    // from locking onto a fixed set of cids when the tags are reused in order.
+    stats_data = get_stats();
+    if (stats_data == NULL) {
+      return 0;
+    }
+    u64 seq = stats_data->sample_seq++;
+    if (((u64)cmd->cid ^ (u64)cmd->qid ^ seq) & sample_mask) {
+      // The completion for this IO misses the in_flight lookup and exits.
+      stats_data->unsampled++;
+      return 0;
+    }
+    stats_data->sampled++;
+  }
+
+  struct request_data req_data = {};
+  req_data.start_ns = bpf_ktime_get_ns();
+  req_data.opcode = cmd->opcode;
+  req_data.ctrl_id = cmd->ctrl_id;
+  req_data.qid = cmd->qid;
+  req_data.cid = cmd->cid;
+  req_data.bytes = bytes;
+
+  if (class1_size_nlb == SIZE_CLASS_DISABLED) {
+    req_data.size_class = 0;
+  } else if (nlb <= (u32)class1_size_nlb) {
+    req_data.size_class = 0;
+  } else if (nlb <= (u32)class2_size_nlb) {
+    req_data.size_class = 1;
+  } else {
+    req_data.size_class = 2;
+  }
+
+  if (track_cgroups || track_stuck_ios) {
+    // The issuing context: the submitting task, or the kworker when blk-mq
+    // dispatches asynchronously.
+    if (track_cgroups) {
+      req_data.cgroup_id = bpf_get_current_cgroup_id();
+    }
+    req_data.tgid = bpf_get_current_pid_tgid() >> 32;
+    bpf_get_current_comm(&req_data.comm, sizeof(req_data.comm));
+  }
+
+  if (overloaded) {
+    if (stats_data == NULL) {
+      stats_data = get_stats();
+    }
+    if (!shed_to_saturated) {
+      if (stats_data != NULL) {
+        stats_data->shed++;
+      }
+      return 0;
+    }
+    if (stats_data != NULL) {
+      stats_data->saturated++;
+    }
+    req_data.saturated = 1;
+  }
+
+  if (bpf_map_update_elem(&in_flight, req_key, &req_data, BPF_ANY) != 0) {
+    // TODO(mogo): Record lost starts.
+  }
+  return 0;
+}
+
+// TODO(mogo): Periodic cleanup of in_flight requests that exceed unreasonable
+// duration. The stuck IO detector reports them from userspace.
+
+static __always_inline int latency_complete_rq(const struct nvme_cpl_info* cpl,
+                                               const in_flight_key_t* req_key) {
+  if (cpl->qid == 0) {
+    if (track_admin) {
+      admin_complete_rq(cpl, req_key);
+    }
+    return 0;
+  }
+  if (track_stuck_ios) {
+    record_queue_progress(cpl);
+  }
+  if (shed_in_flight_cmds != 0 || shed_in_flight_bytes != 0) {
+    load_complete_rq(cpl, req_key);
+  }
+
+  struct request_data* req_data;
+  req_data = bpf_map_lookup_elem(&in_flight, req_key);
+  if (req_data == NULL) {
+    // TODO(mogo): Record missed starts. We expect some missing entries at the
+    // very beginning on the operation, but a continuous increase may indicate
+    // either logic errors or in-flight map overflow.
+    return 0;
+  }
+  u64 ts = bpf_ktime_get_ns();
+
+  struct latency_hist_key hist_key = {};
+  hist_key.ctrl_id = cpl->ctrl_id;
+  hist_key.opcode = req_data->opcode;
+  hist_key.size_class = req_data->size_class;
+  hist_key.saturated = req_data->saturated;
+
+  // TODO(mogo): Record histogram overflow, a NULL hist when the map is full.
+  struct latency_hist* hist = get_percpu_hist(&hists, &hist_key);
+  if (hist != NULL) {
+    u64 delta_us = (ts - req_data->start_ns) / 1000;
+    record_hist(hist, delta_us);
+
+    // An issue before the setup is left over from an earlier dispatch.
+    if (track_blk_stages && cpl->issue_ns >= req_data->start_ns &&
+        cpl->issue_ns <= ts) {
+      record_stages(cpl, req_data, ts);
+    }
+    if (track_cgroups) {
+      record_cgroup(req_data, delta_us);
+    }
+  }
+
+  bpf_map_delete_elem(&in_flight, req_key);
+  return 0;
+}
+
+#endif /* NVME_LATENCY_CORE_BPF_H */
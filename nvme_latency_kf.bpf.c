@@ -0,0 +1,165 @@
+// clang-format off
+#include "nvme_core.bpf.h"
+// clang-format on
+
+#include "nvme_latency.h"
+
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+
+#include "types.bpf.h"
+
+// fentry/fexit programs get the `struct request *` directly, it identifies the
+// request from setup to completion without building a composite key.
+typedef u64 in_flight_key_t;
+
+#include "nvme_latency_core.bpf.h"
+
+char LICENSE[] SEC("license") = "Dual BSD/GPL";
+
+// Block layer timestamps of the requests not yet completed, keyed by the
+// request pointer. block_rq_insert fires before nvme_setup_cmd and
+// block_rq_issue after it, from nvme_queue_rq() right before the doorbell. The
+// completion claims and deletes the entry. The block tracepoints fire for every
+// block device and some requests never reach the nvme driver, LRU eviction
+// bounds the entries that are never claimed.
+struct blk_stamps {
+  u64 insert_ns;
+  u64 issue_ns;
+};
+
+struct {
+  __uint(type, BPF_MAP_TYPE_LRU_HASH);
+  __uint(max_entries, 10240);
+  __type(key, u64);
+  __type(value, struct blk_stamps);
+} blk_in_flight SEC(".maps");
+
+// Equivalent of nvme_req(): the nvme_request is the blk-mq PDU that directly
+// follows the struct request.
+static __always_inline struct nvme_request* kf_nvme_req(struct request* req) {
+  return (struct nvme_request*)((char*)req +
+                                bpf_core_type_size(struct request));
+}
+
+// Equivalent of nvme_req_qid(): the admin queue has no queuedata.
+static __always_inline int kf_req_qid(struct request* req) {
+  if (!BPF_CORE_READ(req, q, queuedata)) {
+    return 0;
+  }
+  return BPF_CORE_READ(req, mq_hctx, queue_num) + 1;
+}
+
+// blk_status_t nvme_setup_cmd(struct nvme_ns *ns, struct request *req)
+// Intercept the exit because the command_id is populated during the setup.
+SEC("fexit/nvme_setup_cmd")
+int BPF_PROG(handle_nvme_setup_cmd, struct nvme_ns* ns, struct request* req,
+             blk_status_t ret) {
+  in_flight_key_t req_key = (u64)req;
+  if (ret != 0) {
+    // The command was not set up and won't be issued.
+    if (track_blk_stages) {
+      bpf_map_delete_elem(&blk_in_flight, &req_key);
+    }
+    return 0;
+  }
+  struct nvme_request* nreq = kf_nvme_req(req);
+  struct nvme_command* ncmd = BPF_CORE_READ(nreq, cmd);
+
+  struct nvme_cmd_info cmd = {};
+  cmd.ctrl_id = BPF_CORE_READ(nreq, ctrl, instance);
+  cmd.qid = kf_req_qid(req);
+  cmd.nsid = BPF_CORE_READ(ncmd, common.nsid);
+  cmd.cdw10 = BPF_CORE_READ(ncmd, common.cdw10);
+  cmd.cdw12 = BPF_CORE_READ(ncmd, common.cdw12);
+  cmd.cid = BPF_CORE_READ(ncmd, common.command_id);
+  cmd.opcode = BPF_CORE_READ(ncmd, common.opcode);
+
+  if (track_blk_stages) {
+    // This dispatch is issued after the setup, an issue stamp is left over
+    // from an earlier use of the request that wasn't inserted again.
+    struct blk_stamps* stamps = bpf_map_lookup_elem(&blk_in_flight, &req_key);
+    if (stamps != NULL && stamps->issue_ns != 0) {
+      bpf_map_delete_elem(&blk_in_flight, &req_key);
+    }
+  }
+#ifdef VLOG
+  bpf_printk("fexit/nvme_setup_cmd: PID %d, qid=%d, cid=%d, opcode=0x%x",
+             bpf_get_current_pid_tgid() >> 32, cmd.qid, cmd.cid, cmd.opcode);
+#endif
+
+  return latency_setup_cmd(&cmd, &req_key);
+}
+
+static __always_inline int kf_complete(struct request* req) {
+  struct nvme_request* nreq = kf_nvme_req(req);
+
+  struct nvme_cpl_info cpl = {};
+  cpl.ctrl_id = BPF_CORE_READ(nreq, ctrl, instance);
+  cpl.qid = kf_req_qid(req);
+  cpl.cid = BPF_CORE_READ(nreq, cmd, common.command_id);
+  cpl.status = BPF_CORE_READ(nreq, status);
+#ifdef VLOG
+  bpf_printk("fentry/nvme_complete: PID %d, qid=%d, cid=%d",
+             bpf_get_current_pid_tgid() >> 32, cpl.qid, cpl.cid);
+#endif
+
+  in_flight_key_t req_key = (u64)req;
+  if (track_blk_stages) {
+    struct blk_stamps* stamps = bpf_map_lookup_elem(&blk_in_flight, &req_key);
+    if (stamps != NULL) {
+      cpl.insert_ns = stamps->insert_ns;
+      cpl.issue_ns = stamps->issue_ns;
+      bpf_map_delete_elem(&blk_in_flight, &req_key);
+    }
+  }
+  return latency_complete_rq(&cpl, &req_key);
+}
+
+// void nvme_complete_rq(struct request *req)
+SEC("fentry/nvme_complete_rq")
+int BPF_PROG(handle_nvme_complete_rq, struct request* req) {
+  return kf_complete(req);
+}
+
+// void nvme_complete_batch_req(struct request *req)
+// The batched completions (io_uring polling, irq batching) bypass
+// nvme_complete_rq. Not every kernel has it, the loader disables this program
+// when the function is missing from the kernel BTF.
+SEC("fentry/nvme_complete_batch_req")
+int BPF_PROG(handle_nvme_complete_batch_req, struct request* req) {
+  return kf_complete(req);
+}
+
+// The block layer programs are only loaded with --blk_stages. The BTF enabled
+// tracepoints take the request alone since 5.11.
+
+// void block_rq_insert(struct request *rq)
+// Not hit by the requests issued directly, bypassing the IO scheduler, their
+// queue stage is not recorded.
+SEC("tp_btf/block_rq_insert")
+int BPF_PROG(handle_block_rq_insert, struct request* rq) {
+  u64 key = (u64)rq;
+  struct blk_stamps stamps = {};
+  stamps.insert_ns = bpf_ktime_get_ns();
+  bpf_map_update_elem(&blk_in_flight, &key, &stamps, BPF_ANY);
+  return 0;
+}
+
+// void block_rq_issue(struct request *rq)
+// A requeued request is set up and issued again, the last issue wins.
+SEC("tp_btf/block_rq_issue")
+int BPF_PROG(handle_block_rq_issue, struct request* rq) {
+  u64 key = (u64)rq;
+  u64 ts = bpf_ktime_get_ns();
+  struct blk_stamps* stamps = bpf_map_lookup_elem(&blk_in_flight, &key);
+  if (stamps != NULL) {
+    stamps->issue_ns = ts;
+    return 0;
+  }
+  struct blk_stamps new_stamps = {};
+  new_stamps.issue_ns = ts;
+  bpf_map_update_elem(&blk_in_flight, &key, &new_stamps, BPF_ANY);
+  return 0;
+}
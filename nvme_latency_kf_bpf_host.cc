@@ -0,0 +1,41 @@
+#include "nvme_latency_bpf_host.h"
+
+#include "nvme_latency.h"
+
+// The rodata become ordinary, writable globals.
+#define BPF_RODATA
+
+// A translation unit of its own, the backends share the names of
+// nvme_latency_core.bpf.h.
+namespace nvme_latency_kf_bpf {
+#include "nvme_latency_kf.bpf.c"
+}  // namespace nvme_latency_kf_bpf
+
+namespace nvme_latency_kf_bpf {
+namespace {
+
+struct Rodata {
+#define NVME_LATENCY_BPF_FIELD(type, name) type name;
+  NVME_LATENCY_BPF_RODATA(NVME_LATENCY_BPF_FIELD)
+#undef NVME_LATENCY_BPF_FIELD
+};
+
+const Rodata kDefaultRodata = {
+#define NVME_LATENCY_BPF_VALUE(type, name) name,
+    NVME_LATENCY_BPF_RODATA(NVME_LATENCY_BPF_VALUE)
+#undef NVME_LATENCY_BPF_VALUE
+};
+
+}  // namespace
+
+void Load(nvme_bpf::BpfHost* host) {
+#define NVME_LATENCY_BPF_ADD_MAP(name) host->AddMap(&name, #name);
+  NVME_LATENCY_BPF_MAPS(NVME_LATENCY_BPF_ADD_MAP)
+#undef NVME_LATENCY_BPF_ADD_MAP
+  host->AddMap(&blk_in_flight, "blk_in_flight");
+#define NVME_LATENCY_BPF_RESET(type, name) name = kDefaultRodata.name;
+  NVME_LATENCY_BPF_RODATA(NVME_LATENCY_BPF_RESET)
+#undef NVME_LATENCY_BPF_RESET
+}
+
+}  // namespace nvme_latency_kf_bpf
@@ -0,0 +1,193 @@
+#include "nvme_log_pages.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/status.h"
+#include "absl/strings/str_cat.h"
+#include "nvme_abi.h"
+#include "nvme_strings.h"
+
+namespace nvme_bpf {
+namespace {
+
+using nvme_abi::ErrorInformationLogEntry;
+using nvme_abi::GetLogPageSmartHealthInformationLog;
+using nvme_abi::GetLogPageTelemetryHeader;
+using nvme_abi::LogPageId;
+
+absl::Status CheckSize(LogPageId id, std::string_view page, size_t size) {
+  if (page.size() < size) {
+    return absl::InvalidArgumentError(
+        absl::StrCat(nvme_abi::LogPageIdToString(id), " log page of ",
+                     page.size(), " bytes, expected ", size));
+  }
+  return absl::OkStatus();
+}
+
+uint64_t Saturate(uint64_t lsb, uint64_t msb) {
+  return msb != 0 ? UINT64_MAX : lsb;
+}
+
+// " name=now(+delta)", the delta only if there is a previous reading and it
+// moved.
+void AppendCounter(std::string* out, std::string_view name, uint64_t now,
+                   const uint64_t* prev, std::string_view unit = "") {
+  absl::StrAppend(out, " ", name, "=", now, unit);
+  if (prev != nullptr && now > *prev) {
+    absl::StrAppend(out, "(+", now - *prev, unit, ")");
+  }
+}
+
+}  // namespace
+
+absl::StatusOr<SmartHealth> ParseSmartHealthLog(std::string_view page) {
+  absl::Status status = CheckSize(LogPageId::kSmartHealthInfo, page,
+                                  sizeof(GetLogPageSmartHealthInformationLog));
+  if (!status.ok()) {
+    return status;
+  }
+  GetLogPageSmartHealthInformationLog log;
+  std::memcpy(&log, page.data(), sizeof(log));
+  SmartHealth health;
+  health.critical_warning = log.critical_warning;
+  // Reported in Kelvin.
+  health.temperature_c = static_cast<int>(log.composite_temperature) - 273;
+  health.available_spare = log.available_spare;
+  health.available_spare_threshold = log.available_spare_threshold;
+  health.percentage_used = log.percentage_used;
+  health.media_errors = Saturate(log.media_and_data_integrity_errors_lsb,
+                                 log.media_and_data_integrity_errors_msb);
+  health.error_log_entries =
+      Saturate(log.num_error_information_log_entries_lsb,
+               log.num_error_information_log_entries_msb);
+  health.controller_busy_minutes = Saturate(log.controller_busy_time_lsb,
+                                            log.controller_busy_time_msb);
+  health.power_on_hours =
+      Saturate(log.power_on_hours_lsb, log.power_on_hours_msb);
+  health.unsafe_shutdowns =
+      Saturate(log.unsafe_shutdowns_lsb, log.unsafe_shutdowns_msb);
+  health.warning_temperature_minutes = log.warning_composite_temperature_time;
+  health.critical_temperature_minutes =
+      log.critical_composite_temperature_time;
+  health.throttle_transitions[0] =
+      log.thermal_management_temperature_1_transition_count;
+  health.throttle_transitions[1] =
+      log.thermal_management_temperature_2_transition_count;
+  health.throttle_seconds[0] = log.total_time_thermal_management_temperature_1;
+  health.throttle_seconds[1] = log.total_time_thermal_management_temperature_2;
+  return health;
+}
+
+absl::StatusOr<std::vector<ErrorInformationLogEntry>> ParseErrorLog(
+    std::string_view page) {
+  if (page.size() % sizeof(ErrorInformationLogEntry) != 0) {
+    return absl::InvalidArgumentError(absl::StrCat(
+        nvme_abi::LogPageIdToString(LogPageId::kErrorInfo), " log page of ",
+        page.size(), " bytes, expected a multiple of ",
+        sizeof(ErrorInformationLogEntry)));
+  }
+  std::vector<ErrorInformationLogEntry> entries;
+  for (size_t offset = 0; offset < page.size();
+       offset += sizeof(ErrorInformationLogEntry)) {
+    ErrorInformationLogEntry entry;
+    std::memcpy(&entry, page.data() + offset, sizeof(entry));
+    // A zero count marks an unused or a lost entry.
+    if (entry.error_count != 0) {
+      entries.push_back(entry);
+    }
+  }
+  std::sort(entries.begin(), entries.end(),
+            [](const auto& a, const auto& b) {
+              return a.error_count > b.error_count;
+            });
+  return entries;
+}
+
+std::string ErrorLogEntryToString(const ErrorInformationLogEntry& entry) {
+  std::string out = absl::StrCat("error_count=", entry.error_count);
+  // 0xFFFF when the error isn't specific to a command.
+  if (entry.submission_queue_id != 0xFFFF) {
+    absl::StrAppend(&out, " sqid=", entry.submission_queue_id,
+                    " cid=", entry.command_id);
+  }
+  absl::StrAppend(&out, " ",
+                  nvme_abi::NvmeStatusCodeToString(
+                      entry.status_field.status_code_type,
+                      entry.status_field.status_code));
+  if (entry.namespace_id != 0) {
+    absl::StrAppend(&out, " nsid=", entry.namespace_id, " lba=", entry.lba);
+  }
+  return out;
+}
+
+absl::StatusOr<TelemetryHeader> ParseTelemetryHeader(std::string_view page) {
+  absl::Status status = CheckSize(LogPageId::kTelemetryHostInitiated, page,
+                                  sizeof(GetLogPageTelemetryHeader));
+  if (!status.ok()) {
+    return status;
+  }
+  GetLogPageTelemetryHeader log;
+  std::memcpy(&log, page.data(), sizeof(log));
+  if (log.log_page_id != LogPageId::kTelemetryHostInitiated &&
+      log.log_page_id != LogPageId::kTelemetryCtrlInitiated) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Not a telemetry log page: ",
+                     nvme_abi::LogPageIdToString(log.log_page_id)));
+  }
+  TelemetryHeader header;
+  header.log_page_id = log.log_page_id;
+  header.ieee_oui = static_cast<uint8_t>(log.ieee_oui[0]) |
+                    static_cast<uint8_t>(log.ieee_oui[1]) << 8 |
+                    static_cast<uint8_t>(log.ieee_oui[2]) << 16;
+  header.area_last_block[0] = log.area1_last_block;
+  header.area_last_block[1] = log.area2_last_block;
+  header.area_last_block[2] = log.area3_last_block;
+  header.controller_data_available = log.ctrl_init_data_avail & 1;
+  header.controller_data_generation = log.ctrl_init_data_gen_num;
+  return header;
+}
+
+std::string FormatSmartHealth(int ctrl_id, const SmartHealth& now,
+                              const SmartHealth* prev) {
+  std::string out = absl::StrCat("nvme", ctrl_id,
+                                 " health: ", now.temperature_c, "C");
+  absl::StrAppend(&out, " spare=", now.available_spare, "%");
+  if (now.available_spare < now.available_spare_threshold) {
+    absl::StrAppend(&out, "(<", now.available_spare_threshold, "%)");
+  }
+  absl::StrAppend(&out, " used=", now.percentage_used, "%");
+  uint64_t throttle = uint64_t{now.throttle_seconds[0]} +
+                      now.throttle_seconds[1];
+  uint64_t prev_throttle =
+      prev == nullptr ? 0
+                      : uint64_t{prev->throttle_seconds[0]} +
+                            prev->throttle_seconds[1];
+  AppendCounter(&out, "throttle", throttle,
+                prev == nullptr ? nullptr : &prev_throttle, "s");
+  uint64_t warn_temp = now.warning_temperature_minutes;
+  uint64_t prev_warn_temp =
+      prev == nullptr ? 0 : prev->warning_temperature_minutes;
+  AppendCounter(&out, "warn_temp", warn_temp,
+                prev == nullptr ? nullptr : &prev_warn_temp, "m");
+  AppendCounter(&out, "media_errors", now.media_errors,
+                prev == nullptr ? nullptr : &prev->media_errors);
+  AppendCounter(&out, "error_log", now.error_log_entries,
+                prev == nullptr ? nullptr : &prev->error_log_entries);
+  const auto& warning = now.critical_warning;
+  if (warning.space || warning.temp || warning.reliability_degradation ||
+      warning.read_only || warning.volatile_memory_backup_failed) {
+    absl::StrAppend(&out, " CRITICAL_WARNING:", warning.space ? " spare" : "",
+                    warning.temp ? " temperature" : "",
+                    warning.reliability_degradation ? " reliability" : "",
+                    warning.read_only ? " read_only" : "",
+                    warning.volatile_memory_backup_failed ? " backup" : "");
+  }
+  return out;
+}
+
+}  // namespace nvme_bpf
@@ -0,0 +1,74 @@
+#ifndef NVME_LOG_PAGES_H_
+#define NVME_LOG_PAGES_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/status/statusor.h"
+#include "nvme_abi.h"
+
+namespace nvme_bpf {
+
+// Parsers of the raw Get Log Page data, as read from the device or saved to a
+// file. The pages are little endian, like the hosts this runs on.
+
+// The SMART / Health Information log fields that explain latency: thermal
+// throttling, spare capacity and media errors. The 128 bit counters saturate
+// at UINT64_MAX.
+struct SmartHealth {
+  nvme_abi::GetLogPageSmartHealthCriticalWarning critical_warning;
+  // The composite temperature in degrees Celsius.
+  int temperature_c;
+  // Percentages.
+  int available_spare;
+  int available_spare_threshold;
+  int percentage_used;
+  uint64_t media_errors;
+  uint64_t error_log_entries;
+  uint64_t controller_busy_minutes;
+  uint64_t power_on_hours;
+  uint64_t unsafe_shutdowns;
+  // The minutes above the warning and the critical composite temperature.
+  uint32_t warning_temperature_minutes;
+  uint32_t critical_temperature_minutes;
+  // The transitions into and the seconds spent in the light (index 0) and the
+  // heavy (index 1) thermal throttling.
+  uint32_t throttle_transitions[2];
+  uint32_t throttle_seconds[2];
+};
+
+absl::StatusOr<SmartHealth> ParseSmartHealthLog(std::string_view page);
+
+// The valid entries of an Error Information log page of any number of
+// entries, the newest (highest error count) first.
+absl::StatusOr<std::vector<nvme_abi::ErrorInformationLogEntry>> ParseErrorLog(
+    std::string_view page);
+
+// E.g. "error_count=5 sqid=1 cid=18 MEDIA_ERROR_STATUS_READ_ERROR nsid=1
+// lba=4096".
+std::string ErrorLogEntryToString(
+    const nvme_abi::ErrorInformationLogEntry& entry);
+
+// The header of the host or the controller initiated Telemetry log.
+struct TelemetryHeader {
+  nvme_abi::LogPageId log_page_id;
+  uint32_t ieee_oui;
+  // The last 512 byte block of the data areas 1 to 3.
+  uint16_t area_last_block[3];
+  bool controller_data_available;
+  uint8_t controller_data_generation;
+};
+
+absl::StatusOr<TelemetryHeader> ParseTelemetryHeader(std::string_view page);
+
+// The report line of a controller, e.g. "nvme0 health: 41C spare=100%
+// used=2% throttle=12s(+3s) warn_temp=0m media_errors=0 error_log=5(+1)". The
+// changes are against `prev` if set, only the non-zero ones are shown.
+std::string FormatSmartHealth(int ctrl_id, const SmartHealth& now,
+                              const SmartHealth* prev);
+
+}  // namespace nvme_bpf
+
+#endif  // NVME_LOG_PAGES_H_
@@ -0,0 +1,134 @@
+#include "nvme_log_pages.h"
+
+#include <cstring>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "nvme_abi.h"
+
+namespace {
+
+using nvme_abi::ErrorInformationLogEntry;
+using nvme_bpf::SmartHealth;
+
+template <typename T>
+std::string Blob(const T& page) {
+  return std::string(reinterpret_cast<const char*>(&page), sizeof(page));
+}
+
+nvme_abi::GetLogPageSmartHealthInformationLog SmartPage() {
+  nvme_abi::GetLogPageSmartHealthInformationLog log = {};
+  log.composite_temperature = 273 + 41;
+  log.available_spare = 100;
+  log.available_spare_threshold = 10;
+  log.percentage_used = 2;
+  log.media_and_data_integrity_errors_lsb = 3;
+  log.num_error_information_log_entries_lsb = 5;
+  log.power_on_hours_lsb = 1000;
+  log.warning_composite_temperature_time = 7;
+  log.thermal_management_temperature_1_transition_count = 2;
+  log.total_time_thermal_management_temperature_1 = 10;
+  log.total_time_thermal_management_temperature_2 = 2;
+  return log;
+}
+
+TEST(ParseSmartHealthLog, Fields) {
+  auto health = nvme_bpf::ParseSmartHealthLog(Blob(SmartPage()));
+  ASSERT_TRUE(health.ok()) << health.status();
+  EXPECT_EQ(health->temperature_c, 41);
+  EXPECT_EQ(health->available_spare, 100);
+  EXPECT_EQ(health->percentage_used, 2);
+  EXPECT_EQ(health->media_errors, 3);
+  EXPECT_EQ(health->error_log_entries, 5);
+  EXPECT_EQ(health->power_on_hours, 1000);
+  EXPECT_EQ(health->warning_temperature_minutes, 7);
+  EXPECT_EQ(health->throttle_transitions[0], 2);
+  EXPECT_EQ(health->throttle_seconds[0], 10);
+  EXPECT_EQ(health->throttle_seconds[1], 2);
+  EXPECT_FALSE(health->critical_warning.temp);
+
+  auto page = SmartPage();
+  page.media_and_data_integrity_errors_msb = 1;
+  page.critical_warning.temp = true;
+  health = nvme_bpf::ParseSmartHealthLog(Blob(page));
+  ASSERT_TRUE(health.ok()) << health.status();
+  EXPECT_EQ(health->media_errors, UINT64_MAX);
+  EXPECT_TRUE(health->critical_warning.temp);
+
+  EXPECT_FALSE(nvme_bpf::ParseSmartHealthLog(Blob(page).substr(0, 511)).ok());
+}
+
+TEST(FormatSmartHealth, ShowsTheChanges) {
+  auto prev = nvme_bpf::ParseSmartHealthLog(Blob(SmartPage()));
+  ASSERT_TRUE(prev.ok());
+  EXPECT_EQ(nvme_bpf::FormatSmartHealth(0, *prev, nullptr),
+            "nvme0 health: 41C spare=100% used=2% throttle=12s warn_temp=7m "
+            "media_errors=3 error_log=5");
+
+  SmartHealth now = *prev;
+  now.throttle_seconds[1] += 3;
+  now.error_log_entries += 1;
+  now.available_spare = 5;
+  now.critical_warning.space = true;
+  EXPECT_EQ(nvme_bpf::FormatSmartHealth(1, now, &*prev),
+            "nvme1 health: 41C spare=5%(<10%) used=2% throttle=15s(+3s) "
+            "warn_temp=7m media_errors=3 error_log=6(+1) CRITICAL_WARNING: "
+            "spare");
+}
+
+TEST(ParseErrorLog, SkipsInvalidAndSortsNewestFirst) {
+  ErrorInformationLogEntry entries[4] = {};
+  entries[0].error_count = 5;
+  entries[0].submission_queue_id = 1;
+  entries[0].command_id = 18;
+  entries[0].status_field.status_code_type =
+      nvme_abi::StatusCodeType::kMediaError;
+  entries[0].status_field.status_code =
+      nvme_abi::StatusCode::kUnrecoveredReadError;
+  entries[0].namespace_id = 1;
+  entries[0].lba = 4096;
+  entries[1].error_count = 6;
+  entries[1].submission_queue_id = 0xFFFF;
+  // entries[2] is unused.
+  entries[3].error_count = 4;
+  std::string page(reinterpret_cast<const char*>(entries), sizeof(entries));
+
+  auto parsed = nvme_bpf::ParseErrorLog(page);
+  ASSERT_TRUE(parsed.ok()) << parsed.status();
+  ASSERT_EQ(parsed->size(), 3);
+  EXPECT_EQ((*parsed)[0].error_count, 6);
+  EXPECT_EQ((*parsed)[1].error_count, 5);
+  EXPECT_EQ((*parsed)[2].error_count, 4);
+  EXPECT_EQ(nvme_bpf::ErrorLogEntryToString((*parsed)[1]),
+            "error_count=5 sqid=1 cid=18 MEDIA_ERROR_STATUS_READ_ERROR nsid=1 "
+            "lba=4096");
+  EXPECT_EQ(nvme_bpf::ErrorLogEntryToString((*parsed)[0]),
+            "error_count=6 GENERIC_STATUS_SUCCESS");
+
+  EXPECT_FALSE(nvme_bpf::ParseErrorLog(page.substr(0, 100)).ok());
+}
+
+TEST(ParseTelemetryHeader, Fields) {
+  nvme_abi::GetLogPageTelemetryHeader log = {};
+  log.log_page_id = nvme_abi::LogPageId::kTelemetryCtrlInitiated;
+  log.ieee_oui[0] = 0x12;
+  log.ieee_oui[1] = 0x34;
+  log.ieee_oui[2] = static_cast<char>(0xAB);
+  log.area1_last_block = 1;
+  log.area2_last_block = 10;
+  log.area3_last_block = 100;
+  log.ctrl_init_data_avail = 1;
+  log.ctrl_init_data_gen_num = 3;
+  auto header = nvme_bpf::ParseTelemetryHeader(Blob(log));
+  ASSERT_TRUE(header.ok()) << header.status();
+  EXPECT_EQ(header->log_page_id, nvme_abi::LogPageId::kTelemetryCtrlInitiated);
+  EXPECT_EQ(header->ieee_oui, 0xAB3412);
+  EXPECT_EQ(header->area_last_block[2], 100);
+  EXPECT_TRUE(header->controller_data_available);
+  EXPECT_EQ(header->controller_data_generation, 3);
+
+  log.log_page_id = nvme_abi::LogPageId::kSmartHealthInfo;
+  EXPECT_FALSE(nvme_bpf::ParseTelemetryHeader(Blob(log)).ok());
+}
+
+}  // namespace
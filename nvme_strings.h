@@ -2,8 +2,10 @@
 #define NVME_STRINGS_H_
 
 #include <cstdint>
+#include <optional>
 #include <ostream>
 #include <string>
+#include <string_view>
 
 #include "nvme_abi.h"
 
@@ -13,6 +15,15 @@ std::string_view NvmeIoOpcodeToString(NvmeOpcode opcode);
 
 std::string_view NvmeAdminOpcodeToString(NvmeOpcode opcode);
 
+// The opcode of a name returned by Nvme{Io,Admin}OpcodeToString, ignoring the
+// case, e.g. "read" is kRead. nullopt for an unknown name.
+std::optional<NvmeOpcode> NvmeIoOpcodeFromString(std::string_view name);
+std::optional<NvmeOpcode> NvmeAdminOpcodeFromString(std::string_view name);
+
+// Parses an opcode filter given either as a decimal number or as the name of
+// an IO or an `admin` opcode.
+std::optional<NvmeOpcode> ParseNvmeOpcode(std::string_view text, bool admin);
+
 std::string_view NvmeIdentifyTypeToString(IdentifyType id_type);
 
 std::string_view NvmeGenericStatusCodeToString(StatusCode status_code);
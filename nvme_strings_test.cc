@@ -0,0 +1,91 @@
+#include "nvme_strings.h"
+
+#include <optional>
+#include <string_view>
+
+#include "gtest/gtest.h"
+#include "nvme_abi.h"
+
+namespace {
+
+using nvme_abi::NvmeOpcode;
+using nvme_abi::StatusCode;
+
+TEST(NvmeStrings, OpcodeToString) {
+  EXPECT_EQ(nvme_abi::NvmeIoOpcodeToString(NvmeOpcode::kRead), "Read");
+  EXPECT_EQ(nvme_abi::NvmeIoOpcodeToString(NvmeOpcode::kReservationRelease),
+            "ReservationRelease");
+  EXPECT_EQ(nvme_abi::NvmeIoOpcodeToString(static_cast<NvmeOpcode>(0x03)),
+            "UnknownIoOp");
+  EXPECT_EQ(nvme_abi::NvmeIoOpcodeToString(static_cast<NvmeOpcode>(0xFF)),
+            "UnknownIoOp");
+  // The same value is a different command in the admin set.
+  EXPECT_EQ(nvme_abi::NvmeAdminOpcodeToString(NvmeOpcode::kRead),
+            "GetLogPage");
+  EXPECT_EQ(nvme_abi::NvmeAdminOpcodeToString(NvmeOpcode::kGetLbaStatus),
+            "GetLbaStatus");
+  EXPECT_EQ(nvme_abi::NvmeAdminOpcodeToString(static_cast<NvmeOpcode>(0xC0)),
+            "UnknownAdminOp");
+}
+
+TEST(NvmeStrings, StatusCodeToString) {
+  using nvme_abi::StatusCodeType;
+  EXPECT_EQ(nvme_abi::NvmeStatusCodeToString(StatusCodeType::kGeneric,
+                                             StatusCode::kAbortedByRequest),
+            "GENERIC_STATUS_ABORTED_REQ");
+  EXPECT_EQ(nvme_abi::NvmeStatusCodeToString(StatusCodeType::kCommandSpecific,
+                                             StatusCode::kInvalidQueueSize),
+            "COMMAND_SPECIFIC_STATUS_MAX_QUEUE_SIZE_EXCEEDED");
+  EXPECT_EQ(nvme_abi::NvmeStatusCodeToString(StatusCodeType::kMediaError,
+                                             StatusCode::kUnrecoveredReadError),
+            "MEDIA_ERROR_STATUS_READ_ERROR");
+  EXPECT_EQ(nvme_abi::NvmeStatusCodeToString(StatusCodeType::kPathRelated,
+                                             StatusCode::kHostPathingError),
+            "PATH_RELATED_HOST_PATHING_ERROR");
+  EXPECT_EQ(nvme_abi::NvmeStatusCodeToString(StatusCodeType::kMediaError,
+                                             StatusCode::kSuccess),
+            "MEDIA_ERROR_STATUS_UNKNOWN");
+  EXPECT_EQ(nvme_abi::LogPageIdToString(nvme_abi::LogPageId::kSanitizeStatus),
+            "SanitizeStatus");
+  EXPECT_EQ(nvme_abi::LogPageIdToString(static_cast<nvme_abi::LogPageId>(0)),
+            "Unknown Log Page Id");
+}
+
+TEST(NvmeStrings, OpcodeFromStringRoundTrips) {
+  for (int value = 0; value <= 0xFF; ++value) {
+    auto opcode = static_cast<NvmeOpcode>(value);
+    std::string_view io = nvme_abi::NvmeIoOpcodeToString(opcode);
+    if (io != "UnknownIoOp") {
+      EXPECT_EQ(nvme_abi::NvmeIoOpcodeFromString(io), opcode) << io;
+    }
+    std::string_view admin = nvme_abi::NvmeAdminOpcodeToString(opcode);
+    if (admin != "UnknownAdminOp") {
+      EXPECT_EQ(nvme_abi::NvmeAdminOpcodeFromString(admin), opcode) << admin;
+    }
+  }
+}
+
+TEST(NvmeStrings, OpcodeFromString) {
+  EXPECT_EQ(nvme_abi::NvmeIoOpcodeFromString("read"), NvmeOpcode::kRead);
+  EXPECT_EQ(nvme_abi::NvmeIoOpcodeFromString("WRITEZEROS"),
+            NvmeOpcode::kWriteZeros);
+  EXPECT_EQ(nvme_abi::NvmeIoOpcodeFromString("Identify"), std::nullopt);
+  EXPECT_EQ(nvme_abi::NvmeIoOpcodeFromString("Rea"), std::nullopt);
+  EXPECT_EQ(nvme_abi::NvmeIoOpcodeFromString(""), std::nullopt);
+  EXPECT_EQ(nvme_abi::NvmeAdminOpcodeFromString("identify"),
+            NvmeOpcode::kIdentify);
+
+  EXPECT_EQ(nvme_abi::ParseNvmeOpcode("2", /*admin=*/false),
+            NvmeOpcode::kRead);
+  EXPECT_EQ(nvme_abi::ParseNvmeOpcode("flush", /*admin=*/false),
+            NvmeOpcode::kFlush);
+  EXPECT_EQ(nvme_abi::ParseNvmeOpcode("GetLogPage", /*admin=*/true),
+            NvmeOpcode::kGetLogPage);
+  EXPECT_EQ(nvme_abi::ParseNvmeOpcode("GetLogPage", /*admin=*/false),
+            std::nullopt);
+  EXPECT_EQ(nvme_abi::ParseNvmeOpcode("256", /*admin=*/false), std::nullopt);
+  EXPECT_EQ(nvme_abi::ParseNvmeOpcode("-1", /*admin=*/false), std::nullopt);
+  EXPECT_EQ(nvme_abi::ParseNvmeOpcode("2x", /*admin=*/false), std::nullopt);
+}
+
+}  // namespace
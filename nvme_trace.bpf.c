@@ -1,14 +1,18 @@
 // clang-format off
-#include "nvme_core_gen.h"
-typedef _Bool bool;
+#include "nvme_core.bpf.h"
 // clang-format on
 #include "nvme_trace.h"
 
+#include <bpf/bpf_core_read.h>
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_tracing.h>
 
 char LICENSE[] SEC("license") = "Dual BSD/GPL";
 
+// The context fields are relocated by the CO-RE definitions of
+// nvme_core.bpf.h, cid is read with BPF_CORE_READ_BITFIELD_PROBED because its
+// size differs between kernel versions.
+
 #define ALL_CTRL_ID 0xFFFFFFFF
 const volatile __u32 filter_ctrl_id = ALL_CTRL_ID;
 
@@ -19,9 +23,10 @@ struct {
 
 SEC("tp/nvme/nvme_setup_cmd")
 int handle_nvme_setup_cmd(struct trace_event_raw_nvme_setup_cmd* ctx) {
+  u16 cid = BPF_CORE_READ_BITFIELD_PROBED(ctx, cid);
 #ifdef VLOG
   bpf_printk("nvme_setup_cmd: PID %d, qid=%d, cid=%d, opcode=0x%x",
-             bpf_get_current_pid_tgid() >> 32, ctx->qid, ctx->cid, ctx->opcode);
+             bpf_get_current_pid_tgid() >> 32, ctx->qid, cid, ctx->opcode);
 #endif
   if (filter_ctrl_id != ALL_CTRL_ID && ctx->ctrl_id != (int)filter_ctrl_id) {
     return 0;
@@ -36,7 +41,7 @@ int handle_nvme_setup_cmd(struct trace_event_raw_nvme_setup_cmd* ctx) {
   e->qid = ctx->qid;
   e->opcode = ctx->opcode;
   e->flags = ctx->flags;
-  e->cid = ctx->cid;
+  e->cid = cid;
   e->nsid = ctx->nsid;
   e->metadata = ctx->metadata;
   e->fctype = ctx->fctype;
@@ -53,9 +58,10 @@ int handle_nvme_setup_cmd(struct trace_event_raw_nvme_setup_cmd* ctx) {
 
 SEC("tp/nvme/nvme_complete_rq")
 int handle_nvme_complete_rq(struct trace_event_raw_nvme_complete_rq* ctx) {
+  u16 cid = BPF_CORE_READ_BITFIELD_PROBED(ctx, cid);
 #ifdef VLOG
   bpf_printk("nvme_complete_rq: PID %d, disk=%s, qid=%d, cid=%d",
-             bpf_get_current_pid_tgid() >> 32, ctx->disk, ctx->qid, ctx->cid);
+             bpf_get_current_pid_tgid() >> 32, ctx->disk, ctx->qid, cid);
 #endif
   if (filter_ctrl_id != ALL_CTRL_ID && ctx->ctrl_id != (int)filter_ctrl_id) {
     return 0;
@@ -69,7 +75,7 @@ int handle_nvme_complete_rq(struct trace_event_raw_nvme_complete_rq* ctx) {
   bpf_probe_read_kernel_str(e->disk, sizeof(e->disk), ctx->disk);
   e->ctrl_id = ctx->ctrl_id;
   e->qid = ctx->qid;
-  e->cid = ctx->cid;
+  e->cid = cid;
   e->result = ctx->result;
   e->retries = ctx->retries;
   e->flags = ctx->flags;
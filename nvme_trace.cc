@@ -25,7 +25,9 @@
 #include "absl/strings/str_join.h"
 #include "absl/strings/strip.h"
 #include "absl/time/time.h"
+#include "event_loop.h"
 #include "nvme_strings.h"
+#include "nvme_view.h"
 #include "nvme_trace.skel.h"
 #include "nvme_trace_vlog_bpf.skel.h"
 
@@ -42,9 +44,6 @@ ABSL_FLAG(bool, bpf_trace, false,
           "kernel built with CONFIG_TRACING and CONFIG_BPF_EVENTS. To display "
           "the events cat /sys/kernel/debug/tracing/trace_pipe");
 
-static volatile bool exiting = false;
-static void sig_handler(int sig) { exiting = true; }
-
 static int libbpf_print_fn(enum libbpf_print_level level, const char* format,
                            va_list args) {
   if (absl::GetFlag(FLAGS_stderrthreshold) == 0 || ABSL_VLOG_IS_ON(1)) {
@@ -72,8 +71,14 @@ static int libbpf_print_fn(enum libbpf_print_level level, const char* format,
   //   return 0;
 }
 
+static_assert(sizeof(nvme_submit_trace_event::cdw10) ==
+              nvme_abi::CommandView::kCdwBytes);
+
 int HandleNvmeSubmitEvent(const nvme_submit_trace_event& se) {
   std::string_view disk(se.disk, strnlen(se.disk, sizeof(se.disk)));
+  nvme_abi::CommandView command(se.qid == 0,
+                                static_cast<nvme_abi::NvmeOpcode>(se.opcode),
+                                se.nsid, se.cdw10);
   if (se.qid == 0) {
     std::cout << std::dec << se.ts_ns << " " << disk << " Submit nvme"
               << std::dec << se.ctrl_id << ": qid=" << se.qid
@@ -83,8 +88,7 @@ int HandleNvmeSubmitEvent(const nvme_submit_trace_event& se) {
               << ", opcode=" << std::dec << static_cast<int>(se.opcode) << " ("
               << nvme_abi::NvmeAdminOpcodeToString(
                      static_cast<nvme_abi::NvmeOpcode>(se.opcode))
-              << ")"
-              << ", cdw10=0x"
+              << ")" << command << ", cdw10=0x"
               << absl::BytesToHexString(std::string_view(
                      reinterpret_cast<const char*>(se.cdw10), sizeof(se.cdw10)))
               << std::endl;
@@ -97,10 +101,13 @@ int HandleNvmeSubmitEvent(const nvme_submit_trace_event& se) {
               << ", opcode=" << std::dec << static_cast<int>(se.opcode) << " ("
               << nvme_abi::NvmeIoOpcodeToString(
                      static_cast<nvme_abi::NvmeOpcode>(se.opcode))
-              << ")" << std::endl;
-    // TODO(mogo): cdw10 seems to be populated with garbage.
-    // << ", cdw10=0x" << absl::BytesToHexString(std::string_view(
-    //        reinterpret_cast<const char*>(se.cdw10), sizeof(se.cdw10)))
+              << ")";
+    // TODO(mogo): cdw10 seems to be populated with garbage, the decoded
+    // fields are only printed with --v=1 until that's understood.
+    if (ABSL_VLOG_IS_ON(1)) {
+      std::cout << command;
+    }
+    std::cout << std::endl;
   }
   return 0;
 }
@@ -112,7 +119,8 @@ int HandleNvmeCompleteEvent(const nvme_complete_trace_event& ce) {
             << ", cid=" << ce.cid << ", res=0x" << std::hex << ce.result
             << ", retries=" << std::dec << static_cast<int>(ce.retries)
             << ", flags=0x" << std::hex << static_cast<int>(ce.flags)
-            << ", status=0x" << std::hex << ce.status << std::endl;
+            << ", status=0x" << std::hex << ce.status << " ("
+            << nvme_abi::StatusFromTrace(ce.status) << ")" << std::endl;
   return 0;
 }
 
@@ -152,8 +160,19 @@ absl::Status RunMain() {
 
   libbpf_set_print(libbpf_print_fn);
 
-  signal(SIGINT, sig_handler);
-  signal(SIGTERM, sig_handler);
+  // SIGINT and SIGTERM are blocked from here on and stop the loop.
+  auto loop = nvme_bpf::EventLoop::Create();
+  if (!loop.ok()) {
+    return loop.status();
+  }
+  auto signal_status =
+      (*loop)->AddSignals({SIGINT, SIGTERM}, [&loop](int sig) {
+        (*loop)->Stop();
+        return absl::OkStatus();
+      });
+  if (!signal_status.ok()) {
+    return signal_status;
+  }
 
   LIBBPF_OPTS(bpf_object_open_opts, open_opts, .kernel_log_level = 2, );
   skel = TSkel::open(&open_opts);
@@ -223,20 +242,19 @@ absl::Status RunMain() {
 
   std::cout << "Successfully started!" << std::endl;
 
-  while (!exiting) {
-    err = ring_buffer__poll(nvme_trace_events, /*timeout_ms=*/100);
-    /* Ctrl-C will cause -EINTR */
-    if (err == -EINTR) {
-      err = 0;
-      break;
-    }
-    if (err < 0) {
-      std::cout << "Error polling perf buffer: " << err << std::endl;
-      break;
-    }
+  auto add_status =
+      (*loop)->AddFd(ring_buffer__epoll_fd(nvme_trace_events), [&]() {
+        int n = ring_buffer__consume(nvme_trace_events);
+        if (n < 0) {
+          return absl::InternalError(
+              absl::StrCat("Error consuming the ring buffer, err=", n));
+        }
+        return absl::OkStatus();
+      });
+  if (!add_status.ok()) {
+    return add_status;
   }
-
-  return absl::OkStatus();
+  return (*loop)->Run();
 }
 
 int main(int argc, char** argv) {
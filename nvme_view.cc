@@ -0,0 +1,165 @@
+#include "nvme_view.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+
+#include "nvme_abi.h"
+#include "nvme_strings.h"
+
+namespace nvme_abi {
+
+ReadWriteCommand CommandView::DecodeReadWrite() const {
+  ReadWriteCdw12 cdw12 = Dword<ReadWriteCdw12>(12);
+  return {
+      .starting_lba = cdw(10) | static_cast<uint64_t>(cdw(11)) << 32,
+      .number_of_blocks = cdw12.number_of_logical_blocks + 1u,
+      .force_unit_access = cdw12.force_unit_access,
+      .limited_retry = cdw12.limited_retry,
+      .protection_information = cdw12.protection_information_field,
+  };
+}
+
+std::optional<ReadWriteCommand> CommandView::AsRead() const {
+  if (!IsIo(NvmeOpcode::kRead)) {
+    return std::nullopt;
+  }
+  return DecodeReadWrite();
+}
+
+std::optional<ReadWriteCommand> CommandView::AsWrite() const {
+  if (!IsIo(NvmeOpcode::kWrite)) {
+    return std::nullopt;
+  }
+  return DecodeReadWrite();
+}
+
+std::optional<ReadWriteCommand> CommandView::AsReadWrite() const {
+  if (admin_) {
+    return std::nullopt;
+  }
+  switch (opcode_) {
+    case NvmeOpcode::kRead:
+    case NvmeOpcode::kWrite:
+    case NvmeOpcode::kCompare:
+    case NvmeOpcode::kWriteZeros:
+    case NvmeOpcode::kVerify:
+      return DecodeReadWrite();
+    default:
+      return std::nullopt;
+  }
+}
+
+std::optional<DatasetMgmtCommand> CommandView::AsDsm() const {
+  if (!IsIo(NvmeOpcode::kDatasetMgmt)) {
+    return std::nullopt;
+  }
+  DatasetMgmtDw10 dw10 = Dword<DatasetMgmtDw10>(10);
+  DatasetMgmtDw11 dw11 = Dword<DatasetMgmtDw11>(11);
+  return DatasetMgmtCommand{
+      .number_of_ranges = dw10.zb_number_of_ranges + 1u,
+      .deallocate = dw11.deallocate,
+      .integral_read = dw11.opt_read,
+      .integral_write = dw11.opt_write,
+  };
+}
+
+std::optional<GetLogPageCommand> CommandView::AsGetLogPage() const {
+  if (!IsAdmin(NvmeOpcode::kGetLogPage)) {
+    return std::nullopt;
+  }
+  GetLogPageSqeCdw10 dw10 = Dword<GetLogPageSqeCdw10>(10);
+  GetLogPageSqeCdw11 dw11 = Dword<GetLogPageSqeCdw11>(11);
+  GetLogPageSqeCdw14 dw14 = Dword<GetLogPageSqeCdw14>(14);
+  return GetLogPageCommand{
+      .log_page_id = dw10.log_page_id,
+      .log_specific_field = dw10.log_specific_field,
+      .retain_async_event = dw10.retain_async_evt,
+      .number_of_dwords =
+          (dw10.num_dwords_lower | static_cast<uint32_t>(dw11.num_dwords_upper)
+                                       << 16) +
+          1,
+      .offset_bytes = cdw(12) | static_cast<uint64_t>(cdw(13)) << 32,
+      .endurance_group_or_set_id = dw11.endurance_group_or_set_id,
+      .uuid_index = dw14.uuid_index,
+  };
+}
+
+std::optional<IdentifyDw10> CommandView::AsIdentify() const {
+  if (!IsAdmin(NvmeOpcode::kIdentify)) {
+    return std::nullopt;
+  }
+  return Dword<IdentifyDw10>(10);
+}
+
+std::optional<FeatureType> CommandView::AsFeatures() const {
+  if (!IsAdmin(NvmeOpcode::kGetFeatures) &&
+      !IsAdmin(NvmeOpcode::kSetFeatures)) {
+    return std::nullopt;
+  }
+  // The feature identifier is the low byte of cdw10 for both.
+  return static_cast<FeatureType>(cdw(10) & 0xFF);
+}
+
+std::ostream& operator<<(std::ostream& os, const CommandView& command) {
+  if (auto rw = command.AsReadWrite()) {
+    os << " slba=" << rw->starting_lba << " nlb=" << rw->number_of_blocks;
+    if (rw->force_unit_access) {
+      os << " fua";
+    }
+    return os;
+  }
+  if (auto dsm = command.AsDsm()) {
+    os << " ranges=" << dsm->number_of_ranges;
+    if (dsm->deallocate) {
+      os << " deallocate";
+    }
+    return os;
+  }
+  if (auto log = command.AsGetLogPage()) {
+    return os << " lid=" << LogPageIdToString(log->log_page_id)
+              << " numd=" << log->number_of_dwords
+              << " offset=" << log->offset_bytes;
+  }
+  if (auto identify = command.AsIdentify()) {
+    return os << " cns=" << NvmeIdentifyTypeToString(identify->c_or_n_structure)
+              << " cntid=" << identify->controller_id;
+  }
+  if (auto fid = command.AsFeatures()) {
+    return os << " fid=" << FeatureIdentifierToString(*fid);
+  }
+  return os;
+}
+
+void VisitSqes(bool admin, const void* sqes, size_t count,
+               CommandVisitor* visitor) {
+  const auto* bytes = static_cast<const uint8_t*>(sqes);
+  for (size_t i = 0; i < count; ++i) {
+    CommandView command =
+        CommandView::OfSqe(admin, bytes + i * kSubmissionQueueEntrySizeBytes);
+    if (admin) {
+      if (auto log = command.AsGetLogPage()) {
+        visitor->GetLogPage(command, *log);
+      } else {
+        visitor->Other(command);
+      }
+      continue;
+    }
+    switch (command.opcode()) {
+      case NvmeOpcode::kRead:
+        visitor->Read(command, *command.AsRead());
+        break;
+      case NvmeOpcode::kWrite:
+        visitor->Write(command, *command.AsWrite());
+        break;
+      case NvmeOpcode::kDatasetMgmt:
+        visitor->Dsm(command, *command.AsDsm());
+        break;
+      default:
+        visitor->Other(command);
+    }
+  }
+}
+
+}  // namespace nvme_abi
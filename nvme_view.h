@@ -0,0 +1,179 @@
+#ifndef NVME_VIEW_H_
+#define NVME_VIEW_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <ostream>
+
+#include "nvme_abi.h"
+
+namespace nvme_abi {
+
+// Views over the raw bytes of NVMe commands and completions, e.g. from the
+// trace records or a capture file. A view keeps a pointer to the bytes and
+// decodes the fields on access with the nvme_abi.h structs, the bytes must
+// outlive it. The accessors load through memcpy, the bytes need no alignment.
+
+// The fields of a Read, Write, Compare, WriteZeros or Verify command.
+struct ReadWriteCommand {
+  uint64_t starting_lba;      // SLBA
+  uint32_t number_of_blocks;  // NLB + 1
+  bool force_unit_access;
+  bool limited_retry;
+  uint8_t protection_information;
+};
+
+// The fields of a Dataset Management command, the ranges are in the data.
+struct DatasetMgmtCommand {
+  uint32_t number_of_ranges;  // NR + 1
+  bool deallocate;
+  bool integral_read;
+  bool integral_write;
+};
+
+// The fields of a Get Log Page command.
+struct GetLogPageCommand {
+  LogPageId log_page_id;
+  uint8_t log_specific_field;
+  bool retain_async_event;
+  uint32_t number_of_dwords;  // NUMD + 1
+  uint64_t offset_bytes;      // LPO
+  uint16_t endurance_group_or_set_id;
+  uint8_t uuid_index;
+};
+
+// A command from its opcode, namespace and command dwords 10 to 15, the
+// fields the nvme_setup_cmd tracepoint records.
+class CommandView {
+ public:
+  // The bytes of command dwords 10 to 15.
+  static constexpr size_t kCdwBytes = 6 * sizeof(uint32_t);
+
+  // `cdws` points to kCdwBytes bytes, cdw10 first.
+  CommandView(bool admin, NvmeOpcode opcode, uint32_t nsid, const void* cdws)
+      : admin_(admin), opcode_(opcode), nsid_(nsid),
+        cdws_(static_cast<const uint8_t*>(cdws)) {}
+
+  // A whole kSubmissionQueueEntrySizeBytes entry.
+  static CommandView OfSqe(bool admin, const void* sqe) {
+    const auto* bytes = static_cast<const uint8_t*>(sqe);
+    uint32_t nsid;
+    std::memcpy(&nsid,
+                bytes + offsetof(SubmissionQueueEntry, namespace_identifier),
+                sizeof(nsid));
+    return CommandView(admin, static_cast<NvmeOpcode>(bytes[0]), nsid,
+                       bytes + offsetof(SubmissionQueueEntry, cdw10));
+  }
+
+  bool admin() const { return admin_; }
+  NvmeOpcode opcode() const { return opcode_; }
+  uint32_t nsid() const { return nsid_; }
+
+  // Command dword `i`, 10 to 15.
+  uint32_t cdw(int i) const { return Dword<uint32_t>(i); }
+
+  // The decoded fields if the command is of that kind, nullopt otherwise.
+  // AsReadWrite() matches all the commands with a ReadWriteCommand layout.
+  std::optional<ReadWriteCommand> AsRead() const;
+  std::optional<ReadWriteCommand> AsWrite() const;
+  std::optional<ReadWriteCommand> AsReadWrite() const;
+  std::optional<DatasetMgmtCommand> AsDsm() const;
+  std::optional<GetLogPageCommand> AsGetLogPage() const;
+  std::optional<IdentifyDw10> AsIdentify() const;
+  std::optional<FeatureType> AsFeatures() const;
+
+ private:
+  bool IsIo(NvmeOpcode opcode) const { return !admin_ && opcode_ == opcode; }
+  bool IsAdmin(NvmeOpcode opcode) const { return admin_ && opcode_ == opcode; }
+
+  template <typename T>
+  T Dword(int i) const {
+    static_assert(sizeof(T) == sizeof(uint32_t));
+    T value;
+    std::memcpy(&value, cdws_ + (i - 10) * sizeof(uint32_t), sizeof(value));
+    return value;
+  }
+
+  ReadWriteCommand DecodeReadWrite() const;
+
+  bool admin_;
+  NvmeOpcode opcode_;
+  uint32_t nsid_;
+  const uint8_t* cdws_;
+};
+
+// A kCompletionQueueEntrySizeBytes completion queue entry.
+class CompletionView {
+ public:
+  explicit CompletionView(const void* cqe)
+      : cqe_(static_cast<const uint8_t*>(cqe)) {}
+
+  uint32_t dw0() const { return Field<uint32_t>(0); }
+  uint16_t sq_head() const {
+    return Field<uint16_t>(
+        offsetof(CompletionQueueEntry, submission_head_pointer));
+  }
+  uint16_t sq_id() const {
+    return Field<uint16_t>(offsetof(CompletionQueueEntry,
+                                    submission_identifier));
+  }
+  uint16_t command_id() const {
+    return Field<uint16_t>(offsetof(CompletionQueueEntry, command_identifier));
+  }
+  StatusStructure status() const {
+    return Field<StatusStructure>(
+        offsetof(CompletionQueueEntry, status_field));
+  }
+
+ private:
+  template <typename T>
+  T Field(size_t offset) const {
+    T value;
+    std::memcpy(&value, cqe_ + offset, sizeof(value));
+    return value;
+  }
+
+  const uint8_t* cqe_;
+};
+
+// The status of the nvme_complete_rq tracepoint, the status field of the
+// completion without the phase tag.
+inline StatusStructure StatusFromTrace(uint16_t status) {
+  uint16_t field = status << 1;
+  StatusStructure result;
+  std::memcpy(&result, &field, sizeof(result));
+  return result;
+}
+
+// Prints the decoded fields of the known commands, e.g. " slba=8 nlb=16 fua",
+// and nothing for the others.
+std::ostream& operator<<(std::ostream& os, const CommandView& command);
+
+// Receives the commands of a batch by kind. The default implementations
+// ignore the command.
+class CommandVisitor {
+ public:
+  virtual ~CommandVisitor() = default;
+
+  virtual void Read(const CommandView& command, const ReadWriteCommand& rw) {}
+  virtual void Write(const CommandView& command, const ReadWriteCommand& rw) {
+  }
+  virtual void Dsm(const CommandView& command,
+                   const DatasetMgmtCommand& dsm) {}
+  virtual void GetLogPage(const CommandView& command,
+                          const GetLogPageCommand& get_log_page) {}
+  // Everything else.
+  virtual void Other(const CommandView& command) {}
+};
+
+// Decodes `count` submission queue entries stored back to back, e.g. a capture
+// file or a queue snapshot, and passes each to `visitor`. The opcode picks the
+// call, only the kinds with a typed call have their dwords decoded.
+void VisitSqes(bool admin, const void* sqes, size_t count,
+               CommandVisitor* visitor);
+
+}  // namespace nvme_abi
+
+#endif  // NVME_VIEW_H_
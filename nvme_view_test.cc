@@ -0,0 +1,160 @@
+#include "nvme_view.h"
+
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "nvme_abi.h"
+
+namespace {
+
+using nvme_abi::CommandView;
+using nvme_abi::NvmeOpcode;
+using nvme_abi::SubmissionQueueEntry;
+
+SubmissionQueueEntry Sqe(NvmeOpcode opcode, uint32_t nsid) {
+  SubmissionQueueEntry sqe = {};
+  sqe.cdw0.opcode = opcode;
+  sqe.namespace_identifier = nsid;
+  return sqe;
+}
+
+SubmissionQueueEntry ReadSqe(uint64_t slba, uint16_t zb_blocks) {
+  SubmissionQueueEntry sqe = Sqe(NvmeOpcode::kRead, 1);
+  sqe.cdw10 = slba;
+  sqe.cdw11 = slba >> 32;
+  nvme_abi::ReadWriteCdw12 cdw12 = {};
+  cdw12.number_of_logical_blocks = zb_blocks;
+  cdw12.force_unit_access = true;
+  std::memcpy(&sqe.cdw12, &cdw12, sizeof(cdw12));
+  return sqe;
+}
+
+TEST(CommandView, ReadWrite) {
+  SubmissionQueueEntry sqe = ReadSqe(0x123456789, 7);
+  CommandView command = CommandView::OfSqe(/*admin=*/false, &sqe);
+  EXPECT_EQ(command.opcode(), NvmeOpcode::kRead);
+  EXPECT_EQ(command.nsid(), 1);
+  auto read = command.AsRead();
+  ASSERT_TRUE(read.has_value());
+  EXPECT_EQ(read->starting_lba, 0x123456789);
+  EXPECT_EQ(read->number_of_blocks, 8);
+  EXPECT_TRUE(read->force_unit_access);
+  EXPECT_FALSE(read->limited_retry);
+  EXPECT_FALSE(command.AsWrite().has_value());
+  EXPECT_FALSE(command.AsDsm().has_value());
+  EXPECT_TRUE(command.AsReadWrite().has_value());
+  // The same opcode is a Get Log Page in the admin set.
+  EXPECT_FALSE(CommandView::OfSqe(/*admin=*/true, &sqe).AsRead().has_value());
+
+  std::ostringstream os;
+  os << command;
+  EXPECT_EQ(os.str(), " slba=4886718345 nlb=8 fua");
+}
+
+TEST(CommandView, Dsm) {
+  SubmissionQueueEntry sqe = Sqe(NvmeOpcode::kDatasetMgmt, 1);
+  sqe.cdw10 = 3;       // 4 ranges
+  sqe.cdw11 = 1 << 2;  // AD
+  auto dsm = CommandView::OfSqe(/*admin=*/false, &sqe).AsDsm();
+  ASSERT_TRUE(dsm.has_value());
+  EXPECT_EQ(dsm->number_of_ranges, 4);
+  EXPECT_TRUE(dsm->deallocate);
+  EXPECT_FALSE(dsm->integral_read);
+}
+
+TEST(CommandView, GetLogPageFromTraceDwords) {
+  // cdw10 to cdw15 as the nvme_setup_cmd tracepoint records them, at an odd
+  // offset to check the unaligned loads.
+  uint8_t record[1 + CommandView::kCdwBytes] = {};
+  uint32_t cdws[6] = {
+      // NUMDL 0x7f, RAE, LID SMART.
+      0x007f8002,
+      // NUMDU 1.
+      0x00000001,
+      // LPOL, LPOU.
+      0x200,
+      0x1,
+      // UUID index.
+      0x5,
+      0,
+  };
+  std::memcpy(record + 1, cdws, sizeof(cdws));
+  CommandView command(/*admin=*/true, NvmeOpcode::kGetLogPage, 0xFFFFFFFF,
+                      record + 1);
+  auto log = command.AsGetLogPage();
+  ASSERT_TRUE(log.has_value());
+  EXPECT_EQ(log->log_page_id, nvme_abi::LogPageId::kSmartHealthInfo);
+  EXPECT_TRUE(log->retain_async_event);
+  EXPECT_EQ(log->number_of_dwords, 0x10080);
+  EXPECT_EQ(log->offset_bytes, 0x100000200);
+  EXPECT_EQ(log->uuid_index, 5);
+  EXPECT_FALSE(command.AsIdentify().has_value());
+  EXPECT_EQ(command.cdw(15), 0);
+}
+
+TEST(CompletionView, Fields) {
+  nvme_abi::CompletionQueueEntry cqe = {};
+  cqe.cdw0 = 42;
+  cqe.submission_head_pointer = 7;
+  cqe.submission_identifier = 3;
+  cqe.command_identifier = 0x1234;
+  cqe.status_field.status_code = nvme_abi::StatusCode::kUnrecoveredReadError;
+  cqe.status_field.status_code_type = nvme_abi::StatusCodeType::kMediaError;
+  cqe.status_field.do_not_retry = true;
+  nvme_abi::CompletionView view(&cqe);
+  EXPECT_EQ(view.dw0(), 42);
+  EXPECT_EQ(view.sq_head(), 7);
+  EXPECT_EQ(view.sq_id(), 3);
+  EXPECT_EQ(view.command_id(), 0x1234);
+  EXPECT_EQ(view.status(), cqe.status_field);
+  EXPECT_FALSE(view.status().ok());
+
+  // The tracepoint status drops the phase tag.
+  uint16_t field;
+  std::memcpy(&field, &cqe.status_field, sizeof(field));
+  EXPECT_EQ(nvme_abi::StatusFromTrace(field >> 1), cqe.status_field);
+}
+
+class CountingVisitor : public nvme_abi::CommandVisitor {
+ public:
+  void Read(const CommandView& command,
+            const nvme_abi::ReadWriteCommand& rw) override {
+    read_blocks += rw.number_of_blocks;
+  }
+  void Dsm(const CommandView& command,
+           const nvme_abi::DatasetMgmtCommand& dsm) override {
+    ++dsms;
+  }
+  void Other(const CommandView& command) override { ++others; }
+
+  uint64_t read_blocks = 0;
+  int dsms = 0;
+  int others = 0;
+};
+
+TEST(VisitSqes, DispatchesByOpcode) {
+  std::vector<SubmissionQueueEntry> sqes = {
+      ReadSqe(0, 7),
+      Sqe(NvmeOpcode::kDatasetMgmt, 1),
+      ReadSqe(100, 0),
+      Sqe(NvmeOpcode::kFlush, 1),
+      // Write isn't overridden, the default drops it.
+      Sqe(NvmeOpcode::kWrite, 1),
+  };
+  CountingVisitor visitor;
+  nvme_abi::VisitSqes(/*admin=*/false, sqes.data(), sqes.size(), &visitor);
+  EXPECT_EQ(visitor.read_blocks, 9);
+  EXPECT_EQ(visitor.dsms, 1);
+  EXPECT_EQ(visitor.others, 1);
+
+  CountingVisitor admin;
+  nvme_abi::VisitSqes(/*admin=*/true, sqes.data(), sqes.size(), &admin);
+  EXPECT_EQ(admin.read_blocks, 0);
+  // The reads are Get Log Page commands here.
+  EXPECT_EQ(admin.others, 3);
+}
+
+}  // namespace
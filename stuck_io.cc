@@ -0,0 +1,111 @@
+#include "stuck_io.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include "absl/strings/str_cat.h"
+#include "nvme_abi.h"
+#include "nvme_strings.h"
+
+namespace nvme_bpf {
+
+StuckIoDetector::StuckIoDetector(uint64_t threshold_ns,
+                                 const Histogram& layout)
+    : threshold_ns_(threshold_ns),
+      pending_ages_(layout.lat_min_us, layout.lat_shift),
+      ages_(pending_ages_) {}
+
+void StuckIoDetector::Add(const InFlightIo& io, uint64_t now_ns) {
+  // The entry may have been created after `now_ns` was taken.
+  uint64_t age_ns = now_ns > io.start_ns ? now_ns - io.start_ns : 0;
+  pending_ages_.Record(age_ns / 1000);
+  if (age_ns >= threshold_ns_) {
+    pending_stuck_.push_back({io, age_ns});
+  }
+}
+
+void StuckIoDetector::EndSweep() {
+  std::sort(pending_stuck_.begin(), pending_stuck_.end(),
+            [](const StuckIo& a, const StuckIo& b) {
+              return a.age_ns > b.age_ns;
+            });
+  stuck_ = std::move(pending_stuck_);
+  pending_stuck_.clear();
+  ages_ = pending_ages_;
+  pending_ages_.Clear();
+  ++sweeps_;
+}
+
+std::vector<QueueStall> StuckIoDetector::UpdateQueues(
+    const std::map<std::pair<int, int>, queue_progress>& queues,
+    uint64_t now_ns) {
+  // The stuck commands and the oldest one per queue.
+  std::map<std::pair<int, int>, std::pair<uint64_t, uint64_t>> stuck_queues;
+  for (const StuckIo& stuck : stuck_) {
+    auto& [count, oldest_ns] = stuck_queues[{stuck.io.ctrl_id, stuck.io.qid}];
+    ++count;
+    oldest_ns = std::max(oldest_ns, stuck.age_ns);
+  }
+
+  std::vector<QueueStall> stalls;
+  std::set<std::pair<int, int>> stalled;
+  for (const auto& [queue, stuck] : stuck_queues) {
+    QueueStall stall;
+    stall.ctrl_id = queue.first;
+    stall.qid = queue.second;
+    stall.stuck_commands = stuck.first;
+    stall.stalled_ns = stuck.second;
+    auto it = queues.find(queue);
+    if (it != queues.end()) {
+      stall.completions = it->second.completions;
+      if (it->second.last_complete_ns != 0) {
+        stall.stalled_ns = now_ns > it->second.last_complete_ns
+                               ? now_ns - it->second.last_complete_ns
+                               : 0;
+      }
+    }
+    if (stall.stalled_ns < threshold_ns_) {
+      // The queue is still completing other commands.
+      continue;
+    }
+    stall.new_stall = !stalled_.contains(queue);
+    stalled.insert(queue);
+    stalls.push_back(stall);
+  }
+  stalled_ = std::move(stalled);
+  return stalls;
+}
+
+void PrintStuckIos(const StuckIoDetector& detector, int max_rows) {
+  const auto& stuck = detector.stuck();
+  std::cout << "Stuck IOs: " << stuck.size() << std::endl;
+  if (!stuck.empty()) {
+    std::cout << std::left << std::setw(8) << "ctrl" << std::setw(6) << "qid"
+              << std::setw(8) << "cid" << std::setw(14) << "opcode"
+              << std::setw(12) << "age_ms" << std::setw(10) << "pid"
+              << "comm" << std::endl;
+  }
+  int rows = 0;
+  for (const StuckIo& s : stuck) {
+    if (rows++ == max_rows) {
+      std::cout << "... " << stuck.size() - max_rows << " more" << std::endl;
+      break;
+    }
+    auto opcode = static_cast<nvme_abi::NvmeOpcode>(s.io.opcode);
+    std::cout << std::left << std::setw(8)
+              << absl::StrCat("nvme", s.io.ctrl_id) << std::setw(6) << s.io.qid
+              << std::setw(8) << s.io.cid << std::setw(14)
+              << nvme_abi::NvmeIoOpcodeToString(opcode) << std::setw(12)
+              << s.age_ns / 1000000 << std::setw(10) << s.io.tgid << s.io.comm
+              << std::endl;
+  }
+  const auto& ages = detector.age_histogram();
+  if (ages.total_count() != 0) {
+    std::cout << "Age of the " << ages.total_count() << " outstanding IOs:"
+              << std::endl;
+    PrintHistogram(ages.view()).IgnoreError();
+  }
+}
+
+}  // namespace nvme_bpf
@@ -0,0 +1,97 @@
+#ifndef STUCK_IO_H_
+#define STUCK_IO_H_
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "histogram.h"
+#include "nvme_latency.h"
+
+namespace nvme_bpf {
+
+// An IO command found in the in-flight map.
+struct InFlightIo {
+  int ctrl_id = 0;
+  int qid = 0;
+  uint16_t cid = 0;
+  uint8_t opcode = 0;
+  uint32_t tgid = 0;
+  std::string comm;
+  // CLOCK_MONOTONIC, same clock as bpf_ktime_get_ns().
+  uint64_t start_ns = 0;
+};
+
+struct StuckIo {
+  InFlightIo io;
+  uint64_t age_ns = 0;
+};
+
+// A queue with commands older than the threshold and no completion for as
+// long.
+struct QueueStall {
+  int ctrl_id = 0;
+  int qid = 0;
+  uint64_t completions = 0;
+  // Since the last completion, or since the oldest command if the queue never
+  // completed anything.
+  uint64_t stalled_ns = 0;
+  uint64_t stuck_commands = 0;
+  // Set on the first report of the stall.
+  bool new_stall = false;
+};
+
+// Finds the IOs that have been in flight for longer than a threshold. The
+// in-flight map is scanned incrementally, a bounded batch per reporting
+// interval, so that the cost of an interval doesn't grow with the map size.
+// The results are published when a sweep over the whole map completes.
+class StuckIoDetector {
+ public:
+  // The age histogram uses the layout of `layout`, in microseconds.
+  StuckIoDetector(uint64_t threshold_ns, const Histogram& layout);
+
+  // Adds an entry of the current sweep.
+  void Add(const InFlightIo& io, uint64_t now_ns);
+
+  // Completes the current sweep: the stuck IOs and the age histogram of the
+  // outstanding IOs now reflect it, and the next Add() starts a new sweep.
+  void EndSweep();
+
+  // Updates the per-queue completion progress, as {ctrl_id, qid} -> progress,
+  // and returns the queues of the last sweep that have stuck commands but
+  // completed nothing for at least the threshold.
+  std::vector<QueueStall> UpdateQueues(
+      const std::map<std::pair<int, int>, queue_progress>& queues,
+      uint64_t now_ns);
+
+  // The stuck IOs of the last complete sweep, oldest first.
+  const std::vector<StuckIo>& stuck() const { return stuck_; }
+  // The age histogram of all the outstanding IOs of the last complete sweep.
+  const OwnedHistogram<LATENCY_MAX_SLOTS>& age_histogram() const {
+    return ages_;
+  }
+  uint64_t sweeps() const { return sweeps_; }
+
+ private:
+  uint64_t threshold_ns_;
+
+  std::vector<StuckIo> pending_stuck_;
+  OwnedHistogram<LATENCY_MAX_SLOTS> pending_ages_;
+
+  std::vector<StuckIo> stuck_;
+  OwnedHistogram<LATENCY_MAX_SLOTS> ages_;
+  uint64_t sweeps_ = 0;
+
+  // The queues currently reported as stalled.
+  std::set<std::pair<int, int>> stalled_;
+};
+
+// Prints the first `max_rows` stuck IOs of `detector` and its age histogram.
+void PrintStuckIos(const StuckIoDetector& detector, int max_rows);
+
+}  // namespace nvme_bpf
+
+#endif /* STUCK_IO_H_ */
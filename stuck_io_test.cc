@@ -0,0 +1,109 @@
+#include "stuck_io.h"
+
+#include <map>
+#include <utility>
+
+#include "gtest/gtest.h"
+
+/*
+bazel test --test_output=streamed :stuck_io_test
+ */
+
+namespace {
+
+using nvme_bpf::InFlightIo;
+using nvme_bpf::StuckIoDetector;
+
+constexpr uint64_t kMs = 1000000;
+
+nvme_bpf::Histogram Layout() {
+  nvme_bpf::Histogram layout;
+  layout.lat_min_us = 20;
+  layout.lat_shift = 0;
+  layout.max_slots = LATENCY_MAX_SLOTS;
+  return layout;
+}
+
+InFlightIo Io(int ctrl_id, int qid, uint16_t cid, uint64_t start_ns) {
+  InFlightIo io;
+  io.ctrl_id = ctrl_id;
+  io.qid = qid;
+  io.cid = cid;
+  io.opcode = 2;
+  io.tgid = 1234;
+  io.comm = "fio";
+  io.start_ns = start_ns;
+  return io;
+}
+
+TEST(StuckIoDetector, ReportsOldIosAfterTheSweep) {
+  StuckIoDetector detector(1000 * kMs, Layout());
+  uint64_t now = 10000 * kMs;
+  // The sweep spans two batches.
+  detector.Add(Io(0, 1, 5, now - 1 * kMs), now);
+  detector.Add(Io(0, 1, 6, now - 1500 * kMs), now);
+  EXPECT_TRUE(detector.stuck().empty());
+  now += 1000 * kMs;
+  detector.Add(Io(1, 3, 7, now - 5000 * kMs), now);
+  // Created after `now` was taken.
+  detector.Add(Io(1, 3, 8, now + 1), now);
+  detector.EndSweep();
+
+  ASSERT_EQ(detector.stuck().size(), 2);
+  EXPECT_EQ(detector.stuck()[0].io.cid, 7);
+  EXPECT_EQ(detector.stuck()[0].age_ns, 5000 * kMs);
+  EXPECT_EQ(detector.stuck()[1].io.cid, 6);
+  EXPECT_EQ(detector.sweeps(), 1);
+
+  const auto& ages = detector.age_histogram();
+  EXPECT_EQ(ages.total_count(), 4);
+  // 1ms, 1.5s and 5s are in buckets, the new entry is below the minimum.
+  EXPECT_EQ(ages.slot(LATENCY_MAX_SLOTS), 1);
+  EXPECT_EQ(ages.percentile(1.0), 20 + (1 << 23));
+
+  // The next sweep starts from scratch.
+  detector.Add(Io(0, 1, 5, now), now);
+  detector.EndSweep();
+  EXPECT_TRUE(detector.stuck().empty());
+  EXPECT_EQ(detector.age_histogram().total_count(), 1);
+}
+
+TEST(StuckIoDetector, QueueStalls) {
+  StuckIoDetector detector(1000 * kMs, Layout());
+  uint64_t now = 100000 * kMs;
+  detector.Add(Io(0, 1, 5, now - 3000 * kMs), now);
+  detector.Add(Io(0, 2, 6, now - 3000 * kMs), now);
+  detector.Add(Io(0, 3, 7, now - 3000 * kMs), now);
+  detector.EndSweep();
+
+  std::map<std::pair<int, int>, queue_progress> queues;
+  // Queue 1 is completing other commands, queue 2 stopped 2s ago and queue 3
+  // never completed anything.
+  queues[{0, 1}] = {100, now - 10 * kMs};
+  queues[{0, 2}] = {50, now - 2000 * kMs};
+  auto stalls = detector.UpdateQueues(queues, now);
+  ASSERT_EQ(stalls.size(), 2);
+  EXPECT_EQ(stalls[0].qid, 2);
+  EXPECT_EQ(stalls[0].completions, 50);
+  EXPECT_EQ(stalls[0].stalled_ns, 2000 * kMs);
+  EXPECT_EQ(stalls[0].stuck_commands, 1);
+  EXPECT_TRUE(stalls[0].new_stall);
+  EXPECT_EQ(stalls[1].qid, 3);
+  EXPECT_EQ(stalls[1].stalled_ns, 3000 * kMs);
+  EXPECT_TRUE(stalls[1].new_stall);
+
+  // Still stalled, no longer new.
+  queues[{0, 1}] = {110, now + 990 * kMs};
+  stalls = detector.UpdateQueues(queues, now + 1000 * kMs);
+  ASSERT_EQ(stalls.size(), 2);
+  EXPECT_FALSE(stalls[0].new_stall);
+
+  // Queue 2 made progress.
+  queues[{0, 1}] = {120, now + 1990 * kMs};
+  queues[{0, 2}] = {51, now + 1500 * kMs};
+  stalls = detector.UpdateQueues(queues, now + 2000 * kMs);
+  ASSERT_EQ(stalls.size(), 1);
+  EXPECT_EQ(stalls[0].qid, 3);
+}
+
+}  // namespace
@@ -0,0 +1,46 @@
+#ifndef VARINT_H_
+#define VARINT_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace nvme_bpf {
+
+// LEB128 varints, 7 bits per byte with the high bit set on all but the last.
+inline void PutVarint(uint64_t v, std::string* out) {
+  while (v >= 0x80) {
+    out->push_back(static_cast<char>(v | 0x80));
+    v >>= 7;
+  }
+  out->push_back(static_cast<char>(v));
+}
+
+// Consumes a varint from the front of `in`. Returns false if `in` ends before
+// the varint does.
+inline bool GetVarint(std::string_view* in, uint64_t* v) {
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64 && !in->empty(); shift += 7) {
+    uint8_t byte = in->front();
+    in->remove_prefix(1);
+    result |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      *v = result;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Maps the small negative values to small varints.
+inline uint64_t ZigZag(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t UnZigZag(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+}  // namespace nvme_bpf
+
+#endif /* VARINT_H_ */